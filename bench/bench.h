@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace bt {
+namespace bench {
+
+// Body of a benchmark, runs the measured operation the given number
+// of times. Setup done before the loop is measured as well, so it
+// should be kept out of the function (i.e: static data).
+using BenchmarkFunction = std::function<void(int64_t iterations)>;
+
+// Registers a benchmark, see BT_BENCHMARK below.
+bool RegisterBenchmark(const std::string &name, BenchmarkFunction function);
+
+// Excludes the time between the two calls from the measure of the
+// running benchmark, for setup that has to be done again at each
+// iteration (i.e: filling a database).
+void PauseTiming();
+void ResumeTiming();
+
+// Prevents the compiler from optimizing away a value computed in a
+// benchmark loop.
+template <typename T> inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench
+} // namespace bt
+
+// Defines a benchmark, the body receives the number of iterations to
+// run as `iterations`:
+//
+// BT_BENCHMARK(MyBenchmark) {
+//   for (int64_t i = 0; i < iterations; ++i) {
+//     ...
+//   }
+// }
+#define BT_BENCHMARK(name)                                                     \
+  void name(int64_t iterations);                                               \
+  static const bool name##_registered =                                        \
+      ::bt::bench::RegisterBenchmark(#name, name);                             \
+  void name(int64_t iterations)
@@ -0,0 +1,140 @@
+#include <random>
+#include <vector>
+
+#include "bench/bench.h"
+#include "proto/backtrace.pb.h"
+#include "server/correlator.h"
+#include "server/mixer_config.h"
+#include "server/nearby_folk.h"
+
+namespace bt {
+namespace bench {
+
+namespace {
+
+constexpr int kFolkCount = 50000;
+constexpr int kUserCount = 1000;
+
+// A crowded block: 50k entries of folks in a single zone (about 100
+// meters wide for 1000 seconds), and entries of a user in it.
+struct CrowdedBlock {
+  CrowdedBlock() {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int64_t> ts(1582410000, 1582410000 + 1000);
+    std::uniform_int_distribution<uint32_t> duration(0, 60);
+    std::uniform_real_distribution<float> gps(0.0, 0.001);
+    std::uniform_real_distribution<float> alt(100.0, 110.0);
+
+    auto add = [&](int count, std::vector<proto::DbKey> *keys,
+                   std::vector<proto::DbValue> *values) {
+      for (int i = 0; i < count; ++i) {
+        proto::DbKey key;
+        key.set_timestamp(ts(gen));
+        key.set_user_id(i);
+        keys->push_back(key);
+
+        proto::DbValue value;
+        value.set_duration(duration(gen));
+        value.set_gps_latitude(48.856 + gps(gen));
+        value.set_gps_longitude(2.352 + gps(gen));
+        value.set_gps_altitude(alt(gen));
+        values->push_back(value);
+      }
+    };
+    add(kFolkCount, &folk_keys, &folk_values);
+    add(kUserCount, &user_keys, &user_values);
+
+    for (int i = 0; i < kFolkCount; ++i) {
+      folks.push_back({&folk_keys[i], &folk_values[i]});
+      folk_block.Add(folk_keys[i], folk_values[i]);
+    }
+  }
+
+  CorrelatorConfig config;
+
+  std::vector<proto::DbKey> folk_keys;
+  std::vector<proto::DbValue> folk_values;
+  std::vector<CorrelationEntry> folks;
+  FolkBlock folk_block;
+
+  std::vector<proto::DbKey> user_keys;
+  std::vector<proto::DbValue> user_values;
+};
+
+const CrowdedBlock &GetCrowdedBlock() {
+  static const CrowdedBlock block;
+  return block;
+}
+
+const Correlator &GetCorrelator() {
+  static const Correlator correlator(GetCrowdedBlock().config,
+                                     GetCrowdedBlock().folks, kUserCount);
+  return correlator;
+}
+
+} // anonymous namespace
+
+// Correlates one entry of the user with all entries of the block.
+BT_BENCHMARK(CorrelateAllPairs) {
+  const CrowdedBlock &block = GetCrowdedBlock();
+  for (int64_t i = 0; i < iterations; ++i) {
+    const int user = i % kUserCount;
+    int matches = 0;
+    for (int folk = 0; folk < kFolkCount; ++folk) {
+      matches += IsNearbyFolk(block.config, block.user_keys[user],
+                              block.user_values[user], block.folk_keys[folk],
+                              block.folk_values[folk]);
+    }
+    DoNotOptimize(matches);
+  }
+}
+
+// Same as above, with the batch kernel on the struct-of-arrays block.
+BT_BENCHMARK(CorrelateAllPairsBatchScalar) {
+  const CrowdedBlock &block = GetCrowdedBlock();
+  std::vector<uint64_t> matches;
+  for (int64_t i = 0; i < iterations; ++i) {
+    const int user = i % kUserCount;
+    IsNearbyFolkBatchScalar(block.config, block.user_keys[user],
+                            block.user_values[user], block.folk_block, 0,
+                            kFolkCount, &matches);
+    DoNotOptimize(matches.data());
+  }
+}
+
+BT_BENCHMARK(CorrelateAllPairsBatchAvx2) {
+  const CrowdedBlock &block = GetCrowdedBlock();
+  std::vector<uint64_t> matches;
+  for (int64_t i = 0; i < iterations; ++i) {
+    const int user = i % kUserCount;
+    IsNearbyFolkBatch(block.config, block.user_keys[user],
+                      block.user_values[user], block.folk_block, 0,
+                      kFolkCount, &matches);
+    DoNotOptimize(matches.data());
+  }
+}
+
+BT_BENCHMARK(CorrelateGrid) {
+  const CrowdedBlock &block = GetCrowdedBlock();
+  const Correlator &correlator = GetCorrelator();
+  std::vector<size_t> nearby_folks;
+  for (int64_t i = 0; i < iterations; ++i) {
+    const int user = i % kUserCount;
+    nearby_folks.clear();
+    correlator.NearbyFolks(block.user_keys[user], block.user_values[user],
+                           &nearby_folks);
+    DoNotOptimize(nearby_folks.size());
+  }
+}
+
+// Indexing of the block, done once per block before correlating.
+BT_BENCHMARK(CorrelatorBuild) {
+  const CrowdedBlock &block = GetCrowdedBlock();
+  for (int64_t i = 0; i < iterations; ++i) {
+    Correlator correlator(block.config, block.folks, kUserCount);
+    DoNotOptimize(correlator);
+  }
+}
+
+} // namespace bench
+} // namespace bt
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <memory>
+#include <random>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench.h"
+#include "proto/backtrace.pb.h"
+#include "server/db.h"
+#include "server/gc.h"
+#include "server/keys.h"
+#include "server/worker_config.h"
+#include "server/zones.h"
+
+DEFINE_int64(gc_bench_points, 1000000,
+             "number of points in the database of GC benchmarks, half "
+             "of them expired");
+
+namespace bt {
+namespace bench {
+
+namespace {
+
+constexpr int kPointsPerUser = 1000;
+constexpr int kPointsPerBatch = 1000;
+constexpr int kWriterPointsPerBatch = 100;
+
+// Writes a point as the pusher does, in the timeline and in the
+// reverse column.
+void AddPoint(int64_t user_id, int64_t ts, float gps_longitude,
+              float gps_latitude, rocksdb::WriteBatch *batch, Db *db) {
+  proto::DbKey key;
+  key.set_timestamp(ts);
+  key.set_user_id(user_id);
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(gps_longitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(gps_latitude));
+
+  proto::DbValue value;
+  value.set_duration(10);
+  value.set_gps_longitude(gps_longitude);
+  value.set_gps_latitude(gps_latitude);
+  value.set_gps_altitude(35.0);
+
+  proto::DbReverseKey reverse_key;
+  reverse_key.set_user_id(user_id);
+  reverse_key.set_timestamp_zone(TsToZone(ts));
+  reverse_key.set_gps_longitude_zone(key.gps_longitude_zone());
+  reverse_key.set_gps_latitude_zone(key.gps_latitude_zone());
+
+  std::string key_raw;
+  EncodeTimelineKey(key, &key_raw);
+  std::string reverse_raw;
+  EncodeReverseKey(reverse_key, &reverse_raw);
+
+  batch->Put(db->TimelineHandle(), key_raw, value.SerializeAsString());
+  batch->Put(db->ReverseHandle(), reverse_raw, rocksdb::Slice());
+}
+
+// Fills the database with points of users moving around a city over
+// twice the retention period, so that half of them are expired, then
+// compacts it as a long-running worker would be.
+void FillDatabase(int retention_days, Db *db) {
+  const int64_t now = std::time(nullptr);
+  const int64_t period = int64_t(retention_days) * 24 * 3600;
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int64_t> user_id(
+      1, std::max<int64_t>(1, FLAGS_gc_bench_points / kPointsPerUser));
+  std::uniform_int_distribution<int64_t> ts(now - 2 * period, now - 1);
+  std::uniform_real_distribution<float> gps(-0.05, 0.05);
+
+  rocksdb::WriteBatch batch;
+  for (int64_t i = 0; i < FLAGS_gc_bench_points; ++i) {
+    AddPoint(user_id(gen), ts(gen), 2.3522 + gps(gen), 48.8566 + gps(gen),
+             &batch, db);
+    if (batch.Count() >= 2 * kPointsPerBatch) {
+      CHECK(db->Rocks()->Write(rocksdb::WriteOptions(), &batch).ok());
+      batch.Clear();
+    }
+  }
+  CHECK(db->Rocks()->Write(rocksdb::WriteOptions(), &batch).ok());
+
+  for (rocksdb::ColumnFamilyHandle *handle :
+       {db->TimelineHandle(), db->ReverseHandle()}) {
+    CHECK(db->Rocks()
+              ->CompactRange(rocksdb::CompactRangeOptions(), handle, nullptr,
+                             nullptr)
+              .ok());
+  }
+}
+
+// Writes fresh points in batches until stopped, recording the latency
+// of each batch: write stalls caused by the GC show up as outliers.
+class Writer {
+public:
+  explicit Writer(Db *db) : db_(db), thread_([this] { Run(); }) {}
+
+  // Stops writing and logs latencies of writes.
+  void Stop(const std::string &name) {
+    stop_ = true;
+    thread_.join();
+
+    if (latencies_us_.empty()) {
+      return;
+    }
+    std::sort(latencies_us_.begin(), latencies_us_.end());
+    LOG(INFO) << name << ": concurrent writes=" << latencies_us_.size()
+              << ", p50_us=" << latencies_us_[latencies_us_.size() / 2]
+              << ", p99_us=" << latencies_us_[latencies_us_.size() * 99 / 100]
+              << ", max_us=" << latencies_us_.back();
+  }
+
+private:
+  void Run() {
+    std::mt19937 gen(43);
+    std::uniform_int_distribution<int64_t> user_id(1, 1000000);
+    std::uniform_real_distribution<float> gps(-0.05, 0.05);
+
+    while (!stop_) {
+      rocksdb::WriteBatch batch;
+      const int64_t now = std::time(nullptr);
+      for (int i = 0; i < kWriterPointsPerBatch; ++i) {
+        AddPoint(user_id(gen), now, 2.3522 + gps(gen), 48.8566 + gps(gen),
+                 &batch, db_);
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      CHECK(db_->Rocks()->Write(rocksdb::WriteOptions(), &batch).ok());
+      latencies_us_.push_back(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+  }
+
+  Db *db_;
+  std::atomic<bool> stop_ = false;
+  std::vector<int64_t> latencies_us_;
+  std::thread thread_;
+};
+
+// Measures a GC pass on a database of --gc_bench_points points while
+// points are written, filling the database is not measured.
+void RunGc(const std::string &name, bool range_deletes, int64_t iterations) {
+  for (int64_t i = 0; i < iterations; ++i) {
+    PauseTiming();
+    WorkerConfig config;
+    config.gc_range_deletes_ = range_deletes;
+
+    auto db = std::make_unique<Db>();
+    CHECK(db->Init(config) == StatusCode::OK);
+    FillDatabase(config.gc_retention_period_days_, db.get());
+
+    Gc gc;
+    CHECK(gc.Init(db.get(), config) == StatusCode::OK);
+    ResumeTiming();
+
+    Writer writer(db.get());
+    CHECK(gc.Cleanup() == StatusCode::OK);
+    writer.Stop(name);
+
+    PauseTiming();
+    LOG(INFO) << name << ": reclaimed_bytes=" << gc.ReclaimedBytes();
+    db.reset();
+    ResumeTiming();
+  }
+}
+
+} // anonymous namespace
+
+BT_BENCHMARK(GcPointDeletes) { RunGc("GcPointDeletes", false, iterations); }
+
+BT_BENCHMARK(GcRangeDeletes) { RunGc("GcRangeDeletes", true, iterations); }
+
+} // namespace bench
+} // namespace bt
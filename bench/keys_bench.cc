@@ -0,0 +1,120 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/bench.h"
+#include "proto/backtrace.pb.h"
+#include "server/db.h"
+#include "server/keys.h"
+#include "server/migrate.h"
+#include "server/zones.h"
+
+namespace bt {
+namespace bench {
+
+namespace {
+
+constexpr int kKeyCount = 10000;
+
+// Random timeline and reverse keys around a realistic area, in both
+// the legacy (serialized protobuf) and the current (fixed-width)
+// formats.
+struct TimelineKeys {
+  TimelineKeys() {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int64_t> ts(1582411000, 1582411000 + 86400);
+    std::uniform_int_distribution<int64_t> user_id(1, 1000000);
+    std::uniform_real_distribution<float> gps(-5.0, 5.0);
+
+    for (int i = 0; i < kKeyCount; ++i) {
+      proto::DbKey key;
+      key.set_timestamp(ts(gen));
+      key.set_user_id(user_id(gen));
+      key.set_gps_longitude_zone(GPSLocationToGPSZone(gps(gen)));
+      key.set_gps_latitude_zone(GPSLocationToGPSZone(gps(gen)));
+      keys.push_back(key);
+
+      std::string raw;
+      key.SerializeToString(&raw);
+      legacy.push_back(raw);
+
+      EncodeTimelineKey(key, &raw);
+      current.push_back(raw);
+
+      proto::DbReverseKey reverse_key;
+      reverse_key.set_user_id(key.user_id());
+      reverse_key.set_timestamp_zone(TsToZone(key.timestamp()));
+      reverse_key.set_gps_longitude_zone(key.gps_longitude_zone());
+      reverse_key.set_gps_latitude_zone(key.gps_latitude_zone());
+
+      reverse_key.SerializeToString(&raw);
+      reverse_legacy.push_back(raw);
+
+      EncodeReverseKey(reverse_key, &raw);
+      reverse_current.push_back(raw);
+    }
+  }
+
+  std::vector<proto::DbKey> keys;
+  std::vector<std::string> legacy;
+  std::vector<std::string> current;
+  std::vector<std::string> reverse_legacy;
+  std::vector<std::string> reverse_current;
+};
+
+const TimelineKeys &Keys() {
+  static TimelineKeys keys;
+  return keys;
+}
+
+void CompareKeys(const rocksdb::Comparator &cmp,
+                 const std::vector<std::string> &raw, int64_t iterations) {
+  int result = 0;
+  for (int64_t i = 0; i < iterations; ++i) {
+    const std::string &a = raw[i % kKeyCount];
+    const std::string &b = raw[(i + 1) % kKeyCount];
+    result += cmp.Compare(a, b);
+  }
+  DoNotOptimize(result);
+}
+
+} // anonymous namespace
+
+BT_BENCHMARK(TimelineKeyCompareLegacy) {
+  LegacyTimelineComparator cmp;
+  CompareKeys(cmp, Keys().legacy, iterations);
+}
+
+BT_BENCHMARK(TimelineKeyCompareCurrent) {
+  TimelineComparator cmp;
+  CompareKeys(cmp, Keys().current, iterations);
+}
+
+BT_BENCHMARK(ReverseKeyCompareLegacy) {
+  LegacyReverseComparator cmp;
+  CompareKeys(cmp, Keys().reverse_legacy, iterations);
+}
+
+BT_BENCHMARK(ReverseKeyCompareCurrent) {
+  ReverseComparator cmp;
+  CompareKeys(cmp, Keys().reverse_current, iterations);
+}
+
+BT_BENCHMARK(TimelineKeyEncodeLegacy) {
+  std::string raw;
+  for (int64_t i = 0; i < iterations; ++i) {
+    Keys().keys[i % kKeyCount].SerializeToString(&raw);
+    DoNotOptimize(raw);
+  }
+}
+
+BT_BENCHMARK(TimelineKeyEncodeCurrent) {
+  std::string raw;
+  for (int64_t i = 0; i < iterations; ++i) {
+    EncodeTimelineKey(Keys().keys[i % kKeyCount], &raw);
+    DoNotOptimize(raw);
+  }
+}
+
+} // namespace bench
+} // namespace bt
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include "bench/bench.h"
+
+DEFINE_string(filter, "", "only run benchmarks whose name contains this");
+DEFINE_int32(min_time_ms, 1000, "minimum duration of each benchmark");
+DEFINE_int32(max_wall_time_ms, 60000,
+             "stop a benchmark before --min_time_ms once it ran for this "
+             "long, including paused time");
+
+namespace bt {
+namespace bench {
+
+namespace {
+
+std::map<std::string, BenchmarkFunction> *Benchmarks() {
+  static std::map<std::string, BenchmarkFunction> benchmarks;
+  return &benchmarks;
+}
+
+// Time excluded from the running benchmark, see PauseTiming.
+std::chrono::steady_clock::duration paused_time;
+std::chrono::steady_clock::time_point pause_start;
+
+// Runs a benchmark with an increasing number of iterations until it
+// runs for at least --min_time_ms (or --max_wall_time_ms with setup
+// excluded by PauseTiming), returns the time per iteration.
+double RunBenchmark(const BenchmarkFunction &function, int64_t *iterations) {
+  const auto min_time = std::chrono::milliseconds(FLAGS_min_time_ms);
+  const auto max_wall_time = std::chrono::milliseconds(FLAGS_max_wall_time_ms);
+
+  *iterations = 1;
+  while (true) {
+    paused_time = std::chrono::steady_clock::duration::zero();
+    const auto start = std::chrono::steady_clock::now();
+    function(*iterations);
+    const auto wall_time = std::chrono::steady_clock::now() - start;
+    const auto elapsed = wall_time - paused_time;
+
+    if (elapsed >= min_time || wall_time >= max_wall_time) {
+      return std::chrono::duration<double, std::nano>(elapsed).count() /
+             *iterations;
+    }
+    *iterations *= 2;
+  }
+}
+
+} // anonymous namespace
+
+bool RegisterBenchmark(const std::string &name, BenchmarkFunction function) {
+  (*Benchmarks())[name] = function;
+  return true;
+}
+
+void PauseTiming() { pause_start = std::chrono::steady_clock::now(); }
+
+void ResumeTiming() {
+  paused_time += std::chrono::steady_clock::now() - pause_start;
+}
+
+} // namespace bench
+} // namespace bt
+
+using namespace bt::bench;
+
+int main(int ac, char **av) {
+  FLAGS_logtostderr = 1;
+  ::google::InitGoogleLogging(av[0]);
+  ::gflags::ParseCommandLineFlags(&ac, &av, true);
+
+  std::cout << std::left << std::setw(48) << "benchmark" << std::right
+            << std::setw(14) << "iterations" << std::setw(16) << "ns/op"
+            << std::endl;
+
+  for (const auto &benchmark : *Benchmarks()) {
+    if (benchmark.first.find(FLAGS_filter) == std::string::npos) {
+      continue;
+    }
+
+    int64_t iterations = 0;
+    const double ns_per_op = RunBenchmark(benchmark.second, &iterations);
+
+    std::cout << std::left << std::setw(48) << benchmark.first << std::right
+              << std::setw(14) << iterations << std::setw(16) << std::fixed
+              << std::setprecision(2) << ns_per_op << std::endl;
+  }
+
+  return 0;
+}
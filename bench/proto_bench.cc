@@ -0,0 +1,93 @@
+#include <google/protobuf/arena.h>
+#include <random>
+#include <string>
+
+#include "bench/bench.h"
+#include "proto/backtrace.pb.h"
+
+namespace bt {
+namespace bench {
+
+namespace {
+
+constexpr int kPointCount = 1000;
+constexpr int kEntryCount = 5000;
+
+// A serialized PutLocation request as received by a worker from a
+// mixer, with points of users moving around a city.
+const std::string &SerializedPutLocation() {
+  static const std::string serialized = [] {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<uint64_t> user_id(1, 1000000000);
+    std::uniform_real_distribution<float> gps(-0.05, 0.05);
+
+    proto::PutLocation_Request request;
+    for (int i = 0; i < kPointCount; ++i) {
+      proto::Location *location = request.add_locations();
+      location->set_user_id(user_id(gen));
+      location->set_timestamp(1582410316 + i);
+      location->set_duration(10);
+      location->set_gps_latitude(48.8566 + gps(gen));
+      location->set_gps_longitude(2.3522 + gps(gen));
+      location->set_gps_altitude(35.0);
+    }
+    return request.SerializeAsString();
+  }();
+  return serialized;
+}
+
+// Fills a block as a worker does when building blocks for a mixer.
+void BuildBlock(proto::BuildBlockForUser_Response *response) {
+  for (int i = 0; i < kEntryCount; ++i) {
+    proto::BlockEntry *entry = response->add_folk_entries();
+    entry->mutable_key()->set_timestamp(1582410316 + i);
+    entry->mutable_key()->set_user_id(i);
+    entry->mutable_value()->set_duration(10);
+    entry->mutable_value()->set_gps_latitude(48.8566);
+    entry->mutable_value()->set_gps_longitude(2.3522);
+  }
+}
+
+} // anonymous namespace
+
+BT_BENCHMARK(PutLocationParseHeap) {
+  const std::string &serialized = SerializedPutLocation();
+  for (int64_t i = 0; i < iterations; ++i) {
+    proto::PutLocation_Request request;
+    request.ParseFromString(serialized);
+    DoNotOptimize(request);
+  }
+}
+
+BT_BENCHMARK(PutLocationParseArena) {
+  const std::string &serialized = SerializedPutLocation();
+  for (int64_t i = 0; i < iterations; ++i) {
+    google::protobuf::Arena arena;
+    auto *request =
+        google::protobuf::Arena::CreateMessage<proto::PutLocation_Request>(
+            &arena);
+    request->ParseFromString(serialized);
+    DoNotOptimize(request);
+  }
+}
+
+BT_BENCHMARK(BlockBuildHeap) {
+  for (int64_t i = 0; i < iterations; ++i) {
+    proto::BuildBlockForUser_Response response;
+    BuildBlock(&response);
+    DoNotOptimize(response);
+  }
+}
+
+BT_BENCHMARK(BlockBuildArena) {
+  for (int64_t i = 0; i < iterations; ++i) {
+    google::protobuf::Arena arena;
+    auto *response = google::protobuf::Arena::CreateMessage<
+        proto::BuildBlockForUser_Response>(&arena);
+    BuildBlock(response);
+    DoNotOptimize(response);
+  }
+}
+
+} // namespace bench
+} // namespace bt
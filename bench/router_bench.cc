@@ -0,0 +1,130 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench/bench.h"
+#include "server/mixer_config.h"
+#include "server/router.h"
+
+namespace bt {
+namespace bench {
+
+namespace {
+
+constexpr int kShardCount = 64;
+constexpr int kAreasPerAxis = 32;
+constexpr int kPointCount = 10000;
+
+// A layout with two sets of partitions, each with a grid of 32x32
+// areas spread over 64 shards (2048 area partitions in total), and
+// random points over the whole layout.
+struct Layout {
+  Layout() {
+    for (int i = 0; i < kShardCount; ++i) {
+      ShardConfig shard;
+      shard.name_ = "shard-" + std::to_string(i);
+      shards.push_back(shard);
+    }
+
+    constexpr float kLatitudeBegin = 41.0;
+    constexpr float kLongitudeBegin = -5.0;
+    constexpr float kAreaSize = 0.3;
+
+    for (uint64_t ts_start : {0, 1582410000}) {
+      PartitionConfig default_partition;
+      default_partition.shard_ = shards[0].name_;
+      default_partition.area_ = kDefaultArea;
+      default_partition.ts_start_ = ts_start;
+      partitions.push_back(default_partition);
+
+      for (int lat = 0; lat < kAreasPerAxis; ++lat) {
+        for (int lng = 0; lng < kAreasPerAxis; ++lng) {
+          PartitionConfig partition;
+          partition.shard_ =
+              shards[1 + (lat * kAreasPerAxis + lng) % (kShardCount - 1)].name_;
+          partition.area_ = "fr";
+          partition.ts_start_ = ts_start;
+          partition.gps_latitude_begin_ = kLatitudeBegin + lat * kAreaSize;
+          partition.gps_longitude_begin_ = kLongitudeBegin + lng * kAreaSize;
+          partition.gps_latitude_end_ = kLatitudeBegin + (lat + 1) * kAreaSize;
+          partition.gps_longitude_end_ =
+              kLongitudeBegin + (lng + 1) * kAreaSize;
+          partitions.push_back(partition);
+        }
+      }
+    }
+
+    router.Init(shards, partitions);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> lat(
+        kLatitudeBegin - 1.0, kLatitudeBegin + kAreasPerAxis * kAreaSize + 1.0);
+    std::uniform_real_distribution<float> lng(
+        kLongitudeBegin - 1.0,
+        kLongitudeBegin + kAreasPerAxis * kAreaSize + 1.0);
+    std::uniform_int_distribution<int64_t> ts(1582410000, 1582410000 + 86400);
+    for (int i = 0; i < kPointCount; ++i) {
+      points_lat.push_back(lat(gen));
+      points_long.push_back(lng(gen));
+      points_ts.push_back(ts(gen));
+    }
+  }
+
+  // Routing as done before the router: each shard in order checks all
+  // of its partitions.
+  int RouteLinear(float gps_lat, float gps_long, int64_t ts) const {
+    for (size_t s = 1; s < shards.size(); ++s) {
+      for (const auto &p : partitions) {
+        if (p.shard_ != shards[s].name_) {
+          continue;
+        }
+        if (gps_lat >= p.gps_latitude_begin_ && gps_lat < p.gps_latitude_end_ &&
+            gps_long >= p.gps_longitude_begin_ &&
+            gps_long < p.gps_longitude_end_ &&
+            static_cast<uint64_t>(ts) >= p.ts_start_ &&
+            (p.ts_end_ == 0 || static_cast<uint64_t>(ts) < p.ts_end_)) {
+          return s;
+        }
+      }
+    }
+    return Router::kDefaultShard;
+  }
+
+  std::vector<ShardConfig> shards;
+  std::vector<PartitionConfig> partitions;
+  Router router;
+
+  std::vector<float> points_lat;
+  std::vector<float> points_long;
+  std::vector<int64_t> points_ts;
+};
+
+const Layout &GetLayout() {
+  static const Layout layout;
+  return layout;
+}
+
+} // anonymous namespace
+
+BT_BENCHMARK(RouteLinear) {
+  const Layout &layout = GetLayout();
+  for (int64_t i = 0; i < iterations; ++i) {
+    const int p = i % kPointCount;
+    DoNotOptimize(layout.RouteLinear(layout.points_lat[p],
+                                     layout.points_long[p],
+                                     layout.points_ts[p]));
+  }
+}
+
+BT_BENCHMARK(RouteGrid) {
+  const Layout &layout = GetLayout();
+  for (int64_t i = 0; i < iterations; ++i) {
+    const int p = i % kPointCount;
+    DoNotOptimize(layout.router.Route(layout.points_lat[p],
+                                      layout.points_long[p],
+                                      layout.points_ts[p]));
+  }
+}
+
+} // namespace bench
+} // namespace bt
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+
+namespace bt {
+
+// Lock-free intrusive multiple-producers single-consumer queue (see
+// Dmitry Vyukov's non-intrusive MPSC node-based queue).
+//
+// Usage:
+//
+//    struct Item : public MpscQueue<Item>::Node { ... };
+//
+//    MpscQueue<Item> queue;
+//    queue.Push(&item);          // from any thread.
+//    Item *item = queue.Pop();   // from a single thread.
+//
+// Push is wait-free, Pop is lock-free and may return nullptr while a
+// producer is in the middle of a push, even if the queue isn't empty:
+// the consumer has to retry later. The queue doesn't own items, they
+// must outlive their time in the queue.
+template <typename T> class MpscQueue {
+public:
+  struct Node {
+    std::atomic<Node *> next = nullptr;
+  };
+
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  void Push(T *item) { PushNode(item); }
+
+  // Only one thread can pop from the queue.
+  T *Pop() {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+
+    // A producer is linking a new node after the tail.
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+
+    // The tail is the last node, put the stub behind it so it can be
+    // popped.
+    PushNode(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T *>(tail);
+    }
+
+    return nullptr;
+  }
+
+  // Whether or not the queue has no items, this is only accurate from
+  // the consumer thread.
+  bool Empty() const {
+    Node *tail = tail_;
+    return tail == &stub_ && tail->next.load(std::memory_order_acquire) ==
+                                 nullptr &&
+           head_.load(std::memory_order_acquire) == &stub_;
+  }
+
+private:
+  void PushNode(Node *node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *previous = head_.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  Node stub_;
+  std::atomic<Node *> head_;
+  Node *tail_;
+};
+
+} // namespace bt
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "common/mpsc_queue.h"
+
+namespace bt {
+namespace {
+
+struct Item : public MpscQueue<Item>::Node {
+  int producer = 0;
+  int value = 0;
+};
+
+TEST(MpscQueueTest, Empty) {
+  MpscQueue<Item> queue;
+
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_EQ(queue.Pop(), nullptr);
+}
+
+TEST(MpscQueueTest, FifoOrder) {
+  MpscQueue<Item> queue;
+  std::vector<Item> items(10);
+
+  for (size_t i = 0; i < items.size(); ++i) {
+    items[i].value = i;
+    queue.Push(&items[i]);
+  }
+  EXPECT_FALSE(queue.Empty());
+
+  for (size_t i = 0; i < items.size(); ++i) {
+    Item *item = queue.Pop();
+    ASSERT_NE(item, nullptr);
+    EXPECT_EQ(item->value, i);
+  }
+  EXPECT_EQ(queue.Pop(), nullptr);
+  EXPECT_TRUE(queue.Empty());
+
+  // Items can be pushed again once popped.
+  queue.Push(&items[0]);
+  EXPECT_EQ(queue.Pop(), &items[0]);
+  EXPECT_EQ(queue.Pop(), nullptr);
+}
+
+TEST(MpscQueueTest, MultipleProducers) {
+  constexpr int kProducers = 4;
+  constexpr int kItemsPerProducer = 10000;
+
+  MpscQueue<Item> queue;
+  std::vector<Item> items(kProducers * kItemsPerProducer);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&queue, &items, p]() {
+      for (int i = 0; i < kItemsPerProducer; ++i) {
+        Item *item = &items[p * kItemsPerProducer + i];
+        item->producer = p;
+        item->value = i;
+        queue.Push(item);
+      }
+    });
+  }
+
+  // Items of a producer are popped in the order they were pushed.
+  std::vector<int> next(kProducers, 0);
+  int popped = 0;
+  while (popped < kProducers * kItemsPerProducer) {
+    Item *item = queue.Pop();
+    if (item == nullptr) {
+      std::this_thread::yield();
+      continue;
+    }
+    EXPECT_EQ(item->value, next[item->producer]);
+    ++next[item->producer];
+    ++popped;
+  }
+
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  EXPECT_EQ(queue.Pop(), nullptr);
+}
+
+} // namespace
+} // namespace bt
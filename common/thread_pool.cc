@@ -0,0 +1,78 @@
+#include <glog/logging.h>
+
+#include "common/thread_pool.h"
+
+namespace bt {
+
+ThreadPool::~ThreadPool() { Shutdown(); }
+
+Status ThreadPool::Init(const std::string &name, int threads) {
+  if (!(threads > 0)) {
+    RETURN_ERROR(INVALID_ARGUMENT,
+                 "thread pool " << name << " needs threads > 0, got "
+                                << threads);
+  }
+
+  name_ = name;
+  for (int i = 0; i < threads; ++i) {
+    threads_.emplace_back([this]() { Loop(); });
+  }
+
+  LOG(INFO) << "started thread pool " << name_ << " with " << threads
+            << " threads";
+
+  return StatusCode::OK;
+}
+
+void ThreadPool::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    if (do_exit_) {
+      return;
+    }
+    do_exit_ = true;
+  }
+  wakeup_.notify_all();
+
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+void ThreadPool::Run(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    if (!do_exit_ && !threads_.empty()) {
+      tasks_.push_back(std::move(task));
+      wakeup_.notify_one();
+      return;
+    }
+  }
+
+  task();
+}
+
+size_t ThreadPool::Pending() {
+  std::lock_guard<std::mutex> lk(lock_);
+  return tasks_.size();
+}
+
+void ThreadPool::Loop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lk(lock_);
+      wakeup_.wait(lk, [this]() { return do_exit_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+  }
+}
+
+} // namespace bt
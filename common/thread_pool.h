@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/status.h"
+
+namespace bt {
+
+// A fixed-size pool of threads running tasks in FIFO order.
+//
+// Usage:
+//
+//    ThreadPool pool;
+//    pool.Init("reads", 4);
+//    pool.Run([]() { ... });
+//
+// Pending tasks are run before the pool stops, either on Shutdown or
+// when the pool is destroyed. This class can be used from multiple
+// threads.
+class ThreadPool {
+public:
+  ~ThreadPool();
+
+  Status Init(const std::string &name, int threads);
+  void Shutdown();
+
+  // Schedules a task, it is run right away if the pool is shut down.
+  void Run(std::function<void()> task);
+
+  // Number of tasks waiting for a thread.
+  size_t Pending();
+
+private:
+  void Loop();
+
+  std::string name_;
+  std::vector<std::thread> threads_;
+
+  std::mutex lock_;
+  std::condition_variable wakeup_;
+  std::deque<std::function<void()>> tasks_;
+  bool do_exit_ = false;
+};
+
+} // namespace bt
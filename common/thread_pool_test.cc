@@ -0,0 +1,65 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "common/thread_pool.h"
+
+namespace bt {
+namespace {
+
+TEST(ThreadPoolTest, InvalidArgs) {
+  ThreadPool pool;
+
+  EXPECT_EQ(pool.Init("test", 0), StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(pool.Init("test", -1), StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  constexpr int kTasks = 1000;
+  std::atomic<int> done = 0;
+
+  {
+    ThreadPool pool;
+    EXPECT_EQ(pool.Init("test", 4), StatusCode::OK);
+    for (int i = 0; i < kTasks; ++i) {
+      pool.Run([&done]() { ++done; });
+    }
+  }
+
+  // Pending tasks are run before the pool is destroyed.
+  EXPECT_EQ(done, kTasks);
+}
+
+TEST(ThreadPoolTest, RunsOnPoolThreads) {
+  std::mutex lock;
+  std::set<std::thread::id> ids;
+
+  ThreadPool pool;
+  EXPECT_EQ(pool.Init("test", 2), StatusCode::OK);
+  for (int i = 0; i < 100; ++i) {
+    pool.Run([&lock, &ids]() {
+      std::lock_guard<std::mutex> lk(lock);
+      ids.insert(std::this_thread::get_id());
+    });
+  }
+  pool.Shutdown();
+
+  EXPECT_GE(ids.size(), 1);
+  EXPECT_LE(ids.size(), 2);
+  EXPECT_EQ(ids.count(std::this_thread::get_id()), 0);
+}
+
+TEST(ThreadPoolTest, RunAfterShutdown) {
+  ThreadPool pool;
+  EXPECT_EQ(pool.Init("test", 2), StatusCode::OK);
+  pool.Shutdown();
+
+  bool done = false;
+  pool.Run([&done]() { done = true; });
+  EXPECT_TRUE(done);
+}
+
+} // namespace
+} // namespace bt
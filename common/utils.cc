@@ -31,6 +31,25 @@ bool DirExists(const std::string& path) {
   return boost::filesystem::exists(path);
 }
 
+Status RenameDirectory(const std::string& from, const std::string& to) {
+  if (DirExists(to)) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "can't rename directory, destination exists, path=" << to);
+  }
+
+  boost::system::error_code error;
+  boost::filesystem::rename(from, to, error);
+  if (error) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't rename directory, from="
+                                     << from << ", to=" << to
+                                     << ", error=" << error.message());
+  }
+
+  LOG(INFO) << "renamed directory, from=" << from << ", to=" << to;
+
+  return StatusCode::OK;
+}
+
 std::vector<std::string> StringSplit(const std::string& str, char delim) {
   std::stringstream ss(str);
   std::vector<std::string> tokens;
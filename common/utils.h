@@ -17,6 +17,9 @@ void DeleteDirectory(const std::string &path);
 // Whether or not a directory exists.
 bool DirExists(const std::string &path);
 
+// Renames a directory, the destination must not exist.
+Status RenameDirectory(const std::string &from, const std::string &to);
+
 // Split a string with a delimiter.
 std::vector<std::string> StringSplit(const std::string &str, char delim);
 
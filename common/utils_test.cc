@@ -14,6 +14,23 @@ TEST(UtilsTest, TempDirectoryCycle) {
   EXPECT_FALSE(utils::DirExists(path));
 }
 
+TEST(UtilsTest, RenameDirectory) {
+  StatusOr<std::string> status = utils::MakeTemporaryDirectory();
+  EXPECT_TRUE(status.Ok());
+  const std::string &path = status.ValueOrDie();
+  const std::string renamed = path + ".renamed";
+
+  EXPECT_EQ(utils::RenameDirectory(path, renamed), StatusCode::OK);
+  EXPECT_FALSE(utils::DirExists(path));
+  EXPECT_TRUE(utils::DirExists(renamed));
+
+  // Renaming to an existing directory fails.
+  EXPECT_EQ(utils::RenameDirectory(renamed, renamed),
+            StatusCode::INTERNAL_ERROR);
+
+  utils::DeleteDirectory(renamed);
+}
+
 TEST(StringSplitTest, NoDelim) {
   const std::vector<std::string> s =
       utils::StringSplit("there is no spoon", '.');
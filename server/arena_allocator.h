@@ -0,0 +1,39 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <grpcpp/support/message_allocator.h>
+
+namespace bt {
+
+// Allocates the request and the response of a callback RPC on an arena
+// owned by the call, so that all their sub-messages (i.e: points of a
+// PutLocation, entries of blocks) are freed at once when the call is
+// done instead of one by one.
+//
+// Set with SetMessageAllocatorFor_<Method> on callback services, the
+// allocator must outlive the server.
+template <typename Request, typename Response>
+class ArenaAllocator : public grpc::MessageAllocator<Request, Response> {
+public:
+  grpc::MessageHolder<Request, Response> *AllocateMessages() override {
+    return new Holder();
+  }
+
+private:
+  class Holder : public grpc::MessageHolder<Request, Response> {
+  public:
+    Holder() {
+      this->set_request(
+          google::protobuf::Arena::CreateMessage<Request>(&arena_));
+      this->set_response(
+          google::protobuf::Arena::CreateMessage<Response>(&arena_));
+    }
+
+    void Release() override { delete this; }
+
+  private:
+    google::protobuf::Arena arena_;
+  };
+};
+
+} // namespace bt
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <functional>
+
+#include "server/block_cache.h"
+
+namespace bt {
+
+BlockCache::BlockCache(size_t max_blocks, std::chrono::milliseconds ttl)
+    : max_blocks_per_shard_(std::max<size_t>(1, max_blocks / kShards)),
+      ttl_(ttl) {}
+
+BlockCache::Shard &BlockCache::ShardForZone(const std::string &zone) {
+  return shards_[std::hash<std::string>()(zone) % kShards];
+}
+
+BlockCache::Entries BlockCache::Lookup(const std::string &zone) {
+  Shard &shard = ShardForZone(zone);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto it = shard.blocks.find(zone);
+  if (it != shard.blocks.end()) {
+    if (std::chrono::steady_clock::now() < it->second.expires_at) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_it);
+      ++hits_;
+      return it->second.entries;
+    }
+
+    shard.lru.erase(it->second.lru_it);
+    shard.blocks.erase(it);
+  }
+
+  ++misses_;
+  return nullptr;
+}
+
+void BlockCache::Insert(const std::string &zone, Entries entries) {
+  Shard &shard = ShardForZone(zone);
+  const auto expires_at = std::chrono::steady_clock::now() + ttl_;
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto it = shard.blocks.find(zone);
+  if (it == shard.blocks.end()) {
+    if (shard.blocks.size() >= max_blocks_per_shard_) {
+      shard.blocks.erase(shard.lru.back());
+      shard.lru.pop_back();
+    }
+    shard.lru.push_front(zone);
+    it = shard.blocks.emplace(zone, Block()).first;
+    it->second.lru_it = shard.lru.begin();
+  } else {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_it);
+  }
+
+  it->second.entries = std::move(entries);
+  it->second.expires_at = expires_at;
+}
+
+void BlockCache::Invalidate(const std::string &zone) {
+  Shard &shard = ShardForZone(zone);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto it = shard.blocks.find(zone);
+  if (it == shard.blocks.end()) {
+    return;
+  }
+  shard.lru.erase(it->second.lru_it);
+  shard.blocks.erase(it);
+}
+
+void BlockCache::Clear() {
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    shard.blocks.clear();
+    shard.lru.clear();
+  }
+}
+
+} // namespace bt
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "proto/backtrace.pb.h"
+
+namespace bt {
+
+// Cache of blocks recently read from workers by the mixer, indexed by
+// their zone in timeline keys (see keys.h).
+//
+// Points of popular places end up in the same blocks, this cache
+// allows nearby folks queries of different users to share them
+// instead of reading them again from all workers. Blocks hold all
+// entries of the zone, the caller splits them between the user and
+// folks.
+//
+// Points pushed through this mixer invalidate their blocks, before and
+// after they are written so that blocks read meanwhile are dropped
+// too. Points pushed through other mixers are not seen: blocks expire
+// after a time to live, which bounds how stale they can be.
+//
+// The cache is bounded by a number of blocks, least recently used
+// ones are evicted first. It is sharded by zone so that concurrent
+// queries don't contend on a single lock.
+//
+// This class can be used from multiple threads.
+class BlockCache {
+public:
+  static constexpr int kShards = 16;
+
+  using Entries = std::shared_ptr<const std::vector<proto::BlockEntry>>;
+
+  BlockCache(size_t max_blocks, std::chrono::milliseconds ttl);
+
+  // Returns entries of the block, or nullptr if it isn't cached or
+  // expired; updates counters.
+  Entries Lookup(const std::string &zone);
+
+  // Records entries of a block, which must be all entries of the zone
+  // merged between workers of its shard (possibly none).
+  void Insert(const std::string &zone, Entries entries);
+
+  // Removes a block (i.e: when points are pushed in it).
+  void Invalidate(const std::string &zone);
+
+  // Removes all blocks (i.e: when a user is deleted).
+  void Clear();
+
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+
+private:
+  struct Block {
+    Entries entries;
+    std::chrono::steady_clock::time_point expires_at;
+    std::list<std::string>::iterator lru_it;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<std::string, Block> blocks;
+
+    // Most recently used zones first.
+    std::list<std::string> lru;
+  };
+
+  Shard &ShardForZone(const std::string &zone);
+
+  size_t max_blocks_per_shard_;
+  std::chrono::milliseconds ttl_;
+  std::array<Shard, kShards> shards_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+};
+
+} // namespace bt
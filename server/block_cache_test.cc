@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "server/block_cache.h"
+
+namespace bt {
+namespace {
+
+constexpr std::chrono::milliseconds kTtl(60000);
+
+BlockCache::Entries MakeEntries(int count) {
+  auto entries = std::make_shared<std::vector<proto::BlockEntry>>();
+  for (int i = 0; i < count; ++i) {
+    entries->emplace_back();
+    entries->back().mutable_key()->set_user_id(i);
+  }
+  return entries;
+}
+
+TEST(BlockCacheTest, HitAfterInsert) {
+  BlockCache cache(1000, kTtl);
+
+  EXPECT_EQ(cache.Lookup("zone-1"), nullptr);
+  cache.Insert("zone-1", MakeEntries(3));
+
+  BlockCache::Entries entries = cache.Lookup("zone-1");
+  ASSERT_NE(entries, nullptr);
+  EXPECT_EQ(entries->size(), 3);
+  EXPECT_EQ(cache.Lookup("zone-2"), nullptr);
+
+  EXPECT_EQ(cache.Hits(), 1);
+  EXPECT_EQ(cache.Misses(), 2);
+}
+
+TEST(BlockCacheTest, CachesEmptyBlocks) {
+  BlockCache cache(1000, kTtl);
+
+  cache.Insert("zone-1", MakeEntries(0));
+
+  BlockCache::Entries entries = cache.Lookup("zone-1");
+  ASSERT_NE(entries, nullptr);
+  EXPECT_TRUE(entries->empty());
+}
+
+TEST(BlockCacheTest, ReplacesBlock) {
+  BlockCache cache(1000, kTtl);
+
+  cache.Insert("zone-1", MakeEntries(1));
+  cache.Insert("zone-1", MakeEntries(2));
+
+  ASSERT_NE(cache.Lookup("zone-1"), nullptr);
+  EXPECT_EQ(cache.Lookup("zone-1")->size(), 2);
+}
+
+TEST(BlockCacheTest, ExpiresBlocks) {
+  BlockCache cache(1000, std::chrono::milliseconds(1));
+
+  cache.Insert("zone-1", MakeEntries(1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+  EXPECT_EQ(cache.Lookup("zone-1"), nullptr);
+}
+
+TEST(BlockCacheTest, EvictsLeastRecentlyUsedBlocks) {
+  // One block per shard.
+  BlockCache cache(BlockCache::kShards, kTtl);
+
+  for (int i = 0; i < 100; ++i) {
+    cache.Insert("zone-" + std::to_string(i), MakeEntries(1));
+  }
+
+  int cached = 0;
+  for (int i = 0; i < 100; ++i) {
+    cached += cache.Lookup("zone-" + std::to_string(i)) != nullptr;
+  }
+  EXPECT_LE(cached, BlockCache::kShards);
+  EXPECT_NE(cache.Lookup("zone-99"), nullptr);
+}
+
+TEST(BlockCacheTest, Invalidate) {
+  BlockCache cache(1000, kTtl);
+
+  cache.Insert("zone-1", MakeEntries(1));
+  cache.Insert("zone-2", MakeEntries(1));
+  cache.Invalidate("zone-1");
+  cache.Invalidate("zone-3");
+
+  EXPECT_EQ(cache.Lookup("zone-1"), nullptr);
+  EXPECT_NE(cache.Lookup("zone-2"), nullptr);
+
+  cache.Clear();
+  EXPECT_EQ(cache.Lookup("zone-2"), nullptr);
+}
+
+} // namespace
+} // namespace bt
@@ -0,0 +1,29 @@
+#include "server/call_group.h"
+
+namespace bt {
+
+CallGroup::~CallGroup() { Wait(); }
+
+std::function<void(grpc::Status)> CallGroup::Add() {
+  std::lock_guard<std::mutex> lk(lock_);
+
+  const size_t index = statuses_.size();
+  statuses_.push_back(grpc::Status::OK);
+  ++pending_;
+
+  return [this, index](grpc::Status status) {
+    // Notified with the lock held, the group can be destroyed as soon
+    // as the lock is released.
+    std::lock_guard<std::mutex> lk(lock_);
+    statuses_[index] = std::move(status);
+    --pending_;
+    done_.notify_all();
+  };
+}
+
+void CallGroup::Wait() {
+  std::unique_lock<std::mutex> lk(lock_);
+  done_.wait(lk, [this]() { return pending_ == 0; });
+}
+
+} // namespace bt
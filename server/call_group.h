@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <grpc++/grpc++.h>
+#include <mutex>
+#include <vector>
+
+namespace bt {
+
+// Group of concurrent asynchronous gRPC calls, used to fan-out a
+// request to multiple workers and wait for all of them.
+//
+// Usage:
+//
+//    CallGroup group;
+//    stub->async()->InternalPutLocation(&context, &request, &response,
+//                                       group.Add());
+//    ...
+//    group.Wait();
+//    group.Statuses();   // in the order calls were added.
+//
+// Contexts, requests and responses of calls must outlive the call to
+// Wait. This class can be used from multiple threads.
+class CallGroup {
+public:
+  CallGroup() = default;
+  CallGroup(const CallGroup &) = delete;
+  CallGroup &operator=(const CallGroup &) = delete;
+
+  // Waits for pending calls, so that callbacks never outlive the
+  // group.
+  ~CallGroup();
+
+  // Registers a new call, returns the callback to pass to the async
+  // stub which records the status of the call.
+  std::function<void(grpc::Status)> Add();
+
+  // Blocks until all registered calls are done.
+  void Wait();
+
+  // Statuses of calls, only valid after Wait.
+  const std::vector<grpc::Status> &Statuses() const { return statuses_; }
+
+private:
+  std::mutex lock_;
+  std::condition_variable done_;
+  int pending_ = 0;
+  std::vector<grpc::Status> statuses_;
+};
+
+} // namespace bt
@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "server/call_group.h"
+
+namespace bt {
+namespace {
+
+TEST(CallGroupTest, EmptyGroup) {
+  CallGroup group;
+
+  group.Wait();
+  EXPECT_TRUE(group.Statuses().empty());
+}
+
+TEST(CallGroupTest, WaitsForAllCalls) {
+  constexpr int kCalls = 8;
+
+  CallGroup group;
+  std::vector<std::thread> calls;
+  for (int i = 0; i < kCalls; ++i) {
+    calls.emplace_back([i, done = group.Add()]() {
+      done(i % 2 ? grpc::Status::OK
+                 : grpc::Status(grpc::StatusCode::UNAVAILABLE, "down"));
+    });
+  }
+
+  group.Wait();
+  ASSERT_EQ(group.Statuses().size(), kCalls);
+  for (int i = 0; i < kCalls; ++i) {
+    EXPECT_EQ(group.Statuses()[i].ok(), i % 2 == 1);
+  }
+
+  for (auto &call : calls) {
+    call.join();
+  }
+}
+
+} // namespace
+} // namespace bt
@@ -4,6 +4,7 @@
 #include <sstream>
 
 #include "server/cluster_test.h"
+#include "server/keys.h"
 #include "server/proto.h"
 
 namespace bt {
@@ -16,14 +17,24 @@ int MakeWorkerPort(int shard_id, int db_count, int db_id) {
 
 int MakeMixerPort(int shard_id) { return 8000 + shard_id; }
 
+// Small enough for requests in tests to be split in multiple batches.
+constexpr int kTestPusherMaxBatchSize = 16;
+
+// Small enough for streamed responses in tests to span many chunks.
+constexpr int kTestStreamChunkSize = 2;
+
 // Generate a worker config for a given id to infer port.
 StatusOr<WorkerConfig> GenerateWorkerConfig(bool simulate_db_down, int shard_id,
-                                            int db_count, int db_id) {
+                                            int db_count, int db_id,
+                                            int partition_days,
+                                            bool compaction_filter,
+                                            bool range_deletes) {
   std::stringstream sstream;
 
   sstream << "instance_type: 'worker'\n";
   sstream << "db:\n";
   sstream << "  data: ''\n";
+  sstream << "  partition_days: " << partition_days << "\n";
   sstream << "network:\n";
   sstream << "  host: '127.0.0.1'\n";
 
@@ -40,6 +51,13 @@ StatusOr<WorkerConfig> GenerateWorkerConfig(bool simulate_db_down, int shard_id,
   sstream << "gc:\n";
   sstream << "  retention_period_days: 14\n";
   sstream << "  delay_between_rounds_sec: 3600\n";
+  sstream << "  compaction_filter: " << (compaction_filter ? "true" : "false")
+          << "\n";
+  sstream << "  range_deletes: " << (range_deletes ? "true" : "false") << "\n";
+  sstream << "pusher:\n";
+  sstream << "  max_batch_size: " << kTestPusherMaxBatchSize << "\n";
+  sstream << "seeker:\n";
+  sstream << "  stream_chunk_size: " << kTestStreamChunkSize << "\n";
 
   LOG(INFO) << "worker config for shard=" << shard_id << ", db=" << db_id
             << "\n"
@@ -76,16 +94,24 @@ float GetShardLatitudeBot(float start, float end, int nb_shard, int idx) {
 } // namespace
 
 StatusOr<MixerConfig> GenerateMixerConfig(int shard_count, int shard_id,
-                                          int db_count) {
+                                          int db_count, bool flusher,
+                                          bool pushdown,
+                                          int block_cache_size) {
   std::stringstream sstream;
 
   sstream << "instance_type: 'mixer'\n";
   sstream << "backoff_fail_fast: true\n";
   sstream << "correlator:\n";
   sstream << "  minutes_to_match: 1\n";
+  sstream << "  pushdown: " << (pushdown ? "true" : "false") << "\n";
+  sstream << "  block_cache_size: " << block_cache_size << "\n";
+  sstream << "flusher:\n";
+  sstream << "  enabled: " << (flusher ? "true" : "false") << "\n";
   sstream << "network:\n";
   sstream << "  host: '127.0.0.1'\n";
   sstream << "  port: " << MakeMixerPort(shard_id) << "\n";
+  sstream << "  stream_chunk_size: " << kTestStreamChunkSize << "\n";
+  sstream << "  compress_batches: true\n";
 
   sstream << "shards:\n";
   for (int i = 0; i < shard_count; ++i) {
@@ -144,8 +170,11 @@ StatusOr<MixerConfig> GenerateMixerConfig(int shard_count, int shard_id,
 Status ClusterTestBase::SetUpShardsInCluster() {
   for (int i = 0; i < nb_shards_; ++i) {
     for (int j = 0; j < nb_databases_per_shard_; ++j) {
-      StatusOr<WorkerConfig> worker_config_or = GenerateWorkerConfig(
-          simulate_db_down_, i, nb_databases_per_shard_, j);
+      StatusOr<WorkerConfig> worker_config_or =
+          GenerateWorkerConfig(simulate_db_down_, i, nb_databases_per_shard_,
+                               j, worker_partition_days_,
+                               worker_compaction_filter_,
+                               worker_gc_range_deletes_);
       RETURN_IF_ERROR(worker_config_or.GetStatus());
       worker_configs_.push_back(worker_config_or.ValueOrDie());
       workers_.push_back(std::make_unique<Worker>());
@@ -156,7 +185,9 @@ Status ClusterTestBase::SetUpShardsInCluster() {
     mixers_.push_back(std::make_unique<Mixer>());
 
     StatusOr<MixerConfig> mixer_config_or =
-        GenerateMixerConfig(nb_shards_, i, nb_databases_per_shard_);
+        GenerateMixerConfig(nb_shards_, i, nb_databases_per_shard_,
+                            mixer_flusher_, mixer_correlator_pushdown_,
+                            mixer_block_cache_size_);
     RETURN_IF_ERROR(mixer_config_or.GetStatus());
     mixer_configs_.push_back(mixer_config_or.ValueOrDie());
   }
@@ -267,6 +298,23 @@ bool ClusterTestBase::PushPoint(uint64_t timestamp, uint32_t duration,
   return status.ok();
 }
 
+bool ClusterTestBase::PushBatch(
+    const std::vector<proto::Location> &locations) {
+  grpc::ServerContext context;
+  proto::PutLocation_Request request;
+  proto::PutLocation_Response response;
+
+  LocationColumns columns;
+  for (const auto &location : locations) {
+    columns.Add(location);
+  }
+  EncodeLocationBatch(columns, false, request.mutable_batch());
+
+  grpc::Status status = GetMixer()->PutLocation(&context, &request, &response);
+
+  return status.ok();
+}
+
 bool ClusterTestBase::FetchTimeline(uint64_t user_id,
                                     proto::GetUserTimeline_Response *response) {
   grpc::ServerContext context;
@@ -293,33 +341,90 @@ bool ClusterTestBase::GetNearbyFolks(
   return status.ok();
 }
 
+bool ClusterTestBase::GetUsersNearbyFolks(
+    const std::vector<uint64_t> &user_ids,
+    std::vector<proto::GetUsersNearbyFolks_Response> *responses) {
+  grpc::ServerContext context;
+  proto::GetUsersNearbyFolks_Request request;
+
+  for (uint64_t user_id : user_ids) {
+    request.add_user_id(user_id);
+  }
+
+  grpc::Status status = GetMixer()->GetUsersNearbyFolks(
+      &context, &request,
+      [responses](const proto::GetUsersNearbyFolks_Response &response) {
+        responses->push_back(response);
+        return true;
+      });
+
+  return status.ok();
+}
+
+bool ClusterTestBase::StreamTimeline(
+    uint64_t user_id, std::vector<proto::GetUserTimeline_Response> *responses) {
+  grpc::ServerContext context;
+  proto::GetUserTimeline_Request request;
+
+  request.set_user_id(user_id);
+
+  grpc::Status status = GetMixer()->StreamUserTimeline(
+      &context, &request,
+      [responses](const proto::GetUserTimeline_Response &response) {
+        responses->push_back(response);
+        return true;
+      });
+
+  return status.ok();
+}
+
+bool ClusterTestBase::StreamNearbyFolks(
+    uint64_t user_id,
+    std::vector<proto::GetUserNearbyFolks_Response> *responses) {
+  grpc::ServerContext context;
+  proto::GetUserNearbyFolks_Request request;
+
+  request.set_user_id(user_id);
+
+  grpc::Status status = GetMixer()->StreamUserNearbyFolks(
+      &context, &request,
+      [responses](const proto::GetUserNearbyFolks_Response &response) {
+        responses->push_back(response);
+        return true;
+      });
+
+  return status.ok();
+}
+
 void ClusterTestBase::DumpTimeline() {
   for (auto &worker : workers_) {
 
     Db *db = worker->GetDb();
 
-    std::unique_ptr<rocksdb::Iterator> it(
-        db->Rocks()->NewIterator(rocksdb::ReadOptions(), db->TimelineHandle()));
-    it->SeekToFirst();
-
     LOG(INFO) << "starting to dump timeline database";
 
     int64_t count = 1;
 
-    while (it->Valid()) {
-      const rocksdb::Slice key_raw = it->key();
-      proto::DbKey key;
-      EXPECT_TRUE(key.ParseFromArray(key_raw.data(), key_raw.size()));
+    for (const Partition &partition : db->Partitions()) {
+      std::unique_ptr<rocksdb::Iterator> it(db->Rocks()->NewIterator(
+          rocksdb::ReadOptions(), partition.timeline.get()));
+      it->SeekToFirst();
 
-      const rocksdb::Slice value_raw = it->value();
-      proto::DbValue value;
-      EXPECT_TRUE(value.ParseFromArray(value_raw.data(), value_raw.size()));
+      while (it->Valid()) {
+        const rocksdb::Slice key_raw = it->key();
+        proto::DbKey key;
+        EXPECT_TRUE(DecodeTimelineKey(key_raw, &key));
 
-      DumpDbTimelineEntry(key, value);
+        const rocksdb::Slice value_raw = it->value();
+        proto::DbValue value;
+        EXPECT_TRUE(value.ParseFromArray(value_raw.data(), value_raw.size()));
 
-      ++count;
+        DumpDbTimelineEntry(key, value);
 
-      it->Next();
+        ++count;
+
+        it->Next();
+      }
     }
 
     LOG(INFO) << "finished to dump timeline database, count=" << count;
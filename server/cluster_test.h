@@ -5,6 +5,7 @@
 
 #include "common/config.h"
 #include "server/db.h"
+#include "server/location_batch.h"
 #include "server/mixer.h"
 #include "server/mixer_config.h"
 #include "server/proto.h"
@@ -48,6 +49,9 @@ public:
   bool PushPoint(uint64_t timestamp, uint32_t duration, uint64_t user_id,
                  float longitude, float latitude, float altitude);
 
+  // Pushes points in a columnar batch, returns true on success.
+  bool PushBatch(const std::vector<proto::Location> &locations);
+
   // Retrieves timeline for a given user.
   bool FetchTimeline(uint64_t user_id,
                      proto::GetUserTimeline_Response *response);
@@ -56,6 +60,20 @@ public:
   bool GetNearbyFolks(uint64_t user_id,
                       proto::GetUserNearbyFolks_Response *response);
 
+  // Retrieves nearby folks for many users at once, responses are
+  // appended in the order they are streamed.
+  bool GetUsersNearbyFolks(
+      const std::vector<uint64_t> &user_ids,
+      std::vector<proto::GetUsersNearbyFolks_Response> *responses);
+
+  // Same as FetchTimeline and GetNearbyFolks with the streaming
+  // calls, responses are appended in the order they are streamed.
+  bool StreamTimeline(uint64_t user_id,
+                      std::vector<proto::GetUserTimeline_Response> *responses);
+  bool
+  StreamNearbyFolks(uint64_t user_id,
+                    std::vector<proto::GetUserNearbyFolks_Response> *responses);
+
   // Retrieves an instance of the mixer, depending on the parameters
   // of the test, it can always be the same or a different one on each
   // call.
@@ -81,6 +99,14 @@ public:
   int nb_databases_per_shard_ = 1;
   bool mixer_round_robin_ = false;
   bool simulate_db_down_ = false;
+
+  // Not test parameters, set by fixtures before SetUp.
+  bool mixer_flusher_ = false;
+  bool mixer_correlator_pushdown_ = true;
+  int mixer_block_cache_size_ = 0;
+  int worker_partition_days_ = 0;
+  bool worker_compaction_filter_ = false;
+  bool worker_gc_range_deletes_ = true;
 };
 
 // Cluster configurations to test, this is the carthesian product so
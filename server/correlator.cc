@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "server/correlator.h"
+#include "server/nearby_folk.h"
+
+namespace bt {
+
+namespace {
+
+// Cells are slightly larger than the nearby distance, so that
+// rounding errors when computing cells never separate two nearby
+// entries by more than one cell.
+constexpr double kCellSlack = 1.0001;
+
+// Below this number of lookups, testing all entries is cheaper than
+// building the grid (which costs about as much as testing 50 pairs per
+// entry).
+constexpr size_t kMinLookupsToIndex = 64;
+
+// Locations too far from the origin in number of cells are not
+// bucketed, past this rounding errors exceed the slack above.
+constexpr double kMaxCell = 1 << 30;
+
+} // anonymous namespace
+
+Correlator::Correlator(const CorrelatorConfig &config,
+                       std::vector<CorrelationEntry> folks, size_t lookups)
+    : config_(config) {
+  bucketed_ = lookups >= kMinLookupsToIndex &&
+              config_.nearby_time_sec_ >= 0 &&
+              std::isfinite(config_.nearby_gps_distance_) &&
+              config_.nearby_gps_distance_ > 0.0;
+  if (!bucketed_) {
+    for (size_t i = 0; i < folks.size(); ++i) {
+      block_.Add(*folks[i].key, *folks[i].value);
+      order_.push_back(i);
+    }
+    return;
+  }
+
+  cell_size_ = config_.nearby_gps_distance_ * kCellSlack;
+
+  std::vector<GridEntry> grid;
+  std::vector<size_t> unbucketed;
+  grid.reserve(folks.size());
+  for (size_t i = 0; i < folks.size(); ++i) {
+    const CorrelationEntry &folk = folks[i];
+
+    // The nearby interval of the folk begins before the epoch, this
+    // wraps around in IsNearbyFolk.
+    int64_t lat_cell = 0;
+    int64_t long_cell = 0;
+    if (folk.key->timestamp() < config_.nearby_time_sec_ ||
+        !CellOf(folk.value->gps_latitude(), folk.value->gps_longitude(),
+                &lat_cell, &long_cell)) {
+      unbucketed.push_back(i);
+      continue;
+    }
+
+    GridEntry entry;
+    entry.cell = CellKey(lat_cell, long_cell);
+    entry.begin_ts = folk.key->timestamp() - config_.nearby_time_sec_;
+    entry.folk = i;
+    grid.push_back(entry);
+  }
+
+  std::sort(grid.begin(), grid.end(),
+            [](const GridEntry &lhs, const GridEntry &rhs) {
+              if (lhs.cell != rhs.cell) {
+                return lhs.cell < rhs.cell;
+              }
+              return lhs.begin_ts < rhs.begin_ts;
+            });
+
+  begin_ts_.reserve(grid.size());
+  for (size_t i = 0; i < grid.size(); ++i) {
+    const CorrelationEntry &folk = folks[grid[i].folk];
+    block_.Add(*folk.key, *folk.value);
+    order_.push_back(grid[i].folk);
+    begin_ts_.push_back(grid[i].begin_ts);
+
+    if (cells_.empty() || cells_.back().cell != grid[i].cell) {
+      Cell cell;
+      cell.cell = grid[i].cell;
+      cell.begin = i;
+      cells_.push_back(cell);
+    }
+
+    Cell &cell = cells_.back();
+    cell.end = i + 1;
+    cell.max_duration =
+        std::max<int64_t>(cell.max_duration, folk.value->duration());
+  }
+
+  unbucketed_ = block_.Size();
+  for (size_t i : unbucketed) {
+    block_.Add(*folks[i].key, *folks[i].value);
+    order_.push_back(i);
+  }
+}
+
+bool Correlator::CellOf(float gps_latitude, float gps_longitude,
+                        int64_t *lat_cell, int64_t *long_cell) const {
+  const double lat = std::floor(gps_latitude / cell_size_);
+  const double lng = std::floor(gps_longitude / cell_size_);
+  if (!(std::fabs(lat) < kMaxCell && std::fabs(lng) < kMaxCell)) {
+    return false;
+  }
+
+  *lat_cell = static_cast<int64_t>(lat);
+  *long_cell = static_cast<int64_t>(lng);
+  return true;
+}
+
+uint64_t Correlator::CellKey(int64_t lat_cell, int64_t long_cell) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(lat_cell)) << 32) |
+         static_cast<uint32_t>(long_cell);
+}
+
+void Correlator::NearbyFolksInCell(const Cell &cell,
+                                   const proto::DbKey &user_key,
+                                   const proto::DbValue &user_value,
+                                   std::vector<uint64_t> *matches,
+                                   std::vector<size_t> *nearby_folks) const {
+  // The nearby interval of a folk entry begins at begin_ts and lasts
+  // at most max_duration plus twice the nearby time, only entries
+  // beginning in this range can overlap the user entry.
+  const int64_t user_begin_ts = user_key.timestamp();
+  const int64_t user_end_ts = user_begin_ts + user_value.duration();
+  const int64_t min_begin_ts =
+      user_begin_ts - cell.max_duration - 2 * config_.nearby_time_sec_;
+
+  const auto cell_begin = begin_ts_.begin() + cell.begin;
+  const auto cell_end = begin_ts_.begin() + cell.end;
+  const auto begin = std::lower_bound(cell_begin, cell_end, min_begin_ts);
+  const auto end = std::upper_bound(begin, cell_end, user_end_ts);
+
+  NearbyFolksIn(begin - begin_ts_.begin(), end - begin_ts_.begin(), user_key,
+                user_value, matches, nearby_folks);
+}
+
+void Correlator::NearbyFolksIn(size_t begin, size_t end,
+                               const proto::DbKey &user_key,
+                               const proto::DbValue &user_value,
+                               std::vector<uint64_t> *matches,
+                               std::vector<size_t> *nearby_folks) const {
+  if (begin >= end) {
+    return;
+  }
+
+  IsNearbyFolkBatch(config_, user_key, user_value, block_, begin, end,
+                    matches);
+  for (size_t word = 0; word < matches->size(); ++word) {
+    for (uint64_t bits = (*matches)[word]; bits != 0; bits &= bits - 1) {
+      const size_t i = begin + word * 64 + __builtin_ctzll(bits);
+      nearby_folks->push_back(order_[i]);
+    }
+  }
+}
+
+void Correlator::NearbyFolks(const proto::DbKey &user_key,
+                             const proto::DbValue &user_value,
+                             std::vector<size_t> *nearby_folks) const {
+  std::vector<uint64_t> matches;
+  int64_t lat_cell = 0;
+  int64_t long_cell = 0;
+
+  // The time of the user entry wraps around in IsNearbyFolk, or its
+  // location can't be bucketed: test all entries.
+  if (!bucketed_ || user_key.timestamp() < 0 ||
+      !CellOf(user_value.gps_latitude(), user_value.gps_longitude(),
+              &lat_cell, &long_cell)) {
+    NearbyFolksIn(0, block_.Size(), user_key, user_value, &matches,
+                  nearby_folks);
+    return;
+  }
+
+  for (int64_t lat = lat_cell - 1; lat <= lat_cell + 1; ++lat) {
+    for (int64_t lng = long_cell - 1; lng <= long_cell + 1; ++lng) {
+      const uint64_t key = CellKey(lat, lng);
+      auto it = std::lower_bound(
+          cells_.begin(), cells_.end(), key,
+          [](const Cell &cell, uint64_t key) { return cell.cell < key; });
+      if (it != cells_.end() && it->cell == key) {
+        NearbyFolksInCell(*it, user_key, user_value, &matches, nearby_folks);
+      }
+    }
+  }
+
+  NearbyFolksIn(unbucketed_, block_.Size(), user_key, user_value, &matches,
+                nearby_folks);
+}
+
+} // namespace bt
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "proto/backtrace.pb.h"
+#include "server/mixer_config.h"
+#include "server/nearby_folk.h"
+
+namespace bt {
+
+// An entry of the database to correlate, the key and the value must
+// outlive the correlator.
+struct CorrelationEntry {
+  const proto::DbKey *key = nullptr;
+  const proto::DbValue *value = nullptr;
+};
+
+// Finds entries of folks nearby an entry of a user, with the same
+// result as testing all of them with IsNearbyFolk but only testing
+// candidates.
+//
+// Folk entries are bucketed on a grid of cells slightly larger than
+// the nearby GPS distance, so that nearby entries are always in the
+// same or an adjacent cell. Entries of a cell are sorted by the
+// beginning of their nearby time interval; with the longest duration
+// of the cell, this bounds the range of entries which can overlap
+// the time of the user entry. Candidates are then checked with
+// IsNearbyFolkBatch, entries being copied in a FolkBlock in grid
+// order so that candidates of a cell are contiguous.
+//
+// Entries which can't be bucketed (i.e: timestamps for which the
+// nearby interval doesn't fit, non-finite coordinates) are tested
+// against all user entries, as are all entries when there are too
+// few lookups to pay for building the grid.
+//
+// This class is immutable after construction, it can be used from
+// multiple threads.
+class Correlator {
+public:
+  // Folk entries are only indexed if they are looked up often enough
+  // for it to be worth it, lookups is the expected number of calls to
+  // NearbyFolks.
+  Correlator(const CorrelatorConfig &config,
+             std::vector<CorrelationEntry> folks, size_t lookups);
+
+  // Appends to nearby_folks the indexes of folk entries nearby the
+  // user entry, in no particular order.
+  void NearbyFolks(const proto::DbKey &user_key,
+                   const proto::DbValue &user_value,
+                   std::vector<size_t> *nearby_folks) const;
+
+private:
+  // A folk entry in the grid.
+  struct GridEntry {
+    uint64_t cell = 0;
+    // Beginning of the nearby interval of the entry, its timestamp
+    // minus the nearby time.
+    int64_t begin_ts = 0;
+    size_t folk = 0;
+  };
+
+  // Range of entries of a cell in the block.
+  struct Cell {
+    uint64_t cell = 0;
+    size_t begin = 0;
+    size_t end = 0;
+    int64_t max_duration = 0;
+  };
+
+  // Returns false if the location can't be mapped to a cell.
+  bool CellOf(float gps_latitude, float gps_longitude, int64_t *lat_cell,
+              int64_t *long_cell) const;
+  static uint64_t CellKey(int64_t lat_cell, int64_t long_cell);
+
+  // Tests entries of the cell which may overlap the time of the user
+  // entry.
+  void NearbyFolksInCell(const Cell &cell, const proto::DbKey &user_key,
+                         const proto::DbValue &user_value,
+                         std::vector<uint64_t> *matches,
+                         std::vector<size_t> *nearby_folks) const;
+
+  // Tests entries [begin, end) of the block.
+  void NearbyFolksIn(size_t begin, size_t end, const proto::DbKey &user_key,
+                     const proto::DbValue &user_value,
+                     std::vector<uint64_t> *matches,
+                     std::vector<size_t> *nearby_folks) const;
+
+  CorrelatorConfig config_;
+
+  // Folk entries, in grid order followed by unbucketed entries, and
+  // the index in the constructor folks of each of them.
+  FolkBlock block_;
+  std::vector<size_t> order_;
+
+  // Whether or not the config allows bucketing entries, if not, all
+  // entries are tested.
+  bool bucketed_ = false;
+  double cell_size_ = 0.0;
+
+  // Beginning of the nearby interval of entries in the grid, sorted
+  // within each cell, and cells sorted by key. Unbucketed entries are
+  // at the end of the block, from unbucketed_.
+  std::vector<int64_t> begin_ts_;
+  std::vector<Cell> cells_;
+  size_t unbucketed_ = 0;
+};
+
+} // namespace bt
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+#include "server/correlator.h"
+#include "server/nearby_folk.h"
+
+namespace bt {
+
+namespace {
+
+// Enough lookups for folks to be indexed.
+constexpr size_t kLookups = 1000;
+
+class CorrelatorTest : public testing::Test {
+public:
+  void AddFolk(int64_t ts, uint32_t duration, float gps_lat, float gps_long,
+               float gps_alt) {
+    keys_.emplace_back();
+    values_.emplace_back();
+
+    keys_.back().set_timestamp(ts);
+    keys_.back().set_user_id(keys_.size());
+    values_.back().set_duration(duration);
+    values_.back().set_gps_latitude(gps_lat);
+    values_.back().set_gps_longitude(gps_long);
+    values_.back().set_gps_altitude(gps_alt);
+  }
+
+  std::vector<CorrelationEntry> Folks() {
+    std::vector<CorrelationEntry> folks;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      folks.push_back({&keys_[i], &values_[i]});
+    }
+    return folks;
+  }
+
+  // Returns nearby folks found by the correlator, sorted.
+  std::vector<size_t> NearbyFolks(const Correlator &correlator, int64_t ts,
+                                  uint32_t duration, float gps_lat,
+                                  float gps_long, float gps_alt) {
+    proto::DbKey key;
+    proto::DbValue value;
+    MakeUser(ts, duration, gps_lat, gps_long, gps_alt, &key, &value);
+
+    std::vector<size_t> folks;
+    correlator.NearbyFolks(key, value, &folks);
+    std::sort(folks.begin(), folks.end());
+    return folks;
+  }
+
+  // Returns nearby folks found by testing all of them.
+  std::vector<size_t> ExpectedNearbyFolks(int64_t ts, uint32_t duration,
+                                          float gps_lat, float gps_long,
+                                          float gps_alt) {
+    proto::DbKey key;
+    proto::DbValue value;
+    MakeUser(ts, duration, gps_lat, gps_long, gps_alt, &key, &value);
+
+    std::vector<size_t> folks;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      if (IsNearbyFolk(config_, key, value, keys_[i], values_[i])) {
+        folks.push_back(i);
+      }
+    }
+    return folks;
+  }
+
+  void MakeUser(int64_t ts, uint32_t duration, float gps_lat, float gps_long,
+                float gps_alt, proto::DbKey *key, proto::DbValue *value) {
+    key->set_timestamp(ts);
+    key->set_user_id(0);
+    value->set_duration(duration);
+    value->set_gps_latitude(gps_lat);
+    value->set_gps_longitude(gps_long);
+    value->set_gps_altitude(gps_alt);
+  }
+
+  CorrelatorConfig config_;
+
+  // Deques so that pointers to entries stay valid.
+  std::deque<proto::DbKey> keys_;
+  std::deque<proto::DbValue> values_;
+};
+
+TEST_F(CorrelatorTest, NoFolks) {
+  Correlator correlator(config_, Folks(), kLookups);
+
+  EXPECT_TRUE(NearbyFolks(correlator, 1582410000, 0, 1.0, 1.0, 0.0).empty());
+}
+
+TEST_F(CorrelatorTest, NearbyFolk) {
+  AddFolk(1582410000, 0, 1.0, 1.0, 0.0);
+  AddFolk(1582410000, 0, 1.1, 1.0, 0.0);
+  AddFolk(1582420000, 0, 1.0, 1.0, 0.0);
+  AddFolk(1582410000, 0, 1.0, 1.0, 10.0);
+
+  Correlator correlator(config_, Folks(), kLookups);
+
+  EXPECT_EQ(NearbyFolks(correlator, 1582410010, 0, 1.000001, 1.0, 0.0),
+            std::vector<size_t>({0}));
+}
+
+TEST_F(CorrelatorTest, LongDuration) {
+  AddFolk(1582410000, 0, 1.0, 1.0, 0.0);
+  AddFolk(1582400000, 20000, 1.0, 1.0, 0.0);
+  AddFolk(1582400000, 5000, 1.0, 1.0, 0.0);
+
+  Correlator correlator(config_, Folks(), kLookups);
+
+  EXPECT_EQ(NearbyFolks(correlator, 1582410000, 0, 1.0, 1.0, 0.0),
+            std::vector<size_t>({0, 1}));
+  EXPECT_EQ(NearbyFolks(correlator, 1582300000, 100000, 1.0, 1.0, 0.0),
+            std::vector<size_t>({1, 2}));
+}
+
+TEST_F(CorrelatorTest, AdjacentCells) {
+  // Folks right around the user, on both sides of cell borders.
+  const float distance = config_.nearby_gps_distance_;
+  for (int lat = -2; lat <= 2; ++lat) {
+    for (int lng = -2; lng <= 2; ++lng) {
+      AddFolk(1582410000, 0, 0.5 * distance * lat, 0.5 * distance * lng, 0.0);
+      AddFolk(1582410000, 0, -1.0 + 0.99 * distance * lat,
+              -1.0 + 0.99 * distance * lng, 0.0);
+    }
+  }
+
+  Correlator correlator(config_, Folks(), kLookups);
+
+  EXPECT_EQ(NearbyFolks(correlator, 1582410000, 0, 0.0, 0.0, 0.0),
+            ExpectedNearbyFolks(1582410000, 0, 0.0, 0.0, 0.0));
+  EXPECT_EQ(NearbyFolks(correlator, 1582410000, 0, -1.0, -1.0, 0.0),
+            ExpectedNearbyFolks(1582410000, 0, -1.0, -1.0, 0.0));
+}
+
+TEST_F(CorrelatorTest, UnbucketedEntries) {
+  // Timestamp before the nearby time, wraps around in IsNearbyFolk.
+  AddFolk(0, 0, 1.0, 1.0, 0.0);
+  AddFolk(1582410000, 0, std::nanf(""), 1.0, 0.0);
+  AddFolk(1582410000, 0, 1.0, 1.0, 0.0);
+
+  Correlator correlator(config_, Folks(), kLookups);
+
+  for (int64_t ts : {int64_t(-10), int64_t(0), int64_t(1582410000)}) {
+    EXPECT_EQ(NearbyFolks(correlator, ts, 0, 1.0, 1.0, 0.0),
+              ExpectedNearbyFolks(ts, 0, 1.0, 1.0, 0.0));
+  }
+}
+
+TEST_F(CorrelatorTest, FewLookups) {
+  AddFolk(1582410000, 0, 1.0, 1.0, 0.0);
+  AddFolk(1582410000, 0, 1.1, 1.0, 0.0);
+
+  Correlator correlator(config_, Folks(), 1);
+
+  EXPECT_EQ(NearbyFolks(correlator, 1582410010, 0, 1.000001, 1.0, 0.0),
+            std::vector<size_t>({0}));
+}
+
+TEST_F(CorrelatorTest, MatchesAllPairs) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int64_t> ts(1582410000, 1582410000 + 1000);
+  std::uniform_int_distribution<uint32_t> duration(0, 120);
+  std::uniform_real_distribution<float> gps(-0.00005, 0.00005);
+  std::uniform_real_distribution<float> alt(0.0, 5.0);
+
+  for (int i = 0; i < 5000; ++i) {
+    AddFolk(ts(gen), duration(gen), 48.8566 + gps(gen), 2.3522 + gps(gen),
+            alt(gen));
+  }
+
+  Correlator correlator(config_, Folks(), kLookups);
+
+  for (int i = 0; i < 500; ++i) {
+    const int64_t user_ts = ts(gen);
+    const uint32_t user_duration = duration(gen);
+    const float user_lat = 48.8566 + gps(gen);
+    const float user_long = 2.3522 + gps(gen);
+    const float user_alt = alt(gen);
+
+    EXPECT_EQ(NearbyFolks(correlator, user_ts, user_duration, user_lat,
+                          user_long, user_alt),
+              ExpectedNearbyFolks(user_ts, user_duration, user_lat, user_long,
+                                  user_alt));
+  }
+}
+
+} // namespace
+
+} // namespace bt
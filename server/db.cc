@@ -1,10 +1,21 @@
+#include <algorithm>
+#include <charconv>
 #include <ctime>
 #include <glog/logging.h>
+#include <iterator>
+#include <limits>
+#include <rocksdb/comparator.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/slice_transform.h>
 #include <rocksdb/table.h>
+#include <string>
 
 #include "common/utils.h"
 #include "proto/backtrace.pb.h"
 #include "server/db.h"
+#include "server/expiry_filter.h"
+#include "server/keys.h"
+#include "server/migrate.h"
 #include "server/worker_config.h"
 #include "server/zones.h"
 
@@ -12,11 +23,39 @@ namespace bt {
 
 namespace {
 
-// Used for GPS float comparisons.
-constexpr float kEpsilon = 0.0000001;
+constexpr int64_t kSecondsPerDay = 24 * 3600;
 
-constexpr char kColumnTimeline[] = "by-timeline";
-constexpr char kColumnReverse[] = "by-user";
+// Bloom filters of database files, about 1% of false positives.
+constexpr double kBloomBitsPerKey = 10;
+
+// Size of the bloom filter of memtables, relative to their size.
+constexpr double kMemtableBloomSizeRatio = 0.02;
+
+// Partition columns are named after the column they partition and
+// the first time zone they hold (i.e: by-timeline.1582329).
+std::string PartitionColumn(const char *column, int64_t start_zone) {
+  return std::string(column) + "." + std::to_string(start_zone);
+}
+
+bool ParsePartitionColumn(const std::string &name, const char *column,
+                          int64_t *start_zone) {
+  const std::string prefix = std::string(column) + ".";
+  if (name.size() <= prefix.size() ||
+      name.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  const char *end = name.data() + name.size();
+  const auto result =
+      std::from_chars(name.data() + prefix.size(), end, *start_zone);
+  return result.ec == std::errc() && result.ptr == end;
+}
+
+int64_t FloorDiv(int64_t a, int64_t b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+int64_t CeilDiv(int64_t a, int64_t b) { return -FloorDiv(-a, b); }
 
 } // anonymous namespace
 
@@ -41,15 +80,15 @@ constexpr char kColumnReverse[] = "by-user";
 // corrupt database. Once we release the database, we'll have to stick
 // with it.
 //
-// Current key layout:
+// Current key layout (see keys.h for the raw encoding):
 //
-// +--------------+-----------+----------+---------+--------------+
-// | TIMESTAMP LO | LONG_ZONE | LAT_ZONE | USER_ID | TIMESTAMP HI |
-// +--------------+-----------+----------+---------+--------------+
+// +-----------+-----------+----------+---------+-------------+
+// | TIME ZONE | LONG_ZONE | LAT_ZONE | USER_ID | TIME OFFSET |
+// +-----------+-----------+----------+---------+-------------+
 //
 // What can be tweaked (not safely):
 //
-// - timestamp low granularity (currently: 1000 seconds)
+// - timestamp zone granularity (currently: 1000 seconds)
 // - longitude zone granularity (currently: 100 meters)
 // - latitude zone granularity (currently: 100 meters)
 //
@@ -65,167 +104,77 @@ constexpr char kColumnReverse[] = "by-user";
 // square during a period of 1000 seconds, this is how many points we'll
 // need to store in memory to process a lookup.
 //
-// An alternative here is to change how keys look like raw and rely on
-// byte comparison. This may yield better results, would this function
-// become the bottleneck.
-namespace {
-
-void DecodeTimelineKey(const rocksdb::Slice &key, uint64_t *timestamp_lo,
-                       float *long_zone, float *lat_zone, uint64_t *user_id,
-                       uint64_t *timestamp_hi) {
-  proto::DbKey db_key;
-  db_key.ParseFromArray(key.data(), key.size());
-
-  *timestamp_lo = db_key.timestamp() / kTimePrecision;
-  *long_zone = db_key.gps_longitude_zone();
-  *lat_zone = db_key.gps_latitude_zone();
-  *user_id = db_key.user_id();
-  *timestamp_hi = db_key.timestamp() % kTimePrecision;
-}
-
-} // anonymous namespace
-
+// Keys are encoded so that their byte order is the order described
+// above: this function is called for every memtable insert, every
+// binary search in SST files and every merge during compactions, so
+// it is a plain memcmp (the first version parsed two protobufs per
+// call, which became the bottleneck).
 int TimelineComparator::Compare(const rocksdb::Slice &a,
                                 const rocksdb::Slice &b) const {
-  uint64_t left_timestamp_lo;
-  float left_long_zone;
-  float left_lat_zone;
-  uint64_t left_user_id;
-  uint64_t left_timestamp_hi;
-  DecodeTimelineKey(a, &left_timestamp_lo, &left_long_zone, &left_lat_zone,
-                    &left_user_id, &left_timestamp_hi);
-
-  uint64_t right_timestamp_lo;
-  float right_long_zone;
-  float right_lat_zone;
-  uint64_t right_user_id;
-  uint64_t right_timestamp_hi;
-  DecodeTimelineKey(b, &right_timestamp_lo, &right_long_zone, &right_lat_zone,
-                    &right_user_id, &right_timestamp_hi);
-
-  if (left_timestamp_lo < right_timestamp_lo) {
-    return -1;
-  }
-  if (left_timestamp_lo > right_timestamp_lo) {
-    return 1;
-  }
-
-  float fdiff;
-
-  fdiff = left_long_zone - right_long_zone;
-  if (fdiff > kEpsilon) {
-    return -1;
-  }
-  if (fdiff < -kEpsilon) {
-    return 1;
-  }
-
-  fdiff = left_lat_zone - right_lat_zone;
-  if (fdiff > kEpsilon) {
-    return -1;
-  }
-  if (fdiff < -kEpsilon) {
-    return 1;
-  }
-
-  if (left_user_id < right_user_id) {
-    return -1;
-  }
-  if (left_user_id > right_user_id) {
-    return 1;
-  }
-
-  if (left_timestamp_hi < right_timestamp_hi) {
-    return -1;
-  }
-  if (left_timestamp_hi > right_timestamp_hi) {
-    return 1;
-  }
-
-  return 0;
-};
+  return a.compare(b);
+}
 
 const char *TimelineComparator::Name() const {
   // Keep this versioned as long as the implementation isn't changed, so we
   // ensure we aren't corrupting a database. It's a good idea to have a unit
   // test here that ensure the order doesn't change.
-  return "timeline-comparator-0.1";
+  return "timeline-comparator-0.2";
 }
 
-namespace {
-
-void DecodeReverseKey(const rocksdb::Slice &key, uint64_t *user_id,
-                      uint64_t *timestamp_zone, float *gps_longitude_zone,
-                      float *gps_latitude_zone) {
-  proto::DbReverseKey db_key;
-  db_key.ParseFromArray(key.data(), key.size());
-  *user_id = db_key.user_id();
-  *timestamp_zone = db_key.timestamp_zone();
-  *gps_longitude_zone = db_key.gps_longitude_zone();
-  *gps_latitude_zone = db_key.gps_latitude_zone();
+// As the order is the byte order, we can rely on RocksDB's bytewise
+// implementation to shorten index keys.
+void TimelineComparator::FindShortestSeparator(
+    std::string *start, const rocksdb::Slice &limit) const {
+  rocksdb::BytewiseComparator()->FindShortestSeparator(start, limit);
 }
 
-} // anonymous namespace
+void TimelineComparator::FindShortSuccessor(std::string *key) const {
+  rocksdb::BytewiseComparator()->FindShortSuccessor(key);
+}
 
+// Reverse comparator.
+//
+// Keys are ordered by user first, so that all zones where a user was
+// are read sequentially:
+//
+// +---------+-----------+-----------+----------+
+// | USER_ID | TIME ZONE | LONG_ZONE | LAT_ZONE |
+// +---------+-----------+-----------+----------+
+//
+// Each ingested point does a Put in this column, so like the timeline
+// comparator, keys are encoded so that this is a plain memcmp (see
+// keys.h).
 int ReverseComparator::Compare(const rocksdb::Slice &a,
                                const rocksdb::Slice &b) const {
-  uint64_t left_user_id;
-  uint64_t left_timestamp_zone;
-  float left_gps_longitude_zone;
-  float left_gps_latitude_zone;
-  DecodeReverseKey(a, &left_user_id, &left_timestamp_zone,
-                   &left_gps_longitude_zone, &left_gps_latitude_zone);
-
-  uint64_t right_user_id;
-  uint64_t right_timestamp_zone;
-  float right_gps_longitude_zone;
-  float right_gps_latitude_zone;
-  DecodeReverseKey(b, &right_user_id, &right_timestamp_zone,
-                   &right_gps_longitude_zone, &right_gps_latitude_zone);
-
-  if (left_user_id < right_user_id) {
-    return -1;
-  }
-  if (left_user_id > right_user_id) {
-    return 1;
-  }
-
-  if (left_timestamp_zone < right_timestamp_zone) {
-    return -1;
-  }
-  if (left_timestamp_zone > right_timestamp_zone) {
-    return 1;
-  }
-
-  float fdiff;
-
-  fdiff = left_gps_longitude_zone - right_gps_longitude_zone;
-  if (fdiff > kEpsilon) {
-    return -1;
-  }
-  if (fdiff < -kEpsilon) {
-    return 1;
-  }
-
-  fdiff = left_gps_latitude_zone - right_gps_latitude_zone;
-  if (fdiff > kEpsilon) {
-    return -1;
-  }
-  if (fdiff < -kEpsilon) {
-    return 1;
-  }
-
-  return 0;
+  return a.compare(b);
 }
 
 const char *ReverseComparator::Name() const {
   // Keep this versioned as long as the implementation isn't changed, so we
   // ensure we aren't corrupting a database. It's a good idea to have a unit
   // test here that ensure the order doesn't change.
-  return "reverse-comparator-0.1";
+  return "reverse-comparator-0.2";
+}
+
+void ReverseComparator::FindShortestSeparator(
+    std::string *start, const rocksdb::Slice &limit) const {
+  rocksdb::BytewiseComparator()->FindShortestSeparator(start, limit);
+}
+
+void ReverseComparator::FindShortSuccessor(std::string *key) const {
+  rocksdb::BytewiseComparator()->FindShortSuccessor(key);
 }
 
 Status Db::Init(const WorkerConfig &config) {
+  partition_days_ = config.db_partition_days_;
+  if (partition_days_ < 0) {
+    RETURN_ERROR(INVALID_CONFIG, "db.partition_days should be >= 0");
+  }
+  if (config.gc_compaction_filter_ &&
+      !(config.gc_periodic_compaction_sec_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "gc.periodic_compaction_sec should be > 0");
+  }
+
   RETURN_IF_ERROR(InitPath(config));
 
   rocksdb::Options rocksdb_options;
@@ -251,23 +200,72 @@ Status Db::Init(const WorkerConfig &config) {
   table_options.block_cache = cache;
   rocksdb_options.table_factory.reset(NewBlockBasedTableFactory(table_options));
 
+  // Databases written with an older format can't be opened with the
+  // current comparators, they are rewritten first.
+  if (!is_temp_) {
+    RETURN_IF_ERROR(ConvertOutdatedFormat(rocksdb_options, config));
+  }
+
   // Column families need to be created prior to opening the database.
-  RETURN_IF_ERROR(InitColumnFamilies(rocksdb_options));
+  bool created = false;
+  RETURN_IF_ERROR(InitColumnFamilies(rocksdb_options, &created));
 
   columns_.push_back(rocksdb::ColumnFamilyDescriptor(
       rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
 
-  rocksdb::ColumnFamilyOptions timeline_options;
-  timeline_options.comparator = &timeline_cmp_;
-  timeline_options.compression = rocksdb::kLZ4Compression;
-  columns_.push_back(
-      rocksdb::ColumnFamilyDescriptor(kColumnTimeline, timeline_options));
+  timeline_options_.comparator = &timeline_cmp_;
+  timeline_options_.compression = rocksdb::kLZ4Compression;
+  reverse_options_.comparator = &reverse_cmp_;
+  reverse_options_.compression = rocksdb::kLZ4Compression;
+
+  // Timeline reads are scans of a zone, filters are built on the zone
+  // prefix only so that empty zones are skipped without reading data
+  // blocks.
+  rocksdb::BlockBasedTableOptions timeline_table_options = table_options;
+  timeline_table_options.filter_policy.reset(
+      rocksdb::NewBloomFilterPolicy(kBloomBitsPerKey));
+  timeline_table_options.whole_key_filtering = false;
+  timeline_options_.table_factory.reset(
+      NewBlockBasedTableFactory(timeline_table_options));
+  timeline_options_.prefix_extractor.reset(
+      rocksdb::NewFixedPrefixTransform(kTimelineZoneSize));
+  timeline_options_.memtable_prefix_bloom_size_ratio = kMemtableBloomSizeRatio;
+
+  // Reverse reads are scans of a user, filters are built on the user
+  // prefix so that unknown users are skipped, and on whole keys.
+  rocksdb::BlockBasedTableOptions reverse_table_options = table_options;
+  reverse_table_options.filter_policy.reset(
+      rocksdb::NewBloomFilterPolicy(kBloomBitsPerKey));
+  reverse_table_options.whole_key_filtering = true;
+  reverse_options_.table_factory.reset(
+      NewBlockBasedTableFactory(reverse_table_options));
+  reverse_options_.prefix_extractor.reset(
+      rocksdb::NewFixedPrefixTransform(kReverseUserSize));
+  reverse_options_.memtable_prefix_bloom_size_ratio = kMemtableBloomSizeRatio;
+  reverse_options_.memtable_whole_key_filtering = true;
+
+  // Expired points are dropped by compactions instead of the GC,
+  // files are compacted periodically so that old ones are too.
+  if (config.gc_compaction_filter_) {
+    timeline_options_.compaction_filter_factory =
+        std::make_shared<ExpiryFilterFactory>(
+            ExpiryColumn::TIMELINE, config.gc_retention_period_days_);
+    timeline_options_.periodic_compaction_seconds =
+        config.gc_periodic_compaction_sec_;
+    reverse_options_.compaction_filter_factory =
+        std::make_shared<ExpiryFilterFactory>(
+            ExpiryColumn::REVERSE, config.gc_retention_period_days_);
+    reverse_options_.periodic_compaction_seconds =
+        config.gc_periodic_compaction_sec_;
+  }
 
-  rocksdb::ColumnFamilyOptions reverse_options;
-  reverse_options.comparator = &reverse_cmp_;
-  reverse_options.compression = rocksdb::kLZ4Compression;
   columns_.push_back(
-      rocksdb::ColumnFamilyDescriptor(kColumnReverse, reverse_options));
+      rocksdb::ColumnFamilyDescriptor(kColumnTimeline, timeline_options_));
+  columns_.push_back(
+      rocksdb::ColumnFamilyDescriptor(kColumnReverse, reverse_options_));
+
+  // All columns have to be opened, including partitions.
+  RETURN_IF_ERROR(ListPartitionColumns(rocksdb_options));
 
   rocksdb::DB *db = nullptr;
   rocksdb::Status db_status =
@@ -277,11 +275,391 @@ Status Db::Init(const WorkerConfig &config) {
                  "unable to init database, error=" << db_status.ToString());
   }
   db_.reset(db);
-  LOG(INFO) << "initialized database, path=" << path_;
+
+  RETURN_IF_ERROR(InitPartitions());
+  RETURN_IF_ERROR(InitFormatVersion(created));
+  RETURN_IF_ERROR(InitPartitionDays(created));
+  LOG(INFO) << "initialized database, path=" << path_
+            << ", format_version=" << kDbFormatVersion
+            << ", partition_days=" << partition_days_
+            << ", partitions=" << partitions_.size();
+
+  return StatusCode::OK;
+}
+
+Status Db::ConvertOutdatedFormat(const rocksdb::Options &rocksdb_options,
+                                 const WorkerConfig &config) {
+  if (!CheckColumnFamilies(rocksdb_options)) {
+    return StatusCode::OK;
+  }
+
+  int version = 0;
+  RETURN_IF_ERROR(ReadDatabaseFormatVersion(path_, &version));
+  if (version == kDbFormatVersion) {
+    return StatusCode::OK;
+  }
+  if (version > kDbFormatVersion) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "database has a newer format than supported, version="
+                     << version << ", path=" << path_);
+  }
+  if (partition_days_ > 0) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "can't convert database to a partitioned one, version="
+                     << version << ", path=" << path_);
+  }
+
+  std::string path = path_;
+  while (path.size() > 1 && path.back() == '/') {
+    path.pop_back();
+  }
+  const std::string legacy_path = path + ".v" + std::to_string(version);
+  if (utils::DirExists(legacy_path)) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "can't convert database, a previous conversion wasn't "
+                 "cleaned up, path="
+                     << legacy_path);
+  }
+
+  LOG(WARNING) << "converting database from format version " << version
+               << " to " << kDbFormatVersion << ", path=" << path_
+               << ", legacy_path=" << legacy_path;
+
+  RETURN_IF_ERROR(utils::RenameDirectory(path, legacy_path));
+  RETURN_IF_ERROR(MigrateDatabase(legacy_path, config));
+
+  LOG(WARNING) << "converted database, legacy database can be deleted, path="
+               << legacy_path;
+
+  return StatusCode::OK;
+}
+
+Status Db::InitFormatVersion(bool created) {
+  const rocksdb::Slice key(kFormatVersionKey);
+
+  if (created) {
+    const std::string version = std::to_string(kDbFormatVersion);
+    rocksdb::Status status = db_->Put(rocksdb::WriteOptions(), DefaultHandle(),
+                                      key, rocksdb::Slice(version));
+    if (!status.ok()) {
+      RETURN_ERROR(INTERNAL_ERROR, "unable to record format version, status="
+                                       << status.ToString());
+    }
+    return StatusCode::OK;
+  }
+
+  std::string version;
+  rocksdb::Status status =
+      db_->Get(rocksdb::ReadOptions(), DefaultHandle(), key, &version);
+  if (!status.ok() && !status.IsNotFound()) {
+    RETURN_ERROR(INTERNAL_ERROR, "unable to read format version, status="
+                                     << status.ToString());
+  }
+
+  if (status.IsNotFound() || version != std::to_string(kDbFormatVersion)) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "database has an unexpected format version, path="
+                     << path_);
+  }
 
   return StatusCode::OK;
 }
 
+Status Db::InitPartitionDays(bool created) {
+  const rocksdb::Slice key(kPartitionDaysKey);
+
+  if (created) {
+    const std::string days = std::to_string(partition_days_);
+    rocksdb::Status status = db_->Put(rocksdb::WriteOptions(), DefaultHandle(),
+                                      key, rocksdb::Slice(days));
+    if (!status.ok()) {
+      RETURN_ERROR(INTERNAL_ERROR, "unable to record partition days, status="
+                                       << status.ToString());
+    }
+    return StatusCode::OK;
+  }
+
+  // Databases created before partitioning aren't partitioned.
+  std::string days = "0";
+  rocksdb::Status status =
+      db_->Get(rocksdb::ReadOptions(), DefaultHandle(), key, &days);
+  if (!status.ok() && !status.IsNotFound()) {
+    RETURN_ERROR(INTERNAL_ERROR, "unable to read partition days, status="
+                                     << status.ToString());
+  }
+
+  if (days != std::to_string(partition_days_)) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "database was created with a different db.partition_days, "
+                 "partition_days="
+                     << days << ", path=" << path_);
+  }
+
+  return StatusCode::OK;
+}
+
+Status Db::ListPartitionColumns(const rocksdb::Options &rocksdb_options) {
+  std::vector<std::string> columns;
+  rocksdb::Status status =
+      rocksdb::DB::ListColumnFamilies(rocksdb_options, path_, &columns);
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "can't list database columns, status=" << status.ToString());
+  }
+
+  for (const auto &column : columns) {
+    int64_t start_zone = 0;
+    if (ParsePartitionColumn(column, kColumnTimeline, &start_zone)) {
+      columns_.push_back(
+          rocksdb::ColumnFamilyDescriptor(column, timeline_options_));
+    } else if (ParsePartitionColumn(column, kColumnReverse, &start_zone)) {
+      columns_.push_back(
+          rocksdb::ColumnFamilyDescriptor(column, reverse_options_));
+    }
+  }
+
+  return StatusCode::OK;
+}
+
+Status Db::InitPartitions() {
+  // Handles past the default, timeline and reverse ones are the ones
+  // of partitions, they are owned by partitions from now on.
+  for (size_t i = 3; i < handles_.size(); ++i) {
+    const std::string &name = columns_[i].name;
+    int64_t start_zone = 0;
+    const bool is_timeline =
+        ParsePartitionColumn(name, kColumnTimeline, &start_zone);
+    if (!is_timeline) {
+      ParsePartitionColumn(name, kColumnReverse, &start_zone);
+    }
+
+    Partition &partition = partitions_[start_zone];
+    if (is_timeline) {
+      partition.timeline = ShareHandle(handles_[i]);
+    } else {
+      partition.reverse = ShareHandle(handles_[i]);
+    }
+  }
+  handles_.resize(3);
+  columns_.resize(3);
+
+  if (!IsPartitioned() && !partitions_.empty()) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "database has partitions but db.partition_days is 0, path="
+                     << path_);
+  }
+
+  // A partition may have a single column if we stopped while creating
+  // it, the missing one is empty.
+  for (auto &it : partitions_) {
+    Partition &partition = it.second;
+    PartitionZones(it.first, &partition.start_zone, &partition.end_zone);
+
+    rocksdb::ColumnFamilyHandle *handle = nullptr;
+    if (partition.timeline == nullptr) {
+      rocksdb::Status status = db_->CreateColumnFamily(
+          timeline_options_, PartitionColumn(kColumnTimeline, it.first),
+          &handle);
+      if (!status.ok()) {
+        RETURN_ERROR(INTERNAL_ERROR, "can't create timeline partition, status="
+                                         << status.ToString());
+      }
+      partition.timeline = ShareHandle(handle);
+    }
+    if (partition.reverse == nullptr) {
+      rocksdb::Status status = db_->CreateColumnFamily(
+          reverse_options_, PartitionColumn(kColumnReverse, it.first),
+          &handle);
+      if (!status.ok()) {
+        RETURN_ERROR(INTERNAL_ERROR, "can't create reverse partition, status="
+                                         << status.ToString());
+      }
+      partition.reverse = ShareHandle(handle);
+    }
+  }
+
+  return StatusCode::OK;
+}
+
+void Db::PartitionZones(int64_t ts_zone, int64_t *start_zone,
+                        int64_t *end_zone) const {
+  // Partitions are aligned on days while time zones aren't, a time
+  // zone belongs to the partition where it starts.
+  const int64_t period = partition_days_ * kSecondsPerDay;
+  const int64_t start = FloorDiv(ts_zone * kTimePrecision, period) * period;
+  *start_zone = CeilDiv(start, kTimePrecision);
+  *end_zone = CeilDiv(start + period, kTimePrecision);
+}
+
+std::shared_ptr<rocksdb::ColumnFamilyHandle>
+Db::ShareHandle(rocksdb::ColumnFamilyHandle *handle) {
+  rocksdb::DB *db = db_.get();
+  return std::shared_ptr<rocksdb::ColumnFamilyHandle>(
+      handle, [db](rocksdb::ColumnFamilyHandle *handle) {
+        rocksdb::Status status = db->DestroyColumnFamilyHandle(handle);
+        if (!status.ok()) {
+          LOG(WARNING) << "can't close partition handle, status="
+                       << status.ToString();
+        }
+      });
+}
+
+std::vector<Partition> Db::Partitions() {
+  std::vector<Partition> partitions;
+  if (!IsPartitioned()) {
+    // Handles of the main columns are owned by the database, the
+    // partition only refers to them.
+    Partition partition;
+    partition.start_zone = std::numeric_limits<int64_t>::min();
+    partition.end_zone = std::numeric_limits<int64_t>::max();
+    partition.timeline = std::shared_ptr<rocksdb::ColumnFamilyHandle>(
+        std::shared_ptr<rocksdb::ColumnFamilyHandle>(), TimelineHandle());
+    partition.reverse = std::shared_ptr<rocksdb::ColumnFamilyHandle>(
+        std::shared_ptr<rocksdb::ColumnFamilyHandle>(), ReverseHandle());
+    partitions.push_back(std::move(partition));
+    return partitions;
+  }
+
+  std::lock_guard<std::mutex> lock(partitions_lock_);
+  partitions.reserve(partitions_.size());
+  for (const auto &it : partitions_) {
+    partitions.push_back(it.second);
+  }
+  return partitions;
+}
+
+Status Db::PartitionForZone(int64_t ts_zone, Partition *partition) {
+  if (!IsPartitioned()) {
+    *partition = Partitions()[0];
+    return StatusCode::OK;
+  }
+
+  int64_t start_zone = 0;
+  int64_t end_zone = 0;
+  PartitionZones(ts_zone, &start_zone, &end_zone);
+
+  std::lock_guard<std::mutex> lock(partitions_lock_);
+  auto it = partitions_.find(start_zone);
+  if (it != partitions_.end()) {
+    *partition = it->second;
+    return StatusCode::OK;
+  }
+
+  // Creating columns writes to the manifest, this only happens once
+  // per partition.
+  rocksdb::ColumnFamilyHandle *timeline = nullptr;
+  const std::string timeline_name =
+      PartitionColumn(kColumnTimeline, start_zone);
+  rocksdb::Status status =
+      db_->CreateColumnFamily(timeline_options_, timeline_name, &timeline);
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't create timeline partition, column="
+                                     << timeline_name
+                                     << ", status=" << status.ToString());
+  }
+
+  rocksdb::ColumnFamilyHandle *reverse = nullptr;
+  const std::string reverse_name = PartitionColumn(kColumnReverse, start_zone);
+  status = db_->CreateColumnFamily(reverse_options_, reverse_name, &reverse);
+  if (!status.ok()) {
+    db_->DropColumnFamily(timeline);
+    db_->DestroyColumnFamilyHandle(timeline);
+    RETURN_ERROR(INTERNAL_ERROR, "can't create reverse partition, column="
+                                     << reverse_name
+                                     << ", status=" << status.ToString());
+  }
+
+  Partition &created = partitions_[start_zone];
+  created.start_zone = start_zone;
+  created.end_zone = end_zone;
+  created.timeline = ShareHandle(timeline);
+  created.reverse = ShareHandle(reverse);
+  *partition = created;
+
+  LOG(INFO) << "created partition, start_zone=" << start_zone
+            << ", end_zone=" << end_zone;
+
+  return StatusCode::OK;
+}
+
+Status Db::DropPartition(const Partition &partition) {
+  if (!IsPartitioned()) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't drop partition, database isn't "
+                                 "partitioned");
+  }
+
+  std::lock_guard<std::mutex> lock(partitions_lock_);
+  auto it = partitions_.find(partition.start_zone);
+  if (it == partitions_.end()) {
+    return StatusCode::OK;
+  }
+
+  // The partition is forgotten even if a drop fails, a lone column is
+  // completed when the database is opened again and dropped by the
+  // next GC pass.
+  const Partition dropped = it->second;
+  partitions_.erase(it);
+
+  rocksdb::Status status = db_->DropColumnFamily(dropped.reverse.get());
+  if (status.ok()) {
+    status = db_->DropColumnFamily(dropped.timeline.get());
+  }
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't drop partition, start_zone="
+                                     << dropped.start_zone
+                                     << ", status=" << status.ToString());
+  }
+
+  LOG(INFO) << "dropped partition, start_zone=" << dropped.start_zone
+            << ", end_zone=" << dropped.end_zone;
+
+  return StatusCode::OK;
+}
+
+rocksdb::ReadOptions PrefixReadOptions() {
+  rocksdb::ReadOptions options;
+  options.prefix_same_as_start = true;
+  return options;
+}
+
+rocksdb::ReadOptions TotalOrderReadOptions() {
+  rocksdb::ReadOptions options;
+  options.total_order_seek = true;
+  return options;
+}
+
+rocksdb::WriteOptions PointWriteOptions() {
+  rocksdb::WriteOptions options;
+  options.ignore_missing_column_families = true;
+  return options;
+}
+
+PartitionIterators::PartitionIterators(Db *db)
+    : db_(db), partitions_(db->Partitions()),
+      timeline_its_(partitions_.size()) {}
+
+rocksdb::Iterator *PartitionIterators::Timeline(int64_t ts_zone) {
+  auto it = std::upper_bound(
+      partitions_.begin(), partitions_.end(), ts_zone,
+      [](int64_t zone, const Partition &p) { return zone < p.start_zone; });
+  if (it == partitions_.begin() || ts_zone >= std::prev(it)->end_zone) {
+    return nullptr;
+  }
+
+  const size_t i = std::prev(it) - partitions_.begin();
+  if (timeline_its_[i] == nullptr) {
+    timeline_its_[i].reset(db_->Rocks()->NewIterator(
+        PrefixReadOptions(), partitions_[i].timeline.get()));
+  }
+  return timeline_its_[i].get();
+}
+
+std::unique_ptr<rocksdb::Iterator>
+PartitionIterators::NewReverse(size_t partition) {
+  return std::unique_ptr<rocksdb::Iterator>(db_->Rocks()->NewIterator(
+      PrefixReadOptions(), partitions_[partition].reverse.get()));
+}
+
 Status Db::InitPath(const WorkerConfig &config) {
   if (!config.db_path_.empty()) {
     path_ = config.db_path_;
@@ -294,7 +672,9 @@ Status Db::InitPath(const WorkerConfig &config) {
   return StatusCode::OK;
 }
 
-Status Db::InitColumnFamilies(const rocksdb::Options &rocksdb_options) {
+Status Db::InitColumnFamilies(const rocksdb::Options &rocksdb_options,
+                              bool *created) {
+  *created = false;
   if (CheckColumnFamilies(rocksdb_options)) {
     return StatusCode::OK;
   }
@@ -337,6 +717,7 @@ Status Db::InitColumnFamilies(const rocksdb::Options &rocksdb_options) {
   if (!CheckColumnFamilies(rocksdb_options)) {
     RETURN_ERROR(INTERNAL_ERROR, "unable to create column families");
   }
+  *created = true;
 
   return StatusCode::OK;
 }
@@ -385,6 +766,9 @@ rocksdb::ColumnFamilyHandle *Db::TimelineHandle() { return handles_[1]; }
 rocksdb::ColumnFamilyHandle *Db::ReverseHandle() { return handles_[2]; }
 
 Db::~Db() {
+  // Partitions must no longer be used at this point.
+  partitions_.clear();
+
   CloseColumnHandle(db_.get(), rocksdb::kDefaultColumnFamilyName,
                     DefaultHandle());
   CloseColumnHandle(db_.get(), kColumnTimeline, TimelineHandle());
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <rocksdb/db.h>
+#include <vector>
 
 #include "common/status.h"
 
@@ -8,6 +12,45 @@ namespace bt {
 
 class WorkerConfig;
 
+// Version of the on-disk format of the database, it is bumped each
+// time the layout of keys changes. Databases created before versions
+// were recorded are version 1 (protobuf keys). Older databases are
+// converted when opened (see migrate.h).
+//
+// - 1: timeline-comparator-0.1, reverse-comparator-0.1,
+// - 2: timeline-comparator-0.2, reverse-comparator-0.1,
+// - 3: timeline-comparator-0.2, reverse-comparator-0.2.
+constexpr int kDbFormatVersion = 3;
+
+// Names of the column families.
+constexpr char kColumnTimeline[] = "by-timeline";
+constexpr char kColumnReverse[] = "by-user";
+
+// Key in the default column where the format version is stored.
+constexpr char kFormatVersionKey[] = "format-version";
+
+// Key in the default column where the number of days per partition is
+// stored, see db.partition_days.
+constexpr char kPartitionDaysKey[] = "partition-days";
+
+// Timeline and reverse columns have a prefix extractor and bloom
+// filters on it: the zone of timeline keys (kTimelineZoneSize) and
+// the user of reverse keys (kReverseUserSize).
+//
+// Read options of scans within a prefix: iterators stop at the end of
+// the prefix they were positioned on, files without the prefix are
+// skipped with their filters.
+rocksdb::ReadOptions PrefixReadOptions();
+
+// Read options of scans across prefixes (i.e: the GC), filters can't
+// be used to skip files when seeking in these.
+rocksdb::ReadOptions TotalOrderReadOptions();
+
+// Write options of points and deletions: the GC may drop a partition
+// while writes to it are queued, these writes are ignored instead of
+// failing the whole batch along with unrelated points.
+rocksdb::WriteOptions PointWriteOptions();
+
 // This is likely the most important part of this project, refer to
 // the .cc file for a long explanation.
 class TimelineComparator : public rocksdb::Comparator {
@@ -16,8 +59,8 @@ public:
   const char *Name() const override;
 
   void FindShortestSeparator(std::string *start,
-                             const rocksdb::Slice &limit) const override {}
-  void FindShortSuccessor(std::string *key) const override {}
+                             const rocksdb::Slice &limit) const override;
+  void FindShortSuccessor(std::string *key) const override;
 };
 
 class ReverseComparator : public rocksdb::Comparator {
@@ -26,8 +69,23 @@ public:
   const char *Name() const override;
 
   void FindShortestSeparator(std::string *start,
-                             const rocksdb::Slice &limit) const override {}
-  void FindShortSuccessor(std::string *key) const override {}
+                             const rocksdb::Slice &limit) const override;
+  void FindShortSuccessor(std::string *key) const override;
+};
+
+// Range of time zones (see TsToZone) stored in its own timeline and
+// reverse columns. Keys have the same layout in all partitions, a
+// time zone is always in a single partition.
+//
+// Handles are shared: a partition dropped by the GC stays readable
+// until its last copy is released.
+struct Partition {
+  // First time zone of the partition, and first one after it.
+  int64_t start_zone = 0;
+  int64_t end_zone = 0;
+
+  std::shared_ptr<rocksdb::ColumnFamilyHandle> timeline;
+  std::shared_ptr<rocksdb::ColumnFamilyHandle> reverse;
 };
 
 class Db {
@@ -37,31 +95,112 @@ public:
 
   rocksdb::DB *Rocks();
 
-  // Handlers to column families.
+  // Handlers to column families, timeline and reverse columns hold
+  // all points if the database isn't partitioned.
   rocksdb::ColumnFamilyHandle *DefaultHandle();
   rocksdb::ColumnFamilyHandle *TimelineHandle();
   rocksdb::ColumnFamilyHandle *ReverseHandle();
 
   const std::string &Path() { return path_; }
 
+  // Whether points are stored in time partitions (db.partition_days),
+  // this is fixed when the database is created.
+  bool IsPartitioned() const { return partition_days_ > 0; }
+
+  // Returns the current partitions ordered by time. Without
+  // partitioning, there is a single partition covering all time
+  // zones, backed by the timeline and reverse columns.
+  std::vector<Partition> Partitions();
+
+  // Returns the partition holding a time zone, the partition is
+  // created if it doesn't exist yet.
+  Status PartitionForZone(int64_t ts_zone, Partition *partition);
+
+  // Drops the columns of a partition, this doesn't write tombstones:
+  // files of the partition are deleted once no one reads it anymore.
+  Status DropPartition(const Partition &partition);
+
 private:
   // If no path is configured, path is set from an ephemere temporary directory.
   Status InitPath(const WorkerConfig &config);
 
   // Column families management.
   bool CheckColumnFamilies(const rocksdb::Options &rocksdb_options);
-  Status InitColumnFamilies(const rocksdb::Options &rocksdb_options);
+  Status InitColumnFamilies(const rocksdb::Options &rocksdb_options,
+                            bool *created);
   Status CloseColumnHandle(rocksdb::DB *db, const std::string column,
                            rocksdb::ColumnFamilyHandle *handle);
 
+  // Converts an existing database with an older format version to the
+  // current one, the old database is kept next to the new one.
+  Status ConvertOutdatedFormat(const rocksdb::Options &rocksdb_options,
+                               const WorkerConfig &config);
+
+  // Records the format version in new databases, and ensures existing
+  // ones use the current format.
+  Status InitFormatVersion(bool created);
+
+  // Same as above for the number of days per partition, databases
+  // can't be converted from one to the other.
+  Status InitPartitionDays(bool created);
+
+  // Adds partition columns found in the database to the columns to
+  // open, and keeps their handles once opened.
+  Status ListPartitionColumns(const rocksdb::Options &rocksdb_options);
+  Status InitPartitions();
+
+  // Time zones of the partition holding a time zone.
+  void PartitionZones(int64_t ts_zone, int64_t *start_zone,
+                      int64_t *end_zone) const;
+
+  // Wraps a handle of a partition column, it is destroyed with its
+  // last copy.
+  std::shared_ptr<rocksdb::ColumnFamilyHandle>
+  ShareHandle(rocksdb::ColumnFamilyHandle *handle);
+
   std::string path_;
   bool is_temp_ = false;
   std::unique_ptr<rocksdb::DB> db_;
 
   ReverseComparator reverse_cmp_;
   TimelineComparator timeline_cmp_;
+  rocksdb::ColumnFamilyOptions timeline_options_;
+  rocksdb::ColumnFamilyOptions reverse_options_;
   std::vector<rocksdb::ColumnFamilyDescriptor> columns_;
   std::vector<rocksdb::ColumnFamilyHandle *> handles_;
+
+  int partition_days_ = 0;
+
+  // Partitions by start zone, created by writers and dropped by the
+  // GC.
+  std::mutex partitions_lock_;
+  std::map<int64_t, Partition> partitions_;
+};
+
+// Iterators over a snapshot of the partitions of a database, the
+// timeline iterator of a partition is opened when first used. This
+// class is not thread-safe.
+//
+// Iterators are opened with PrefixReadOptions, they can only be used
+// to scan a zone of the timeline or a user of the reverse column.
+class PartitionIterators {
+public:
+  explicit PartitionIterators(Db *db);
+
+  // Partitions of the snapshot, ordered by time.
+  const std::vector<Partition> &Partitions() const { return partitions_; }
+
+  // Returns the timeline iterator of the partition holding a time
+  // zone, or nullptr if there is none (i.e: no points in this zone).
+  rocksdb::Iterator *Timeline(int64_t ts_zone);
+
+  // Returns a new iterator on the reverse column of a partition.
+  std::unique_ptr<rocksdb::Iterator> NewReverse(size_t partition);
+
+private:
+  Db *db_;
+  std::vector<Partition> partitions_;
+  std::vector<std::unique_ptr<rocksdb::Iterator>> timeline_its_;
 };
 
 } // namespace bt
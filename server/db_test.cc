@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <glog/logging.h>
 
+#include "common/utils.h"
 #include "proto/backtrace.pb.h"
 #include "server/cluster_test.h"
+#include "server/keys.h"
+#include "server/zones.h"
 
 namespace bt {
 namespace {
@@ -32,7 +36,7 @@ TEST_P(DbTest, TimestampOrdering) {
     while (it->Valid()) {
       const rocksdb::Slice key_raw = it->key();
       proto::DbKey key;
-      EXPECT_TRUE(key.ParseFromArray(key_raw.data(), key_raw.size()));
+      EXPECT_TRUE(DecodeTimelineKey(key_raw, &key));
 
       int64_t ts = key.timestamp();
       EXPECT_GE(ts, 0);
@@ -54,7 +58,207 @@ TEST_P(DbTest, TimestampOrdering) {
   EXPECT_EQ(i, kNumberOfPoints * expected_databases);
 }
 
+// Tests that prefix scans stop at the end of their prefix, once
+// points are flushed to files with filters.
+TEST_P(DbTest, PrefixScansOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kNumberOfPoints = 100;
+  for (int i = 0; i < kNumberOfPoints; ++i) {
+    for (uint64_t user_id : {kBaseUserId - 1, kBaseUserId + 1}) {
+      EXPECT_TRUE(PushPoint(kBaseTimestamp + i, kBaseDuration, user_id,
+                            kBaseGpsLongitude, kBaseGpsLatitude,
+                            kBaseGpsAltitude));
+    }
+  }
+
+  for (auto &worker : workers_) {
+    Db *db = worker->GetDb();
+    for (rocksdb::ColumnFamilyHandle *handle :
+         {db->TimelineHandle(), db->ReverseHandle()}) {
+      EXPECT_NE(db->Rocks()->GetOptions(handle).prefix_extractor, nullptr);
+      EXPECT_TRUE(db->Rocks()->Flush(rocksdb::FlushOptions(), handle).ok());
+    }
+
+    // An unknown user between two known ones has no reverse keys.
+    std::string prefix;
+    EncodeReversePrefix(kBaseUserId, &prefix);
+    std::unique_ptr<rocksdb::Iterator> it(
+        db->Rocks()->NewIterator(PrefixReadOptions(), db->ReverseHandle()));
+    it->Seek(prefix);
+    EXPECT_FALSE(it->Valid());
+    EXPECT_TRUE(it->status().ok());
+
+    // Keys of a known user are all read, and only them.
+    EncodeReversePrefix(kBaseUserId + 1, &prefix);
+    int count = 0;
+    for (it->Seek(prefix); it->Valid(); it->Next()) {
+      EXPECT_TRUE(it->key().starts_with(prefix));
+      ++count;
+    }
+    EXPECT_TRUE(it->status().ok());
+    if (count > 0) {
+      EXPECT_EQ(count, TsToZone(kBaseTimestamp + kNumberOfPoints - 1) -
+                           TsToZone(kBaseTimestamp) + 1);
+    }
+  }
+
+  proto::GetUserTimeline_Response unknown;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId, &unknown));
+  EXPECT_EQ(unknown.point_size(), 0);
+
+  proto::GetUserTimeline_Response known;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId + 1, &known));
+  EXPECT_EQ(known.point_size(), kNumberOfPoints);
+}
+
 INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, DbTest, CLUSTER_PARAMS);
 
+class DbPartitionedTest : public ClusterTestBase {
+public:
+  void SetUp() override {
+    worker_partition_days_ = 1;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Tests that points spanning many partitions are read back in order,
+// correlated, and deleted from all partitions.
+TEST_P(DbPartitionedTest, PointsAcrossPartitionsOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kDays = 3;
+  constexpr int kPointsPerDay = 4;
+  constexpr int64_t kDay = 24 * 60 * 60;
+
+  // Points every 6 hours, they are in at least kDays partitions.
+  for (int i = 0; i < kDays * kPointsPerDay; ++i) {
+    const int64_t ts = kBaseTimestamp + i * kDay / kPointsPerDay;
+    EXPECT_TRUE(PushPoint(ts, kBaseDuration, kBaseUserId, kBaseGpsLongitude,
+                          kBaseGpsLatitude, kBaseGpsAltitude));
+    EXPECT_TRUE(PushPoint(ts, kBaseDuration, kBaseUserId + 1,
+                          kBaseGpsLongitude, kBaseGpsLatitude,
+                          kBaseGpsAltitude));
+  }
+
+  // Workers simulated down don't get any point.
+  size_t partitions = 0;
+  for (auto &worker : workers_) {
+    partitions = std::max(partitions, worker->GetDb()->Partitions().size());
+  }
+  EXPECT_GE(partitions, kDays);
+
+  proto::GetUserTimeline_Response timeline;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId, &timeline));
+  ASSERT_EQ(timeline.point_size(), kDays * kPointsPerDay);
+  for (int i = 1; i < timeline.point_size(); ++i) {
+    EXPECT_LT(timeline.point(i - 1).timestamp(), timeline.point(i).timestamp());
+  }
+
+  std::vector<proto::GetUserTimeline_Response> chunks;
+  EXPECT_TRUE(StreamTimeline(kBaseUserId, &chunks));
+  int i = 0;
+  for (const auto &chunk : chunks) {
+    for (const auto &point : chunk.point()) {
+      ASSERT_LT(i, timeline.point_size());
+      EXPECT_EQ(timeline.point(i++).timestamp(), point.timestamp());
+    }
+  }
+  EXPECT_EQ(i, timeline.point_size());
+
+  proto::GetUserNearbyFolks_Response folks;
+  EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &folks));
+  ASSERT_EQ(folks.folk_size(), 1);
+  EXPECT_EQ(folks.folk(0).user_id(), kBaseUserId + 1);
+  EXPECT_EQ(folks.folk(0).score(), kDays * kPointsPerDay);
+
+  if (simulate_db_down_ && nb_databases_per_shard_ > 1) {
+    return;
+  }
+
+  EXPECT_TRUE(DeleteUser(kBaseUserId));
+  proto::GetUserTimeline_Response deleted;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId, &deleted));
+  EXPECT_EQ(deleted.point_size(), 0);
+
+  proto::GetUserTimeline_Response other;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId + 1, &other));
+  EXPECT_EQ(other.point_size(), kDays * kPointsPerDay);
+}
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, DbPartitionedTest,
+                         CLUSTER_PARAMS);
+
+// Tests that partitions are found when the database is opened again,
+// and that partitioning can't be changed afterwards.
+TEST(DbPartitionTest, ReopenOK) {
+  StatusOr<std::string> dir = utils::MakeTemporaryDirectory();
+  ASSERT_TRUE(dir.Ok());
+
+  WorkerConfig config;
+  config.db_path_ = dir.ValueOrDie() + "/db";
+  config.db_partition_days_ = 1;
+
+  const int64_t zone = TsToZone(kBaseTimestamp);
+  {
+    Db db;
+    EXPECT_EQ(db.Init(config), StatusCode::OK);
+    EXPECT_TRUE(db.Partitions().empty());
+
+    Partition first;
+    EXPECT_EQ(db.PartitionForZone(zone, &first), StatusCode::OK);
+    EXPECT_LE(first.start_zone, zone);
+    EXPECT_GT(first.end_zone, zone);
+
+    // A day is 86.4 time zones, partitions are contiguous.
+    Partition next;
+    EXPECT_EQ(db.PartitionForZone(first.end_zone, &next), StatusCode::OK);
+    EXPECT_EQ(next.start_zone, first.end_zone);
+    EXPECT_EQ(db.PartitionForZone(zone, &next), StatusCode::OK);
+    EXPECT_EQ(next.timeline.get(), first.timeline.get());
+    EXPECT_EQ(db.Partitions().size(), 2);
+
+    proto::DbKey key;
+    key.set_timestamp(kBaseTimestamp);
+    key.set_user_id(kBaseUserId);
+    std::string raw_key;
+    EncodeTimelineKey(key, &raw_key);
+    EXPECT_TRUE(db.Rocks()
+                    ->Put(rocksdb::WriteOptions(), first.timeline.get(),
+                          raw_key, "")
+                    .ok());
+  }
+
+  {
+    Db db;
+    EXPECT_EQ(db.Init(config), StatusCode::OK);
+    const std::vector<Partition> partitions = db.Partitions();
+    ASSERT_EQ(partitions.size(), 2);
+    EXPECT_LT(partitions[0].start_zone, partitions[1].start_zone);
+
+    // Dropped partitions stay readable until released.
+    EXPECT_EQ(db.DropPartition(partitions[0]), StatusCode::OK);
+    EXPECT_EQ(db.Partitions().size(), 1);
+    std::unique_ptr<rocksdb::Iterator> it(db.Rocks()->NewIterator(
+        rocksdb::ReadOptions(), partitions[0].timeline.get()));
+    it->SeekToFirst();
+    EXPECT_TRUE(it->Valid());
+  }
+
+  {
+    Db db;
+    EXPECT_EQ(db.Init(config), StatusCode::OK);
+    EXPECT_EQ(db.Partitions().size(), 1);
+  }
+
+  config.db_partition_days_ = 0;
+  {
+    Db db;
+    EXPECT_EQ(db.Init(config), StatusCode::INVALID_CONFIG);
+  }
+
+  utils::DeleteDirectory(dir.ValueOrDie());
+}
+
 } // namespace
 } // namespace bt
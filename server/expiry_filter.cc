@@ -0,0 +1,63 @@
+#include <chrono>
+
+#include "server/expiry_filter.h"
+#include "server/keys.h"
+#include "server/zones.h"
+
+namespace bt {
+
+namespace {
+
+class ExpiryFilter : public rocksdb::CompactionFilter {
+public:
+  ExpiryFilter(ExpiryColumn column, int64_t cutoff_zone)
+      : column_(column), cutoff_zone_(cutoff_zone) {}
+
+  bool Filter(int level, const rocksdb::Slice &key,
+              const rocksdb::Slice &existing_value, std::string *new_value,
+              bool *value_changed) const override {
+    int64_t ts_zone = 0;
+    const bool decoded = column_ == ExpiryColumn::TIMELINE
+                             ? TimelineKeyTimeZone(key, &ts_zone)
+                             : ReverseKeyTimeZone(key, &ts_zone);
+
+    // Malformed keys are kept, we can't tell if they expired.
+    return decoded && ts_zone < cutoff_zone_;
+  }
+
+  const char *Name() const override { return "expiry-filter"; }
+
+private:
+  const ExpiryColumn column_;
+  const int64_t cutoff_zone_;
+};
+
+} // anonymous namespace
+
+ExpiryFilterFactory::ExpiryFilterFactory(ExpiryColumn column,
+                                         int retention_period_days)
+    : column_(column), retention_period_days_(retention_period_days) {}
+
+std::unique_ptr<rocksdb::CompactionFilter>
+ExpiryFilterFactory::CreateCompactionFilter(
+    const rocksdb::CompactionFilter::Context &context) {
+  return NewExpiryFilter(column_, CutoffZone());
+}
+
+const char *ExpiryFilterFactory::Name() const {
+  return "expiry-filter-factory";
+}
+
+int64_t ExpiryFilterFactory::CutoffZone() const {
+  const std::time_t cutoff_ts = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now() -
+      std::chrono::hours(retention_period_days_ * 24));
+  return TsToZone(cutoff_ts);
+}
+
+std::unique_ptr<rocksdb::CompactionFilter>
+NewExpiryFilter(ExpiryColumn column, int64_t cutoff_zone) {
+  return std::make_unique<ExpiryFilter>(column, cutoff_zone);
+}
+
+} // namespace bt
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <rocksdb/compaction_filter.h>
+
+namespace bt {
+
+// Layout of the keys of a filtered column, the time zone of an entry
+// is read from its key.
+enum class ExpiryColumn { TIMELINE, REVERSE };
+
+// Creates compaction filters dropping entries of expired time zones,
+// an alternative to the GC scanning and deleting points (see
+// gc.compaction_filter): expired points are dropped when their files
+// are compacted, without tombstones. Paired with periodic compactions
+// so that files nobody writes to are rewritten too: reads don't check
+// expiry, expired points stay readable until then.
+//
+// Each compaction gets its own filter, with the cutoff computed when
+// the compaction starts; it is the same as the one of the GC (time
+// zones before the one of now minus the retention period).
+class ExpiryFilterFactory : public rocksdb::CompactionFilterFactory {
+public:
+  ExpiryFilterFactory(ExpiryColumn column, int retention_period_days);
+
+  std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
+      const rocksdb::CompactionFilter::Context &context) override;
+  const char *Name() const override;
+
+  // Time zone before which entries are dropped by a compaction
+  // starting now.
+  int64_t CutoffZone() const;
+
+private:
+  const ExpiryColumn column_;
+  const int retention_period_days_;
+};
+
+// Filter created by the factory above, exposed for tests.
+std::unique_ptr<rocksdb::CompactionFilter>
+NewExpiryFilter(ExpiryColumn column, int64_t cutoff_zone);
+
+} // namespace bt
@@ -0,0 +1,156 @@
+#include <ctime>
+#include <glog/logging.h>
+
+#include "server/cluster_test.h"
+#include "server/expiry_filter.h"
+#include "server/keys.h"
+#include "server/zones.h"
+
+namespace bt {
+namespace {
+
+proto::DbKey MakeKey(int64_t timestamp) {
+  proto::DbKey key;
+  key.set_timestamp(timestamp);
+  key.set_user_id(kBaseUserId);
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(kBaseGpsLongitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(kBaseGpsLatitude));
+  return key;
+}
+
+proto::DbReverseKey MakeReverseKey(int64_t timestamp) {
+  proto::DbReverseKey key;
+  key.set_user_id(kBaseUserId);
+  key.set_timestamp_zone(TsToZone(timestamp));
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(kBaseGpsLongitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(kBaseGpsLatitude));
+  return key;
+}
+
+// Tests that entries before the cutoff zone are dropped, and that
+// malformed keys are kept.
+TEST(ExpiryFilter, DropsExpiredZones) {
+  const int64_t base_ts = kBaseTimestamp;
+  const int64_t cutoff_zone = TsToZone(base_ts);
+  std::unique_ptr<rocksdb::CompactionFilter> timeline =
+      NewExpiryFilter(ExpiryColumn::TIMELINE, cutoff_zone);
+  std::unique_ptr<rocksdb::CompactionFilter> reverse =
+      NewExpiryFilter(ExpiryColumn::REVERSE, cutoff_zone);
+
+  std::string value;
+  bool value_changed = false;
+  for (int64_t ts :
+       {base_ts - kTimePrecision * 2, cutoff_zone * kTimePrecision - 1}) {
+    std::string raw;
+    EncodeTimelineKey(MakeKey(ts), &raw);
+    EXPECT_TRUE(timeline->Filter(0, raw, "", &value, &value_changed));
+    EncodeReverseKey(MakeReverseKey(ts), &raw);
+    EXPECT_TRUE(reverse->Filter(0, raw, "", &value, &value_changed));
+  }
+
+  for (int64_t ts :
+       {cutoff_zone * kTimePrecision, base_ts + kTimePrecision * 2}) {
+    std::string raw;
+    EncodeTimelineKey(MakeKey(ts), &raw);
+    EXPECT_FALSE(timeline->Filter(0, raw, "", &value, &value_changed));
+    EncodeReverseKey(MakeReverseKey(ts), &raw);
+    EXPECT_FALSE(reverse->Filter(0, raw, "", &value, &value_changed));
+  }
+
+  EXPECT_FALSE(timeline->Filter(0, "too short", "", &value, &value_changed));
+  EXPECT_FALSE(reverse->Filter(0, "too short", "", &value, &value_changed));
+  EXPECT_FALSE(value_changed);
+}
+
+class ExpiryFilterTest : public ClusterTestBase {
+public:
+  void SetUp() override {
+    worker_compaction_filter_ = true;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Tests that compacting drops expired points.
+TEST_P(ExpiryFilterTest, SimpleCompaction) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  EXPECT_TRUE(PushPoint(kBaseTimestamp, kBaseDuration, kBaseUserId,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), 1);
+  }
+
+  // GC passes don't scan the database with the compaction filter.
+  for (auto &worker : workers_) {
+    EXPECT_EQ(worker->GetGc()->Cleanup(), StatusCode::OK);
+  }
+
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), 1);
+  }
+
+  for (auto &worker : workers_) {
+    EXPECT_EQ(worker->GetGc()->CompactExpired(), StatusCode::OK);
+  }
+
+  DumpTimeline();
+
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), 0);
+  }
+}
+
+TEST_P(ExpiryFilterTest, ClearExpiredPoints) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  std::time_t now = std::time(nullptr);
+  std::time_t cutoff = 14 * 24 * 60 * 60;
+
+  constexpr int kFreshCount = 10000;
+  constexpr int kExpiredCount = 5000;
+
+  // Push some points after the GC cutoff.
+  for (int i = 0; i < kFreshCount; ++i) {
+    EXPECT_TRUE(PushPoint(now - cutoff + i + kTimePrecision * 3, kBaseDuration,
+                          kBaseUserId, kBaseGpsLongitude, kBaseGpsLatitude,
+                          kBaseGpsAltitude));
+  }
+
+  // Push some points before the GC cutoff (to be dropped).
+  for (int i = 0; i < kExpiredCount; ++i) {
+    EXPECT_TRUE(PushPoint(now - cutoff - i - kTimePrecision * 3, kBaseDuration,
+                          kBaseUserId, kBaseGpsLongitude, kBaseGpsLatitude,
+                          kBaseGpsAltitude));
+  }
+
+  // Expect all points to be there before compacting.
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), kFreshCount + kExpiredCount);
+  }
+
+  for (auto &worker : workers_) {
+    EXPECT_EQ(worker->GetGc()->CompactExpired(), StatusCode::OK);
+  }
+
+  // Expect points after the cutoff to be there after compacting.
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), kFreshCount);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, ExpiryFilterTest,
+                         CLUSTER_PARAMS);
+
+} // namespace
+} // namespace bt
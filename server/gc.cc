@@ -1,16 +1,27 @@
 #include <glog/logging.h>
 #include <chrono>
 #include <ctime>
+#include <limits>
 #include <mutex>
+#include <rocksdb/convenience.h>
 
 #include "proto/backtrace.grpc.pb.h"
 #include "server/gc.h"
+#include "server/keys.h"
 #include "server/zones.h"
 
 using namespace std::chrono_literals;
 
 namespace bt {
 
+namespace {
+
+// Maximum number of range deletes written in a single batch when
+// expiring reverse entries.
+constexpr size_t kMaxRangesPerBatch = 1000;
+
+}  // anonymous namespace
+
 Status Gc::Init(Db* db, const WorkerConfig& config) {
   retention_period_days_ = config.gc_retention_period_days_;
   if (!(retention_period_days_ > 0)) {
@@ -22,6 +33,8 @@ Status Gc::Init(Db* db, const WorkerConfig& config) {
     RETURN_ERROR(INVALID_CONFIG, "gc.delay_between_rounds_sec should be > 0");
   }
 
+  compaction_filter_ = config.gc_compaction_filter_;
+  range_deletes_ = config.gc_range_deletes_;
   db_ = db;
 
   return StatusCode::OK;
@@ -58,11 +71,6 @@ Status Gc::Cleanup() {
   LOG(INFO) << "starting garbage collection iteration for points older than "
             << retention_period_days_ << " days";
 
-  long timeline_gc_count = 0;
-  long reverse_gc_count = 0;
-
-  proto::DbKey start_key;
-
   const std::chrono::system_clock::time_point now =
       std::chrono::system_clock::now();
   const std::time_t start_ts = std::chrono::system_clock::to_time_t(
@@ -70,26 +78,44 @@ Status Gc::Cleanup() {
 
   LOG(INFO) << "deleting all points smaller than timestamp=" << start_ts;
 
-  start_key.set_timestamp(start_ts);
-  start_key.set_user_id(0);
-  start_key.set_gps_longitude_zone(0);
-  start_key.set_gps_latitude_zone(0);
-  std::string start_key_raw;
-  if (!start_key.SerializeToString(&start_key_raw)) {
-    RETURN_ERROR(
-        INTERNAL_ERROR,
-        "can't serialize internal db timeline key, timestamp=" << start_ts);
+  // Partitions are dropped as a whole, without scanning their points
+  // nor writing tombstones.
+  if (db_->IsPartitioned()) {
+    return DropExpiredPartitions(TsToZone(start_ts));
   }
 
-  std::unique_ptr<rocksdb::Iterator> it(
-      db_->Rocks()->NewIterator(rocksdb::ReadOptions(), db_->TimelineHandle()));
+  // Points are dropped by compactions, see expiry_filter.h.
+  if (compaction_filter_) {
+    LOG(INFO) << "garbage collection iteration skipped, expired points are "
+                 "dropped by compactions";
+    return StatusCode::OK;
+  }
+
+  if (range_deletes_) {
+    return DeleteExpiredRanges(TsToZone(start_ts));
+  }
+  return DeleteExpiredPoints(TsToZone(start_ts));
+}
+
+uint64_t Gc::ReclaimedBytes() const { return reclaimed_bytes_; }
+
+Status Gc::DeleteExpiredPoints(int64_t cutoff_zone) {
+  long timeline_gc_count = 0;
+  long reverse_gc_count = 0;
+
+  // Keys are ordered by time zone first, seeking before the prefix of
+  // the cutoff zone lands on the last key of the previous zone.
+  std::string start_key_raw;
+  EncodeTimelinePrefix(cutoff_zone, &start_key_raw);
+
+  std::unique_ptr<rocksdb::Iterator> it(db_->Rocks()->NewIterator(
+      TotalOrderReadOptions(), db_->TimelineHandle()));
   it->SeekForPrev(rocksdb::Slice(start_key_raw.data(), start_key_raw.size()));
   while (it->Valid()) {
     const rocksdb::Slice key_raw = it->key();
     proto::DbKey key;
-    if (!key.ParseFromArray(key_raw.data(), key_raw.size())) {
-      RETURN_ERROR(INTERNAL_ERROR,
-                   "can't unserialize internal db timeline key");
+    if (!DecodeTimelineKey(key_raw, &key)) {
+      RETURN_ERROR(INTERNAL_ERROR, "can't decode internal db timeline key");
     }
 
     const rocksdb::Slice value_raw = it->value();
@@ -114,9 +140,7 @@ Status Gc::Cleanup() {
         GPSLocationToGPSZone(value.gps_latitude()));
 
     std::string reverse_raw_key;
-    if (!reverse_key.SerializeToString(&reverse_raw_key)) {
-      RETURN_ERROR(INTERNAL_ERROR, "unable to serialize reverse key, skipped");
-    }
+    EncodeReverseKey(reverse_key, &reverse_raw_key);
 
     if (db_->Rocks()
             ->Delete(
@@ -140,4 +164,192 @@ Status Gc::Cleanup() {
   return StatusCode::OK;
 }
 
+Status Gc::DeleteExpiredRanges(int64_t cutoff_zone) {
+  uint64_t timeline_bytes = 0;
+  uint64_t reverse_bytes = 0;
+  long reverse_gc_users = 0;
+
+  // Keys are ordered by time zone first, so all expired points of the
+  // timeline are between its first key and the prefix of the cutoff
+  // zone.
+  std::string end_key_raw;
+  EncodeTimelinePrefix(cutoff_zone, &end_key_raw);
+  {
+    std::unique_ptr<rocksdb::Iterator> it(db_->Rocks()->NewIterator(
+        TotalOrderReadOptions(), db_->TimelineHandle()));
+    it->SeekToFirst();
+    if (!it->status().ok()) {
+      RETURN_ERROR(INTERNAL_ERROR, "GC unable to seek in database, error="
+                                       << it->status().ToString());
+    }
+
+    // Nothing expired, don't write a tombstone each pass.
+    if (it->Valid() && it->key().compare(end_key_raw) < 0) {
+      RETURN_IF_ERROR(DeleteRanges(db_->TimelineHandle(),
+                                   {{it->key().ToString(), end_key_raw}},
+                                   true, &timeline_bytes));
+    }
+  }
+
+  // Reverse keys are ordered by user first, expired entries of a user
+  // are between its first key and the prefix of the cutoff zone for
+  // this user. Only the first key of each user is read, seeking to
+  // the next user crosses prefixes so filters can't be used.
+  std::vector<std::pair<std::string, std::string>> ranges;
+  std::unique_ptr<rocksdb::Iterator> it(db_->Rocks()->NewIterator(
+      TotalOrderReadOptions(), db_->ReverseHandle()));
+  it->SeekToFirst();
+  while (it->Valid()) {
+    proto::DbReverseKey key;
+    if (!DecodeReverseKey(it->key(), &key)) {
+      RETURN_ERROR(INTERNAL_ERROR, "can't decode internal db reverse key");
+    }
+
+    if (key.timestamp_zone() < cutoff_zone) {
+      ranges.emplace_back(it->key().ToString(), std::string());
+      EncodeReverseZonePrefix(key.user_id(), cutoff_zone,
+                              &ranges.back().second);
+      ++reverse_gc_users;
+      if (ranges.size() >= kMaxRangesPerBatch) {
+        RETURN_IF_ERROR(DeleteRanges(db_->ReverseHandle(), ranges, false,
+                                     &reverse_bytes));
+        ranges.clear();
+      }
+    }
+
+    // Users are ordered as unsigned integers.
+    const uint64_t user_id = static_cast<uint64_t>(key.user_id());
+    if (user_id == std::numeric_limits<uint64_t>::max()) {
+      break;
+    }
+    std::string next_user_raw;
+    EncodeReversePrefix(static_cast<int64_t>(user_id + 1), &next_user_raw);
+    it->Seek(next_user_raw);
+  }
+
+  if (!it->status().ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "GC unable to seek in database, error="
+                                     << it->status().ToString());
+  }
+
+  if (!ranges.empty()) {
+    RETURN_IF_ERROR(
+        DeleteRanges(db_->ReverseHandle(), ranges, false, &reverse_bytes));
+  }
+
+  reclaimed_bytes_ += timeline_bytes + reverse_bytes;
+
+  LOG(INFO) << "garbage collection iteration done, reverse_gc_users="
+            << reverse_gc_users << ", timeline_reclaimed_bytes="
+            << timeline_bytes << ", reverse_reclaimed_bytes="
+            << reverse_bytes;
+
+  return StatusCode::OK;
+}
+
+Status Gc::DeleteRanges(
+    rocksdb::ColumnFamilyHandle* handle,
+    const std::vector<std::pair<std::string, std::string>>& ranges,
+    bool delete_files, uint64_t* bytes) {
+  std::vector<rocksdb::Range> sized_ranges;
+  for (const auto& range : ranges) {
+    sized_ranges.emplace_back(range.first, range.second);
+  }
+
+  // Estimated before anything is deleted, so that files dropped below
+  // are accounted for.
+  std::vector<uint64_t> sizes(sized_ranges.size());
+  rocksdb::Status status = db_->Rocks()->GetApproximateSizes(
+      handle, sized_ranges.data(), sized_ranges.size(), sizes.data());
+  if (status.ok()) {
+    for (uint64_t size : sizes) {
+      *bytes += size;
+    }
+  }
+
+  // Files entirely made of expired points are dropped right away, the
+  // range deletes cover what is left in other files.
+  if (delete_files) {
+    for (const rocksdb::Range& range : sized_ranges) {
+      status = rocksdb::DeleteFilesInRange(db_->Rocks(), handle, &range.start,
+                                           &range.limit, false);
+      if (!status.ok()) {
+        LOG(WARNING) << "can't delete expired files, status="
+                     << status.ToString();
+      }
+    }
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const rocksdb::Range& range : sized_ranges) {
+    batch.DeleteRange(handle, range.start, range.limit);
+  }
+  status = db_->Rocks()->Write(rocksdb::WriteOptions(), &batch);
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't delete expired ranges, status="
+                                     << status.ToString());
+  }
+
+  return StatusCode::OK;
+}
+
+Status Gc::CompactExpired() {
+  if (!compaction_filter_) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "can't compact expired points without gc.compaction_filter");
+  }
+
+  LOG(INFO) << "compacting database to drop expired points";
+
+  // Manual compactions run the compaction filter down to the last
+  // level, so all files are rewritten without expired points.
+  rocksdb::CompactRangeOptions options;
+  for (const Partition& partition : db_->Partitions()) {
+    for (rocksdb::ColumnFamilyHandle* handle :
+         {partition.timeline.get(), partition.reverse.get()}) {
+      rocksdb::Status status =
+          db_->Rocks()->CompactRange(options, handle, nullptr, nullptr);
+      if (!status.ok()) {
+        RETURN_ERROR(INTERNAL_ERROR, "can't compact database, status="
+                                         << status.ToString());
+      }
+    }
+  }
+
+  LOG(INFO) << "compacted database";
+
+  return StatusCode::OK;
+}
+
+Status Gc::DropExpiredPartitions(int64_t cutoff_zone) {
+  int dropped_count = 0;
+  int kept_count = 0;
+  uint64_t reclaimed_bytes = 0;
+
+  for (const Partition& partition : db_->Partitions()) {
+    if (partition.end_zone > cutoff_zone) {
+      ++kept_count;
+      continue;
+    }
+    for (rocksdb::ColumnFamilyHandle* handle :
+         {partition.timeline.get(), partition.reverse.get()}) {
+      uint64_t size = 0;
+      if (db_->Rocks()->GetIntProperty(handle, "rocksdb.total-sst-files-size",
+                                       &size)) {
+        reclaimed_bytes += size;
+      }
+    }
+    RETURN_IF_ERROR(db_->DropPartition(partition));
+    ++dropped_count;
+  }
+
+  reclaimed_bytes_ += reclaimed_bytes;
+
+  LOG(INFO) << "garbage collection iteration done, dropped_partitions="
+            << dropped_count << ", kept_partitions=" << kept_count
+            << ", reclaimed_bytes=" << reclaimed_bytes;
+
+  return StatusCode::OK;
+}
+
 }  // namespace bt
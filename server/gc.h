@@ -1,7 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <rocksdb/db.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "common/status.h"
 #include "server/db.h"
@@ -20,11 +24,46 @@ public:
   Status Shutdown();
   Status Cleanup();
 
+  // With gc.compaction_filter, compacts all columns now so that
+  // expired points are dropped without waiting for compactions.
+  Status CompactExpired();
+
+  // Estimated number of bytes of expired points deleted by GC passes
+  // since startup; with range deletes, space is only freed on disk
+  // once the deleted ranges are compacted.
+  uint64_t ReclaimedBytes() const;
+
 private:
+  // Deletes expired points one by one while scanning the timeline,
+  // also deleting their reverse entries.
+  Status DeleteExpiredPoints(int64_t cutoff_zone);
+
+  // Deletes all expired points of the timeline with a single range
+  // delete, and expired reverse entries with one range delete per
+  // user.
+  Status DeleteExpiredRanges(int64_t cutoff_zone);
+
+  // Deletes the given [begin, end) ranges of a column in one batch,
+  // adds their estimated size to bytes. With delete_files, database
+  // files entirely within a range are dropped first.
+  Status DeleteRanges(
+      rocksdb::ColumnFamilyHandle *handle,
+      const std::vector<std::pair<std::string, std::string>> &ranges,
+      bool delete_files, uint64_t *bytes);
+
+  // Drops partitions where all points are older than the cutoff time
+  // zone, points of the partition holding the cutoff are kept until
+  // the partition is entirely expired.
+  Status DropExpiredPartitions(int64_t cutoff_zone);
+
   Db *db_ = nullptr;
 
   int retention_period_days_ = 0;
   int delay_between_rounds_sec_ = 0;
+  bool compaction_filter_ = false;
+  bool range_deletes_ = true;
+
+  std::atomic<uint64_t> reclaimed_bytes_ = 0;
 
   std::mutex gc_wakeup_lock_;
   std::condition_variable gc_wakeup_;
@@ -1,13 +1,65 @@
 #include <ctime>
 #include <glog/logging.h>
+#include <rocksdb/db.h>
 
 #include "server/cluster_test.h"
+#include "server/keys.h"
 #include "server/zones.h"
 
 namespace bt {
 namespace {
 
-class GcTest : public ClusterTestBase {};
+class GcTest : public ClusterTestBase {
+protected:
+  // Pushes points before and after the GC cutoff, and checks that
+  // only the expired ones are deleted by a GC pass.
+  void ClearExpiredPoints() {
+    EXPECT_EQ(Init(), StatusCode::OK);
+
+    std::time_t now = std::time(nullptr);
+    std::time_t cutoff = 14 * 24 * 60 * 60;
+
+    constexpr int kFreshCount = 10000;
+    constexpr int kExpiredCount = 5000;
+
+    // Push some points after the GC cutoff.
+    for (int i = 0; i < kFreshCount; ++i) {
+      EXPECT_TRUE(PushPoint(now - cutoff + i + kTimePrecision * 3,
+                            kBaseDuration, kBaseUserId, kBaseGpsLongitude,
+                            kBaseGpsLatitude, kBaseGpsAltitude));
+    }
+
+    // Push some points before the GC cutoff (to be deleted).
+    for (int i = 0; i < kExpiredCount; ++i) {
+      EXPECT_TRUE(PushPoint(now - cutoff - i - kTimePrecision * 3,
+                            kBaseDuration, kBaseUserId, kBaseGpsLongitude,
+                            kBaseGpsLatitude, kBaseGpsAltitude));
+    }
+
+    // Expect all points to be there before GC pass.
+    {
+      proto::GetUserTimeline_Response response;
+      EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+      EXPECT_EQ(response.point_size(), kFreshCount + kExpiredCount);
+    }
+
+    DumpTimeline();
+
+    for (auto &worker : workers_) {
+      EXPECT_EQ(worker->GetGc()->Cleanup(), StatusCode::OK);
+    }
+
+    DumpTimeline();
+
+    // Expect points after the cutoff to be there after GC pass.
+    {
+      proto::GetUserTimeline_Response response;
+      EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+      DumpProtoTimelineResponse(kBaseUserId, response);
+      EXPECT_EQ(response.point_size(), kFreshCount);
+    }
+  }
+};
 
 // Tests that simple GC round works.
 TEST_P(GcTest, SimpleGcRound) {
@@ -37,54 +89,163 @@ TEST_P(GcTest, SimpleGcRound) {
   }
 }
 
-TEST_P(GcTest, ClearExpiredPoints) {
+TEST_P(GcTest, ClearExpiredPoints) { ClearExpiredPoints(); }
+
+// Tests that range deletes expire points of all users, both in the
+// timeline and in the reverse column, and that the size of deleted
+// points is reported.
+TEST_P(GcTest, RangeDeletesReclaimBytes) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  std::time_t now = std::time(nullptr);
+  std::time_t cutoff = 14 * 24 * 60 * 60;
+
+  constexpr int kUserCount = 10;
+  constexpr int kFreshCount = 100;
+  constexpr int kExpiredCount = 100;
+
+  for (int u = 0; u < kUserCount; ++u) {
+    for (int i = 0; i < kFreshCount; ++i) {
+      EXPECT_TRUE(PushPoint(now - cutoff + kTimePrecision * 3 + i * 60,
+                            kBaseDuration, kBaseUserId + u, kBaseGpsLongitude,
+                            kBaseGpsLatitude, kBaseGpsAltitude));
+    }
+    for (int i = 0; i < kExpiredCount; ++i) {
+      EXPECT_TRUE(PushPoint(now - cutoff - kTimePrecision * 3 - i * 60,
+                            kBaseDuration, kBaseUserId + u, kBaseGpsLongitude,
+                            kBaseGpsLatitude, kBaseGpsAltitude));
+    }
+  }
+
+  uint64_t reclaimed_bytes = 0;
+  for (auto &worker : workers_) {
+    // Sizes are estimated from database files, points must be flushed
+    // out of memtables to be accounted for.
+    Db *db = worker->GetDb();
+    EXPECT_TRUE(
+        db->Rocks()->Flush(rocksdb::FlushOptions(), db->TimelineHandle()).ok());
+    EXPECT_TRUE(
+        db->Rocks()->Flush(rocksdb::FlushOptions(), db->ReverseHandle()).ok());
+
+    EXPECT_EQ(worker->GetGc()->Cleanup(), StatusCode::OK);
+    reclaimed_bytes += worker->GetGc()->ReclaimedBytes();
+
+    // No reverse entry is left before the cutoff.
+    std::unique_ptr<rocksdb::Iterator> it(db->Rocks()->NewIterator(
+        rocksdb::ReadOptions(), db->ReverseHandle()));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      int64_t ts_zone = 0;
+      EXPECT_TRUE(ReverseKeyTimeZone(it->key(), &ts_zone));
+      EXPECT_GE(ts_zone, TsToZone(now - cutoff));
+    }
+  }
+  EXPECT_GT(reclaimed_bytes, 0);
+
+  for (int u = 0; u < kUserCount; ++u) {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId + u, &response));
+    EXPECT_EQ(response.point_size(), kFreshCount);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, GcTest, CLUSTER_PARAMS);
+
+class GcPointDeletesTest : public GcTest {
+public:
+  void SetUp() override {
+    worker_gc_range_deletes_ = false;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Same as with range deletes, with one delete per point.
+TEST_P(GcPointDeletesTest, ClearExpiredPoints) { ClearExpiredPoints(); }
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, GcPointDeletesTest,
+                         CLUSTER_PARAMS);
+
+class GcPartitionedTest : public ClusterTestBase {
+public:
+  void SetUp() override {
+    worker_partition_days_ = 1;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Tests that partitions where all points expired are dropped, and
+// that other partitions are kept.
+TEST_P(GcPartitionedTest, DropExpiredPartitions) {
   EXPECT_EQ(Init(), StatusCode::OK);
 
   std::time_t now = std::time(nullptr);
   std::time_t cutoff = 14 * 24 * 60 * 60;
 
-  constexpr int kFreshCount = 10000;
-  constexpr int kExpiredCount = 5000;
+  constexpr int kFreshCount = 100;
+  constexpr int kExpiredCount = 100;
 
-  // Push some points after the GC cutoff.
+  // Push some points a day after the GC cutoff.
   for (int i = 0; i < kFreshCount; ++i) {
-    EXPECT_TRUE(PushPoint(now - cutoff + i + kTimePrecision * 3, kBaseDuration,
+    EXPECT_TRUE(PushPoint(now - cutoff + 24 * 60 * 60 + i * 60, kBaseDuration,
                           kBaseUserId, kBaseGpsLongitude, kBaseGpsLatitude,
                           kBaseGpsAltitude));
   }
 
-  // Push some points before the GC cutoff (to be deleted).
+  // Push some points in partitions before the GC cutoff, spanning
+  // three days.
   for (int i = 0; i < kExpiredCount; ++i) {
-    EXPECT_TRUE(PushPoint(now - cutoff - i - kTimePrecision * 3, kBaseDuration,
-                          kBaseUserId, kBaseGpsLongitude, kBaseGpsLatitude,
-                          kBaseGpsAltitude));
+    EXPECT_TRUE(PushPoint(now - cutoff - 2 * 24 * 60 * 60 - i * 1800,
+                          kBaseDuration, kBaseUserId, kBaseGpsLongitude,
+                          kBaseGpsLatitude, kBaseGpsAltitude));
   }
 
-  // Expect all points to be there before GC pass.
   {
     proto::GetUserTimeline_Response response;
     EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
     EXPECT_EQ(response.point_size(), kFreshCount + kExpiredCount);
   }
 
-  DumpTimeline();
-
   for (auto &worker : workers_) {
+    EXPECT_TRUE(worker->GetDb()->IsPartitioned());
     EXPECT_EQ(worker->GetGc()->Cleanup(), StatusCode::OK);
+
+    // Only the partitions of fresh points are left.
+    const std::vector<Partition> partitions = worker->GetDb()->Partitions();
+    EXPECT_LE(partitions.size(), 2);
+    for (const Partition &partition : partitions) {
+      EXPECT_GT(partition.end_zone, TsToZone(now - cutoff));
+    }
   }
 
-  DumpTimeline();
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), kFreshCount);
+  }
+
+  // Points can still be pushed in a dropped partition, it is dropped
+  // again by the next round.
+  EXPECT_TRUE(PushPoint(now - cutoff - 2 * 24 * 60 * 60, kBaseDuration,
+                        kBaseUserId, kBaseGpsLongitude, kBaseGpsLatitude,
+                        kBaseGpsAltitude));
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), kFreshCount + 1);
+  }
+
+  for (auto &worker : workers_) {
+    EXPECT_EQ(worker->GetGc()->Cleanup(), StatusCode::OK);
+  }
 
-  // Expect points after the cutoff to be there after GC pass.
   {
     proto::GetUserTimeline_Response response;
     EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
-    DumpProtoTimelineResponse(kBaseUserId, response);
     EXPECT_EQ(response.point_size(), kFreshCount);
   }
 }
 
-INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, GcTest, CLUSTER_PARAMS);
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, GcPartitionedTest,
+                         CLUSTER_PARAMS);
 
 } // namespace
 } // namespace bt
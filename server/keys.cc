@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <math.h>
+
+#include "server/keys.h"
+#include "server/zones.h"
+
+namespace bt {
+
+namespace {
+
+constexpr uint64_t kSignBit64 = 1ULL << 63;
+constexpr uint32_t kSignBit32 = 1U << 31;
+
+void PutBigEndian64(uint64_t value, std::string *raw) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    raw->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+void PutBigEndian32(uint32_t value, std::string *raw) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    raw->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+void PutVarint32(uint32_t value, std::string *raw) {
+  while (value >= 0x80) {
+    raw->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  raw->push_back(static_cast<char>(value));
+}
+
+// Reads a varint at the beginning of data and skips it, returns false
+// if it is truncated or too large.
+bool GetVarint32(rocksdb::Slice *data, uint32_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 32 && !data->empty(); shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>((*data)[0]);
+    data->remove_prefix(1);
+    *value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t GetBigEndian64(const char *data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(data[i]);
+  }
+  return value;
+}
+
+uint32_t GetBigEndian32(const char *data) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value = (value << 8) | static_cast<uint8_t>(data[i]);
+  }
+  return value;
+}
+
+// Signed integers have their sign bit flipped so that negative values
+// are ordered before positive ones in byte order.
+void PutSigned64(int64_t value, std::string *raw) {
+  PutBigEndian64(static_cast<uint64_t>(value) ^ kSignBit64, raw);
+}
+
+void PutSigned32(int32_t value, std::string *raw) {
+  PutBigEndian32(static_cast<uint32_t>(value) ^ kSignBit32, raw);
+}
+
+int64_t GetSigned64(const char *data) {
+  return static_cast<int64_t>(GetBigEndian64(data) ^ kSignBit64);
+}
+
+int32_t GetSigned32(const char *data) {
+  return static_cast<int32_t>(GetBigEndian32(data) ^ kSignBit32);
+}
+
+} // anonymous namespace
+
+int32_t GPSZoneToKeyZone(float gps_zone) {
+  // Zones are computed with floats and may be slightly off (i.e:
+  // GPSNextZone adds kGPSZoneDistance), rounding here ensures we get
+  // the same integer for a given zone.
+  return static_cast<int32_t>(lround(gps_zone * kGPSZonePrecision));
+}
+
+float KeyZoneToGPSZone(int32_t key_zone) {
+  return static_cast<float>(key_zone) / kGPSZonePrecision;
+}
+
+void EncodeTimelineKey(const proto::DbKey &key, std::string *raw) {
+  const int64_t ts_zone = TsToZone(key.timestamp());
+  const int64_t ts_offset = key.timestamp() - ts_zone * kTimePrecision;
+
+  raw->clear();
+  raw->reserve(kTimelineKeySize);
+
+  PutSigned64(ts_zone, raw);
+  PutSigned32(GPSZoneToKeyZone(key.gps_longitude_zone()), raw);
+  PutSigned32(GPSZoneToKeyZone(key.gps_latitude_zone()), raw);
+  PutBigEndian64(static_cast<uint64_t>(key.user_id()), raw);
+  PutSigned32(static_cast<int32_t>(ts_offset), raw);
+}
+
+bool DecodeTimelineKey(const rocksdb::Slice &raw, proto::DbKey *key) {
+  if (raw.size() != kTimelineKeySize) {
+    return false;
+  }
+
+  const char *data = raw.data();
+  const int64_t ts_zone = GetSigned64(data);
+  const int32_t long_zone = GetSigned32(data + 8);
+  const int32_t lat_zone = GetSigned32(data + 12);
+  const uint64_t user_id = GetBigEndian64(data + 16);
+  const int32_t ts_offset = GetSigned32(data + 24);
+
+  key->set_timestamp(ts_zone * kTimePrecision + ts_offset);
+  key->set_user_id(static_cast<int64_t>(user_id));
+  key->set_gps_longitude_zone(KeyZoneToGPSZone(long_zone));
+  key->set_gps_latitude_zone(KeyZoneToGPSZone(lat_zone));
+
+  return true;
+}
+
+void EncodeTimelinePrefix(int64_t ts_zone, std::string *raw) {
+  raw->clear();
+  PutSigned64(ts_zone, raw);
+}
+
+rocksdb::Slice TimelineKeyZone(const rocksdb::Slice &raw) {
+  return rocksdb::Slice(raw.data(), std::min(raw.size(), kTimelineZoneSize));
+}
+
+void EncodeTimelineUserRange(const proto::DbKey &key, std::string *begin,
+                             std::string *end) {
+  // Drops the time offset, which is the end of the key.
+  EncodeTimelineKey(key, begin);
+  begin->resize(kTimelineKeySize - 4);
+
+  // Keys of the user only differ by their time offset, a string one
+  // byte longer than keys made of the prefix followed by 0xff sorts
+  // after all of them.
+  *end = *begin;
+  end->append(kTimelineKeySize - begin->size() + 1, '\xff');
+}
+
+bool TimelineKeyTimeZone(const rocksdb::Slice &raw, int64_t *ts_zone) {
+  if (raw.size() != kTimelineKeySize) {
+    return false;
+  }
+  *ts_zone = GetSigned64(raw.data());
+  return true;
+}
+
+void EncodeReverseKey(const proto::DbReverseKey &key, std::string *raw) {
+  raw->clear();
+  raw->reserve(kReverseKeySize);
+
+  PutBigEndian64(static_cast<uint64_t>(key.user_id()), raw);
+  PutSigned64(key.timestamp_zone(), raw);
+  PutSigned32(GPSZoneToKeyZone(key.gps_longitude_zone()), raw);
+  PutSigned32(GPSZoneToKeyZone(key.gps_latitude_zone()), raw);
+}
+
+bool DecodeReverseKey(const rocksdb::Slice &raw, proto::DbReverseKey *key) {
+  if (raw.size() != kReverseKeySize) {
+    return false;
+  }
+
+  const char *data = raw.data();
+  key->set_user_id(static_cast<int64_t>(GetBigEndian64(data)));
+  key->set_timestamp_zone(GetSigned64(data + 8));
+  key->set_gps_longitude_zone(KeyZoneToGPSZone(GetSigned32(data + 16)));
+  key->set_gps_latitude_zone(KeyZoneToGPSZone(GetSigned32(data + 20)));
+
+  return true;
+}
+
+void EncodeReversePrefix(int64_t user_id, std::string *raw) {
+  raw->clear();
+  PutBigEndian64(static_cast<uint64_t>(user_id), raw);
+}
+
+void EncodeReverseZonePrefix(int64_t user_id, int64_t ts_zone,
+                             std::string *raw) {
+  EncodeReversePrefix(user_id, raw);
+  PutSigned64(ts_zone, raw);
+}
+
+bool ReverseKeyTimeZone(const rocksdb::Slice &raw, int64_t *ts_zone) {
+  if (raw.size() != kReverseKeySize) {
+    return false;
+  }
+  *ts_zone = GetSigned64(raw.data() + kReverseUserSize);
+  return true;
+}
+
+void AppendRawEntry(const rocksdb::Slice &key, const rocksdb::Slice &value,
+                    std::string *packed) {
+  PutVarint32(static_cast<uint32_t>(key.size()), packed);
+  packed->append(key.data(), key.size());
+  PutVarint32(static_cast<uint32_t>(value.size()), packed);
+  packed->append(value.data(), value.size());
+}
+
+bool RawEntryReader::ReadSized(rocksdb::Slice *data) {
+  uint32_t size = 0;
+  if (!GetVarint32(&left_, &size) || size > left_.size()) {
+    return false;
+  }
+
+  *data = rocksdb::Slice(left_.data(), size);
+  left_.remove_prefix(size);
+  return true;
+}
+
+bool RawEntryReader::Next(rocksdb::Slice *key, rocksdb::Slice *value) {
+  if (left_.empty() || failed_) {
+    return false;
+  }
+
+  if (!ReadSized(key) || !ReadSized(value)) {
+    failed_ = true;
+    return false;
+  }
+
+  return true;
+}
+
+bool DecodeRawEntry(const rocksdb::Slice &key, const rocksdb::Slice &value,
+                    proto::BlockEntry *entry) {
+  return DecodeTimelineKey(key, entry->mutable_key()) &&
+         entry->mutable_value()->ParseFromArray(value.data(), value.size());
+}
+
+} // namespace bt
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <rocksdb/slice.h>
+#include <string>
+
+#include "proto/backtrace.pb.h"
+
+namespace bt {
+
+// Raw layout of keys in the database.
+//
+// Keys are stored as fixed-width big-endian strings, so that the
+// byte order of two keys is the order in which we want them in the
+// database: comparing keys is a memcmp, there is no need to decode
+// them. Signed fields are stored with their sign bit flipped, GPS
+// zones are stored as integers (i.e: the zone multiplied by
+// kGPSZonePrecision), so they can be compared without epsilon.
+//
+// Timeline key layout:
+//
+// +-----------+-----------+----------+---------+-------------+
+// | TIME ZONE | LONG_ZONE | LAT_ZONE | USER_ID | TIME OFFSET |
+// +-----------+-----------+----------+---------+-------------+
+//       8           4          4          8           4
+//
+// All fields sort ascending. This differs from the legacy protobuf
+// keys (see LegacyTimelineComparator in migrate.cc), where GPS zones
+// within a time zone were sorted descending: blocks of a time zone
+// are now scanned from the smallest longitude and latitude zones.
+// Migrations re-sort the data, nothing depends on the old order.
+//
+// Reverse key layout:
+//
+// +---------+-----------+-----------+----------+
+// | USER_ID | TIME ZONE | LONG_ZONE | LAT_ZONE |
+// +---------+-----------+-----------+----------+
+//      8          8           4          4
+//
+// Changing this requires a new version of the database format, see
+// kDbFormatVersion in db.h.
+constexpr size_t kTimelineKeySize = 28;
+constexpr size_t kReverseKeySize = 24;
+
+// Size of the part of a timeline key that identifies a zone (time
+// zone, longitude zone, latitude zone): all entries of a logical
+// block share this prefix.
+constexpr size_t kTimelineZoneSize = 16;
+
+// Encodes a timeline key to its raw representation.
+void EncodeTimelineKey(const proto::DbKey &key, std::string *raw);
+
+// Decodes a raw timeline key, returns false if the key is malformed.
+bool DecodeTimelineKey(const rocksdb::Slice &raw, proto::DbKey *key);
+
+// Encodes the prefix shared by all timeline keys of the given
+// timestamp zone (see TsToZone).
+void EncodeTimelinePrefix(int64_t ts_zone, std::string *raw);
+
+// Returns the zone part of a raw timeline key.
+rocksdb::Slice TimelineKeyZone(const rocksdb::Slice &raw);
+
+// Encodes the bounds of the [begin, end) range holding all timeline
+// keys of the user of the given key, in the zone of the key.
+void EncodeTimelineUserRange(const proto::DbKey &key, std::string *begin,
+                             std::string *end);
+
+// Reads the time zone of a raw timeline key without decoding the
+// rest of it, returns false if the key is malformed.
+bool TimelineKeyTimeZone(const rocksdb::Slice &raw, int64_t *ts_zone);
+
+// Size of the part of a reverse key that identifies a user: all
+// entries of a user share this prefix.
+constexpr size_t kReverseUserSize = 8;
+
+// Encodes a reverse key to its raw representation.
+void EncodeReverseKey(const proto::DbReverseKey &key, std::string *raw);
+
+// Decodes a raw reverse key, returns false if the key is malformed.
+bool DecodeReverseKey(const rocksdb::Slice &raw, proto::DbReverseKey *key);
+
+// Encodes the prefix shared by all reverse keys of the given user.
+void EncodeReversePrefix(int64_t user_id, std::string *raw);
+
+// Encodes the prefix shared by all reverse keys of the given user in
+// the given timestamp zone; it sorts after all keys of the user in
+// earlier zones.
+void EncodeReverseZonePrefix(int64_t user_id, int64_t ts_zone,
+                             std::string *raw);
+
+// Same as TimelineKeyTimeZone for a raw reverse key.
+bool ReverseKeyTimeZone(const rocksdb::Slice &raw, int64_t *ts_zone);
+
+// Raw layout of block entries exchanged between workers and mixers.
+//
+// Entries are sent as they are stored in the database instead of
+// being decoded and copied into BlockEntry messages, packed back to
+// back in a single buffer:
+//
+// +----------+-----+------------+-------+
+// | KEY SIZE | KEY | VALUE SIZE | VALUE |
+// +----------+-----+------------+-------+
+//    varint           varint
+//
+// Keys are raw timeline keys, values are serialized DbValue.
+
+// Appends a raw entry to packed.
+void AppendRawEntry(const rocksdb::Slice &key, const rocksdb::Slice &value,
+                    std::string *packed);
+
+// Reads raw entries without copying them, slices point into the
+// packed buffer which must outlive them.
+class RawEntryReader {
+public:
+  explicit RawEntryReader(const rocksdb::Slice &packed) : left_(packed) {}
+
+  // Reads the next entry, returns false once all entries are read or
+  // if an entry is malformed (see Failed).
+  bool Next(rocksdb::Slice *key, rocksdb::Slice *value);
+
+  // Whether or not reading stopped on a malformed entry.
+  bool Failed() const { return failed_; }
+
+private:
+  bool ReadSized(rocksdb::Slice *data);
+
+  rocksdb::Slice left_;
+  bool failed_ = false;
+};
+
+// Decodes a raw entry, returns false if it is malformed.
+bool DecodeRawEntry(const rocksdb::Slice &key, const rocksdb::Slice &value,
+                    proto::BlockEntry *entry);
+
+// Converts a GPS zone to its integer representation in keys.
+int32_t GPSZoneToKeyZone(float gps_zone);
+
+// Converts the integer representation of a GPS zone back to a zone.
+float KeyZoneToGPSZone(int32_t key_zone);
+
+} // namespace bt
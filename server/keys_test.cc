@@ -0,0 +1,278 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "server/keys.h"
+#include "server/zones.h"
+
+namespace bt {
+
+namespace {
+
+proto::DbKey MakeKey(int64_t timestamp, int64_t user_id, float gps_longitude,
+                     float gps_latitude) {
+  proto::DbKey key;
+  key.set_timestamp(timestamp);
+  key.set_user_id(user_id);
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(gps_longitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(gps_latitude));
+  return key;
+}
+
+int CompareRaw(const proto::DbKey &a, const proto::DbKey &b) {
+  std::string raw_a;
+  std::string raw_b;
+  EncodeTimelineKey(a, &raw_a);
+  EncodeTimelineKey(b, &raw_b);
+  return rocksdb::Slice(raw_a).compare(rocksdb::Slice(raw_b));
+}
+
+TEST(KeysTimeline, RoundTrip) {
+  const proto::DbKey key = MakeKey(1582411316, 42, 1.2345, -7.6543);
+
+  std::string raw;
+  EncodeTimelineKey(key, &raw);
+  EXPECT_EQ(raw.size(), kTimelineKeySize);
+
+  proto::DbKey decoded;
+  EXPECT_TRUE(DecodeTimelineKey(raw, &decoded));
+  EXPECT_EQ(decoded.timestamp(), key.timestamp());
+  EXPECT_EQ(decoded.user_id(), key.user_id());
+  EXPECT_FLOAT_EQ(decoded.gps_longitude_zone(), key.gps_longitude_zone());
+  EXPECT_FLOAT_EQ(decoded.gps_latitude_zone(), key.gps_latitude_zone());
+}
+
+TEST(KeysTimeline, DecodeInvalidSize) {
+  proto::DbKey key;
+  EXPECT_FALSE(DecodeTimelineKey(rocksdb::Slice("too short"), &key));
+}
+
+TEST(KeysTimeline, TimeZone) {
+  std::string raw;
+  EncodeTimelineKey(MakeKey(1582411316, 42, 1.2345, -7.6543), &raw);
+
+  int64_t ts_zone = 0;
+  EXPECT_TRUE(TimelineKeyTimeZone(raw, &ts_zone));
+  EXPECT_EQ(ts_zone, TsToZone(1582411316));
+
+  EncodeTimelineKey(MakeKey(-1582411316, 42, 1.2345, -7.6543), &raw);
+  EXPECT_TRUE(TimelineKeyTimeZone(raw, &ts_zone));
+  EXPECT_EQ(ts_zone, TsToZone(-1582411316));
+
+  EXPECT_FALSE(TimelineKeyTimeZone(rocksdb::Slice("too short"), &ts_zone));
+}
+
+TEST(KeysTimeline, OrderByTimeZoneFirst) {
+  EXPECT_LT(CompareRaw(MakeKey(1582411316, 2, 10.0, 10.0),
+                       MakeKey(1582412000, 1, -10.0, -10.0)),
+            0);
+}
+
+TEST(KeysTimeline, OrderByNegativeZones) {
+  EXPECT_LT(CompareRaw(MakeKey(1582411316, 1, -1.0, 0.0),
+                       MakeKey(1582411316, 1, 1.0, 0.0)),
+            0);
+  EXPECT_LT(CompareRaw(MakeKey(1582411316, 1, 0.0, -1.0),
+                       MakeKey(1582411316, 1, 0.0, 1.0)),
+            0);
+}
+
+TEST(KeysTimeline, OrderByUserThenOffset) {
+  EXPECT_LT(CompareRaw(MakeKey(1582411999, 1, 1.0, 1.0),
+                       MakeKey(1582411000, 2, 1.0, 1.0)),
+            0);
+  EXPECT_LT(CompareRaw(MakeKey(1582411000, 1, 1.0, 1.0),
+                       MakeKey(1582411999, 1, 1.0, 1.0)),
+            0);
+  EXPECT_EQ(CompareRaw(MakeKey(1582411316, 1, 1.0, 1.0),
+                       MakeKey(1582411316, 1, 1.0, 1.0)),
+            0);
+}
+
+TEST(KeysTimeline, SameZoneSharesPrefix) {
+  std::string raw_a;
+  std::string raw_b;
+  EncodeTimelineKey(MakeKey(1582411000, 1, 1.2341, 5.6781), &raw_a);
+  EncodeTimelineKey(MakeKey(1582411999, 2, 1.2349, 5.6789), &raw_b);
+  EXPECT_EQ(TimelineKeyZone(raw_a), TimelineKeyZone(raw_b));
+
+  std::string prefix;
+  EncodeTimelinePrefix(TsToZone(1582411000), &prefix);
+  EXPECT_TRUE(rocksdb::Slice(raw_a).starts_with(prefix));
+}
+
+TEST(KeysTimeline, UserRange) {
+  auto in_range = [](const proto::DbKey &range_key, const proto::DbKey &key) {
+    std::string begin;
+    std::string end;
+    EncodeTimelineUserRange(range_key, &begin, &end);
+    std::string raw;
+    EncodeTimelineKey(key, &raw);
+    const rocksdb::Slice slice(raw);
+    return slice.compare(begin) >= 0 && slice.compare(end) < 0;
+  };
+
+  const proto::DbKey key = MakeKey(1582411000, 2, 1.0, 1.0);
+  EXPECT_TRUE(in_range(key, MakeKey(1582411000, 2, 1.0, 1.0)));
+  EXPECT_TRUE(in_range(key, MakeKey(1582411999, 2, 1.0, 1.0)));
+  EXPECT_FALSE(in_range(key, MakeKey(1582411500, 1, 1.0, 1.0)));
+  EXPECT_FALSE(in_range(key, MakeKey(1582411500, 3, 1.0, 1.0)));
+  EXPECT_FALSE(in_range(key, MakeKey(1582412000, 2, 1.0, 1.0)));
+  EXPECT_FALSE(in_range(key, MakeKey(1582411500, 2, 2.0, 1.0)));
+
+  const proto::DbKey last = MakeKey(1582411000, -1, 1.0, 1.0);
+  EXPECT_TRUE(in_range(last, MakeKey(1582411999, -1, 1.0, 1.0)));
+  EXPECT_FALSE(in_range(last, MakeKey(1582411999, 2, 1.0, 1.0)));
+}
+
+proto::DbReverseKey MakeReverseKey(int64_t user_id, int64_t timestamp_zone,
+                                   float gps_longitude, float gps_latitude) {
+  proto::DbReverseKey key;
+  key.set_user_id(user_id);
+  key.set_timestamp_zone(timestamp_zone);
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(gps_longitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(gps_latitude));
+  return key;
+}
+
+int CompareRaw(const proto::DbReverseKey &a, const proto::DbReverseKey &b) {
+  std::string raw_a;
+  std::string raw_b;
+  EncodeReverseKey(a, &raw_a);
+  EncodeReverseKey(b, &raw_b);
+  return rocksdb::Slice(raw_a).compare(rocksdb::Slice(raw_b));
+}
+
+TEST(KeysReverse, RoundTrip) {
+  const proto::DbReverseKey key = MakeReverseKey(42, 1582411, -1.2345, 7.6543);
+
+  std::string raw;
+  EncodeReverseKey(key, &raw);
+  EXPECT_EQ(raw.size(), kReverseKeySize);
+
+  proto::DbReverseKey decoded;
+  EXPECT_TRUE(DecodeReverseKey(raw, &decoded));
+  EXPECT_EQ(decoded.user_id(), key.user_id());
+  EXPECT_EQ(decoded.timestamp_zone(), key.timestamp_zone());
+  EXPECT_FLOAT_EQ(decoded.gps_longitude_zone(), key.gps_longitude_zone());
+  EXPECT_FLOAT_EQ(decoded.gps_latitude_zone(), key.gps_latitude_zone());
+}
+
+TEST(KeysReverse, DecodeInvalidSize) {
+  proto::DbReverseKey key;
+  EXPECT_FALSE(DecodeReverseKey(rocksdb::Slice("too short"), &key));
+}
+
+TEST(KeysReverse, TimeZone) {
+  std::string raw;
+  EncodeReverseKey(MakeReverseKey(42, 1582411, -1.2345, 7.6543), &raw);
+
+  int64_t ts_zone = 0;
+  EXPECT_TRUE(ReverseKeyTimeZone(raw, &ts_zone));
+  EXPECT_EQ(ts_zone, 1582411);
+
+  EXPECT_FALSE(ReverseKeyTimeZone(rocksdb::Slice("too short"), &ts_zone));
+}
+
+TEST(KeysReverse, OrderByUserFirst) {
+  EXPECT_LT(CompareRaw(MakeReverseKey(1, 1582412, 10.0, 10.0),
+                       MakeReverseKey(2, 1582411, -10.0, -10.0)),
+            0);
+  EXPECT_LT(CompareRaw(MakeReverseKey(1, 1582411, 10.0, 10.0),
+                       MakeReverseKey(1, 1582412, -10.0, -10.0)),
+            0);
+  EXPECT_LT(CompareRaw(MakeReverseKey(1, 1582411, -10.0, 10.0),
+                       MakeReverseKey(1, 1582411, 10.0, -10.0)),
+            0);
+}
+
+TEST(KeysReverse, SameUserSharesPrefix) {
+  std::string raw;
+  EncodeReverseKey(MakeReverseKey(42, 1582411, 1.0, 1.0), &raw);
+
+  std::string prefix;
+  EncodeReversePrefix(42, &prefix);
+  EXPECT_EQ(prefix.size(), kReverseUserSize);
+  EXPECT_TRUE(rocksdb::Slice(raw).starts_with(prefix));
+
+  EncodeReversePrefix(43, &prefix);
+  EXPECT_FALSE(rocksdb::Slice(raw).starts_with(prefix));
+}
+
+// The zone prefix bounds the keys of a user in earlier zones, as used
+// by range deletes of the GC.
+TEST(KeysReverse, ZonePrefixBoundsEarlierZones) {
+  std::string prefix;
+  EncodeReverseZonePrefix(42, -3, &prefix);
+  EXPECT_EQ(prefix.size(), kReverseUserSize + 8);
+
+  std::string raw;
+  EncodeReverseKey(MakeReverseKey(42, -3, -90.0, -180.0), &raw);
+  EXPECT_TRUE(rocksdb::Slice(raw).starts_with(prefix));
+  EncodeReverseKey(MakeReverseKey(42, -4, 90.0, 180.0), &raw);
+  EXPECT_LT(rocksdb::Slice(raw).compare(prefix), 0);
+  EncodeReverseKey(MakeReverseKey(41, 1582411, 90.0, 180.0), &raw);
+  EXPECT_LT(rocksdb::Slice(raw).compare(prefix), 0);
+  EncodeReverseKey(MakeReverseKey(43, -1582411, -90.0, -180.0), &raw);
+  EXPECT_GT(rocksdb::Slice(raw).compare(prefix), 0);
+}
+
+TEST(KeysRawEntry, RoundTrip) {
+  proto::DbValue value;
+  value.set_duration(10);
+  value.set_gps_latitude(1.2345);
+  value.set_gps_longitude(-7.6543);
+  value.set_gps_altitude(120.2);
+
+  std::string packed;
+  std::vector<proto::DbKey> keys;
+  for (int i = 0; i < 3; ++i) {
+    keys.push_back(MakeKey(1582411316 + i, 42 + i, 1.2345, -7.6543));
+
+    std::string key_raw;
+    EncodeTimelineKey(keys.back(), &key_raw);
+    AppendRawEntry(key_raw, value.SerializeAsString(), &packed);
+  }
+
+  RawEntryReader reader(packed);
+  rocksdb::Slice key_raw;
+  rocksdb::Slice value_raw;
+  for (const auto &key : keys) {
+    ASSERT_TRUE(reader.Next(&key_raw, &value_raw));
+
+    proto::BlockEntry entry;
+    ASSERT_TRUE(DecodeRawEntry(key_raw, value_raw, &entry));
+    EXPECT_EQ(key.timestamp(), entry.key().timestamp());
+    EXPECT_EQ(key.user_id(), entry.key().user_id());
+    EXPECT_EQ(value.duration(), entry.value().duration());
+    EXPECT_EQ(value.gps_altitude(), entry.value().gps_altitude());
+  }
+  EXPECT_FALSE(reader.Next(&key_raw, &value_raw));
+  EXPECT_FALSE(reader.Failed());
+}
+
+TEST(KeysRawEntry, Truncated) {
+  std::string packed;
+  AppendRawEntry(std::string(kTimelineKeySize, 'k'), std::string(200, 'v'),
+                 &packed);
+
+  rocksdb::Slice key_raw;
+  rocksdb::Slice value_raw;
+  for (size_t size = 1; size < packed.size(); ++size) {
+    RawEntryReader reader(rocksdb::Slice(packed.data(), size));
+    EXPECT_FALSE(reader.Next(&key_raw, &value_raw));
+    EXPECT_TRUE(reader.Failed());
+  }
+
+  RawEntryReader empty(rocksdb::Slice(packed.data(), 0));
+  EXPECT_FALSE(empty.Next(&key_raw, &value_raw));
+  EXPECT_FALSE(empty.Failed());
+}
+
+TEST(KeysRawEntry, DecodeInvalid) {
+  proto::BlockEntry entry;
+  EXPECT_FALSE(DecodeRawEntry(std::string(3, 'k'), "", &entry));
+}
+
+} // anonymous namespace
+
+} // namespace bt
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <lz4.h>
+#include <string>
+#include <type_traits>
+
+#include "server/location_batch.h"
+
+namespace bt {
+
+namespace {
+
+// Bounds the memory a batch can make us allocate, well above the size
+// of a gRPC message.
+constexpr uint32_t kMaxUncompressedSize = 64 << 20;
+
+int32_t ToFixed(float value, double precision) {
+  if (std::isnan(value)) {
+    return 0;
+  }
+  const double fixed = std::round(value * precision);
+  return static_cast<int32_t>(
+      std::clamp<double>(fixed, std::numeric_limits<int32_t>::min(),
+                         std::numeric_limits<int32_t>::max()));
+}
+
+// Deltas wrap around instead of overflowing.
+template <typename T> T Delta(T value, T previous) {
+  using U = std::make_unsigned_t<T>;
+  return static_cast<T>(static_cast<U>(value) - static_cast<U>(previous));
+}
+
+template <typename T> T Undelta(T delta, T previous) {
+  using U = std::make_unsigned_t<T>;
+  return static_cast<T>(static_cast<U>(previous) + static_cast<U>(delta));
+}
+
+void EncodeColumns(const LocationColumns &columns,
+                   proto::LocationBatch *batch) {
+  const int size = columns.Size();
+  batch->mutable_user_id()->Reserve(size);
+  batch->mutable_timestamp_delta()->Reserve(size);
+  batch->mutable_duration()->Reserve(size);
+  batch->mutable_gps_latitude_delta()->Reserve(size);
+  batch->mutable_gps_longitude_delta()->Reserve(size);
+  batch->mutable_gps_altitude()->Reserve(size);
+
+  for (int i = 0; i < size; ++i) {
+    const bool first = i == 0;
+    batch->add_user_id(columns.user_id[i]);
+    batch->add_timestamp_delta(Delta<int64_t>(
+        columns.timestamp[i], first ? 0 : columns.timestamp[i - 1]));
+    batch->add_duration(columns.duration[i]);
+    batch->add_gps_latitude_delta(Delta<int32_t>(
+        columns.gps_latitude[i], first ? 0 : columns.gps_latitude[i - 1]));
+    batch->add_gps_longitude_delta(Delta<int32_t>(
+        columns.gps_longitude[i], first ? 0 : columns.gps_longitude[i - 1]));
+    batch->add_gps_altitude(columns.gps_altitude[i]);
+  }
+}
+
+Status DecodeColumns(const proto::LocationBatch &batch,
+                     LocationColumns *columns) {
+  const int size = batch.user_id_size();
+  if (batch.timestamp_delta_size() != size ||
+      batch.duration_size() != size ||
+      batch.gps_latitude_delta_size() != size ||
+      batch.gps_longitude_delta_size() != size ||
+      batch.gps_altitude_size() != size) {
+    RETURN_ERROR(INVALID_ARGUMENT,
+                 "location batch has columns of different sizes");
+  }
+
+  columns->user_id.insert(columns->user_id.end(), batch.user_id().begin(),
+                          batch.user_id().end());
+  columns->duration.insert(columns->duration.end(), batch.duration().begin(),
+                           batch.duration().end());
+  columns->gps_altitude.insert(columns->gps_altitude.end(),
+                               batch.gps_altitude().begin(),
+                               batch.gps_altitude().end());
+
+  columns->timestamp.reserve(columns->timestamp.size() + size);
+  columns->gps_latitude.reserve(columns->gps_latitude.size() + size);
+  columns->gps_longitude.reserve(columns->gps_longitude.size() + size);
+  int64_t timestamp = 0;
+  int32_t gps_latitude = 0;
+  int32_t gps_longitude = 0;
+  for (int i = 0; i < size; ++i) {
+    timestamp = Undelta(batch.timestamp_delta(i), timestamp);
+    gps_latitude = Undelta(batch.gps_latitude_delta(i), gps_latitude);
+    gps_longitude = Undelta(batch.gps_longitude_delta(i), gps_longitude);
+    columns->timestamp.push_back(timestamp);
+    columns->gps_latitude.push_back(gps_latitude);
+    columns->gps_longitude.push_back(gps_longitude);
+  }
+
+  return StatusCode::OK;
+}
+
+} // anonymous namespace
+
+int32_t GPSToBatch(float gps) { return ToFixed(gps, kBatchGpsPrecision); }
+
+float BatchToGPS(int32_t gps) { return gps / kBatchGpsPrecision; }
+
+int32_t AltitudeToBatch(float altitude) {
+  return ToFixed(altitude, kBatchAltitudePrecision);
+}
+
+float BatchToAltitude(int32_t altitude) {
+  return altitude / kBatchAltitudePrecision;
+}
+
+void LocationColumns::Add(const proto::Location &location) {
+  user_id.push_back(location.user_id());
+  timestamp.push_back(location.timestamp());
+  duration.push_back(location.duration());
+  gps_latitude.push_back(GPSToBatch(location.gps_latitude()));
+  gps_longitude.push_back(GPSToBatch(location.gps_longitude()));
+  gps_altitude.push_back(AltitudeToBatch(location.gps_altitude()));
+}
+
+void LocationColumns::Append(const LocationColumns &columns, size_t i) {
+  user_id.push_back(columns.user_id[i]);
+  timestamp.push_back(columns.timestamp[i]);
+  duration.push_back(columns.duration[i]);
+  gps_latitude.push_back(columns.gps_latitude[i]);
+  gps_longitude.push_back(columns.gps_longitude[i]);
+  gps_altitude.push_back(columns.gps_altitude[i]);
+}
+
+void LocationColumns::RemoveUser(uint64_t removed_user_id) {
+  size_t kept = 0;
+  for (size_t i = 0; i < Size(); ++i) {
+    if (user_id[i] == removed_user_id) {
+      continue;
+    }
+    user_id[kept] = user_id[i];
+    timestamp[kept] = timestamp[i];
+    duration[kept] = duration[i];
+    gps_latitude[kept] = gps_latitude[i];
+    gps_longitude[kept] = gps_longitude[i];
+    gps_altitude[kept] = gps_altitude[i];
+    ++kept;
+  }
+
+  user_id.resize(kept);
+  timestamp.resize(kept);
+  duration.resize(kept);
+  gps_latitude.resize(kept);
+  gps_longitude.resize(kept);
+  gps_altitude.resize(kept);
+}
+
+void LocationColumns::Clear() {
+  user_id.clear();
+  timestamp.clear();
+  duration.clear();
+  gps_latitude.clear();
+  gps_longitude.clear();
+  gps_altitude.clear();
+}
+
+void EncodeLocationBatch(const LocationColumns &columns, bool compress,
+                         proto::LocationBatch *batch) {
+  batch->Clear();
+  if (!compress) {
+    EncodeColumns(columns, batch);
+    return;
+  }
+
+  proto::LocationBatch uncompressed;
+  EncodeColumns(columns, &uncompressed);
+  const std::string serialized = uncompressed.SerializeAsString();
+
+  std::string *compressed = batch->mutable_lz4_columns();
+  compressed->resize(LZ4_compressBound(serialized.size()));
+  const int size =
+      LZ4_compress_default(serialized.data(), &(*compressed)[0],
+                           serialized.size(), compressed->size());
+  compressed->resize(size);
+  batch->set_uncompressed_size(serialized.size());
+}
+
+Status DecodeLocationBatch(const proto::LocationBatch &batch,
+                           LocationColumns *columns) {
+  if (batch.lz4_columns().empty()) {
+    return DecodeColumns(batch, columns);
+  }
+
+  if (batch.user_id_size() != 0) {
+    RETURN_ERROR(INVALID_ARGUMENT,
+                 "location batch has both compressed and plain columns");
+  }
+  if (batch.uncompressed_size() > kMaxUncompressedSize) {
+    RETURN_ERROR(INVALID_ARGUMENT, "location batch is too large, size="
+                                       << batch.uncompressed_size());
+  }
+
+  std::string serialized(batch.uncompressed_size(), '\0');
+  const int size = LZ4_decompress_safe(
+      batch.lz4_columns().data(), &serialized[0], batch.lz4_columns().size(),
+      serialized.size());
+  if (size != static_cast<int>(serialized.size())) {
+    RETURN_ERROR(INVALID_ARGUMENT, "can't decompress location batch");
+  }
+
+  proto::LocationBatch uncompressed;
+  if (!uncompressed.ParseFromString(serialized) ||
+      !uncompressed.lz4_columns().empty()) {
+    RETURN_ERROR(INVALID_ARGUMENT, "can't parse location batch");
+  }
+
+  return DecodeColumns(uncompressed, columns);
+}
+
+} // namespace bt
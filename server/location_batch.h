@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common/status.h"
+#include "proto/backtrace.pb.h"
+
+namespace bt {
+
+// Fixed-point precision of coordinates in a LocationBatch: degrees
+// are stored to the 1e-7 (about a centimeter at the equator, which
+// fits longitudes in 32 bits), altitudes to the centimeter.
+constexpr double kBatchGpsPrecision = 1e7;
+constexpr double kBatchAltitudePrecision = 1e2;
+
+// Converts coordinates to their fixed-point representation in a batch
+// and back, values out of range are clamped.
+int32_t GPSToBatch(float gps);
+float BatchToGPS(int32_t gps);
+int32_t AltitudeToBatch(float altitude);
+float BatchToAltitude(int32_t altitude);
+
+// Location points of a LocationBatch, decoded in columns so that they
+// can be routed and queued without building a Location per point.
+// Coordinates are kept fixed-point.
+struct LocationColumns {
+  std::vector<uint64_t> user_id;
+  std::vector<int64_t> timestamp;
+  std::vector<uint32_t> duration;
+  std::vector<int32_t> gps_latitude;
+  std::vector<int32_t> gps_longitude;
+  std::vector<int32_t> gps_altitude;
+
+  size_t Size() const { return user_id.size(); }
+
+  // Appends a point, coordinates are converted to fixed-point.
+  void Add(const proto::Location &location);
+
+  // Appends point i of columns.
+  void Append(const LocationColumns &columns, size_t i);
+
+  // Removes all points of a user.
+  void RemoveUser(uint64_t user_id);
+
+  void Clear();
+};
+
+// Encodes points in a batch, columns are compressed with LZ4 if
+// compress is set.
+void EncodeLocationBatch(const LocationColumns &columns, bool compress,
+                         proto::LocationBatch *batch);
+
+// Decodes points of a batch, appended to columns. Fails if the batch
+// is malformed (i.e: columns of different sizes, corrupted LZ4).
+Status DecodeLocationBatch(const proto::LocationBatch &batch,
+                           LocationColumns *columns);
+
+} // namespace bt
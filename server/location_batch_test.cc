@@ -0,0 +1,196 @@
+#include <cmath>
+#include <gtest/gtest.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "server/location_batch.h"
+
+namespace bt {
+
+namespace {
+
+proto::Location MakeLocation(uint64_t user_id, int64_t timestamp,
+                             uint32_t duration, float gps_latitude,
+                             float gps_longitude, float gps_altitude) {
+  proto::Location location;
+  location.set_user_id(user_id);
+  location.set_timestamp(timestamp);
+  location.set_duration(duration);
+  location.set_gps_latitude(gps_latitude);
+  location.set_gps_longitude(gps_longitude);
+  location.set_gps_altitude(gps_altitude);
+  return location;
+}
+
+// Points of users moving around a city, as pushed in a batch.
+std::vector<proto::Location> MakeCityLocations(int count) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<uint64_t> user_id(1, 1000000000);
+  std::uniform_int_distribution<int> ts_offset(0, 3);
+  std::uniform_int_distribution<uint32_t> duration(0, 300);
+  std::uniform_real_distribution<float> gps(-0.05, 0.05);
+  std::uniform_real_distribution<float> alt(0.0, 50.0);
+
+  std::vector<proto::Location> locations;
+  int64_t ts = 1582410316;
+  for (int i = 0; i < count; ++i) {
+    ts += ts_offset(gen);
+    locations.push_back(MakeLocation(user_id(gen), ts, duration(gen),
+                                     48.8566 + gps(gen), 2.3522 + gps(gen),
+                                     alt(gen)));
+  }
+  return locations;
+}
+
+void ExpectSameLocations(const std::vector<proto::Location> &locations,
+                         const LocationColumns &columns) {
+  ASSERT_EQ(locations.size(), columns.Size());
+  for (size_t i = 0; i < locations.size(); ++i) {
+    EXPECT_EQ(locations[i].user_id(), columns.user_id[i]);
+    EXPECT_EQ(locations[i].timestamp(), columns.timestamp[i]);
+    EXPECT_EQ(locations[i].duration(), columns.duration[i]);
+    EXPECT_NEAR(locations[i].gps_latitude(),
+                BatchToGPS(columns.gps_latitude[i]), 1e-5);
+    EXPECT_NEAR(locations[i].gps_longitude(),
+                BatchToGPS(columns.gps_longitude[i]), 1e-5);
+    EXPECT_NEAR(locations[i].gps_altitude(),
+                BatchToAltitude(columns.gps_altitude[i]), 1e-2);
+  }
+}
+
+TEST(LocationBatch, FixedPoint) {
+  EXPECT_EQ(GPSToBatch(48.5), 485000000);
+  EXPECT_EQ(GPSToBatch(-180.0), -1800000000);
+  EXPECT_EQ(GPSToBatch(0.0), 0);
+  EXPECT_EQ(GPSToBatch(INFINITY), std::numeric_limits<int32_t>::max());
+  EXPECT_EQ(GPSToBatch(-INFINITY), std::numeric_limits<int32_t>::min());
+  EXPECT_EQ(GPSToBatch(NAN), 0);
+  EXPECT_NEAR(BatchToGPS(GPSToBatch(-6.3135357)), -6.3135357, 1e-6);
+
+  EXPECT_EQ(AltitudeToBatch(120.25), 12025);
+  EXPECT_NEAR(BatchToAltitude(AltitudeToBatch(-3.5)), -3.5, 1e-6);
+}
+
+TEST(LocationBatch, RoundTrip) {
+  const std::vector<proto::Location> locations = {
+      MakeLocation(1, 1582410316, 10, 48.8566, 2.3522, 35.0),
+      MakeLocation(2, 1582410000, 0, -6.3135357, 53.2876332, 120.2),
+      MakeLocation(3, 0, 0, 0.0, 0.0, 0.0),
+      MakeLocation(3, INT64_MAX, 0, -90.0, 180.0, -10.0),
+      MakeLocation(UINT64_MAX, 1582410316, UINT32_MAX, 90.0, -180.0, 0.0),
+  };
+
+  LocationColumns columns;
+  for (const auto &location : locations) {
+    columns.Add(location);
+  }
+
+  for (bool compress : {false, true}) {
+    proto::LocationBatch batch;
+    EncodeLocationBatch(columns, compress, &batch);
+    EXPECT_EQ(compress, !batch.lz4_columns().empty());
+
+    LocationColumns decoded;
+    EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::OK);
+    ExpectSameLocations(locations, decoded);
+  }
+}
+
+TEST(LocationBatch, DecodeAppends) {
+  LocationColumns columns;
+  columns.Add(MakeLocation(1, 1582410316, 10, 1.0, 1.0, 1.0));
+
+  proto::LocationBatch batch;
+  EncodeLocationBatch(columns, false, &batch);
+
+  LocationColumns decoded;
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::OK);
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::OK);
+  EXPECT_EQ(2, decoded.Size());
+  EXPECT_EQ(1582410316, decoded.timestamp[1]);
+}
+
+TEST(LocationBatch, Empty) {
+  proto::LocationBatch batch;
+  EncodeLocationBatch(LocationColumns(), false, &batch);
+  EXPECT_EQ(0, batch.ByteSizeLong());
+
+  LocationColumns decoded;
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::OK);
+  EXPECT_EQ(0, decoded.Size());
+}
+
+TEST(LocationBatch, RemoveUser) {
+  LocationColumns columns;
+  for (uint64_t user_id : {1, 2, 1, 3, 1}) {
+    columns.Add(MakeLocation(user_id, 1582410316 + user_id, 0, 1.0, 1.0, 1.0));
+  }
+
+  columns.RemoveUser(1);
+  EXPECT_EQ(columns.user_id, std::vector<uint64_t>({2, 3}));
+  EXPECT_EQ(columns.timestamp, std::vector<int64_t>({1582410318, 1582410319}));
+  EXPECT_EQ(2, columns.gps_altitude.size());
+}
+
+TEST(LocationBatch, Malformed) {
+  LocationColumns columns;
+  columns.Add(MakeLocation(1, 1582410316, 10, 1.0, 1.0, 1.0));
+  columns.Add(MakeLocation(2, 1582410317, 10, 1.0, 1.0, 1.0));
+
+  proto::LocationBatch batch;
+  EncodeLocationBatch(columns, false, &batch);
+  batch.mutable_gps_altitude()->RemoveLast();
+
+  LocationColumns decoded;
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::INVALID_ARGUMENT);
+
+  EncodeLocationBatch(columns, true, &batch);
+  batch.mutable_lz4_columns()->resize(batch.lz4_columns().size() / 2);
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::INVALID_ARGUMENT);
+
+  EncodeLocationBatch(columns, true, &batch);
+  batch.set_uncompressed_size(batch.uncompressed_size() + 1);
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::INVALID_ARGUMENT);
+
+  EncodeLocationBatch(columns, true, &batch);
+  batch.set_uncompressed_size(1 << 30);
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::INVALID_ARGUMENT);
+
+  EncodeLocationBatch(columns, true, &batch);
+  batch.add_user_id(1);
+  EXPECT_EQ(DecodeLocationBatch(batch, &decoded), StatusCode::INVALID_ARGUMENT);
+
+  EXPECT_EQ(0, decoded.Size());
+}
+
+// Columnar batches are meant to be much smaller than a list of
+// Location messages (about half the size with random user ids, which
+// don't compress).
+TEST(LocationBatch, SmallerThanLocations) {
+  const std::vector<proto::Location> locations = MakeCityLocations(5000);
+
+  proto::PutLocation_Request request;
+  LocationColumns columns;
+  for (const auto &location : locations) {
+    *request.add_locations() = location;
+    columns.Add(location);
+  }
+
+  proto::LocationBatch batch;
+  EncodeLocationBatch(columns, false, &batch);
+  proto::LocationBatch compressed;
+  EncodeLocationBatch(columns, true, &compressed);
+
+  const size_t size = request.ByteSizeLong();
+  EXPECT_LT(batch.ByteSizeLong() * 3 / 2, size);
+  EXPECT_LE(compressed.ByteSizeLong(), batch.ByteSizeLong() * 11 / 10);
+
+  LocationColumns decoded;
+  EXPECT_EQ(DecodeLocationBatch(compressed, &decoded), StatusCode::OK);
+  ExpectSameLocations(locations, decoded);
+}
+
+} // anonymous namespace
+
+} // namespace bt
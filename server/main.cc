@@ -3,6 +3,7 @@
 
 #include "common/config.h"
 #include "server/mixer.h"
+#include "server/migrate.h"
 #include "server/mixer_config.h"
 #include "server/worker.h"
 #include "server/worker_config.h"
@@ -12,7 +13,13 @@ using namespace bt;
 DEFINE_string(config,
               "",
               "path to the config file ('worker.yml', 'mixer.yml')");
-DEFINE_string(type, "", "type of the instance ('worker' or 'mixer')");
+DEFINE_string(type,
+              "",
+              "type of the instance ('worker', 'mixer' or 'migrate')");
+DEFINE_string(migrate_from,
+              "",
+              "path to the database to migrate (with --type=migrate, the "
+              "destination is the path of the worker config)");
 
 namespace {
 
@@ -65,6 +72,24 @@ Status MixerLoop(const Config& config) {
   return StatusCode::OK;
 }
 
+Status MigrateLoop(const Config& config) {
+  Status status;
+  WorkerConfig worker_config;
+  status = WorkerConfig::MakeWorkerConfig(config, &worker_config);
+  if (status != StatusCode::OK) {
+    LOG(ERROR) << "unable to initialize config, status=" << status;
+    return status;
+  }
+
+  status = MigrateDatabase(FLAGS_migrate_from, worker_config);
+  if (status != StatusCode::OK) {
+    LOG(ERROR) << "unable to migrate database, status=" << status;
+    return status;
+  }
+
+  return StatusCode::OK;
+}
+
 }  // namespace
 
 int main(int ac, char** av) {
@@ -92,8 +117,14 @@ int main(int ac, char** av) {
       return -1;
     }
     return -1;
+  } else if (FLAGS_type == kMigrateType) {
+    Status status = MigrateLoop(*config_status.ValueOrDie());
+    if (status != StatusCode::OK) {
+      LOG(ERROR) << "migration exited with error, status=" << status;
+      return -1;
+    }
   } else {
-    LOG(ERROR) << "invalid flag, --type must be 'worker' or 'mixer'";
+    LOG(ERROR) << "invalid flag, --type must be 'worker', 'mixer' or 'migrate'";
     return -1;
   }
 
@@ -0,0 +1,379 @@
+#include <cstdlib>
+#include <functional>
+#include <glog/logging.h>
+#include <memory>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include <vector>
+
+#include "common/utils.h"
+#include "proto/backtrace.pb.h"
+#include "server/db.h"
+#include "server/keys.h"
+#include "server/migrate.h"
+#include "server/zones.h"
+
+namespace bt {
+
+namespace {
+
+// Number of entries written per batch in the destination database.
+constexpr int kMigrationBatchSize = 10000;
+
+// Used for GPS float comparisons.
+constexpr float kEpsilon = 0.0000001;
+
+void DecodeLegacyTimelineKey(const rocksdb::Slice &key, uint64_t *timestamp_lo,
+                             float *long_zone, float *lat_zone,
+                             uint64_t *user_id, uint64_t *timestamp_hi) {
+  proto::DbKey db_key;
+  db_key.ParseFromArray(key.data(), key.size());
+
+  *timestamp_lo = db_key.timestamp() / kTimePrecision;
+  *long_zone = db_key.gps_longitude_zone();
+  *lat_zone = db_key.gps_latitude_zone();
+  *user_id = db_key.user_id();
+  *timestamp_hi = db_key.timestamp() % kTimePrecision;
+}
+
+void DecodeLegacyReverseKey(const rocksdb::Slice &key, uint64_t *user_id,
+                            uint64_t *timestamp_zone, float *gps_longitude_zone,
+                            float *gps_latitude_zone) {
+  proto::DbReverseKey db_key;
+  db_key.ParseFromArray(key.data(), key.size());
+  *user_id = db_key.user_id();
+  *timestamp_zone = db_key.timestamp_zone();
+  *gps_longitude_zone = db_key.gps_longitude_zone();
+  *gps_latitude_zone = db_key.gps_latitude_zone();
+}
+
+} // anonymous namespace
+
+int LegacyTimelineComparator::Compare(const rocksdb::Slice &a,
+                                      const rocksdb::Slice &b) const {
+  uint64_t left_timestamp_lo;
+  float left_long_zone;
+  float left_lat_zone;
+  uint64_t left_user_id;
+  uint64_t left_timestamp_hi;
+  DecodeLegacyTimelineKey(a, &left_timestamp_lo, &left_long_zone,
+                          &left_lat_zone, &left_user_id, &left_timestamp_hi);
+
+  uint64_t right_timestamp_lo;
+  float right_long_zone;
+  float right_lat_zone;
+  uint64_t right_user_id;
+  uint64_t right_timestamp_hi;
+  DecodeLegacyTimelineKey(b, &right_timestamp_lo, &right_long_zone,
+                          &right_lat_zone, &right_user_id,
+                          &right_timestamp_hi);
+
+  if (left_timestamp_lo < right_timestamp_lo) {
+    return -1;
+  }
+  if (left_timestamp_lo > right_timestamp_lo) {
+    return 1;
+  }
+
+  float fdiff;
+
+  fdiff = left_long_zone - right_long_zone;
+  if (fdiff > kEpsilon) {
+    return -1;
+  }
+  if (fdiff < -kEpsilon) {
+    return 1;
+  }
+
+  fdiff = left_lat_zone - right_lat_zone;
+  if (fdiff > kEpsilon) {
+    return -1;
+  }
+  if (fdiff < -kEpsilon) {
+    return 1;
+  }
+
+  if (left_user_id < right_user_id) {
+    return -1;
+  }
+  if (left_user_id > right_user_id) {
+    return 1;
+  }
+
+  if (left_timestamp_hi < right_timestamp_hi) {
+    return -1;
+  }
+  if (left_timestamp_hi > right_timestamp_hi) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int LegacyReverseComparator::Compare(const rocksdb::Slice &a,
+                                     const rocksdb::Slice &b) const {
+  uint64_t left_user_id;
+  uint64_t left_timestamp_zone;
+  float left_gps_longitude_zone;
+  float left_gps_latitude_zone;
+  DecodeLegacyReverseKey(a, &left_user_id, &left_timestamp_zone,
+                         &left_gps_longitude_zone, &left_gps_latitude_zone);
+
+  uint64_t right_user_id;
+  uint64_t right_timestamp_zone;
+  float right_gps_longitude_zone;
+  float right_gps_latitude_zone;
+  DecodeLegacyReverseKey(b, &right_user_id, &right_timestamp_zone,
+                         &right_gps_longitude_zone, &right_gps_latitude_zone);
+
+  if (left_user_id < right_user_id) {
+    return -1;
+  }
+  if (left_user_id > right_user_id) {
+    return 1;
+  }
+
+  if (left_timestamp_zone < right_timestamp_zone) {
+    return -1;
+  }
+  if (left_timestamp_zone > right_timestamp_zone) {
+    return 1;
+  }
+
+  float fdiff;
+
+  fdiff = left_gps_longitude_zone - right_gps_longitude_zone;
+  if (fdiff > kEpsilon) {
+    return -1;
+  }
+  if (fdiff < -kEpsilon) {
+    return 1;
+  }
+
+  fdiff = left_gps_latitude_zone - right_gps_latitude_zone;
+  if (fdiff > kEpsilon) {
+    return -1;
+  }
+  if (fdiff < -kEpsilon) {
+    return 1;
+  }
+
+  return 0;
+}
+
+namespace {
+
+// Converts a raw key from the old format to the new one, returns
+// false if the key can't be converted.
+using KeyConverter =
+    std::function<bool(const rocksdb::Slice &from, std::string *to)>;
+
+bool ConvertLegacyTimelineKey(const rocksdb::Slice &from, std::string *to) {
+  proto::DbKey key;
+  if (!key.ParseFromArray(from.data(), from.size())) {
+    return false;
+  }
+  EncodeTimelineKey(key, to);
+  return true;
+}
+
+bool ConvertLegacyReverseKey(const rocksdb::Slice &from, std::string *to) {
+  proto::DbReverseKey key;
+  if (!key.ParseFromArray(from.data(), from.size())) {
+    return false;
+  }
+  EncodeReverseKey(key, to);
+  return true;
+}
+
+bool CopyKey(const rocksdb::Slice &from, std::string *to) {
+  to->assign(from.data(), from.size());
+  return true;
+}
+
+// Read-only database to migrate, handles are closed before the
+// database.
+struct SourceDb {
+  ~SourceDb() {
+    for (auto *handle : handles) {
+      db->DestroyColumnFamilyHandle(handle);
+    }
+  }
+
+  std::unique_ptr<rocksdb::DB> db;
+  std::vector<rocksdb::ColumnFamilyHandle *> handles;
+};
+
+Status CopyColumn(const std::string &column, SourceDb *source,
+                  rocksdb::ColumnFamilyHandle *from_handle, Db *to,
+                  rocksdb::ColumnFamilyHandle *to_handle,
+                  const KeyConverter &converter) {
+  std::unique_ptr<rocksdb::Iterator> it(
+      source->db->NewIterator(rocksdb::ReadOptions(), from_handle));
+
+  int64_t count = 0;
+  rocksdb::WriteBatch batch;
+  std::string raw_key;
+
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    if (!converter(it->key(), &raw_key)) {
+      RETURN_ERROR(INTERNAL_ERROR,
+                   "can't convert key, column=" << column << ", count="
+                                                << count);
+    }
+    batch.Put(to_handle, rocksdb::Slice(raw_key.data(), raw_key.size()),
+              it->value());
+    ++count;
+
+    if (batch.Count() >= kMigrationBatchSize) {
+      rocksdb::Status status =
+          to->Rocks()->Write(rocksdb::WriteOptions(), &batch);
+      if (!status.ok()) {
+        RETURN_ERROR(INTERNAL_ERROR, "can't write migrated entries, column="
+                                         << column
+                                         << ", status=" << status.ToString());
+      }
+      batch.Clear();
+      LOG_EVERY_N(INFO, 100) << "migrating column " << column
+                             << ", count=" << count;
+    }
+  }
+
+  if (!it->status().ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't iterate over column="
+                                     << column
+                                     << ", status=" << it->status().ToString());
+  }
+
+  rocksdb::Status status = to->Rocks()->Write(rocksdb::WriteOptions(), &batch);
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "can't write migrated entries, column="
+                                     << column
+                                     << ", status=" << status.ToString());
+  }
+
+  LOG(INFO) << "migrated column " << column << ", count=" << count;
+
+  return StatusCode::OK;
+}
+
+} // anonymous namespace
+
+Status ReadDatabaseFormatVersion(const std::string &path, int *version) {
+  // Read-only databases can be opened with a subset of their columns,
+  // which avoids having to know the comparators of the other ones.
+  std::vector<rocksdb::ColumnFamilyDescriptor> columns;
+  columns.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+
+  SourceDb source;
+  rocksdb::DB *db = nullptr;
+  rocksdb::Status status = rocksdb::DB::OpenForReadOnly(
+      rocksdb::Options(), path, columns, &source.handles, &db);
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "unable to open database to read its format version, status="
+                     << status.ToString());
+  }
+  source.db.reset(db);
+
+  std::string raw_version;
+  status = source.db->Get(rocksdb::ReadOptions(), source.handles[0],
+                          rocksdb::Slice(kFormatVersionKey), &raw_version);
+  if (status.IsNotFound()) {
+    *version = 1;
+    return StatusCode::OK;
+  }
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "can't read format version, status=" << status.ToString());
+  }
+
+  *version = std::atoi(raw_version.c_str());
+  return StatusCode::OK;
+}
+
+Status MigrateDatabase(const std::string &from_path,
+                       const WorkerConfig &config) {
+  if (config.db_path_.empty()) {
+    RETURN_ERROR(INVALID_CONFIG, "migration needs a destination db.path");
+  }
+  if (!utils::DirExists(from_path)) {
+    RETURN_ERROR(INVALID_ARGUMENT,
+                 "database to migrate doesn't exist, path=" << from_path);
+  }
+  if (utils::DirExists(config.db_path_)) {
+    RETURN_ERROR(INVALID_ARGUMENT,
+                 "destination database already exists, path="
+                     << config.db_path_);
+  }
+
+  int version = 0;
+  RETURN_IF_ERROR(ReadDatabaseFormatVersion(from_path, &version));
+  if (version < 1 || version >= kDbFormatVersion) {
+    RETURN_ERROR(INVALID_ARGUMENT,
+                 "unsupported format version for migration, version="
+                     << version);
+  }
+  // Converted points are copied to the unpartitioned columns.
+  if (config.db_partition_days_ > 0) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "can't convert database to a partitioned one, version="
+                     << version << ", path=" << config.db_path_);
+  }
+
+  // Comparators and key conversions depend on the source version.
+  LegacyTimelineComparator legacy_timeline_cmp;
+  TimelineComparator timeline_cmp;
+  LegacyReverseComparator legacy_reverse_cmp;
+
+  const rocksdb::Comparator *from_timeline_cmp = &legacy_timeline_cmp;
+  KeyConverter timeline_converter = ConvertLegacyTimelineKey;
+  if (version >= 2) {
+    from_timeline_cmp = &timeline_cmp;
+    timeline_converter = CopyKey;
+  }
+
+  std::vector<rocksdb::ColumnFamilyDescriptor> columns;
+  columns.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+
+  rocksdb::ColumnFamilyOptions timeline_options;
+  timeline_options.comparator = from_timeline_cmp;
+  columns.push_back(
+      rocksdb::ColumnFamilyDescriptor(kColumnTimeline, timeline_options));
+
+  rocksdb::ColumnFamilyOptions reverse_options;
+  reverse_options.comparator = &legacy_reverse_cmp;
+  columns.push_back(
+      rocksdb::ColumnFamilyDescriptor(kColumnReverse, reverse_options));
+
+  SourceDb source;
+  rocksdb::DB *db = nullptr;
+  rocksdb::Status db_status = rocksdb::DB::OpenForReadOnly(
+      rocksdb::Options(), from_path, columns, &source.handles, &db);
+  if (!db_status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "unable to open database to migrate, status="
+                                     << db_status.ToString());
+  }
+  source.db.reset(db);
+
+  LOG(INFO) << "migrating database from version " << version << " to "
+            << kDbFormatVersion << ", from=" << from_path
+            << ", to=" << config.db_path_;
+
+  Db to;
+  RETURN_IF_ERROR(to.Init(config));
+
+  RETURN_IF_ERROR(CopyColumn(kColumnTimeline, &source, source.handles[1], &to,
+                             to.TimelineHandle(), timeline_converter));
+  RETURN_IF_ERROR(CopyColumn(kColumnReverse, &source, source.handles[2], &to,
+                             to.ReverseHandle(), ConvertLegacyReverseKey));
+
+  LOG(INFO) << "migration done, old database can be deleted, path="
+            << from_path;
+
+  return StatusCode::OK;
+}
+
+} // namespace bt
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <rocksdb/comparator.h>
+#include <string>
+
+#include "common/status.h"
+#include "server/worker_config.h"
+
+namespace bt {
+
+constexpr auto kMigrateType = "migrate";
+
+// Timeline comparator of version 1 databases, where keys are
+// serialized protobufs. It is only kept to read databases that need
+// to be migrated, see TimelineComparator in db.h for the current one.
+class LegacyTimelineComparator : public rocksdb::Comparator {
+public:
+  int Compare(const rocksdb::Slice &a, const rocksdb::Slice &b) const override;
+  const char *Name() const override { return "timeline-comparator-0.1"; }
+
+  void FindShortestSeparator(std::string *start,
+                             const rocksdb::Slice &limit) const override {}
+  void FindShortSuccessor(std::string *key) const override {}
+};
+
+// Reverse comparator of version 1 and 2 databases, see
+// ReverseComparator in db.h for the current one.
+class LegacyReverseComparator : public rocksdb::Comparator {
+public:
+  int Compare(const rocksdb::Slice &a, const rocksdb::Slice &b) const override;
+  const char *Name() const override { return "reverse-comparator-0.1"; }
+
+  void FindShortestSeparator(std::string *start,
+                             const rocksdb::Slice &limit) const override {}
+  void FindShortSuccessor(std::string *key) const override {}
+};
+
+// Reads the format version of an existing database, databases
+// created before versions were recorded are version 1.
+Status ReadDatabaseFormatVersion(const std::string &path, int *version);
+
+// Conversion of a database written with an older format (see
+// kDbFormatVersion in db.h) to the current one. The old database is
+// opened read-only and rewritten to the path of the given worker
+// config, which must not exist yet. Once done, the old database can
+// be deleted.
+//
+// This is done automatically by Db::Init when opening an outdated
+// database, it can also be run offline (see --type=migrate).
+Status MigrateDatabase(const std::string &from_path,
+                       const WorkerConfig &config);
+
+} // namespace bt
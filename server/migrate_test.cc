@@ -0,0 +1,210 @@
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <rocksdb/db.h>
+#include <vector>
+
+#include "common/utils.h"
+#include "proto/backtrace.pb.h"
+#include "server/db.h"
+#include "server/keys.h"
+#include "server/migrate.h"
+#include "server/worker_config.h"
+#include "server/zones.h"
+
+namespace bt {
+namespace {
+
+constexpr int kNumberOfPoints = 100;
+constexpr int64_t kBaseTimestamp = 1582410000;
+constexpr int64_t kBaseUserId = 42;
+
+class MigrateTest : public testing::Test {
+protected:
+  void SetUp() override {
+    StatusOr<std::string> status = utils::MakeTemporaryDirectory();
+    EXPECT_TRUE(status.Ok());
+    dir_ = status.ValueOrDie();
+    config_.db_path_ = dir_ + "/db";
+  }
+
+  void TearDown() override { utils::DeleteDirectory(dir_); }
+
+  proto::DbKey MakeKey(int i) {
+    proto::DbKey key;
+    key.set_timestamp(kBaseTimestamp + i * 100);
+    key.set_user_id(kBaseUserId + i % 3);
+    key.set_gps_longitude_zone(GPSLocationToGPSZone(-1.0 + i * 0.01));
+    key.set_gps_latitude_zone(GPSLocationToGPSZone(2.0 - i * 0.01));
+    return key;
+  }
+
+  proto::DbReverseKey MakeReverseKey(const proto::DbKey &key) {
+    proto::DbReverseKey reverse_key;
+    reverse_key.set_user_id(key.user_id());
+    reverse_key.set_timestamp_zone(TsToZone(key.timestamp()));
+    reverse_key.set_gps_longitude_zone(key.gps_longitude_zone());
+    reverse_key.set_gps_latitude_zone(key.gps_latitude_zone());
+    return reverse_key;
+  }
+
+  // Writes a database with the layout of the given format version.
+  void MakeLegacyDatabase(int version) {
+    LegacyTimelineComparator legacy_timeline_cmp;
+    TimelineComparator timeline_cmp;
+    LegacyReverseComparator reverse_cmp;
+
+    rocksdb::Options options;
+    options.create_if_missing = true;
+    options.create_missing_column_families = true;
+
+    std::vector<rocksdb::ColumnFamilyDescriptor> columns;
+    columns.push_back(rocksdb::ColumnFamilyDescriptor(
+        rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+    rocksdb::ColumnFamilyOptions timeline_options;
+    timeline_options.comparator = &timeline_cmp;
+    if (version == 1) {
+      timeline_options.comparator = &legacy_timeline_cmp;
+    }
+    columns.push_back(
+        rocksdb::ColumnFamilyDescriptor(kColumnTimeline, timeline_options));
+    rocksdb::ColumnFamilyOptions reverse_options;
+    reverse_options.comparator = &reverse_cmp;
+    columns.push_back(
+        rocksdb::ColumnFamilyDescriptor(kColumnReverse, reverse_options));
+
+    std::vector<rocksdb::ColumnFamilyHandle *> handles;
+    rocksdb::DB *db = nullptr;
+    ASSERT_TRUE(rocksdb::DB::Open(options, config_.db_path_, columns,
+                                  &handles, &db)
+                    .ok());
+
+    if (version > 1) {
+      EXPECT_TRUE(db->Put(rocksdb::WriteOptions(), handles[0],
+                          kFormatVersionKey, std::to_string(version))
+                      .ok());
+    }
+
+    for (int i = 0; i < kNumberOfPoints; ++i) {
+      const proto::DbKey key = MakeKey(i);
+      std::string raw_key;
+      if (version == 1) {
+        key.SerializeToString(&raw_key);
+      } else {
+        EncodeTimelineKey(key, &raw_key);
+      }
+      EXPECT_TRUE(
+          db->Put(rocksdb::WriteOptions(), handles[1], raw_key, "").ok());
+
+      std::string raw_reverse_key;
+      MakeReverseKey(key).SerializeToString(&raw_reverse_key);
+      EXPECT_TRUE(
+          db->Put(rocksdb::WriteOptions(), handles[2], raw_reverse_key, "")
+              .ok());
+    }
+
+    for (auto *handle : handles) {
+      db->DestroyColumnFamilyHandle(handle);
+    }
+    delete db;
+  }
+
+  // Ensures all points written by MakeLegacyDatabase are readable and
+  // sorted with the current format.
+  void CheckConvertedDatabase(Db *db) {
+    std::unique_ptr<rocksdb::Iterator> it(
+        db->Rocks()->NewIterator(rocksdb::ReadOptions(), db->TimelineHandle()));
+    int count = 0;
+    std::string previous;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      proto::DbKey key;
+      EXPECT_TRUE(DecodeTimelineKey(it->key(), &key));
+      EXPECT_LT(previous, it->key().ToString());
+      previous = it->key().ToString();
+      ++count;
+    }
+    EXPECT_EQ(count, kNumberOfPoints);
+
+    for (int i = 0; i < kNumberOfPoints; ++i) {
+      const proto::DbKey key = MakeKey(i);
+
+      std::string raw_key;
+      EncodeTimelineKey(key, &raw_key);
+      std::string value;
+      EXPECT_TRUE(db->Rocks()
+                      ->Get(rocksdb::ReadOptions(), db->TimelineHandle(),
+                            raw_key, &value)
+                      .ok());
+
+      std::string raw_reverse_key;
+      EncodeReverseKey(MakeReverseKey(key), &raw_reverse_key);
+      EXPECT_TRUE(db->Rocks()
+                      ->Get(rocksdb::ReadOptions(), db->ReverseHandle(),
+                            raw_reverse_key, &value)
+                      .ok());
+    }
+  }
+
+  std::string dir_;
+  WorkerConfig config_;
+};
+
+TEST_F(MigrateTest, NewDatabaseHasCurrentVersion) {
+  {
+    Db db;
+    EXPECT_EQ(db.Init(config_), StatusCode::OK);
+  }
+
+  int version = 0;
+  EXPECT_EQ(ReadDatabaseFormatVersion(config_.db_path_, &version),
+            StatusCode::OK);
+  EXPECT_EQ(version, kDbFormatVersion);
+}
+
+TEST_F(MigrateTest, ConvertVersion1OnInit) {
+  MakeLegacyDatabase(1);
+
+  Db db;
+  EXPECT_EQ(db.Init(config_), StatusCode::OK);
+  CheckConvertedDatabase(&db);
+  EXPECT_TRUE(utils::DirExists(config_.db_path_ + ".v1"));
+}
+
+TEST_F(MigrateTest, ConvertVersion2OnInit) {
+  MakeLegacyDatabase(2);
+
+  Db db;
+  EXPECT_EQ(db.Init(config_), StatusCode::OK);
+  CheckConvertedDatabase(&db);
+  EXPECT_TRUE(utils::DirExists(config_.db_path_ + ".v2"));
+}
+
+TEST_F(MigrateTest, OfflineMigration) {
+  MakeLegacyDatabase(1);
+
+  const std::string from_path = dir_ + "/old";
+  EXPECT_EQ(utils::RenameDirectory(config_.db_path_, from_path),
+            StatusCode::OK);
+  EXPECT_EQ(MigrateDatabase(from_path, config_), StatusCode::OK);
+
+  // The destination must not exist.
+  EXPECT_NE(MigrateDatabase(from_path, config_), StatusCode::OK);
+
+  Db db;
+  EXPECT_EQ(db.Init(config_), StatusCode::OK);
+  CheckConvertedDatabase(&db);
+}
+
+TEST_F(MigrateTest, OfflineMigrationToPartitionedDatabase) {
+  MakeLegacyDatabase(1);
+
+  const std::string from_path = dir_ + "/old";
+  EXPECT_EQ(utils::RenameDirectory(config_.db_path_, from_path),
+            StatusCode::OK);
+
+  config_.db_partition_days_ = 1;
+  EXPECT_EQ(MigrateDatabase(from_path, config_), StatusCode::INVALID_CONFIG);
+  EXPECT_FALSE(utils::DirExists(config_.db_path_));
+}
+
+} // namespace
+} // namespace bt
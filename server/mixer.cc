@@ -1,9 +1,15 @@
 #include <glog/logging.h>
 #include <google/protobuf/util/message_differencer.h>
 #include <grpc++/grpc++.h>
+#include <map>
+#include <set>
 #include <sstream>
+#include <string_view>
 
 #include "common/signal.h"
+#include "server/correlator.h"
+#include "server/keys.h"
+#include "server/location_batch.h"
 #include "server/mixer.h"
 #include "server/nearby_folk.h"
 #include "server/zones.h"
@@ -11,11 +17,20 @@
 namespace bt {
 
 Status Mixer::Init(const MixerConfig &config) {
+  correlator_config_ = config.ConfigForCorrelator();
+  flusher_config_ = config.ConfigForFlusher();
+  stream_chunk_size_ = config.StreamChunkSize();
+
+  if (!correlator_config_.pushdown_ &&
+      correlator_config_.block_cache_size_ > 0) {
+    block_cache_ = std::make_unique<BlockCache>(
+        correlator_config_.block_cache_size_,
+        std::chrono::milliseconds(correlator_config_.block_cache_ttl_ms_));
+  }
+
   RETURN_IF_ERROR(InitHandlers(config));
   RETURN_IF_ERROR(InitService(config));
 
-  correlator_config_ = config.ConfigForCorrelator();
-
   return StatusCode::OK;
 }
 
@@ -45,6 +60,9 @@ Status Mixer::InitHandlers(const MixerConfig &config) {
     RETURN_ERROR(INVALID_CONFIG, "no area for handler");
   }
 
+  RETURN_IF_ERROR(
+      router_.Init(config.ShardConfigs(), config.PartitionConfigs()));
+
   return StatusCode::OK;
 }
 
@@ -74,6 +92,11 @@ grpc::Status Mixer::DeleteUser(grpc::ServerContext *context,
     }
   }
 
+  // Blocks with points of the user are not tracked.
+  if (block_cache_ != nullptr) {
+    block_cache_->Clear();
+  }
+
   LOG(INFO) << "user deleted in all shards";
 
   return ret;
@@ -82,31 +105,97 @@ grpc::Status Mixer::DeleteUser(grpc::ServerContext *context,
 grpc::Status Mixer::PutLocation(grpc::ServerContext *context,
                                 const proto::PutLocation_Request *request,
                                 proto::PutLocation_Response *response) {
+  // Points of a columnar batch stay in columns, they are routed by
+  // index and copied column by column to shards.
+  LocationColumns columns;
+  Status batch_status = DecodeLocationBatch(request->batch(), &columns);
+  if (batch_status != StatusCode::OK) {
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        batch_status.Message());
+  }
+
+  // Points are grouped by shard so that each shard is locked once per
+  // request, the last group is for the default shard.
+  std::vector<std::vector<const proto::Location *>> routed(
+      all_handlers_.size() + 1);
+  std::vector<std::vector<size_t>> routed_columns(all_handlers_.size() + 1);
   for (const auto &loc : request->locations()) {
-    bool sent = false;
-    for (auto &handler : area_handlers_) {
-      if (handler->QueueLocation(loc)) {
-        sent = true;
-        break;
-      }
+    const int shard =
+        router_.Route(loc.gps_latitude(), loc.gps_longitude(), loc.timestamp());
+    routed[shard == Router::kDefaultShard ? all_handlers_.size() : shard]
+        .push_back(&loc);
+  }
+  for (size_t i = 0; i < columns.Size(); ++i) {
+    const float gps_latitude = BatchToGPS(columns.gps_latitude[i]);
+    const float gps_longitude = BatchToGPS(columns.gps_longitude[i]);
+    const int shard =
+        router_.Route(gps_latitude, gps_longitude, columns.timestamp[i]);
+    routed_columns[shard == Router::kDefaultShard ? all_handlers_.size()
+                                                  : shard]
+        .push_back(i);
+  }
+
+  // Blocks are invalidated before and after points are written: a
+  // block read in between may not have them and is dropped again.
+  InvalidateBlocks(*request, columns);
+
+  if (default_handler_ == nullptr &&
+      (!routed.back().empty() || !routed_columns.back().empty())) {
+    LOG_EVERY_N(WARNING, 1000) << "no matching shard handler for point";
+  }
+
+  // With the background flusher, batches where points were queued.
+  std::vector<std::shared_ptr<ShardHandler::PendingBatch>> batches;
+  for (size_t i = 0; i < routed.size(); ++i) {
+    ShardHandler *handler = i < all_handlers_.size()
+                                ? all_handlers_[i].get()
+                                : default_handler_.get();
+    if (handler == nullptr ||
+        (routed[i].empty() && routed_columns[i].empty())) {
+      continue;
     }
-    if (!sent) {
-      if (!default_handler_->QueueLocation(loc)) {
-        LOG_EVERY_N(WARNING, 1000) << "no matching shard handler for point";
-      }
+
+    std::shared_ptr<ShardHandler::PendingBatch> batch;
+    handler->QueueRoutedLocations(routed[i], &batch);
+    handler->QueueRoutedBatch(columns, routed_columns[i], &batch);
+    if (batch != nullptr) {
+      batches.push_back(std::move(batch));
     }
   }
 
   grpc::Status status = grpc::Status::OK;
-  for (auto &handler : all_handlers_) {
-    grpc::Status handler_status = handler->FlushLocations();
-    if (!handler_status.ok()) {
-      status = handler_status;
+
+  if (flusher_config_.enabled_) {
+    // Points are sent by background flushers, wait for them to be
+    // acked by workers.
+    for (const auto &batch : batches) {
+      grpc::Status batch_status = batch->result.get();
+      if (!batch_status.ok()) {
+        status = batch_status;
+      }
+    }
+  } else {
+    // Locations are sent to all workers of all shards at once, the
+    // latency of the request is the slowest worker instead of the sum.
+    std::vector<std::unique_ptr<ShardHandler::Flush>> flushes;
+    for (auto &handler : all_handlers_) {
+      flushes.push_back(handler->StartFlush(context->deadline()));
+    }
+
+    for (size_t i = 0; i < all_handlers_.size(); ++i) {
+      grpc::Status handler_status =
+          all_handlers_[i]->FinishFlush(flushes[i].get());
+      if (!handler_status.ok()) {
+        status = handler_status;
+      }
     }
   }
 
+  InvalidateBlocks(*request, columns);
+
   if (status.ok()) {
-    pushed_points_counter_.Increment(request->locations_size());
+    pushed_points_counter_.Increment(request->locations_size() +
+                                     columns.Size());
   }
 
   LOG_EVERY_N(INFO, 10000) << "stats for mixer QPS over last hour "
@@ -115,6 +204,42 @@ grpc::Status Mixer::PutLocation(grpc::ServerContext *context,
   return status;
 }
 
+void Mixer::InvalidateBlocks(const proto::PutLocation_Request &request,
+                             const LocationColumns &columns) {
+  if (block_cache_ == nullptr) {
+    return;
+  }
+
+  for (const auto &loc : request.locations()) {
+    InvalidateBlock(loc.timestamp(), loc.duration(), loc.gps_latitude(),
+                    loc.gps_longitude());
+  }
+  for (size_t i = 0; i < columns.Size(); ++i) {
+    InvalidateBlock(columns.timestamp[i], columns.duration[i],
+                    BatchToGPS(columns.gps_latitude[i]),
+                    BatchToGPS(columns.gps_longitude[i]));
+  }
+}
+
+void Mixer::InvalidateBlock(int64_t timestamp, uint32_t duration,
+                            float gps_latitude, float gps_longitude) {
+  proto::DbKey key;
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(gps_longitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(gps_latitude));
+
+  // Points are stored in each time zone their duration spans, as in
+  // Pusher::PutPoint.
+  int64_t ts = timestamp;
+  const int64_t ts_end = timestamp + duration;
+  do {
+    key.set_timestamp(ts);
+    std::string key_raw;
+    EncodeTimelineKey(key, &key_raw);
+    block_cache_->Invalidate(TimelineKeyZone(key_raw).ToString());
+    ts = TsNextZone(ts) * kTimePrecision;
+  } while (ts < ts_end);
+}
+
 grpc::Status Mixer::GetMixerStats(grpc::ServerContext *context,
                                   const proto::MixerStats_Request *request,
                                   proto::MixerStats_Response *response) {
@@ -155,25 +280,27 @@ grpc::Status
 Mixer::GetUserTimeline(grpc::ServerContext *context,
                        const proto::GetUserTimeline_Request *request,
                        proto::GetUserTimeline_Response *response) {
-  std::set<proto::UserTimelinePoint, CompareTimelinePoints> timeline;
-
+  // All workers of all shards are queried at once, the request then
+  // takes as long as the slowest worker instead of the sum of all of
+  // them.
+  std::vector<std::unique_ptr<ShardHandler::TimelineFetch>> fetches;
   for (auto &handler : all_handlers_) {
-    proto::GetUserTimeline_Response shard_response;
-    grpc::Status status = handler->GetUserTimeline(request, &shard_response);
+    fetches.push_back(
+        handler->StartGetUserTimeline(request, context->deadline()));
+  }
+
+  std::vector<proto::GetUserTimeline_Response *> timelines;
+  for (size_t i = 0; i < all_handlers_.size(); ++i) {
+    grpc::Status status =
+        all_handlers_[i]->FinishGetUserTimeline(fetches[i].get(), &timelines);
     if (!status.ok()) {
       LOG_EVERY_N(WARNING, 10000)
           << "unable to retrieve user timeline because a shard is down";
       return status;
     }
-
-    for (const auto &p : shard_response.point()) {
-      timeline.insert(p);
-    }
   }
 
-  for (const auto &p : timeline) {
-    *response->add_point() = p;
-  }
+  MergeTimelines(timelines, response);
 
   return grpc::Status::OK;
 }
@@ -194,74 +321,537 @@ proto::DbKey MakeKey(int64_t timestamp, int64_t user_id,
 
 } // anonymous namespace
 
+grpc::Status Mixer::StreamUserTimeline(
+    grpc::ServerContext *context, const proto::GetUserTimeline_Request *request,
+    grpc::ServerWriter<proto::GetUserTimeline_Response> *writer) {
+  return StreamUserTimeline(
+      context, request,
+      [writer](const proto::GetUserTimeline_Response &response) {
+        return writer->Write(response);
+      });
+}
+
+grpc::Status Mixer::StreamUserTimeline(
+    grpc::ServerContext *context, const proto::GetUserTimeline_Request *request,
+    const std::function<bool(const proto::GetUserTimeline_Response &)>
+        &write) {
+  // All workers of all shards stream at once, their timelines are
+  // merged as chunks arrive.
+  std::vector<std::vector<std::unique_ptr<ShardHandler::TimelineStream>>>
+      streams;
+  std::vector<TimelineSource *> sources;
+  for (auto &handler : all_handlers_) {
+    streams.push_back(
+        handler->StartStreamUserTimeline(*request, context->deadline()));
+    for (auto &stream : streams.back()) {
+      sources.push_back(stream.get());
+    }
+  }
+
+  if (!MergeTimelineSources(sources, stream_chunk_size_, write)) {
+    return grpc::Status(grpc::StatusCode::CANCELLED,
+                        "unable to stream timeline to client");
+  }
+
+  // Workers of a shard hold the same points, a shard only fails if
+  // all of its workers did; points streamed by workers before they
+  // failed are still merged.
+  for (const auto &shard_streams : streams) {
+    grpc::Status status = grpc::Status::OK;
+    for (const auto &stream : shard_streams) {
+      status = stream->CallStatus();
+      if (status.ok()) {
+        break;
+      }
+    }
+    if (!status.ok()) {
+      LOG_EVERY_N(WARNING, 10000)
+          << "unable to stream user timeline because a shard is down";
+      return status;
+    }
+  }
+
+  return grpc::Status::OK;
+}
+
 grpc::Status
 Mixer::GetUserNearbyFolks(grpc::ServerContext *context,
                           const proto::GetUserNearbyFolks_Request *request,
                           proto::GetUserNearbyFolks_Response *response) {
+  std::map<uint64_t, int> scores;
+  grpc::Status status =
+      ScoreUserNearbyFolks(context, request->user_id(), &scores);
+  if (!status.ok()) {
+    return status;
+  }
+
+  AddNearbyFolks(scores, response->mutable_folk());
+
+  return grpc::Status::OK;
+}
+
+grpc::Status Mixer::StreamUserNearbyFolks(
+    grpc::ServerContext *context,
+    const proto::GetUserNearbyFolks_Request *request,
+    grpc::ServerWriter<proto::GetUserNearbyFolks_Response> *writer) {
+  return StreamUserNearbyFolks(
+      context, request,
+      [writer](const proto::GetUserNearbyFolks_Response &response) {
+        return writer->Write(response);
+      });
+}
+
+grpc::Status Mixer::StreamUserNearbyFolks(
+    grpc::ServerContext *context,
+    const proto::GetUserNearbyFolks_Request *request,
+    const std::function<bool(const proto::GetUserNearbyFolks_Response &)>
+        &write) {
+  // Scores of a folk add up over all blocks, they are only known once
+  // all of them are read.
+  std::map<uint64_t, int> scores;
+  grpc::Status status =
+      ScoreUserNearbyFolks(context, request->user_id(), &scores);
+  if (!status.ok()) {
+    return status;
+  }
+
+  proto::GetUserNearbyFolks_Response response;
+  for (const auto &score : scores) {
+    if (score.second < correlator_config_.minutes_to_match_) {
+      continue;
+    }
+
+    proto::NearbyUserFolk *folk = response.add_folk();
+    folk->set_user_id(score.first);
+    folk->set_score(score.second);
+    if (response.folk_size() >= stream_chunk_size_) {
+      if (!write(response)) {
+        return grpc::Status(grpc::StatusCode::CANCELLED,
+                            "unable to stream nearby folks to client");
+      }
+      response.Clear();
+    }
+  }
+
+  if (response.folk_size() > 0 && !write(response)) {
+    return grpc::Status(grpc::StatusCode::CANCELLED,
+                        "unable to stream nearby folks to client");
+  }
+
+  return grpc::Status::OK;
+}
+
+grpc::Status Mixer::ScoreUserNearbyFolks(grpc::ServerContext *context,
+                                         uint64_t user_id,
+                                         std::map<uint64_t, int> *scores) {
   proto::GetUserTimeline_Response tl_rsp;
   proto::GetUserTimeline_Request tl_request;
-  tl_request.set_user_id(request->user_id());
+  tl_request.set_user_id(user_id);
   grpc::Status grpc_status = GetUserTimeline(context, &tl_request, &tl_rsp);
   if (!grpc_status.ok()) {
     return grpc_status;
   }
 
-  std::map<uint64_t, int> scores;
+  std::vector<std::vector<std::string>> point_blocks;
+  std::vector<ShardBlocks> shard_blocks(all_handlers_.size() + 1);
+  BlocksAroundTimeline(user_id, tl_rsp, &point_blocks, &shard_blocks);
+
+  return correlator_config_.pushdown_
+             ? CorrelateInWorkers(context, user_id, tl_rsp, point_blocks,
+                                  &shard_blocks, scores)
+             : CorrelateInMixer(context, user_id, tl_rsp, point_blocks,
+                                &shard_blocks, scores);
+}
+
+grpc::Status Mixer::GetUsersNearbyFolks(
+    grpc::ServerContext *context,
+    const proto::GetUsersNearbyFolks_Request *request,
+    grpc::ServerWriter<proto::GetUsersNearbyFolks_Response> *writer) {
+  return GetUsersNearbyFolks(
+      context, request,
+      [writer](const proto::GetUsersNearbyFolks_Response &response) {
+        return writer->Write(response);
+      });
+}
+
+grpc::Status Mixer::GetUsersNearbyFolks(
+    grpc::ServerContext *context,
+    const proto::GetUsersNearbyFolks_Request *request,
+    const std::function<bool(const proto::GetUsersNearbyFolks_Response &)>
+        &write) {
+  std::vector<uint64_t> user_ids;
+  std::set<uint64_t> seen;
+  for (uint64_t user_id : request->user_id()) {
+    if (seen.insert(user_id).second) {
+      user_ids.push_back(user_id);
+    }
+  }
+
+  // Timelines of all users are fetched from all workers of all shards
+  // at once.
+  std::vector<proto::GetUserTimeline_Request> tl_requests(user_ids.size());
+  std::vector<std::vector<std::unique_ptr<ShardHandler::TimelineFetch>>>
+      fetches(user_ids.size());
+  for (size_t i = 0; i < user_ids.size(); ++i) {
+    tl_requests[i].set_user_id(user_ids[i]);
+    for (auto &handler : all_handlers_) {
+      fetches[i].push_back(
+          handler->StartGetUserTimeline(&tl_requests[i], context->deadline()));
+    }
+  }
+
+  // Blocks around all users are merged, so that blocks around several
+  // of them are only read once.
+  std::vector<proto::GetUserTimeline_Response> tl_rsps(user_ids.size());
+  std::vector<std::vector<std::vector<std::string>>> point_blocks(
+      user_ids.size());
+  std::vector<ShardBlocks> shard_blocks(all_handlers_.size() + 1);
+  for (size_t i = 0; i < user_ids.size(); ++i) {
+    std::vector<proto::GetUserTimeline_Response *> timelines;
+    for (size_t j = 0; j < all_handlers_.size(); ++j) {
+      grpc::Status status = all_handlers_[j]->FinishGetUserTimeline(
+          fetches[i][j].get(), &timelines);
+      if (!status.ok()) {
+        LOG_EVERY_N(WARNING, 10000)
+            << "unable to retrieve user timeline because a shard is down";
+        return status;
+      }
+    }
+
+    MergeTimelines(timelines, &tl_rsps[i]);
+    BlocksAroundTimeline(user_ids[i], tl_rsps[i], &point_blocks[i],
+                         &shard_blocks);
+  }
+
+  // Entries of all users are read, the user id only splits them
+  // between the user and folks in responses of workers.
+  Blocks blocks;
+  grpc::Status status = FetchBlocks(context, 0, &shard_blocks, &blocks);
+  if (!status.ok()) {
+    return status;
+  }
 
-  // We don't use all_handlers_ here because *order* is important, we
-  // want the default handler to be the fallback if no other found
-  // it. The default handler will always consider it can accept any
-  // request, even if it is supposed to be handled by another one.
-  std::vector<std::shared_ptr<ShardHandler>> handlers = area_handlers_;
-  handlers.push_back(default_handler_);
+  for (size_t i = 0; i < user_ids.size(); ++i) {
+    std::map<uint64_t, int> scores;
+    ScoreInMixer(user_ids[i], point_blocks[i], blocks, &scores);
 
-  for (int i = 0; i < tl_rsp.point_size(); ++i) {
+    proto::GetUsersNearbyFolks_Response response;
+    response.set_user_id(user_ids[i]);
+    AddNearbyFolks(scores, response.mutable_folk());
+    if (!write(response)) {
+      return grpc::Status(grpc::StatusCode::CANCELLED,
+                          "unable to stream nearby folks to client");
+    }
+  }
+
+  return grpc::Status::OK;
+}
 
-    std::set<proto::BlockEntry, CompareBlockEntry> user_entries;
-    std::set<proto::BlockEntry, CompareBlockEntry> folk_entries;
+void Mixer::BlocksAroundTimeline(
+    uint64_t user_id, const proto::GetUserTimeline_Response &timeline,
+    std::vector<std::vector<std::string>> *point_blocks,
+    std::vector<ShardBlocks> *shard_blocks) {
+  point_blocks->resize(timeline.point_size());
 
-    const auto &point = tl_rsp.point(i);
+  std::string key_raw;
+  for (int i = 0; i < timeline.point_size(); ++i) {
+    const auto &point = timeline.point(i);
     std::list<proto::DbKey> keys;
-    Status status =
-        BuildKeysToSearchAroundPoint(request->user_id(), point, &keys);
+    Status status = BuildKeysToSearchAroundPoint(user_id, point, &keys);
     if (status != StatusCode::OK) {
       LOG(WARNING) << "can't build key for block, status=" << status;
       continue;
     }
 
-    for (const auto &key : keys) {
-      for (auto &handler : handlers) {
-        bool found = false;
-        status = handler->InternalBuildBlockForUser(
-            key, request->user_id(), &user_entries, &folk_entries, &found);
-        if (status != StatusCode::OK) {
-          LOG_EVERY_N(WARNING, 1000) << "unable to get internal block for user";
+    for (auto &key : keys) {
+      EncodeTimelineKey(key, &key_raw);
+      std::string block = TimelineKeyZone(key_raw).ToString();
+
+      const int shard =
+          router_.Route(ZoneToGPSLocation(key.gps_latitude_zone()),
+                        ZoneToGPSLocation(key.gps_longitude_zone()),
+                        key.timestamp());
+      (*shard_blocks)[shard == Router::kDefaultShard ? all_handlers_.size()
+                                                     : shard]
+          .emplace(block, std::move(key));
+      (*point_blocks)[i].push_back(std::move(block));
+    }
+  }
+}
+
+void Mixer::AddNearbyFolks(
+    const std::map<uint64_t, int> &scores,
+    google::protobuf::RepeatedPtrField<proto::NearbyUserFolk> *folks) {
+  for (const auto &score : scores) {
+    if (score.second >= correlator_config_.minutes_to_match_) {
+      proto::NearbyUserFolk *folk = folks->Add();
+      folk->set_user_id(score.first);
+      folk->set_score(score.second);
+    }
+  }
+}
+
+grpc::Status Mixer::CorrelateInMixer(
+    grpc::ServerContext *context, uint64_t user_id,
+    const proto::GetUserTimeline_Response &timeline,
+    const std::vector<std::vector<std::string>> &point_blocks,
+    std::vector<ShardBlocks> *shard_blocks, std::map<uint64_t, int> *scores) {
+  Blocks blocks;
+  grpc::Status status = FetchBlocks(context, user_id, shard_blocks, &blocks);
+  if (!status.ok()) {
+    return status;
+  }
+
+  ScoreInMixer(user_id, point_blocks, blocks, scores);
+
+  return grpc::Status::OK;
+}
+
+grpc::Status Mixer::FetchBlocks(grpc::ServerContext *context,
+                                uint64_t user_id,
+                                std::vector<ShardBlocks> *shard_blocks,
+                                Blocks *blocks) {
+  // One call per worker of each shard, all at once, for blocks which
+  // aren't cached.
+  std::vector<ShardHandler *> handlers;
+  std::vector<std::unique_ptr<ShardHandler::BlockFetch>> fetches;
+  std::vector<std::string> fetched_zones;
+  for (size_t i = 0; i < shard_blocks->size(); ++i) {
+    ShardHandler *handler = i < all_handlers_.size()
+                                ? all_handlers_[i].get()
+                                : default_handler_.get();
+    if (handler == nullptr) {
+      continue;
+    }
+
+    std::vector<proto::DbKey> keys;
+    keys.reserve((*shard_blocks)[i].size());
+    for (auto &block : (*shard_blocks)[i]) {
+      if (block_cache_ != nullptr) {
+        BlockCache::Entries entries = block_cache_->Lookup(block.first);
+        if (entries != nullptr) {
+          (*blocks)[block.first] = std::move(entries);
+          continue;
+        }
+      }
+      fetched_zones.push_back(block.first);
+      keys.push_back(std::move(block.second));
+    }
+
+    if (keys.empty()) {
+      continue;
+    }
+
+    handlers.push_back(handler);
+    fetches.push_back(handler->StartBuildBlocksForUser(user_id, std::move(keys),
+                                                       context->deadline()));
+  }
+
+  // Blocks are fetched raw, they must all be received before entries
+  // are referenced from them.
+  std::vector<proto::BuildBlocksForUser_Response> shard_entries;
+  for (size_t i = 0; i < fetches.size(); ++i) {
+    grpc::Status status =
+        handlers[i]->FinishBuildBlocksForUser(fetches[i].get(), &shard_entries);
+    if (!status.ok()) {
+      LOG_EVERY_N(WARNING, 1000) << "unable to get internal block for user";
+      return grpc::Status(grpc::StatusCode::INTERNAL,
+                          "unable to get internal block for user");
+    }
+  }
+
+  // Raw entries of fetched blocks, merged between workers of a shard
+  // by raw key so that entries are decoded once.
+  std::map<std::string, std::map<std::string_view, rocksdb::Slice>> fetched;
+
+  std::string key_raw;
+  rocksdb::Slice entry_key;
+  rocksdb::Slice entry_value;
+  for (const auto &shard_block : shard_entries) {
+    EncodeTimelineKey(shard_block.timeline_key(), &key_raw);
+    auto &entries = fetched[TimelineKeyZone(key_raw).ToString()];
+
+    RawEntryReader reader(shard_block.raw_entries());
+    while (reader.Next(&entry_key, &entry_value)) {
+      entries.emplace(std::string_view(entry_key.data(), entry_key.size()),
+                      entry_value);
+    }
+    if (reader.Failed()) {
+      LOG_EVERY_N(WARNING, 1000) << "can't decode internal block entries";
+      return grpc::Status(grpc::StatusCode::INTERNAL,
+                          "can't decode internal block entries");
+    }
+  }
+
+  // Workers only stream blocks with entries, empty ones are cached
+  // too so that they aren't read again.
+  for (const auto &zone : fetched_zones) {
+    auto entries = std::make_shared<std::vector<proto::BlockEntry>>();
+    auto it = fetched.find(zone);
+    if (it != fetched.end()) {
+      entries->resize(it->second.size());
+      size_t i = 0;
+      for (const auto &entry : it->second) {
+        const rocksdb::Slice key(entry.first.data(), entry.first.size());
+        if (!DecodeRawEntry(key, entry.second, &(*entries)[i++])) {
+          LOG_EVERY_N(WARNING, 1000) << "can't decode internal block entry";
           return grpc::Status(grpc::StatusCode::INTERNAL,
-                              "unable to get internal block for user");
+                              "can't decode internal block entry");
         }
-        if (found) {
-          break;
+      }
+    }
+    if (block_cache_ != nullptr) {
+      block_cache_->Insert(zone, entries);
+    }
+    (*blocks)[zone] = std::move(entries);
+  }
+
+  return grpc::Status::OK;
+}
+
+void Mixer::ScoreInMixer(
+    uint64_t user_id, const std::vector<std::vector<std::string>> &point_blocks,
+    const Blocks &blocks, std::map<uint64_t, int> *scores) {
+  // Blocks around a point are distinct zones, so their entries are
+  // too: entries of the user and of folks around each point are
+  // referenced from blocks instead of being copied and merged.
+  std::vector<const proto::BlockEntry *> user_entries;
+  std::vector<const proto::BlockEntry *> folk_index;
+  std::vector<CorrelationEntry> folks;
+  std::vector<size_t> nearby_folks;
+  for (const auto &point : point_blocks) {
+    user_entries.clear();
+    folk_index.clear();
+    folks.clear();
+
+    for (const auto &block : point) {
+      auto it = blocks.find(block);
+      if (it == blocks.end()) {
+        continue;
+      }
+      for (const auto &entry : *it->second) {
+        if (static_cast<uint64_t>(entry.key().user_id()) == user_id) {
+          user_entries.push_back(&entry);
+        } else {
+          folk_index.push_back(&entry);
+          folks.push_back({&entry.key(), &entry.value()});
         }
       }
     }
 
-    // Naive implementation, this is to be optimized with bitmaps etc.
-    for (const auto &user_entry : user_entries) {
-      for (const auto &folk_entry : folk_entries) {
-        if (IsNearbyFolk(correlator_config_, user_entry.key(),
-                         user_entry.value(), folk_entry.key(),
-                         folk_entry.value())) {
-          scores[folk_entry.key().user_id()]++;
+    const Correlator correlator(correlator_config_, folks,
+                                user_entries.size());
+    for (const auto *user_entry : user_entries) {
+      nearby_folks.clear();
+      correlator.NearbyFolks(user_entry->key(), user_entry->value(),
+                             &nearby_folks);
+      for (size_t folk : nearby_folks) {
+        (*scores)[folk_index[folk]->key().user_id()]++;
+      }
+    }
+  }
+}
+
+grpc::Status Mixer::CorrelateInWorkers(
+    grpc::ServerContext *context, uint64_t user_id,
+    const proto::GetUserTimeline_Response &timeline,
+    const std::vector<std::vector<std::string>> &point_blocks,
+    std::vector<ShardBlocks> *shard_blocks, std::map<uint64_t, int> *scores) {
+  // Points of the user in each block, they are the entries of the
+  // user the mixer would get from workers.
+  std::map<std::string, std::vector<uint32_t>> block_points;
+  std::string key_raw;
+  for (int i = 0; i < timeline.point_size(); ++i) {
+    const auto &point = timeline.point(i);
+    EncodeTimelineKey(MakeKey(point.timestamp(), user_id,
+                              GPSLocationToGPSZone(point.gps_longitude()),
+                              GPSLocationToGPSZone(point.gps_latitude())),
+                      &key_raw);
+    block_points[TimelineKeyZone(key_raw).ToString()].push_back(i);
+  }
+
+  // Each point of the timeline matches entries of the user in blocks
+  // around it with entries of folks in the same blocks; for each
+  // block, this counts how many times each point of the user is
+  // matched with entries of folks in the block.
+  std::map<std::string, std::map<uint32_t, uint32_t>> block_weights;
+  for (size_t i = 0; i < point_blocks.size(); ++i) {
+    std::vector<uint32_t> user_points;
+    for (const auto &block : point_blocks[i]) {
+      auto it = block_points.find(block);
+      if (it != block_points.end()) {
+        user_points.insert(user_points.end(), it->second.begin(),
+                           it->second.end());
+      }
+    }
+    if (user_points.empty()) {
+      continue;
+    }
+
+    for (const auto &block : point_blocks[i]) {
+      std::map<uint32_t, uint32_t> &weights = block_weights[block];
+      for (uint32_t user_point : user_points) {
+        ++weights[user_point];
+      }
+    }
+  }
+
+  // One call per worker of each shard, all at once; each shard only
+  // gets the points of the user it needs.
+  std::vector<ShardHandler *> handlers;
+  std::vector<std::unique_ptr<ShardHandler::Correlation>> correlations;
+  for (size_t i = 0; i < shard_blocks->size(); ++i) {
+    ShardHandler *handler = i < all_handlers_.size()
+                                ? all_handlers_[i].get()
+                                : default_handler_.get();
+    if (handler == nullptr) {
+      continue;
+    }
+
+    proto::CorrelateUser_Request shard_request;
+    shard_request.set_user_id(user_id);
+    shard_request.set_nearby_seconds(correlator_config_.nearby_time_sec_);
+    shard_request.set_nearby_gps_distance(
+        correlator_config_.nearby_gps_distance_);
+
+    std::map<uint32_t, uint32_t> shard_points;
+    for (auto &block : (*shard_blocks)[i]) {
+      auto it = block_weights.find(block.first);
+      if (it == block_weights.end()) {
+        continue;
+      }
+
+      proto::CorrelationBlock *shard_block = shard_request.add_block();
+      *shard_block->mutable_timeline_key() = std::move(block.second);
+      for (const auto &weight : it->second) {
+        auto point = shard_points.emplace(weight.first, shard_points.size());
+        if (point.second) {
+          *shard_request.add_point() = timeline.point(weight.first);
         }
+
+        proto::CorrelationBlock::UserPoint *user_point =
+            shard_block->add_user_point();
+        user_point->set_index(point.first->second);
+        user_point->set_weight(weight.second);
       }
     }
+
+    if (shard_request.block_size() == 0) {
+      continue;
+    }
+
+    handlers.push_back(handler);
+    correlations.push_back(handler->StartCorrelateUser(
+        std::move(shard_request), context->deadline()));
   }
 
-  for (const auto &score : scores) {
-    proto::NearbyUserFolk *folk = response->add_folk();
-    if (score.second >= correlator_config_.minutes_to_match_) {
-      folk->set_user_id(score.first);
-      folk->set_score(score.second);
+  for (size_t i = 0; i < correlations.size(); ++i) {
+    grpc::Status status =
+        handlers[i]->FinishCorrelateUser(correlations[i].get(), scores);
+    if (!status.ok()) {
+      LOG_EVERY_N(WARNING, 1000) << "unable to correlate user in a shard";
+      return grpc::Status(grpc::StatusCode::INTERNAL,
+                          "unable to correlate user in a shard");
     }
   }
 
@@ -1,15 +1,20 @@
 #pragma once
 
+#include <functional>
 #include <grpc++/grpc++.h>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "common/rate_counter.h"
 #include "common/status.h"
 #include "proto/backtrace.grpc.pb.h"
+#include "server/block_cache.h"
 #include "server/mixer_config.h"
 #include "server/proto.h"
+#include "server/router.h"
 #include "server/shard_handler.h"
 
 namespace bt {
@@ -38,14 +43,119 @@ public:
                      const proto::GetUserNearbyFolks_Request *request,
                      proto::GetUserNearbyFolks_Response *response) override;
 
+  // Streaming versions of the above, responses are chunks of the
+  // result. Timelines are merged from workers while they stream them,
+  // without holding the whole timeline.
+  grpc::Status StreamUserTimeline(
+      grpc::ServerContext *context,
+      const proto::GetUserTimeline_Request *request,
+      grpc::ServerWriter<proto::GetUserTimeline_Response> *writer) override;
+  grpc::Status StreamUserNearbyFolks(
+      grpc::ServerContext *context,
+      const proto::GetUserNearbyFolks_Request *request,
+      grpc::ServerWriter<proto::GetUserNearbyFolks_Response> *writer)
+      override;
+
+  // Same as above, chunks are passed to write instead of a stream, the
+  // call fails if write returns false.
+  grpc::Status StreamUserTimeline(
+      grpc::ServerContext *context,
+      const proto::GetUserTimeline_Request *request,
+      const std::function<bool(const proto::GetUserTimeline_Response &)>
+          &write);
+  grpc::Status StreamUserNearbyFolks(
+      grpc::ServerContext *context,
+      const proto::GetUserNearbyFolks_Request *request,
+      const std::function<bool(const proto::GetUserNearbyFolks_Response &)>
+          &write);
+
   grpc::Status GetMixerStats(grpc::ServerContext *context,
                              const proto::MixerStats_Request *request,
                              proto::MixerStats_Response *response) override;
 
+  // Blocks around all users are read once, and folks are always
+  // scored by the mixer: the same blocks are shared by several users.
+  grpc::Status GetUsersNearbyFolks(
+      grpc::ServerContext *context,
+      const proto::GetUsersNearbyFolks_Request *request,
+      grpc::ServerWriter<proto::GetUsersNearbyFolks_Response> *writer)
+      override;
+
+  // Same as above, responses are passed to write instead of a stream,
+  // the call fails if write returns false.
+  grpc::Status GetUsersNearbyFolks(
+      grpc::ServerContext *context,
+      const proto::GetUsersNearbyFolks_Request *request,
+      const std::function<bool(const proto::GetUsersNearbyFolks_Response &)>
+          &write);
+
 private:
   Status InitHandlers(const MixerConfig &config);
   Status InitService(const MixerConfig &config);
 
+  // Drops the cached blocks where points of a request are pushed, they
+  // are outdated.
+  void InvalidateBlocks(const proto::PutLocation_Request &request,
+                        const LocationColumns &columns);
+
+  // Drops the cached blocks of a point, one per time zone it spans.
+  void InvalidateBlock(int64_t timestamp, uint32_t duration,
+                       float gps_latitude, float gps_longitude);
+
+  // Keys of blocks to read from a shard, sorted in timeline key order
+  // and indexed by their zone in timeline keys (see keys.h).
+  using ShardBlocks = std::map<std::string, proto::DbKey>;
+
+  // All entries of blocks, indexed by their zone.
+  using Blocks = std::map<std::string, BlockCache::Entries>;
+
+  // Scores folks around a user.
+  grpc::Status ScoreUserNearbyFolks(grpc::ServerContext *context,
+                                    uint64_t user_id,
+                                    std::map<uint64_t, int> *scores);
+
+  // Computes blocks around each point of the timeline of a user, and
+  // adds them to blocks to read from each shard (the last one is for
+  // the default shard).
+  void BlocksAroundTimeline(uint64_t user_id,
+                            const proto::GetUserTimeline_Response &timeline,
+                            std::vector<std::vector<std::string>> *point_blocks,
+                            std::vector<ShardBlocks> *shard_blocks);
+
+  // Adds folks with a high enough score.
+  void AddNearbyFolks(
+      const std::map<uint64_t, int> &scores,
+      google::protobuf::RepeatedPtrField<proto::NearbyUserFolk> *folks);
+
+  // Scores folks around the points of a user, either by reading all
+  // entries of blocks around the user, or by having workers score
+  // folks in their blocks. Keys of blocks are moved out of
+  // shard_blocks. Each block is read once per query, and blocks in
+  // the block cache aren't read at all.
+  grpc::Status
+  CorrelateInMixer(grpc::ServerContext *context, uint64_t user_id,
+                   const proto::GetUserTimeline_Response &timeline,
+                   const std::vector<std::vector<std::string>> &point_blocks,
+                   std::vector<ShardBlocks> *shard_blocks,
+                   std::map<uint64_t, int> *scores);
+  grpc::Status
+  CorrelateInWorkers(grpc::ServerContext *context, uint64_t user_id,
+                     const proto::GetUserTimeline_Response &timeline,
+                     const std::vector<std::vector<std::string>> &point_blocks,
+                     std::vector<ShardBlocks> *shard_blocks,
+                     std::map<uint64_t, int> *scores);
+
+  // Reads all entries of blocks from workers, or from the block cache;
+  // keys of blocks are moved out of shard_blocks.
+  grpc::Status FetchBlocks(grpc::ServerContext *context, uint64_t user_id,
+                           std::vector<ShardBlocks> *shard_blocks,
+                           Blocks *blocks);
+
+  // Scores folks around the points of a user in blocks.
+  void ScoreInMixer(uint64_t user_id,
+                    const std::vector<std::vector<std::string>> &point_blocks,
+                    const Blocks &blocks, std::map<uint64_t, int> *scores);
+
   Status BuildKeysToSearchAroundPoint(uint64_t user_id,
                                       const proto::UserTimelinePoint &point,
                                       std::list<proto::DbKey> *keys);
@@ -54,11 +164,20 @@ private:
   std::vector<std::shared_ptr<ShardHandler>> area_handlers_;
   std::shared_ptr<ShardHandler> default_handler_;
 
+  // Maps points to handlers, indexes are the ones of all_handlers_.
+  Router router_;
+
   RateCounter pushed_points_counter_;
 
   std::unique_ptr<grpc::Server> grpc_;
 
   CorrelatorConfig correlator_config_;
+  FlusherConfig flusher_config_;
+  int stream_chunk_size_ = kDefaultStreamChunkSize;
+
+  // Blocks read by previous queries, only set if enabled in the
+  // config.
+  std::unique_ptr<BlockCache> block_cache_;
 };
 
 } // namespace bt
@@ -18,8 +18,20 @@ const CorrelatorConfig &MixerConfig::ConfigForCorrelator() const {
   return correlator_config_;
 }
 
+const FlusherConfig &MixerConfig::ConfigForFlusher() const {
+  return flusher_config_;
+}
+
 bool MixerConfig::BackoffFailFast() const { return backoff_fail_fast_; }
 
+std::chrono::milliseconds MixerConfig::WorkerTimeout() const {
+  return std::chrono::milliseconds(worker_timeout_ms_);
+}
+
+int MixerConfig::StreamChunkSize() const { return stream_chunk_size_; }
+
+bool MixerConfig::CompressBatches() const { return compress_batches_; }
+
 std::string MixerConfig::NetworkAddress() const {
   std::stringstream ss;
 
@@ -83,10 +95,15 @@ Status MixerConfig::MakePartitionConfigs(const Config &config) {
               return lhs.ts_start_ < rhs.ts_start_;
             });
 
+  // Partitions last until the next set of partitions starts, those
+  // of the same set share the same start.
   uint64_t ts_end = 0;
   for (int i = partition_configs_.size() - 1; i >= 0; --i) {
+    if (i + 1 < static_cast<int>(partition_configs_.size()) &&
+        partition_configs_[i + 1].ts_start_ > partition_configs_[i].ts_start_) {
+      ts_end = partition_configs_[i + 1].ts_start_;
+    }
     partition_configs_[i].ts_end_ = ts_end;
-    ts_end = partition_configs_[i].ts_start_;
   }
 
   return StatusCode::OK;
@@ -116,6 +133,11 @@ Status MixerConfig::MakeNetworkConfig(const Config &config) {
   port_ = config.Get<int>("network.port");
   host_ = config.Get<std::string>("network.host");
   backoff_fail_fast_ = config.Get<bool>("backoff_fail_fast", false);
+  worker_timeout_ms_ =
+      config.Get<int>("network.worker_timeout_ms", kDefaultWorkerTimeoutMs);
+  stream_chunk_size_ =
+      config.Get<int>("network.stream_chunk_size", kDefaultStreamChunkSize);
+  compress_batches_ = config.Get<bool>("network.compress_batches", false);
 
   if (port_ <= 0) {
     RETURN_ERROR(INVALID_CONFIG, "mixer must have a valid network port");
@@ -123,6 +145,13 @@ Status MixerConfig::MakeNetworkConfig(const Config &config) {
   if (host_.empty()) {
     RETURN_ERROR(INVALID_CONFIG, "mixer must have a valid network host");
   }
+  if (worker_timeout_ms_ <= 0) {
+    RETURN_ERROR(INVALID_CONFIG, "mixer must have a positive worker timeout");
+  }
+  if (stream_chunk_size_ <= 0) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "mixer must have a positive stream chunk size");
+  }
 
   return StatusCode::OK;
 }
@@ -134,6 +163,12 @@ Status MixerConfig::MakeCorrelatorConfig(const Config &config) {
       "correlator.nearby_gps_distance", kGPSZoneNearbyApproximation);
   correlator_config_.minutes_to_match_ =
       config.Get<int>("correlator.minutes_to_match", kMinutesToMatch);
+  correlator_config_.pushdown_ =
+      config.Get<bool>("correlator.pushdown", true);
+  correlator_config_.block_cache_size_ =
+      config.Get<int>("correlator.block_cache_size", 0);
+  correlator_config_.block_cache_ttl_ms_ = config.Get<int>(
+      "correlator.block_cache_ttl_ms", kDefaultBlockCacheTtlMs);
 
   if (correlator_config_.nearby_time_sec_ <= 0) {
     RETURN_ERROR(INVALID_CONFIG,
@@ -148,6 +183,31 @@ Status MixerConfig::MakeCorrelatorConfig(const Config &config) {
         INVALID_CONFIG,
         "correlator config must have a positive number of minutesto match");
   }
+  if (correlator_config_.block_cache_size_ < 0) {
+    RETURN_ERROR(INVALID_CONFIG, "correlator.block_cache_size should be >= 0");
+  }
+  if (correlator_config_.block_cache_ttl_ms_ <= 0) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "correlator config must have a positive block cache ttl");
+  }
+
+  return StatusCode::OK;
+}
+
+Status MixerConfig::MakeFlusherConfig(const Config &config) {
+  flusher_config_.enabled_ = config.Get<bool>("flusher.enabled", false);
+  flusher_config_.max_points_ =
+      config.Get<int>("flusher.max_points", kDefaultFlusherMaxPoints);
+  flusher_config_.max_delay_ms_ =
+      config.Get<int>("flusher.max_delay_ms", kDefaultFlusherMaxDelayMs);
+
+  if (flusher_config_.max_points_ <= 0) {
+    RETURN_ERROR(INVALID_CONFIG,
+                 "flusher config must have a positive number of points");
+  }
+  if (flusher_config_.max_delay_ms_ <= 0) {
+    RETURN_ERROR(INVALID_CONFIG, "flusher config must have a positive delay");
+  }
 
   return StatusCode::OK;
 }
@@ -158,6 +218,7 @@ Status MixerConfig::MakeMixerConfig(const Config &config,
   RETURN_IF_ERROR(mixer_config->MakeShardConfigs(config));
   RETURN_IF_ERROR(mixer_config->MakeNetworkConfig(config));
   RETURN_IF_ERROR(mixer_config->MakeCorrelatorConfig(config));
+  RETURN_IF_ERROR(mixer_config->MakeFlusherConfig(config));
 
   return StatusCode::OK;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <utility>
 #include <vector>
@@ -12,6 +13,11 @@ namespace bt {
 
 constexpr auto kMixerConfigType = "mixer";
 constexpr auto kDefaultArea = "default";
+constexpr auto kDefaultWorkerTimeoutMs = 10000;
+constexpr auto kDefaultFlusherMaxPoints = 5000;
+constexpr auto kDefaultFlusherMaxDelayMs = 20;
+constexpr auto kDefaultBlockCacheTtlMs = 5000;
+constexpr auto kDefaultStreamChunkSize = 1000;
 
 // Config of a shard.
 struct ShardConfig {
@@ -36,6 +42,23 @@ struct CorrelatorConfig {
   int minutes_to_match_ = kMinutesToMatch;
   int nearby_time_sec_ = kTimeNearbyApproximation;
   float nearby_gps_distance_ = kGPSZoneNearbyApproximation;
+
+  // Whether or not workers score folks in their blocks, instead of
+  // sending all entries of blocks to the mixer.
+  bool pushdown_ = true;
+
+  // Maximum number of blocks read from workers kept by the mixer
+  // between queries (0 disables the cache), and for how long; only
+  // used without pushdown.
+  int block_cache_size_ = 0;
+  int block_cache_ttl_ms_ = kDefaultBlockCacheTtlMs;
+};
+
+// Config for the background flusher of shard handlers.
+struct FlusherConfig {
+  bool enabled_ = false;
+  int max_points_ = kDefaultFlusherMaxPoints;
+  int max_delay_ms_ = kDefaultFlusherMaxDelayMs;
 };
 
 // Config for mixers.
@@ -49,20 +72,37 @@ public:
   std::string NetworkAddress() const;
   bool BackoffFailFast() const;
 
+  // Deadline of calls to workers, relative to when they are sent.
+  std::chrono::milliseconds WorkerTimeout() const;
+
+  // Maximum number of points or folks per message of streamed
+  // responses.
+  int StreamChunkSize() const;
+
+  // Whether or not points sent to workers in columnar batches are
+  // compressed with LZ4.
+  bool CompressBatches() const;
+
   const CorrelatorConfig &ConfigForCorrelator() const;
+  const FlusherConfig &ConfigForFlusher() const;
 
 private:
   Status MakePartitionConfigs(const Config &config);
   Status MakeShardConfigs(const Config &config);
   Status MakeNetworkConfig(const Config &config);
   Status MakeCorrelatorConfig(const Config &config);
+  Status MakeFlusherConfig(const Config &config);
 
   bool backoff_fail_fast_ = false;
+  int worker_timeout_ms_ = kDefaultWorkerTimeoutMs;
+  int stream_chunk_size_ = kDefaultStreamChunkSize;
+  bool compress_batches_ = false;
   int port_ = 0;
   std::string host_;
   std::vector<PartitionConfig> partition_configs_;
   std::vector<ShardConfig> shard_configs_;
   CorrelatorConfig correlator_config_;
+  FlusherConfig flusher_config_;
 };
 
 } // namespace bt
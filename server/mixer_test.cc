@@ -1,3 +1,6 @@
+#include <thread>
+#include <vector>
+
 #include "server/cluster_test.h"
 
 namespace bt {
@@ -41,7 +44,327 @@ TEST_P(MixerTest, MixerStatsOK) {
   }
 }
 
+// Tests that correlating many users at once gives the same folks as
+// correlating them one by one, once per user.
+TEST_P(MixerTest, UsersNearbyFolksOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kBaseTs = 1582410000;
+
+  EXPECT_TRUE(PushPoint(kBaseTs, kBaseDuration, kBaseUserId,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+  EXPECT_TRUE(PushPoint(kBaseTs + 1, kBaseDuration, kBaseUserId + 1,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+  EXPECT_TRUE(PushPoint(kBaseTs, kBaseDuration, kBaseUserId + 2,
+                        kBaseGpsLongitude + 0.1, kBaseGpsLatitude,
+                        kBaseGpsAltitude));
+
+  const std::vector<uint64_t> user_ids = {kBaseUserId, kBaseUserId + 2,
+                                          kBaseUserId, kBaseUserId + 1,
+                                          kBaseUserId + 9};
+
+  std::vector<proto::GetUsersNearbyFolks_Response> responses;
+  EXPECT_TRUE(GetUsersNearbyFolks(user_ids, &responses));
+  ASSERT_EQ(4, responses.size());
+
+  const std::vector<uint64_t> expected_user_ids = {
+      kBaseUserId, kBaseUserId + 2, kBaseUserId + 1, kBaseUserId + 9};
+  for (size_t i = 0; i < responses.size(); ++i) {
+    EXPECT_EQ(expected_user_ids[i], responses[i].user_id());
+
+    proto::GetUserNearbyFolks_Response response;
+    EXPECT_TRUE(GetNearbyFolks(expected_user_ids[i], &response));
+    ASSERT_EQ(response.folk_size(), responses[i].folk_size());
+    for (int j = 0; j < response.folk_size(); ++j) {
+      EXPECT_EQ(response.folk(j).user_id(), responses[i].folk(j).user_id());
+      EXPECT_EQ(response.folk(j).score(), responses[i].folk(j).score());
+    }
+  }
+
+  ASSERT_EQ(1, responses[0].folk_size());
+  EXPECT_EQ(kBaseUserId + 1, responses[0].folk(0).user_id());
+  EXPECT_EQ(1, responses[0].folk(0).score());
+  EXPECT_EQ(0, responses[1].folk_size());
+  EXPECT_EQ(0, responses[3].folk_size());
+}
+
+// Tests that streamed timelines and nearby folks are the same as the
+// ones returned in a single response, split in chunks.
+TEST_P(MixerTest, StreamOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kBaseTs = 1582410000;
+  constexpr int kPoints = 7;
+
+  for (int i = 0; i < kPoints; ++i) {
+    EXPECT_TRUE(PushPoint(kBaseTs + i * 3600, kBaseDuration, kBaseUserId,
+                          kBaseGpsLongitude, kBaseGpsLatitude,
+                          kBaseGpsAltitude));
+    EXPECT_TRUE(PushPoint(kBaseTs + i * 3600, kBaseDuration,
+                          kBaseUserId + 1 + i, kBaseGpsLongitude,
+                          kBaseGpsLatitude, kBaseGpsAltitude));
+  }
+
+  proto::GetUserTimeline_Response timeline;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId, &timeline));
+  ASSERT_EQ(kPoints, timeline.point_size());
+
+  std::vector<proto::GetUserTimeline_Response> timeline_chunks;
+  EXPECT_TRUE(StreamTimeline(kBaseUserId, &timeline_chunks));
+  EXPECT_EQ(4, timeline_chunks.size());
+
+  int i = 0;
+  for (const auto &chunk : timeline_chunks) {
+    for (const auto &point : chunk.point()) {
+      ASSERT_LT(i, timeline.point_size());
+      EXPECT_EQ(timeline.point(i).timestamp(), point.timestamp());
+      EXPECT_EQ(timeline.point(i).duration(), point.duration());
+      ++i;
+    }
+  }
+  EXPECT_EQ(kPoints, i);
+
+  proto::GetUserNearbyFolks_Response folks;
+  EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &folks));
+  ASSERT_EQ(kPoints, folks.folk_size());
+
+  std::vector<proto::GetUserNearbyFolks_Response> folk_chunks;
+  EXPECT_TRUE(StreamNearbyFolks(kBaseUserId, &folk_chunks));
+  EXPECT_EQ(4, folk_chunks.size());
+
+  i = 0;
+  for (const auto &chunk : folk_chunks) {
+    for (const auto &folk : chunk.folk()) {
+      ASSERT_LT(i, folks.folk_size());
+      EXPECT_EQ(folks.folk(i).user_id(), folk.user_id());
+      EXPECT_EQ(folks.folk(i).score(), folk.score());
+      ++i;
+    }
+  }
+  EXPECT_EQ(kPoints, i);
+
+  std::vector<proto::GetUserTimeline_Response> empty_chunks;
+  EXPECT_TRUE(StreamTimeline(kBaseUserId + 100, &empty_chunks));
+  EXPECT_TRUE(empty_chunks.empty());
+}
+
+// Tests that points pushed in columnar batches are stored like points
+// pushed one by one, with fixed-point coordinates.
+TEST_P(MixerTest, PushBatchOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kBaseTs = 1582410000;
+  constexpr int kPoints = 20;
+
+  std::vector<proto::Location> locations;
+  for (int i = 0; i < kPoints; ++i) {
+    proto::Location location;
+    location.set_timestamp(kBaseTs + (i % 2 ? i : -i) * 3600);
+    location.set_duration(i);
+    location.set_user_id(kBaseUserId + i % 2);
+    location.set_gps_longitude(kBaseGpsLongitude + i * 0.1);
+    location.set_gps_latitude(kBaseGpsLatitude - i * 0.1);
+    location.set_gps_altitude(kBaseGpsAltitude);
+    locations.push_back(location);
+  }
+  EXPECT_TRUE(PushBatch(locations));
+
+  for (int user = 0; user < 2; ++user) {
+    proto::GetUserTimeline_Response timeline;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId + user, &timeline));
+    ASSERT_EQ(kPoints / 2, timeline.point_size());
+
+    for (const auto &point : timeline.point()) {
+      const int i = point.duration();
+      EXPECT_EQ(user, i % 2);
+      EXPECT_EQ(locations[i].timestamp(), point.timestamp());
+      EXPECT_NEAR(locations[i].gps_longitude(), point.gps_longitude(), 1e-5);
+      EXPECT_NEAR(locations[i].gps_latitude(), point.gps_latitude(), 1e-5);
+      EXPECT_NEAR(locations[i].gps_altitude(), point.gps_altitude(), 1e-2);
+    }
+  }
+
+  // Columns of different sizes.
+  proto::PutLocation_Request request;
+  proto::PutLocation_Response response;
+  request.mutable_batch()->add_user_id(kBaseUserId);
+  grpc::ServerContext context;
+  grpc::Status status = GetMixer()->PutLocation(&context, &request, &response);
+  EXPECT_EQ(grpc::StatusCode::INVALID_ARGUMENT, status.error_code());
+}
+
 INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, MixerTest, CLUSTER_PARAMS);
 
+class MixerFlusherTest : public ClusterTestBase {
+public:
+  void SetUp() override {
+    mixer_flusher_ = true;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Tests that points pushed concurrently with the background flusher
+// are all written before requests complete.
+TEST_P(MixerFlusherTest, ConcurrentPushesOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kClients = 4;
+  constexpr int kPointsPerClient = 50;
+
+  std::vector<std::thread> clients;
+  for (int c = 0; c < kClients; ++c) {
+    // Each client uses its own mixer, GetMixer isn't thread-safe.
+    Mixer *mixer = mixers_.at(c % mixers_.size()).get();
+    clients.emplace_back([mixer, c]() {
+      for (int i = 0; i < kPointsPerClient; ++i) {
+        grpc::ServerContext context;
+        proto::PutLocation_Request request;
+        proto::PutLocation_Response response;
+
+        proto::Location *location = request.add_locations();
+        location->set_timestamp(kBaseTimestamp + c * kPointsPerClient + i);
+        location->set_duration(kBaseDuration);
+        location->set_user_id(kBaseUserId);
+        location->set_gps_longitude(kBaseGpsLongitude);
+        location->set_gps_latitude(kBaseGpsLatitude);
+        location->set_gps_altitude(kBaseGpsAltitude);
+
+        EXPECT_TRUE(mixer->PutLocation(&context, &request, &response).ok());
+      }
+    });
+  }
+  for (auto &client : clients) {
+    client.join();
+  }
+
+  proto::GetUserTimeline_Response response;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+  EXPECT_EQ(response.point_size(), kClients * kPointsPerClient);
+}
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, MixerFlusherTest,
+                         CLUSTER_PARAMS);
+
+class MixerNoPushdownTest : public ClusterTestBase {
+public:
+  void SetUp() override {
+    mixer_correlator_pushdown_ = false;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Tests that folks are scored the same way when the mixer reads all
+// entries of blocks instead of having workers score them.
+TEST_P(MixerNoPushdownTest, NearbyFolksOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kBaseTs = 1582410000;
+
+  // Two users at nearly the same position in different timestamp
+  // zones, and a third one far away.
+  EXPECT_TRUE(PushPoint(kBaseTs - 1, kBaseDuration, kBaseUserId,
+                        kBaseGpsLongitude + 0.000001,
+                        kBaseGpsLatitude - 0.000002, kBaseGpsAltitude));
+  EXPECT_TRUE(PushPoint(kBaseTs + 1, kBaseDuration, kBaseUserId + 1,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+  EXPECT_TRUE(PushPoint(kBaseTs, kBaseDuration, kBaseUserId + 2,
+                        kBaseGpsLongitude + 0.1, kBaseGpsLatitude,
+                        kBaseGpsAltitude));
+
+  {
+    proto::GetUserNearbyFolks_Response response;
+    EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &response));
+    EXPECT_EQ(1, response.folk_size());
+    EXPECT_EQ(kBaseUserId + 1, response.folk(0).user_id());
+    EXPECT_EQ(1, response.folk(0).score());
+  }
+
+  {
+    proto::GetUserNearbyFolks_Response response;
+    EXPECT_TRUE(GetNearbyFolks(kBaseUserId + 2, &response));
+    EXPECT_EQ(0, response.folk_size());
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, MixerNoPushdownTest,
+                         CLUSTER_PARAMS);
+
+class MixerBlockCacheTest : public ClusterTestBase {
+public:
+  void SetUp() override {
+    mixer_correlator_pushdown_ = false;
+    mixer_block_cache_size_ = 1000;
+    ClusterTestBase::SetUp();
+  }
+};
+
+// Tests that cached blocks give the same scores, and that points
+// pushed through a mixer are seen by its next queries.
+TEST_P(MixerBlockCacheTest, NearbyFolksOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kBaseTs = 1582410000;
+
+  EXPECT_TRUE(PushPoint(kBaseTs, kBaseDuration, kBaseUserId,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+  EXPECT_TRUE(PushPoint(kBaseTs + 1, kBaseDuration, kBaseUserId + 1,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+
+  for (int i = 0; i < 2; ++i) {
+    proto::GetUserNearbyFolks_Response response;
+    EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &response));
+    EXPECT_EQ(1, response.folk_size());
+    EXPECT_EQ(kBaseUserId + 1, response.folk(0).user_id());
+    EXPECT_EQ(1, response.folk(0).score());
+  }
+
+  // Other mixers only see the point once their blocks expire.
+  if (mixer_round_robin_) {
+    return;
+  }
+
+  EXPECT_TRUE(PushPoint(kBaseTs + 2, kBaseDuration, kBaseUserId + 2,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+
+  proto::GetUserNearbyFolks_Response response;
+  EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &response));
+  EXPECT_EQ(2, response.folk_size());
+}
+
+// Tests that a point invalidates the blocks of all time zones its
+// duration spans, not only the one where it starts.
+TEST_P(MixerBlockCacheTest, PointAcrossZonesOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  // Other mixers only see the point once their blocks expire.
+  if (mixer_round_robin_) {
+    return;
+  }
+
+  constexpr int kBaseTs = 1582410000;
+
+  // The user is in the middle of a time zone, only its block is read.
+  EXPECT_TRUE(PushPoint(kBaseTs + kTimePrecision + kTimePrecision / 2,
+                        kBaseDuration, kBaseUserId, kBaseGpsLongitude,
+                        kBaseGpsLatitude, kBaseGpsAltitude));
+
+  proto::GetUserNearbyFolks_Response response;
+  EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &response));
+  EXPECT_EQ(0, response.folk_size());
+
+  // Starts in the previous time zone and lasts until the next one.
+  EXPECT_TRUE(PushPoint(kBaseTs + kTimePrecision - 10, 2 * kTimePrecision,
+                        kBaseUserId + 1, kBaseGpsLongitude, kBaseGpsLatitude,
+                        kBaseGpsAltitude));
+
+  response.Clear();
+  EXPECT_TRUE(GetNearbyFolks(kBaseUserId, &response));
+  ASSERT_EQ(1, response.folk_size());
+  EXPECT_EQ(kBaseUserId + 1, response.folk(0).user_id());
+}
+
+INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, MixerBlockCacheTest,
+                         CLUSTER_PARAMS);
+
 } // namespace
 } // namespace bt
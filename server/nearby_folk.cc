@@ -1,19 +1,26 @@
 #include "server/nearby_folk.h"
 #include "server/zones.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace bt {
 
-bool IsNearbyFolk(const CorrelatorConfig &config, const proto::DbKey &user_key,
-                  const proto::DbValue &user_value,
-                  const proto::DbKey &folk_key,
-                  const proto::DbValue &folk_value) {
-  const uint64_t user_begin_ts = user_key.timestamp();
-  const uint64_t user_end_ts = user_begin_ts + user_value.duration();
+namespace {
+
+// Single implementation of the test, on raw fields of entries.
+inline bool IsNearbyFolkRaw(const CorrelatorConfig &config, int64_t user_ts,
+                            uint32_t user_duration, float user_lat,
+                            float user_long, float user_alt, int64_t folk_ts,
+                            uint32_t folk_duration, float folk_lat,
+                            float folk_long, float folk_alt) {
+  const uint64_t user_begin_ts = user_ts;
+  const uint64_t user_end_ts = user_begin_ts + user_duration;
 
-  const uint64_t nearby_begin_ts =
-      folk_key.timestamp() - config.nearby_time_sec_;
+  const uint64_t nearby_begin_ts = folk_ts - config.nearby_time_sec_;
   const uint64_t nearby_end_ts =
-      folk_key.timestamp() + folk_value.duration() + config.nearby_time_sec_;
+      folk_ts + folk_duration + config.nearby_time_sec_;
 
   const bool is_nearby_ts =
       (user_begin_ts >= nearby_begin_ts && user_begin_ts <= nearby_end_ts) ||
@@ -22,18 +29,205 @@ bool IsNearbyFolk(const CorrelatorConfig &config, const proto::DbKey &user_key,
       (nearby_end_ts >= user_begin_ts && nearby_end_ts <= user_end_ts);
 
   const bool is_nearby_long =
-      fabs(user_value.gps_longitude() - folk_value.gps_longitude()) <
-      config.nearby_gps_distance_;
+      fabs(user_long - folk_long) < config.nearby_gps_distance_;
 
   const bool is_nearby_lat =
-      fabs(user_value.gps_latitude() - folk_value.gps_latitude()) <
-      config.nearby_gps_distance_;
+      fabs(user_lat - folk_lat) < config.nearby_gps_distance_;
 
-  const bool is_nearby_alt =
-      fabs(user_value.gps_altitude() - folk_value.gps_altitude()) <
-      kGPSNearbyAltitude;
+  const bool is_nearby_alt = fabs(user_alt - folk_alt) < kGPSNearbyAltitude;
 
   return is_nearby_ts && is_nearby_long && is_nearby_lat && is_nearby_alt;
 }
 
+void ResizeMatches(size_t begin, size_t end, std::vector<uint64_t> *matches) {
+  matches->assign((end - begin + 63) / 64, 0);
+}
+
+} // anonymous namespace
+
+bool IsNearbyFolk(const CorrelatorConfig &config, const proto::DbKey &user_key,
+                  const proto::DbValue &user_value,
+                  const proto::DbKey &folk_key,
+                  const proto::DbValue &folk_value) {
+  return IsNearbyFolkRaw(
+      config, user_key.timestamp(), user_value.duration(),
+      user_value.gps_latitude(), user_value.gps_longitude(),
+      user_value.gps_altitude(), folk_key.timestamp(), folk_value.duration(),
+      folk_value.gps_latitude(), folk_value.gps_longitude(),
+      folk_value.gps_altitude());
+}
+
+void FolkBlock::Add(const proto::DbKey &key, const proto::DbValue &value) {
+  timestamp.push_back(key.timestamp());
+  duration.push_back(value.duration());
+  gps_latitude.push_back(value.gps_latitude());
+  gps_longitude.push_back(value.gps_longitude());
+  gps_altitude.push_back(value.gps_altitude());
+}
+
+void IsNearbyFolkBatchScalar(const CorrelatorConfig &config,
+                             const proto::DbKey &user_key,
+                             const proto::DbValue &user_value,
+                             const FolkBlock &folks, size_t begin,
+                             size_t end, std::vector<uint64_t> *matches) {
+  ResizeMatches(begin, end, matches);
+
+  for (size_t i = begin; i < end; ++i) {
+    if (IsNearbyFolkRaw(config, user_key.timestamp(), user_value.duration(),
+                        user_value.gps_latitude(), user_value.gps_longitude(),
+                        user_value.gps_altitude(), folks.timestamp[i],
+                        folks.duration[i], folks.gps_latitude[i],
+                        folks.gps_longitude[i], folks.gps_altitude[i])) {
+      (*matches)[(i - begin) / 64] |= uint64_t(1) << ((i - begin) % 64);
+    }
+  }
+}
+
+#if defined(__x86_64__)
+
+bool HasAvx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+namespace {
+
+// Returns a mask of lanes where a > b, as unsigned 64-bit integers.
+__attribute__((target("avx2"))) inline __m256i
+GreaterThanU64(__m256i a, __m256i b) {
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign),
+                            _mm256_xor_si256(b, sign));
+}
+
+// Time test of IsNearbyFolkRaw on 4 entries, returns a 4-bit mask.
+__attribute__((target("avx2"))) inline int
+NearbyTs4(__m256i user_begin_ts, __m256i user_end_ts, __m256i nearby_time,
+          const int64_t *folk_ts, const uint32_t *folk_duration) {
+  const __m256i ts =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(folk_ts));
+  const __m256i duration = _mm256_cvtepu32_epi64(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(folk_duration)));
+
+  const __m256i nearby_begin_ts = _mm256_sub_epi64(ts, nearby_time);
+  const __m256i nearby_end_ts =
+      _mm256_add_epi64(_mm256_add_epi64(ts, duration), nearby_time);
+
+  // Each case is a <= x <= b, the negation of x < a || x > b.
+  const __m256i not_case1 =
+      _mm256_or_si256(GreaterThanU64(nearby_begin_ts, user_begin_ts),
+                      GreaterThanU64(user_begin_ts, nearby_end_ts));
+  const __m256i not_case2 =
+      _mm256_or_si256(GreaterThanU64(nearby_begin_ts, user_end_ts),
+                      GreaterThanU64(user_end_ts, nearby_end_ts));
+  const __m256i not_case3 =
+      _mm256_or_si256(GreaterThanU64(user_begin_ts, nearby_begin_ts),
+                      GreaterThanU64(nearby_begin_ts, user_end_ts));
+  const __m256i not_case4 =
+      _mm256_or_si256(GreaterThanU64(user_begin_ts, nearby_end_ts),
+                      GreaterThanU64(nearby_end_ts, user_end_ts));
+
+  const __m256i not_nearby =
+      _mm256_and_si256(_mm256_and_si256(not_case1, not_case2),
+                       _mm256_and_si256(not_case3, not_case4));
+
+  return ~_mm256_movemask_pd(_mm256_castsi256_pd(not_nearby)) & 0xf;
+}
+
+} // anonymous namespace
+
+__attribute__((target("avx2"))) void
+IsNearbyFolkBatchAvx2(const CorrelatorConfig &config,
+                      const proto::DbKey &user_key,
+                      const proto::DbValue &user_value, const FolkBlock &folks,
+                      size_t begin, size_t end,
+                      std::vector<uint64_t> *matches) {
+  ResizeMatches(begin, end, matches);
+
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 distance = _mm256_set1_ps(config.nearby_gps_distance_);
+  const __m256 altitude = _mm256_set1_ps(kGPSNearbyAltitude);
+  const __m256 user_lat = _mm256_set1_ps(user_value.gps_latitude());
+  const __m256 user_long = _mm256_set1_ps(user_value.gps_longitude());
+  const __m256 user_alt = _mm256_set1_ps(user_value.gps_altitude());
+
+  const uint64_t begin_ts = user_key.timestamp();
+  const __m256i user_begin_ts = _mm256_set1_epi64x(begin_ts);
+  const __m256i user_end_ts =
+      _mm256_set1_epi64x(begin_ts + user_value.duration());
+  const __m256i nearby_time = _mm256_set1_epi64x(config.nearby_time_sec_);
+
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const __m256 lat = _mm256_loadu_ps(&folks.gps_latitude[i]);
+    const __m256 lng = _mm256_loadu_ps(&folks.gps_longitude[i]);
+    const __m256 alt = _mm256_loadu_ps(&folks.gps_altitude[i]);
+
+    const __m256 is_nearby_lat = _mm256_cmp_ps(
+        _mm256_and_ps(_mm256_sub_ps(user_lat, lat), abs_mask), distance,
+        _CMP_LT_OQ);
+    const __m256 is_nearby_long = _mm256_cmp_ps(
+        _mm256_and_ps(_mm256_sub_ps(user_long, lng), abs_mask), distance,
+        _CMP_LT_OQ);
+    const __m256 is_nearby_alt = _mm256_cmp_ps(
+        _mm256_and_ps(_mm256_sub_ps(user_alt, alt), abs_mask), altitude,
+        _CMP_LT_OQ);
+
+    const int nearby_gps = _mm256_movemask_ps(_mm256_and_ps(
+        _mm256_and_ps(is_nearby_lat, is_nearby_long), is_nearby_alt));
+    if (nearby_gps == 0) {
+      continue;
+    }
+
+    const int nearby_ts =
+        NearbyTs4(user_begin_ts, user_end_ts, nearby_time,
+                  &folks.timestamp[i], &folks.duration[i]) |
+        NearbyTs4(user_begin_ts, user_end_ts, nearby_time,
+                  &folks.timestamp[i + 4], &folks.duration[i + 4])
+            << 4;
+
+    const uint64_t nearby = nearby_gps & nearby_ts;
+    (*matches)[(i - begin) / 64] |= nearby << ((i - begin) % 64);
+  }
+
+  for (; i < end; ++i) {
+    if (IsNearbyFolkRaw(config, user_key.timestamp(), user_value.duration(),
+                        user_value.gps_latitude(), user_value.gps_longitude(),
+                        user_value.gps_altitude(), folks.timestamp[i],
+                        folks.duration[i], folks.gps_latitude[i],
+                        folks.gps_longitude[i], folks.gps_altitude[i])) {
+      (*matches)[(i - begin) / 64] |= uint64_t(1) << ((i - begin) % 64);
+    }
+  }
+}
+
+#else
+
+bool HasAvx2() { return false; }
+
+void IsNearbyFolkBatchAvx2(const CorrelatorConfig &config,
+                           const proto::DbKey &user_key,
+                           const proto::DbValue &user_value,
+                           const FolkBlock &folks, size_t begin, size_t end,
+                           std::vector<uint64_t> *matches) {
+  IsNearbyFolkBatchScalar(config, user_key, user_value, folks, begin, end,
+                          matches);
+}
+
+#endif
+
+void IsNearbyFolkBatch(const CorrelatorConfig &config,
+                       const proto::DbKey &user_key,
+                       const proto::DbValue &user_value,
+                       const FolkBlock &folks, size_t begin, size_t end,
+                       std::vector<uint64_t> *matches) {
+  if (HasAvx2()) {
+    IsNearbyFolkBatchAvx2(config, user_key, user_value, folks, begin, end,
+                          matches);
+  } else {
+    IsNearbyFolkBatchScalar(config, user_key, user_value, folks, begin, end,
+                            matches);
+  }
+}
+
 } // namespace bt
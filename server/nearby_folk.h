@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include "proto/backtrace.grpc.pb.h"
 
 #include "server/mixer_config.h"
@@ -11,4 +14,42 @@ bool IsNearbyFolk(const CorrelatorConfig &config, const proto::DbKey &user_key,
                   const proto::DbKey &folk_key,
                   const proto::DbValue &folk_value);
 
+// Folk entries stored as a struct of arrays (one contiguous array per
+// field), to test a user entry against many of them at once.
+struct FolkBlock {
+  void Add(const proto::DbKey &key, const proto::DbValue &value);
+  size_t Size() const { return timestamp.size(); }
+
+  std::vector<int64_t> timestamp;
+  std::vector<uint32_t> duration;
+  std::vector<float> gps_latitude;
+  std::vector<float> gps_longitude;
+  std::vector<float> gps_altitude;
+};
+
+// Batch version of IsNearbyFolk, with the same result: tests the user
+// entry against entries [begin, end) of the block, and sets bit i of
+// matches (64 entries per word) if entry begin + i is nearby. Matches
+// is resized to fit the entries. This uses AVX2 if the CPU supports
+// it.
+void IsNearbyFolkBatch(const CorrelatorConfig &config,
+                       const proto::DbKey &user_key,
+                       const proto::DbValue &user_value,
+                       const FolkBlock &folks, size_t begin, size_t end,
+                       std::vector<uint64_t> *matches);
+
+// Implementations of the above, exposed for tests and benchmarks; the
+// AVX2 one can only be called if HasAvx2 returns true.
+bool HasAvx2();
+void IsNearbyFolkBatchScalar(const CorrelatorConfig &config,
+                             const proto::DbKey &user_key,
+                             const proto::DbValue &user_value,
+                             const FolkBlock &folks, size_t begin,
+                             size_t end, std::vector<uint64_t> *matches);
+void IsNearbyFolkBatchAvx2(const CorrelatorConfig &config,
+                           const proto::DbKey &user_key,
+                           const proto::DbValue &user_value,
+                           const FolkBlock &folks, size_t begin, size_t end,
+                           std::vector<uint64_t> *matches);
+
 } // namespace bt
@@ -1,3 +1,6 @@
+#include <cmath>
+#include <random>
+
 #include "server/cluster_test.h"
 #include "server/nearby_folk.h"
 #include "server/zones.h"
@@ -134,5 +137,116 @@ TEST_F(NearbyFolkTest, NearbyTsCase6) {
       IsNearbyFolk(config_, user_key_, user_value_, folk_key_, folk_value_));
 }
 
+class NearbyFolkBatchTest : public NearbyFolkTest {
+public:
+  void AddFolk(int64_t ts, uint32_t duration, float gps_lat, float gps_long,
+               float gps_alt) {
+    folk_keys_.emplace_back();
+    folk_keys_.back().set_timestamp(ts);
+    folk_values_.emplace_back();
+    folk_values_.back().set_duration(duration);
+    folk_values_.back().set_gps_latitude(gps_lat);
+    folk_values_.back().set_gps_longitude(gps_long);
+    folk_values_.back().set_gps_altitude(gps_alt);
+    block_.Add(folk_keys_.back(), folk_values_.back());
+  }
+
+  // Checks that both implementations of the batch match IsNearbyFolk
+  // on all ranges starting at begin.
+  void ExpectSameAsScalar(size_t begin) {
+    std::vector<uint64_t> scalar;
+    IsNearbyFolkBatchScalar(config_, user_key_, user_value_, block_, begin,
+                            block_.Size(), &scalar);
+
+    std::vector<uint64_t> avx2;
+    if (HasAvx2()) {
+      IsNearbyFolkBatchAvx2(config_, user_key_, user_value_, block_, begin,
+                            block_.Size(), &avx2);
+      EXPECT_EQ(scalar, avx2);
+    }
+
+    ASSERT_EQ(scalar.size(), (block_.Size() - begin + 63) / 64);
+    for (size_t i = begin; i < block_.Size(); ++i) {
+      const bool match = (scalar[(i - begin) / 64] >> ((i - begin) % 64)) & 1;
+      EXPECT_EQ(match, IsNearbyFolk(config_, user_key_, user_value_,
+                                    folk_keys_[i], folk_values_[i]))
+          << "entry " << i;
+    }
+  }
+
+  std::vector<proto::DbKey> folk_keys_;
+  std::vector<proto::DbValue> folk_values_;
+  FolkBlock block_;
+};
+
+TEST_F(NearbyFolkBatchTest, Empty) {
+  std::vector<uint64_t> matches = {1};
+  IsNearbyFolkBatch(config_, user_key_, user_value_, block_, 0, 0, &matches);
+  EXPECT_TRUE(matches.empty());
+}
+
+TEST_F(NearbyFolkBatchTest, EdgeCases) {
+  const float distance = config_.nearby_gps_distance_;
+  const int64_t time = config_.nearby_time_sec_;
+
+  user_value_.set_duration(100);
+  for (int64_t ts : {kBaseTimestamp - time - 1, kBaseTimestamp - time,
+                     kBaseTimestamp + 100 + time,
+                     kBaseTimestamp + 100 + time + 1}) {
+    AddFolk(ts, 0, kBaseGpsLatitude, kBaseGpsLongitude, kBaseGpsAltitude);
+  }
+  AddFolk(kBaseTimestamp - 1000, 1000 - time, kBaseGpsLatitude,
+          kBaseGpsLongitude, kBaseGpsAltitude);
+  AddFolk(kBaseTimestamp - 1000, 1000 - time - 1, kBaseGpsLatitude,
+          kBaseGpsLongitude, kBaseGpsAltitude);
+  AddFolk(kBaseTimestamp, 0, kBaseGpsLatitude + distance, kBaseGpsLongitude,
+          kBaseGpsAltitude);
+  AddFolk(kBaseTimestamp, 0, kBaseGpsLatitude, kBaseGpsLongitude - distance,
+          kBaseGpsAltitude);
+  AddFolk(kBaseTimestamp, 0, kBaseGpsLatitude, kBaseGpsLongitude,
+          kBaseGpsAltitude + kGPSNearbyAltitude);
+  AddFolk(kBaseTimestamp, 0, std::nanf(""), kBaseGpsLongitude,
+          kBaseGpsAltitude);
+  AddFolk(kBaseTimestamp, 0, kBaseGpsLatitude, INFINITY, kBaseGpsAltitude);
+  // Timestamps wrapping around as unsigned integers.
+  AddFolk(0, 0, kBaseGpsLatitude, kBaseGpsLongitude, kBaseGpsAltitude);
+  AddFolk(-1, 0, kBaseGpsLatitude, kBaseGpsLongitude, kBaseGpsAltitude);
+  AddFolk(INT64_MAX, UINT32_MAX, kBaseGpsLatitude, kBaseGpsLongitude,
+          kBaseGpsAltitude);
+  AddFolk(INT64_MIN, UINT32_MAX, kBaseGpsLatitude, kBaseGpsLongitude,
+          kBaseGpsAltitude);
+
+  for (int64_t ts : {int64_t(kBaseTimestamp), int64_t(0), int64_t(-1),
+                     INT64_MAX, INT64_MIN}) {
+    user_key_.set_timestamp(ts);
+    for (size_t begin = 0; begin < block_.Size(); ++begin) {
+      ExpectSameAsScalar(begin);
+    }
+  }
+}
+
+TEST_F(NearbyFolkBatchTest, Random) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int64_t> ts(kBaseTimestamp,
+                                            kBaseTimestamp + 1000);
+  std::uniform_int_distribution<uint32_t> duration(0, 120);
+  std::uniform_real_distribution<float> gps(-0.00005, 0.00005);
+  std::uniform_real_distribution<float> alt(0.0, 5.0);
+
+  for (int i = 0; i < 1000; ++i) {
+    AddFolk(ts(gen), duration(gen), kBaseGpsLatitude + gps(gen),
+            kBaseGpsLongitude + gps(gen), kBaseGpsAltitude + alt(gen));
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    user_key_.set_timestamp(ts(gen));
+    user_value_.set_duration(duration(gen));
+    user_value_.set_gps_latitude(kBaseGpsLatitude + gps(gen));
+    user_value_.set_gps_longitude(kBaseGpsLongitude + gps(gen));
+    user_value_.set_gps_altitude(kBaseGpsAltitude + alt(gen));
+    ExpectSameAsScalar(i);
+  }
+}
+
 } // namespace
 } // namespace bt
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <glog/logging.h>
+#include <queue>
 
 #include "server/proto.h"
 
@@ -53,32 +55,118 @@ bool CompareTimelinePoints::operator()(
   return lhs.duration() < rhs.duration();
 }
 
-bool CompareBlockEntry::operator()(const proto::BlockEntry& lhs,
-                                   const proto::BlockEntry& rhs) const {
-  if (lhs.key().timestamp() != rhs.key().timestamp()) {
-    return lhs.key().timestamp() < rhs.key().timestamp();
-  }
-  if (lhs.key().user_id() != rhs.key().user_id()) {
-    return lhs.key().user_id() < rhs.key().user_id();
-  }
-  if (lhs.key().gps_longitude_zone() != rhs.key().gps_longitude_zone()) {
-    return lhs.key().gps_longitude_zone() < rhs.key().gps_longitude_zone();
-  }
-  if (lhs.key().gps_latitude_zone() != rhs.key().gps_latitude_zone()) {
-    return lhs.key().gps_latitude_zone() < rhs.key().gps_latitude_zone();
+void MergeTimelines(
+    const std::vector<proto::GetUserTimeline_Response*>& timelines,
+    proto::GetUserTimeline_Response* merged) {
+  CompareTimelinePoints cmp;
+
+  // Position of the next point to merge in each timeline, the heap
+  // yields the timeline with the smallest next point.
+  struct Cursor {
+    proto::GetUserTimeline_Response* timeline;
+    int pos;
+  };
+  auto cursor_cmp = [&cmp](const Cursor& lhs, const Cursor& rhs) {
+    return cmp(rhs.timeline->point(rhs.pos), lhs.timeline->point(lhs.pos));
+  };
+  std::priority_queue<Cursor, std::vector<Cursor>, decltype(cursor_cmp)> heap(
+      cursor_cmp);
+
+  int total = 0;
+  for (auto* timeline : timelines) {
+    auto* points = timeline->mutable_point();
+    if (!std::is_sorted(points->begin(), points->end(), cmp)) {
+      std::sort(points->begin(), points->end(), cmp);
+    }
+    if (!points->empty()) {
+      heap.push(Cursor{timeline, 0});
+      total += points->size();
+    }
   }
 
-  if (lhs.value().duration() != rhs.value().duration()) {
-    return lhs.value().duration() < rhs.value().duration();
+  merged->mutable_point()->Reserve(merged->point_size() + total);
+  while (!heap.empty()) {
+    Cursor cursor = heap.top();
+    heap.pop();
+
+    proto::UserTimelinePoint* point =
+        cursor.timeline->mutable_point(cursor.pos);
+    const int last = merged->point_size() - 1;
+    if (last < 0 || cmp(merged->point(last), *point)) {
+      merged->add_point()->Swap(point);
+    }
+
+    if (++cursor.pos < cursor.timeline->point_size()) {
+      heap.push(cursor);
+    }
   }
-  if (lhs.value().gps_latitude() != rhs.value().gps_latitude()) {
-    return lhs.value().gps_latitude() < rhs.value().gps_latitude();
+}
+
+bool MergeTimelineSources(
+    const std::vector<TimelineSource*>& sources, int chunk_size,
+    const std::function<bool(const proto::GetUserTimeline_Response&)>& emit) {
+  CompareTimelinePoints cmp;
+
+  // Current chunk of each source and position of its next point to
+  // merge, the heap yields the source with the smallest next point.
+  struct Cursor {
+    TimelineSource* source;
+    proto::GetUserTimeline_Response chunk;
+    int pos = -1;
+  };
+  auto advance = [](Cursor* cursor) {
+    while (++cursor->pos >= cursor->chunk.point_size()) {
+      cursor->chunk.Clear();
+      cursor->pos = -1;
+      if (!cursor->source->Next(&cursor->chunk)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  auto cursor_cmp = [&cmp](const Cursor* lhs, const Cursor* rhs) {
+    return cmp(rhs->chunk.point(rhs->pos), lhs->chunk.point(lhs->pos));
+  };
+  std::priority_queue<Cursor*, std::vector<Cursor*>, decltype(cursor_cmp)>
+      heap(cursor_cmp);
+
+  std::vector<Cursor> cursors(sources.size());
+  for (size_t i = 0; i < sources.size(); ++i) {
+    cursors[i].source = sources[i];
+    if (advance(&cursors[i])) {
+      heap.push(&cursors[i]);
+    }
   }
-  if (lhs.value().gps_longitude() != rhs.value().gps_longitude()) {
-    return lhs.value().gps_longitude() < rhs.value().gps_longitude();
+
+  proto::GetUserTimeline_Response merged;
+  proto::UserTimelinePoint last;
+  bool has_last = false;
+  while (!heap.empty()) {
+    Cursor* cursor = heap.top();
+    heap.pop();
+
+    proto::UserTimelinePoint* point = cursor->chunk.mutable_point(cursor->pos);
+    if (!has_last || cmp(last, *point)) {
+      last = *point;
+      has_last = true;
+      merged.add_point()->Swap(point);
+      if (merged.point_size() >= chunk_size) {
+        if (!emit(merged)) {
+          return false;
+        }
+        merged.Clear();
+      }
+    }
+
+    if (advance(cursor)) {
+      heap.push(cursor);
+    }
   }
 
-  return lhs.value().gps_altitude() < rhs.value().gps_altitude();
+  if (merged.point_size() > 0) {
+    return emit(merged);
+  }
+  return true;
 }
 
 }  // namespace bt
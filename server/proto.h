@@ -1,5 +1,8 @@
 #pragma once
 
+#include <functional>
+#include <vector>
+
 #include "proto/backtrace.pb.h"
 
 namespace bt {
@@ -18,9 +21,31 @@ struct CompareTimelinePoints {
                   const proto::UserTimelinePoint &rhs) const;
 };
 
-struct CompareBlockEntry {
-  bool operator()(const proto::BlockEntry &lhs,
-                  const proto::BlockEntry &rhs) const;
+// Merges timelines sorted by CompareTimelinePoints into a single
+// sorted timeline, duplicated points (i.e: returned by several
+// replicas) are only added once. Timelines which are not sorted are
+// sorted first; points are moved out of the input timelines.
+void MergeTimelines(
+    const std::vector<proto::GetUserTimeline_Response *> &timelines,
+    proto::GetUserTimeline_Response *merged);
+
+// Timeline read in chunks (i.e: streamed by a worker), points are
+// sorted by CompareTimelinePoints across chunks.
+class TimelineSource {
+public:
+  virtual ~TimelineSource() = default;
+
+  // Reads the next chunk of points, returns false once there are no
+  // more points or if the source failed.
+  virtual bool Next(proto::GetUserTimeline_Response *chunk) = 0;
 };
 
+// Same as MergeTimelines for timelines read in chunks, at most one
+// chunk per source is held at once. Merged points are passed to emit
+// in chunks of at most chunk_size points; returns false if emit did,
+// in which case merging stops.
+bool MergeTimelineSources(
+    const std::vector<TimelineSource *> &sources, int chunk_size,
+    const std::function<bool(const proto::GetUserTimeline_Response &)> &emit);
+
 } // namespace bt
@@ -75,6 +75,109 @@ TEST_F(ProtoTest, CompareTimelinePointEq) {
   EXPECT_FALSE(cmp(rhs, lhs));
 }
 
+TEST_F(ProtoTest, MergeTimelines) {
+  proto::GetUserTimeline_Response first;
+  *first.add_point() = MakePoint(1, 0, 0, 0, 0);
+  *first.add_point() = MakePoint(3, 0, 0, 0, 0);
+  *first.add_point() = MakePoint(5, 0, 0, 0, 0);
+
+  proto::GetUserTimeline_Response second;
+  *second.add_point() = MakePoint(2, 0, 0, 0, 0);
+  *second.add_point() = MakePoint(3, 0, 0, 0, 0);
+  *second.add_point() = MakePoint(6, 0, 0, 0, 0);
+
+  proto::GetUserTimeline_Response empty;
+
+  proto::GetUserTimeline_Response merged;
+  MergeTimelines({&first, &empty, &second}, &merged);
+
+  ASSERT_EQ(merged.point_size(), 5);
+  EXPECT_EQ(merged.point(0).timestamp(), 1);
+  EXPECT_EQ(merged.point(1).timestamp(), 2);
+  EXPECT_EQ(merged.point(2).timestamp(), 3);
+  EXPECT_EQ(merged.point(3).timestamp(), 5);
+  EXPECT_EQ(merged.point(4).timestamp(), 6);
+}
+
+TEST_F(ProtoTest, MergeTimelinesUnsorted) {
+  proto::GetUserTimeline_Response first;
+  *first.add_point() = MakePoint(4, 0, 0, 0, 0);
+  *first.add_point() = MakePoint(1, 0, 0, 0, 0);
+  *first.add_point() = MakePoint(1, 1, 0, 0, 0);
+
+  proto::GetUserTimeline_Response second;
+  *second.add_point() = MakePoint(1, 1, 0, 0, 0);
+
+  proto::GetUserTimeline_Response merged;
+  MergeTimelines({&first, &second}, &merged);
+
+  ASSERT_EQ(merged.point_size(), 3);
+  EXPECT_EQ(merged.point(0).timestamp(), 1);
+  EXPECT_EQ(merged.point(0).duration(), 0);
+  EXPECT_EQ(merged.point(1).timestamp(), 1);
+  EXPECT_EQ(merged.point(1).duration(), 1);
+  EXPECT_EQ(merged.point(2).timestamp(), 4);
+}
+
+// Source returning timelines chunk by chunk.
+class FakeTimelineSource : public TimelineSource {
+public:
+  explicit FakeTimelineSource(
+      std::vector<proto::GetUserTimeline_Response> chunks)
+      : chunks_(std::move(chunks)) {}
+
+  bool Next(proto::GetUserTimeline_Response *chunk) override {
+    if (next_ >= chunks_.size()) {
+      return false;
+    }
+    *chunk = chunks_[next_++];
+    return true;
+  }
+
+private:
+  std::vector<proto::GetUserTimeline_Response> chunks_;
+  size_t next_ = 0;
+};
+
+proto::GetUserTimeline_Response MakeChunk(std::vector<int64_t> timestamps) {
+  proto::GetUserTimeline_Response chunk;
+  for (int64_t timestamp : timestamps) {
+    *chunk.add_point() = MakePoint(timestamp, 0, 0, 0, 0);
+  }
+  return chunk;
+}
+
+TEST_F(ProtoTest, MergeTimelineSources) {
+  FakeTimelineSource first({MakeChunk({1, 3}), MakeChunk({}), MakeChunk({5})});
+  FakeTimelineSource second({MakeChunk({2}), MakeChunk({3, 6})});
+  FakeTimelineSource empty({});
+
+  std::vector<std::vector<int64_t>> chunks;
+  EXPECT_TRUE(MergeTimelineSources(
+      {&first, &empty, &second}, 2,
+      [&chunks](const proto::GetUserTimeline_Response &chunk) {
+        chunks.emplace_back();
+        for (const auto &point : chunk.point()) {
+          chunks.back().push_back(point.timestamp());
+        }
+        return true;
+      }));
+
+  EXPECT_EQ(chunks, std::vector<std::vector<int64_t>>({{1, 2}, {3, 5}, {6}}));
+}
+
+TEST_F(ProtoTest, MergeTimelineSourcesStops) {
+  FakeTimelineSource source({MakeChunk({1, 2, 3})});
+
+  int chunks = 0;
+  EXPECT_FALSE(MergeTimelineSources(
+      {&source}, 1, [&chunks](const proto::GetUserTimeline_Response &chunk) {
+        ++chunks;
+        return false;
+      }));
+  EXPECT_EQ(chunks, 1);
+}
+
 } // namespace
 
 } // namespace bt
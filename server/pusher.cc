@@ -1,19 +1,70 @@
 #include <algorithm>
 #include <atomic>
 #include <glog/logging.h>
-#include <rocksdb/write_batch.h>
 
+#include "server/keys.h"
+#include "server/location_batch.h"
 #include "server/pusher.h"
 #include "server/zones.h"
 
 namespace bt {
 
-Status Pusher::Init(Db *db) {
+Status Pusher::Init(Db *db, Writer *writer, const WorkerConfig &config) {
+  max_batch_size_ = config.pusher_max_batch_size_;
+  if (!(max_batch_size_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "pusher.max_batch_size should be > 0");
+  }
+
+  if (config.pusher_reverse_cache_size_ < 0) {
+    RETURN_ERROR(INVALID_CONFIG, "pusher.reverse_cache_size should be >= 0");
+  }
+  if (config.pusher_reverse_cache_size_ > 0) {
+    reverse_cache_ =
+        std::make_unique<ReverseCache>(config.pusher_reverse_cache_size_);
+  }
+
+  if (!(config.pusher_threads_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "pusher.threads should be > 0");
+  }
+  RETURN_IF_ERROR(pool_.Init("pusher", config.pusher_threads_));
+
   db_ = db;
+  writer_ = writer;
+  SetMessageAllocatorFor_InternalPutLocation(&put_location_allocator_);
 
   return StatusCode::OK;
 }
 
+grpc::ServerUnaryReactor *
+Pusher::InternalPutLocation(grpc::CallbackServerContext *context,
+                            const proto::PutLocation_Request *request,
+                            proto::PutLocation_Response *response) {
+  grpc::ServerUnaryReactor *reactor = context->DefaultReactor();
+  pool_.Run([this, reactor, request, response]() {
+    reactor->Finish(PutLocation(request, response));
+  });
+  return reactor;
+}
+
+grpc::ServerUnaryReactor *
+Pusher::InternalDeleteUser(grpc::CallbackServerContext *context,
+                           const proto::DeleteUser_Request *request,
+                           proto::DeleteUser_Response *response) {
+  grpc::ServerUnaryReactor *reactor = context->DefaultReactor();
+  pool_.Run([this, reactor, request, response]() {
+    reactor->Finish(DeleteUser(request, response));
+  });
+  return reactor;
+}
+
+uint64_t Pusher::ReverseCacheHits() const {
+  return reverse_cache_ ? reverse_cache_->Hits() : 0;
+}
+
+uint64_t Pusher::ReverseCacheMisses() const {
+  return reverse_cache_ ? reverse_cache_->Misses() : 0;
+}
+
 namespace {
 
 Status MakeTimelineKey(int64_t user_id, int64_t ts, uint32_t duration,
@@ -42,7 +93,8 @@ Status MakeTimelineValue(int64_t user_id, int64_t ts, uint32_t duration,
 
 Status Pusher::PutTimelineLocation(int64_t user_id, int64_t ts,
                                    uint32_t duration, float gps_longitude,
-                                   float gps_latitude, float gps_altitude) {
+                                   float gps_latitude, float gps_altitude,
+                                   PendingBatch *batch) {
   proto::DbKey key;
   Status status = MakeTimelineKey(user_id, ts, duration, gps_longitude,
                                   gps_latitude, gps_altitude, &key);
@@ -65,25 +117,21 @@ Status Pusher::PutTimelineLocation(int64_t user_id, int64_t ts,
   }
 
   std::string raw_key;
-  if (!key.SerializeToString(&raw_key)) {
-    RETURN_ERROR(INTERNAL_ERROR, "unable to serialize key, skipped");
-  }
+  EncodeTimelineKey(key, &raw_key);
 
-  rocksdb::Status rocks_status =
-      db_->Rocks()->Put(rocksdb::WriteOptions(), db_->TimelineHandle(),
-                        rocksdb::Slice(raw_key.data(), raw_key.size()),
-                        rocksdb::Slice(raw_value.data(), raw_value.size()));
-  if (!rocks_status.ok()) {
-    RETURN_ERROR(INTERNAL_ERROR, "failed to put timeline value, status="
-                                     << rocks_status.ToString());
-  }
+  const Partition *partition = nullptr;
+  RETURN_IF_ERROR(BatchPartition(TsToZone(ts), batch, &partition));
+  batch->records.push_back(WriteRecord{partition->timeline.get(),
+                                       std::move(raw_key),
+                                       std::move(raw_value)});
 
   return StatusCode::OK;
 }
 
 Status Pusher::PutReverseLocation(int64_t user_id, int64_t ts,
                                   uint32_t duration, float gps_longitude,
-                                  float gps_latitude, float gps_altitude) {
+                                  float gps_latitude, float gps_altitude,
+                                  PendingBatch *batch) {
   proto::DbReverseKey key;
   key.set_user_id(user_id);
   key.set_timestamp_zone(TsToZone(ts));
@@ -91,8 +139,15 @@ Status Pusher::PutReverseLocation(int64_t user_id, int64_t ts,
   key.set_gps_latitude_zone(GPSLocationToGPSZone(gps_latitude));
 
   std::string raw_key;
-  if (!key.SerializeToString(&raw_key)) {
-    RETURN_ERROR(INTERNAL_ERROR, "unable to serialize reverse key, skipped");
+  EncodeReverseKey(key, &raw_key);
+
+  // Reverse keys are the same for all points of a user in a zone, skip
+  // the ones already written or already in this batch.
+  if (reverse_cache_ != nullptr) {
+    if (batch->raw_reverse_keys.count(raw_key) ||
+        reverse_cache_->Contains(key)) {
+      return StatusCode::OK;
+    }
   }
 
   proto::DbReverseValue value;
@@ -101,193 +156,302 @@ Status Pusher::PutReverseLocation(int64_t user_id, int64_t ts,
     RETURN_ERROR(INTERNAL_ERROR, "unable to serialize reverse value, skipped");
   }
 
-  rocksdb::Status status =
-      db_->Rocks()->Put(rocksdb::WriteOptions(), db_->ReverseHandle(),
-                        rocksdb::Slice(raw_key.data(), raw_key.size()),
-                        rocksdb::Slice(raw_value.data(), raw_value.size()));
-  if (!status.ok()) {
-    RETURN_ERROR(INTERNAL_ERROR,
-                 "failed to merge reverse value, status=" << status.ToString());
+  const Partition *partition = nullptr;
+  RETURN_IF_ERROR(BatchPartition(key.timestamp_zone(), batch, &partition));
+
+  if (reverse_cache_ != nullptr) {
+    batch->raw_reverse_keys.insert(raw_key);
+    batch->reverse_keys.push_back(key);
+  }
+
+  batch->records.push_back(WriteRecord{
+      partition->reverse.get(), std::move(raw_key), std::move(raw_value)});
+
+  return StatusCode::OK;
+}
+
+Status Pusher::BatchPartition(int64_t ts_zone, PendingBatch *batch,
+                              const Partition **partition) {
+  // Points of a batch are usually in a single partition, it is looked
+  // up in the database once per batch.
+  auto it = batch->partitions.upper_bound(ts_zone);
+  if (it != batch->partitions.begin()) {
+    --it;
+    if (ts_zone < it->second.end_zone) {
+      *partition = &it->second;
+      return StatusCode::OK;
+    }
   }
 
+  Partition found;
+  RETURN_IF_ERROR(db_->PartitionForZone(ts_zone, &found));
+  const int64_t start_zone = found.start_zone;
+  *partition =
+      &batch->partitions.emplace(start_zone, std::move(found)).first->second;
   return StatusCode::OK;
 }
 
-grpc::Status
-Pusher::InternalPutLocation(grpc::ServerContext *context,
-                            const proto::PutLocation_Request *request,
-                            proto::PutLocation_Response *response) {
+Status Pusher::WaitBatch(PendingBatch *batch, int *success, int *errors) {
+  if (batch->points == 0) {
+    return StatusCode::OK;
+  }
+
+  Status status = batch->done.get();
+  if (status != StatusCode::OK) {
+    *errors += batch->points;
+    RETURN_ERROR(INTERNAL_ERROR, "failed to write batch of points, points="
+                                     << batch->points
+                                     << ", status=" << status);
+  }
+
+  if (reverse_cache_ != nullptr) {
+    for (const auto &key : batch->reverse_keys) {
+      reverse_cache_->Insert(key);
+    }
+  }
+
+  *success += batch->points;
+  return StatusCode::OK;
+}
+
+void Pusher::PutPoint(uint64_t user_id, int64_t timestamp, uint32_t duration,
+                      float gps_longitude, float gps_latitude,
+                      float gps_altitude, std::vector<PendingBatch> *batches,
+                      int *errors) {
+  // Each location can have a duration that spans multiple blocks:
+  // in that case, create artificial points at the beginning of each
+  // block for the block duration.
+  int64_t ts = timestamp;
+  const int64_t ts_end = timestamp + duration;
+  do {
+    const int64_t next_ts = std::min(ts_end, TsNextZone(ts) * kTimePrecision);
+    const int64_t point_duration = next_ts - ts;
+
+    // Points are either fully added to the batch or not at all, the
+    // reverse location is added last and adds nothing on errors.
+    PendingBatch *batch = &batches->back();
+    const size_t records = batch->records.size();
+
+    Status status =
+        PutTimelineLocation(user_id, ts, point_duration, gps_longitude,
+                            gps_latitude, gps_altitude, batch);
+    if (status == StatusCode::OK) {
+      status = PutReverseLocation(user_id, ts, point_duration, gps_longitude,
+                                  gps_latitude, gps_altitude, batch);
+    }
+
+    if (status == StatusCode::OK) {
+      ++batch->points;
+    } else {
+      batch->records.resize(records);
+      ++*errors;
+    }
+
+    if (batch->points >= max_batch_size_) {
+      batch->done = writer_->Submit(std::move(batch->records));
+      batches->emplace_back();
+    }
+
+    ts = next_ts;
+  } while (ts < ts_end);
+}
+
+grpc::Status Pusher::PutLocation(const proto::PutLocation_Request *request,
+                                 proto::PutLocation_Response *response) {
   int success = 0;
   int errors = 0;
-  for (int i = 0; i < request->locations_size(); ++i) {
-    const proto::Location &location = request->locations(i);
-
-    // Each location can have a duration that spans multiple blocks:
-    // in that case, create artificial points at the beginning of each
-    // block for the block duration.
-    int64_t ts = location.timestamp();
-    const int64_t ts_end = location.timestamp() + location.duration();
-    do {
-      const int64_t next_ts = std::min(ts_end, TsNextZone(ts) * kTimePrecision);
-      const int64_t duration = next_ts - ts;
-
-      Status status = PutTimelineLocation(
-          location.user_id(), ts, duration, location.gps_longitude(),
-          location.gps_latitude(), location.gps_altitude());
-      if (status == StatusCode::OK) {
-        status = PutReverseLocation(
-            location.user_id(), ts, duration, location.gps_longitude(),
-            location.gps_latitude(), location.gps_altitude());
-      }
 
-      if (status == StatusCode::OK) {
-        ++success;
-      } else {
-        ++errors;
-      }
+  // Points of a columnar batch are decoded before anything is written,
+  // so that a malformed batch is rejected as a whole.
+  LocationColumns columns;
+  Status batch_status = DecodeLocationBatch(request->batch(), &columns);
+  if (batch_status != StatusCode::OK) {
+    LOG_EVERY_N(WARNING, 1000)
+        << "invalid location batch, status=" << batch_status;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        batch_status.Message());
+  }
+
+  // Points of the request are encoded here and handed to the writer
+  // thread in batches of at most max batch size points, all batches
+  // are submitted before waiting for any so they can be committed
+  // together.
+  std::vector<PendingBatch> batches(1);
 
-      ts = next_ts;
-    } while (ts < ts_end);
+  for (const proto::Location &location : request->locations()) {
+    PutPoint(location.user_id(), location.timestamp(), location.duration(),
+             location.gps_longitude(), location.gps_latitude(),
+             location.gps_altitude(), &batches, &errors);
+  }
+  for (size_t i = 0; i < columns.Size(); ++i) {
+    PutPoint(columns.user_id[i], columns.timestamp[i], columns.duration[i],
+             BatchToGPS(columns.gps_longitude[i]),
+             BatchToGPS(columns.gps_latitude[i]),
+             BatchToAltitude(columns.gps_altitude[i]), &batches, &errors);
+  }
+
+  PendingBatch &last = batches.back();
+  if (last.points > 0) {
+    last.done = writer_->Submit(std::move(last.records));
+  }
+
+  bool write_failed = false;
+  for (PendingBatch &batch : batches) {
+    Status status = WaitBatch(&batch, &success, &errors);
+    if (status != StatusCode::OK) {
+      LOG_EVERY_N(WARNING, 1000)
+          << "unable to write points, status=" << status;
+      write_failed = true;
+    }
   }
 
   counter_ok_ += success;
   counter_ko_ += errors;
 
-  LOG_EVERY_N(INFO, 1000) << "PutLocation of " << request->locations_size()
+  LOG_EVERY_N(INFO, 1000) << "PutLocation of "
+                          << request->locations_size() + columns.Size()
                           << ", total_ok=" << counter_ok_
-                          << ", total_ko=" << counter_ko_;
+                          << ", total_ko=" << counter_ko_
+                          << ", reverse_cache_hits=" << ReverseCacheHits()
+                          << ", reverse_cache_misses=" << ReverseCacheMisses()
+                          << ", writer_queue_depth=" << writer_->QueueDepth();
+
+  if (write_failed) {
+    return grpc::Status(grpc::StatusCode::INTERNAL,
+                        "unable to write points to the database");
+  }
 
   return grpc::Status::OK;
 }
 
-Status Pusher::DeleteUserFromBlock(int64_t user_id,
+Status Pusher::DeleteUserFromBlock(const Partition &partition,
                                    const proto::DbKey &start_key,
+                                   rocksdb::WriteBatch *batch,
                                    int64_t *timeline_count) {
-  std::string start_key_raw;
-  if (!start_key.SerializeToString(&start_key_raw)) {
-    RETURN_ERROR(INTERNAL_ERROR, "can't serialize internal db timeline key");
-  }
-
+  // Entries of a block are sorted by user, the iterator is bounded to
+  // the entries of this user so that entries of other folks in the
+  // block are never read.
+  std::string begin_raw;
+  std::string end_raw;
+  EncodeTimelineUserRange(start_key, &begin_raw, &end_raw);
+  const rocksdb::Slice begin(begin_raw);
+  const rocksdb::Slice end(end_raw);
+
+  rocksdb::ReadOptions options;
+  options.iterate_lower_bound = &begin;
+  options.iterate_upper_bound = &end;
   std::unique_ptr<rocksdb::Iterator> it(
-      db_->Rocks()->NewIterator(rocksdb::ReadOptions(), db_->TimelineHandle()));
-  it->SeekForPrev(rocksdb::Slice(start_key_raw.data(), start_key_raw.size()));
+      db_->Rocks()->NewIterator(options, partition.timeline.get()));
 
-  while (it->Valid()) {
-    const rocksdb::Slice key_raw = it->key();
-    proto::DbKey key;
-    if (!key.ParseFromArray(key_raw.data(), key_raw.size())) {
+  for (it->Seek(begin); it->Valid(); it->Next()) {
+    rocksdb::Status rocksdb_status =
+        batch->Delete(partition.timeline.get(), it->key());
+    if (!rocksdb_status.ok()) {
       RETURN_ERROR(INTERNAL_ERROR,
-                   "can't unserialize internal db timeline key");
-    }
-
-    if (user_id == key.user_id()) {
-      rocksdb::Status rocksdb_status = db_->Rocks()->Delete(
-          rocksdb::WriteOptions(), db_->TimelineHandle(), key_raw);
-
-      // We don't check for NOT_FOUND here, this is because the point
-      // here may be older than the expiration date and compete with the
-      // GC, so we may be double-deleting points; that's fine.
-      if (!rocksdb_status.ok()) {
-        RETURN_ERROR(INTERNAL_ERROR,
-                     "can't delete user data from block for user_id="
-                         << user_id
-                         << ", status=" << rocksdb_status.ToString());
-      } else {
-        ++(*timeline_count);
-      }
-    }
-
-    const bool end_of_zone =
-        (TsToZone(key.timestamp()) != TsToZone(start_key.timestamp())) ||
-        (key.gps_longitude_zone() != start_key.gps_longitude_zone()) ||
-        (key.gps_latitude_zone() != start_key.gps_latitude_zone());
-    if (end_of_zone) {
-      break;
+                   "can't delete user data from block for user_id="
+                       << start_key.user_id()
+                       << ", status=" << rocksdb_status.ToString());
     }
+    ++(*timeline_count);
+  }
 
-    it->Next();
+  if (!it->status().ok()) {
+    RETURN_ERROR(INTERNAL_ERROR,
+                 "can't read user data from block for user_id="
+                     << start_key.user_id()
+                     << ", status=" << it->status().ToString());
   }
 
   return StatusCode::OK;
 }
 
-grpc::Status
-Pusher::InternalDeleteUser(grpc::ServerContext *context,
-                           const proto::DeleteUser_Request *request,
-                           proto::DeleteUser_Response *response) {
+grpc::Status Pusher::DeleteUser(const proto::DeleteUser_Request *request,
+                                proto::DeleteUser_Response *response) {
   int64_t user_id = request->user_id();
   int64_t reverse_count = 0;
   int64_t timeline_count = 0;
 
   LOG(INFO) << "deleting history for user " << user_id;
 
-  proto::DbReverseKey reverse_key_it;
-
-  reverse_key_it.set_user_id(user_id);
-  reverse_key_it.set_timestamp_zone(0);
-  reverse_key_it.set_gps_longitude_zone(0.0);
-  reverse_key_it.set_gps_latitude_zone(0.0);
-
-  std::string reverse_raw_key_it;
-  if (!reverse_key_it.SerializeToString(&reverse_raw_key_it)) {
-    LOG(WARNING) << "can't serialize internal reverse key, user_id=" << user_id;
-    return grpc::Status(grpc::StatusCode::INTERNAL,
-                        "can't serialize internal reverse key");
+  // Reverse keys of this user are about to be deleted, they must be
+  // written again if the user pushes new points.
+  if (reverse_cache_ != nullptr) {
+    reverse_cache_->InvalidateUser(user_id);
   }
 
-  std::unique_ptr<rocksdb::Iterator> reverse_it(
-      db_->Rocks()->NewIterator(rocksdb::ReadOptions(), db_->ReverseHandle()));
-  reverse_it->Seek(
-      rocksdb::Slice(reverse_raw_key_it.data(), reverse_raw_key_it.size()));
-
-  while (reverse_it->Valid()) {
-    const rocksdb::Slice reverse_key_raw = reverse_it->key();
-    proto::DbReverseKey reverse_key;
-    if (!reverse_key.ParseFromArray(reverse_key_raw.data(),
-                                    reverse_key_raw.size())) {
-      LOG(WARNING) << "can't unserialize internal reverse key, user_id="
-                   << user_id;
-      return grpc::Status(grpc::StatusCode::INTERNAL,
-                          "can't unserialize internal reverse key");
-    }
-
-    // If we have a different user ID, we are done scanning keys for
-    // this user.
-    if (reverse_key.user_id() != user_id) {
-      break;
-    }
-
-    proto::DbKey key_begin;
+  std::string reverse_prefix;
+  EncodeReversePrefix(user_id, &reverse_prefix);
+
+  // Deletes of all partitions are written at once, partitions must be
+  // kept until then.
+  const std::vector<Partition> partitions = db_->Partitions();
+  rocksdb::WriteBatch batch;
+
+  // Each partition has its own reverse keys for the user.
+  for (const Partition &partition : partitions) {
+    // The iterator stops after the last key of the user.
+    std::unique_ptr<rocksdb::Iterator> reverse_it(db_->Rocks()->NewIterator(
+        PrefixReadOptions(), partition.reverse.get()));
+    reverse_it->Seek(
+        rocksdb::Slice(reverse_prefix.data(), reverse_prefix.size()));
+
+    while (reverse_it->Valid()) {
+      const rocksdb::Slice reverse_key_raw = reverse_it->key();
+
+      proto::DbReverseKey reverse_key;
+      if (!DecodeReverseKey(reverse_key_raw, &reverse_key)) {
+        LOG(WARNING) << "can't decode internal reverse key, user_id="
+                     << user_id;
+        return grpc::Status(grpc::StatusCode::INTERNAL,
+                            "can't decode internal reverse key");
+      }
 
-    key_begin.set_timestamp(reverse_key.timestamp_zone() * kTimePrecision);
-    key_begin.set_user_id(user_id);
-    key_begin.set_gps_longitude_zone(reverse_key.gps_longitude_zone());
-    key_begin.set_gps_latitude_zone(reverse_key.gps_latitude_zone());
+      proto::DbKey key_begin;
 
-    Status status = DeleteUserFromBlock(user_id, key_begin, &timeline_count);
-    if (status != StatusCode::OK) {
-      LOG(WARNING) << "can't delete user data from block for user_id="
-                   << user_id << ", status=" << status;
-      return grpc::Status(grpc::StatusCode::INTERNAL,
-                          "can't delete user data from block");
-    }
+      key_begin.set_timestamp(reverse_key.timestamp_zone() * kTimePrecision);
+      key_begin.set_user_id(user_id);
+      key_begin.set_gps_longitude_zone(reverse_key.gps_longitude_zone());
+      key_begin.set_gps_latitude_zone(reverse_key.gps_latitude_zone());
 
-    rocksdb::Status rocksdb_status = db_->Rocks()->Delete(
-        rocksdb::WriteOptions(), db_->ReverseHandle(), reverse_key_raw);
+      Status status =
+          DeleteUserFromBlock(partition, key_begin, &batch, &timeline_count);
+      if (status != StatusCode::OK) {
+        LOG(WARNING) << "can't delete user data from block for user_id="
+                     << user_id << ", status=" << status;
+        return grpc::Status(grpc::StatusCode::INTERNAL,
+                            "can't delete user data from block");
+      }
 
-    // We don't check for NOT_FOUND here, this is because the point
-    // here may be older than the expiration date and compete with the
-    // GC, so we may be double-deleting points; that's fine.
-    if (!rocksdb_status.ok()) {
-      LOG(WARNING) << "can't delete user data from block for user_id="
-                   << user_id << ", status=" << rocksdb_status.ToString();
-      return grpc::Status(grpc::StatusCode::INTERNAL,
-                          "can't delete user data from block");
-    } else {
+      rocksdb::Status rocksdb_status =
+          batch.Delete(partition.reverse.get(), reverse_key_raw);
+      if (!rocksdb_status.ok()) {
+        LOG(WARNING) << "can't delete user data from block for user_id="
+                     << user_id << ", status=" << rocksdb_status.ToString();
+        return grpc::Status(grpc::StatusCode::INTERNAL,
+                            "can't delete user data from block");
+      }
       ++reverse_count;
+
+      reverse_it->Next();
     }
+  }
+
+  // All data of the user is deleted at once. We don't check for
+  // NOT_FOUND here, this is because points may be older than the
+  // expiration date and compete with the GC, so we may be
+  // double-deleting points; that's fine. The GC may also drop a
+  // partition we are deleting from.
+  rocksdb::Status rocksdb_status =
+      db_->Rocks()->Write(PointWriteOptions(), &batch);
+  if (!rocksdb_status.ok()) {
+    LOG(WARNING) << "can't delete user data for user_id=" << user_id
+                 << ", status=" << rocksdb_status.ToString();
+    return grpc::Status(grpc::StatusCode::INTERNAL, "can't delete user data");
+  }
 
-    reverse_it->Next();
+  // Points pushed while deleting may have been cached.
+  if (reverse_cache_ != nullptr) {
+    reverse_cache_->InvalidateUser(user_id);
   }
 
   LOG(INFO) << "deleted all data for user_id=" << user_id
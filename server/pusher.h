@@ -1,47 +1,111 @@
 #include <atomic>
+#include <future>
 #include <grpc++/grpc++.h>
+#include <map>
+#include <memory>
 #include <rocksdb/db.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 #include "common/status.h"
+#include "common/thread_pool.h"
 #include "proto/backtrace.grpc.pb.h"
+#include "server/arena_allocator.h"
 #include "server/db.h"
+#include "server/reverse_cache.h"
+#include "server/worker_config.h"
+#include "server/writer.h"
 
 namespace bt {
 
 class Db;
 
-// Service to push points to the database, see threading notes above,
-// there is only one thread accepting requests and writing to the
-// database in batches.
-class Pusher : public proto::Pusher::Service {
+// Service to push points to the database, see threading notes in
+// worker.h: requests are handled by the pusher thread pool, points are
+// encoded there and written by the single writer thread.
+class Pusher : public proto::Pusher::CallbackService {
 public:
-  Status Init(Db *db);
+  Status Init(Db *db, Writer *writer, const WorkerConfig &config);
 
-  grpc::Status
-  InternalPutLocation(grpc::ServerContext *context,
+  grpc::ServerUnaryReactor *
+  InternalPutLocation(grpc::CallbackServerContext *context,
                       const proto::PutLocation_Request *request,
                       proto::PutLocation_Response *response) override;
 
-  grpc::Status InternalDeleteUser(grpc::ServerContext *context,
-                                  const proto::DeleteUser_Request *request,
-                                  proto::DeleteUser_Response *response) override;
+  grpc::ServerUnaryReactor *
+  InternalDeleteUser(grpc::CallbackServerContext *context,
+                     const proto::DeleteUser_Request *request,
+                     proto::DeleteUser_Response *response) override;
+
+  // Reverse cache counters, zero if the cache is disabled.
+  uint64_t ReverseCacheHits() const;
+  uint64_t ReverseCacheMisses() const;
 
 private:
+  grpc::Status PutLocation(const proto::PutLocation_Request *request,
+                           proto::PutLocation_Response *response);
+  grpc::Status DeleteUser(const proto::DeleteUser_Request *request,
+                          proto::DeleteUser_Response *response);
+
+  // Records of a batch of points submitted to the writer, reverse
+  // keys are recorded in the reverse cache once the batch is written.
+  // Partitions of the records are kept until then, by start zone.
+  struct PendingBatch {
+    std::vector<WriteRecord> records;
+    std::map<int64_t, Partition> partitions;
+    int points = 0;
+    std::unordered_set<std::string> raw_reverse_keys;
+    std::vector<proto::DbReverseKey> reverse_keys;
+    std::future<Status> done;
+  };
+
+  // Adds a point to the batch, in both the timeline and the reverse
+  // columns.
   Status PutTimelineLocation(int64_t user_id, int64_t ts, uint32_t duration,
                              float gps_longitude, float gps_latitude,
-                             float gps_altitude);
+                             float gps_altitude, PendingBatch *batch);
 
   Status PutReverseLocation(int64_t user_id, int64_t ts, uint32_t duration,
                             float gps_longitude, float gps_latitude,
-                            float gps_altitude);
+                            float gps_altitude, PendingBatch *batch);
+
+  // Adds a location to the last batch, splitting it in one point per
+  // time zone it spans; a new batch is submitted to the writer once
+  // the last one is full.
+  void PutPoint(uint64_t user_id, int64_t timestamp, uint32_t duration,
+                float gps_longitude, float gps_latitude, float gps_altitude,
+                std::vector<PendingBatch> *batches, int *errors);
 
-  Status DeleteUserFromBlock(int64_t user_id, const proto::DbKey &begin,
-                             int64_t *count);
+  // Waits for the batch to be written, points in the batch are either
+  // all accounted as successes or as errors.
+  Status WaitBatch(PendingBatch *batch, int *success, int *errors);
+
+  // Returns the partition of the database holding a time zone.
+  Status BatchPartition(int64_t ts_zone, PendingBatch *batch,
+                        const Partition **partition);
+
+  // Adds deletes of the timeline entries of the user of the begin key,
+  // in the zone of the key, to the batch.
+  Status DeleteUserFromBlock(const Partition &partition,
+                             const proto::DbKey &begin,
+                             rocksdb::WriteBatch *batch, int64_t *count);
 
   Db *db_ = nullptr;
+  Writer *writer_ = nullptr;
+  int max_batch_size_ = kDefaultPusherMaxBatchSize;
+  std::unique_ptr<ReverseCache> reverse_cache_;
+
+  // Points of a request are allocated on an arena.
+  ArenaAllocator<proto::PutLocation_Request, proto::PutLocation_Response>
+      put_location_allocator_;
 
   std::atomic<uint64_t> counter_ok_ = 0;
   std::atomic<uint64_t> counter_ko_ = 0;
+
+  // Last so that pending requests are done before other members are
+  // destroyed.
+  ThreadPool pool_;
 };
 
 } // namespace bt
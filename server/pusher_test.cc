@@ -1,4 +1,5 @@
 #include "server/cluster_test.h"
+#include "server/zones.h"
 
 namespace bt {
 namespace {
@@ -18,6 +19,82 @@ TEST_P(PusherTest, TimelineSinglePointOK) {
   EXPECT_EQ(response.point_size(), 1);
 }
 
+// Tests that a request larger than the max batch size, with points
+// spanning multiple time zones, is fully written.
+TEST_P(PusherTest, TimelineLargeRequestOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kNumberOfPoints = 100;
+
+  grpc::ServerContext context;
+  proto::PutLocation_Request request;
+  proto::PutLocation_Response response;
+
+  for (int i = 0; i < kNumberOfPoints; ++i) {
+    proto::Location *location = request.add_locations();
+    location->set_timestamp(kBaseTimestamp + i * 60);
+    location->set_duration(kBaseDuration);
+    location->set_user_id(kBaseUserId);
+    location->set_gps_longitude(kBaseGpsLongitude);
+    location->set_gps_latitude(kBaseGpsLatitude);
+    location->set_gps_altitude(kBaseGpsAltitude);
+  }
+
+  // This one spans 3 time zones, so it is split in 3 points.
+  proto::Location *location = request.add_locations();
+  location->set_timestamp(kBaseTimestamp + kNumberOfPoints * 60);
+  location->set_duration(kTimePrecision * 2);
+  location->set_user_id(kBaseUserId);
+  location->set_gps_longitude(kBaseGpsLongitude);
+  location->set_gps_latitude(kBaseGpsLatitude);
+  location->set_gps_altitude(kBaseGpsAltitude);
+
+  EXPECT_TRUE(GetMixer()->PutLocation(&context, &request, &response).ok());
+
+  proto::GetUserTimeline_Response timeline;
+  EXPECT_TRUE(FetchTimeline(kBaseUserId, &timeline));
+  EXPECT_EQ(timeline.point_size(), kNumberOfPoints + 3);
+}
+
+// Tests that points of a user staying in a zone only write the
+// reverse key once, and that it is written again after a deletion.
+TEST_P(PusherTest, ReverseCacheOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kNumberOfPoints = 10;
+  for (int i = 0; i < kNumberOfPoints; ++i) {
+    EXPECT_TRUE(PushPoint(kBaseTimestamp + i, kBaseDuration, kBaseUserId,
+                          kBaseGpsLongitude, kBaseGpsLatitude,
+                          kBaseGpsAltitude));
+  }
+
+  uint64_t hits = 0;
+  for (auto &worker : workers_) {
+    hits += worker->GetPusher()->ReverseCacheHits();
+  }
+  EXPECT_GT(hits, 0);
+
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), kNumberOfPoints);
+  }
+
+  if (simulate_db_down_ && nb_databases_per_shard_ > 1) {
+    return;
+  }
+
+  EXPECT_TRUE(DeleteUser(kBaseUserId));
+  EXPECT_TRUE(PushPoint(kBaseTimestamp, kBaseDuration, kBaseUserId,
+                        kBaseGpsLongitude, kBaseGpsLatitude, kBaseGpsAltitude));
+
+  {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(kBaseUserId, &response));
+    EXPECT_EQ(response.point_size(), 1);
+  }
+}
+
 TEST_P(PusherTest, DeleteUserSimpleOK) {
   EXPECT_EQ(Init(), StatusCode::OK);
 
@@ -106,6 +183,38 @@ TEST_P(PusherTest, DeleteUserLargeOK) {
   }
 }
 
+// Tests that deleting a user spanning many blocks keeps entries of
+// the users sorted right before and after it in the same blocks.
+TEST_P(PusherTest, DeleteUserKeepsNeighboursOK) {
+  EXPECT_EQ(Init(), StatusCode::OK);
+
+  constexpr int kZoneCount = 10;
+  constexpr int kPointsPerZone = 20;
+
+  for (int i = 0; i < kZoneCount; ++i) {
+    for (int j = 0; j < kPointsPerZone; ++j) {
+      for (uint64_t user_id : {kBaseUserId - 1, kBaseUserId, kBaseUserId + 1}) {
+        EXPECT_TRUE(PushPoint(kBaseTimestamp + i * kTimePrecision + j,
+                              kBaseDuration, user_id, kBaseGpsLongitude,
+                              kBaseGpsLatitude, kBaseGpsAltitude));
+      }
+    }
+  }
+
+  if (simulate_db_down_ && nb_databases_per_shard_ > 1) {
+    return;
+  }
+
+  EXPECT_TRUE(DeleteUser(kBaseUserId));
+
+  for (uint64_t user_id : {kBaseUserId - 1, kBaseUserId, kBaseUserId + 1}) {
+    proto::GetUserTimeline_Response response;
+    EXPECT_TRUE(FetchTimeline(user_id, &response));
+    EXPECT_EQ(response.point_size(),
+              user_id == kBaseUserId ? 0 : kZoneCount * kPointsPerZone);
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(GeoBtClusterLayouts, PusherTest, CLUSTER_PARAMS);
 
 } // namespace
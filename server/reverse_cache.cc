@@ -0,0 +1,121 @@
+#include <algorithm>
+
+#include "server/keys.h"
+#include "server/reverse_cache.h"
+
+namespace bt {
+
+namespace {
+
+uint64_t MakeGPSZone(const proto::DbReverseKey &key) {
+  const uint32_t longitude = GPSZoneToKeyZone(key.gps_longitude_zone());
+  const uint32_t latitude = GPSZoneToKeyZone(key.gps_latitude_zone());
+  return (static_cast<uint64_t>(longitude) << 32) | latitude;
+}
+
+bool HasGPSZone(const std::vector<uint64_t> &gps_zones, uint64_t gps_zone) {
+  return std::find(gps_zones.begin(), gps_zones.end(), gps_zone) !=
+         gps_zones.end();
+}
+
+} // anonymous namespace
+
+ReverseCache::ReverseCache(size_t max_users)
+    : max_users_per_shard_(std::max<size_t>(1, max_users / kShards)) {}
+
+ReverseCache::Shard &ReverseCache::ShardForUser(int64_t user_id) {
+  return shards_[static_cast<uint64_t>(user_id) % kShards];
+}
+
+bool ReverseCache::Contains(const proto::DbReverseKey &key) {
+  Shard &shard = ShardForUser(key.user_id());
+  const uint64_t gps_zone = MakeGPSZone(key);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto it = shard.users.find(key.user_id());
+  if (it != shard.users.end()) {
+    const UserEntry &entry = it->second;
+    const TimeZone *time_zone = nullptr;
+    if (entry.current.timestamp_zone == key.timestamp_zone()) {
+      time_zone = &entry.current;
+    } else if (entry.previous.timestamp_zone == key.timestamp_zone()) {
+      time_zone = &entry.previous;
+    }
+
+    if (time_zone != nullptr && HasGPSZone(time_zone->gps_zones, gps_zone)) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru_it);
+      ++hits_;
+      return true;
+    }
+  }
+
+  ++misses_;
+  return false;
+}
+
+void ReverseCache::Insert(const proto::DbReverseKey &key) {
+  Shard &shard = ShardForUser(key.user_id());
+  const uint64_t gps_zone = MakeGPSZone(key);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto it = shard.users.find(key.user_id());
+  if (it == shard.users.end()) {
+    if (shard.users.size() >= max_users_per_shard_) {
+      shard.users.erase(shard.lru.back());
+      shard.lru.pop_back();
+    }
+    shard.lru.push_front(key.user_id());
+    it = shard.users.emplace(key.user_id(), UserEntry()).first;
+    it->second.lru_it = shard.lru.begin();
+  } else {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_it);
+  }
+
+  UserEntry &entry = it->second;
+  TimeZone *time_zone = nullptr;
+
+  if (entry.current.timestamp_zone == key.timestamp_zone()) {
+    time_zone = &entry.current;
+  } else if (entry.previous.timestamp_zone == key.timestamp_zone()) {
+    time_zone = &entry.previous;
+  } else if (key.timestamp_zone() > entry.current.timestamp_zone) {
+    // The user moved to a new time zone, keep the current one only if
+    // it is adjacent.
+    if (key.timestamp_zone() == entry.current.timestamp_zone + 1) {
+      entry.previous = std::move(entry.current);
+    } else {
+      entry.previous = TimeZone();
+    }
+    entry.current = TimeZone();
+    entry.current.timestamp_zone = key.timestamp_zone();
+    time_zone = &entry.current;
+  } else {
+    // Out of order point for an older time zone, not worth caching.
+    return;
+  }
+
+  if (HasGPSZone(time_zone->gps_zones, gps_zone)) {
+    return;
+  }
+  if (time_zone->gps_zones.size() >= kMaxZonesPerTimeZone) {
+    time_zone->gps_zones.erase(time_zone->gps_zones.begin());
+  }
+  time_zone->gps_zones.push_back(gps_zone);
+}
+
+void ReverseCache::InvalidateUser(int64_t user_id) {
+  Shard &shard = ShardForUser(user_id);
+
+  std::lock_guard<std::mutex> lock(shard.lock);
+
+  auto it = shard.users.find(user_id);
+  if (it == shard.users.end()) {
+    return;
+  }
+  shard.lru.erase(it->second.lru_it);
+  shard.users.erase(it);
+}
+
+} // namespace bt
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "proto/backtrace.pb.h"
+
+namespace bt {
+
+// Cache of reverse keys recently written to the database.
+//
+// A user staying in the same zone writes the same reverse key for
+// each of its points (the key only has the time zone and the GPS
+// zone), this cache allows the pusher to skip those writes. For each
+// user, only the zones of the current and previous time zones are
+// kept: points are mostly received in order, older time zones are
+// unlikely to be hit again.
+//
+// The cache is bounded by a number of users, least recently used ones
+// are evicted first. It is sharded by user so that concurrent pushes
+// for different users don't contend on a single lock.
+//
+// This class can be used from multiple threads.
+class ReverseCache {
+public:
+  static constexpr int kShards = 16;
+
+  // Maximum number of GPS zones kept per time zone for a user, older
+  // ones are dropped first.
+  static constexpr size_t kMaxZonesPerTimeZone = 16;
+
+  explicit ReverseCache(size_t max_users);
+
+  // Whether or not the key was recently written, updates counters.
+  bool Contains(const proto::DbReverseKey &key);
+
+  // Records a key as written, this must only be called once the key
+  // is persisted in the database.
+  void Insert(const proto::DbReverseKey &key);
+
+  // Removes all keys of a user (i.e: when its data is deleted).
+  void InvalidateUser(int64_t user_id);
+
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+
+private:
+  struct TimeZone {
+    int64_t timestamp_zone = -1;
+    std::vector<uint64_t> gps_zones;
+  };
+
+  struct UserEntry {
+    TimeZone current;
+    TimeZone previous;
+    std::list<int64_t>::iterator lru_it;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<int64_t, UserEntry> users;
+
+    // Most recently used users first.
+    std::list<int64_t> lru;
+  };
+
+  Shard &ShardForUser(int64_t user_id);
+
+  size_t max_users_per_shard_;
+  std::array<Shard, kShards> shards_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+};
+
+} // namespace bt
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include "server/reverse_cache.h"
+#include "server/zones.h"
+
+namespace bt {
+namespace {
+
+constexpr int64_t kTimestampZone = 1582410;
+
+proto::DbReverseKey MakeKey(int64_t user_id, int64_t timestamp_zone,
+                            float gps_longitude = 53.287,
+                            float gps_latitude = -6.313) {
+  proto::DbReverseKey key;
+  key.set_user_id(user_id);
+  key.set_timestamp_zone(timestamp_zone);
+  key.set_gps_longitude_zone(GPSLocationToGPSZone(gps_longitude));
+  key.set_gps_latitude_zone(GPSLocationToGPSZone(gps_latitude));
+  return key;
+}
+
+TEST(ReverseCacheTest, HitAfterInsert) {
+  ReverseCache cache(1000);
+
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone)));
+  cache.Insert(MakeKey(1, kTimestampZone));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone)));
+
+  // Different user, time zone or GPS zone.
+  EXPECT_FALSE(cache.Contains(MakeKey(2, kTimestampZone)));
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone + 1)));
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone, 53.2, -6.3)));
+
+  EXPECT_EQ(cache.Hits(), 1);
+  EXPECT_EQ(cache.Misses(), 4);
+}
+
+TEST(ReverseCacheTest, KeepsPreviousTimeZone) {
+  ReverseCache cache(1000);
+
+  cache.Insert(MakeKey(1, kTimestampZone));
+  cache.Insert(MakeKey(1, kTimestampZone + 1));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone)));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone + 1)));
+
+  // Only the current and previous time zones are kept.
+  cache.Insert(MakeKey(1, kTimestampZone + 2));
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone)));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone + 1)));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone + 2)));
+
+  // Jumping over a time zone drops both.
+  cache.Insert(MakeKey(1, kTimestampZone + 10));
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone + 1)));
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone + 2)));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone + 10)));
+}
+
+TEST(ReverseCacheTest, IgnoresOlderTimeZones) {
+  ReverseCache cache(1000);
+
+  cache.Insert(MakeKey(1, kTimestampZone));
+  cache.Insert(MakeKey(1, kTimestampZone - 5));
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone - 5)));
+  EXPECT_TRUE(cache.Contains(MakeKey(1, kTimestampZone)));
+}
+
+TEST(ReverseCacheTest, BoundedZonesPerTimeZone) {
+  ReverseCache cache(1000);
+
+  // Locations in the middle of zones, to avoid rounding issues.
+  constexpr float kBaseLongitude = 1.0005;
+
+  for (size_t i = 0; i <= ReverseCache::kMaxZonesPerTimeZone; ++i) {
+    cache.Insert(
+        MakeKey(1, kTimestampZone, kBaseLongitude + i * kGPSZoneDistance));
+  }
+
+  // The first zone was dropped, the last ones are kept.
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone, kBaseLongitude)));
+  EXPECT_TRUE(cache.Contains(MakeKey(
+      1, kTimestampZone,
+      kBaseLongitude +
+          ReverseCache::kMaxZonesPerTimeZone * kGPSZoneDistance)));
+}
+
+TEST(ReverseCacheTest, EvictsLeastRecentlyUsedUsers) {
+  // One user per shard.
+  ReverseCache cache(ReverseCache::kShards);
+
+  cache.Insert(MakeKey(1, kTimestampZone));
+  cache.Insert(MakeKey(1 + ReverseCache::kShards, kTimestampZone));
+
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone)));
+  EXPECT_TRUE(
+      cache.Contains(MakeKey(1 + ReverseCache::kShards, kTimestampZone)));
+}
+
+TEST(ReverseCacheTest, InvalidateUser) {
+  ReverseCache cache(1000);
+
+  cache.Insert(MakeKey(1, kTimestampZone));
+  cache.Insert(MakeKey(2, kTimestampZone));
+  cache.InvalidateUser(1);
+  cache.InvalidateUser(3);
+
+  EXPECT_FALSE(cache.Contains(MakeKey(1, kTimestampZone)));
+  EXPECT_TRUE(cache.Contains(MakeKey(2, kTimestampZone)));
+}
+
+} // namespace
+} // namespace bt
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "server/router.h"
+
+namespace bt {
+
+namespace {
+
+bool IsWithinArea(float gps_latitude, float gps_longitude, float lat_begin,
+                  float long_begin, float lat_end, float long_end) {
+  return gps_latitude >= lat_begin && gps_latitude < lat_end &&
+         gps_longitude >= long_begin && gps_longitude < long_end;
+}
+
+} // anonymous namespace
+
+Status Router::Init(const std::vector<ShardConfig> &shards,
+                    const std::vector<PartitionConfig> &partitions) {
+  std::unordered_map<std::string, int> shard_index;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    shard_index[shards[i].name_] = i;
+  }
+
+  // Every start time begins a new interval, even if it only has a
+  // default partition: areas of the previous one end there.
+  struct Candidate {
+    std::pair<int, int> priority;
+    Area area;
+  };
+  std::map<uint64_t, std::vector<Candidate>> by_start;
+
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    const PartitionConfig &partition = partitions[i];
+    std::vector<Candidate> &candidates = by_start[partition.ts_start_];
+
+    if (partition.area_ == kDefaultArea) {
+      continue;
+    }
+    auto it = shard_index.find(partition.shard_);
+    if (it == shard_index.end()) {
+      RETURN_ERROR(INVALID_CONFIG,
+                   "partition refers to an unknown shard " << partition.shard_);
+    }
+
+    // Empty areas can't match any point.
+    if (!(partition.gps_latitude_begin_ < partition.gps_latitude_end_) ||
+        !(partition.gps_longitude_begin_ < partition.gps_longitude_end_)) {
+      continue;
+    }
+
+    Candidate candidate;
+    candidate.priority = std::make_pair(it->second, static_cast<int>(i));
+    candidate.area.shard = it->second;
+    candidate.area.gps_latitude_begin = partition.gps_latitude_begin_;
+    candidate.area.gps_longitude_begin = partition.gps_longitude_begin_;
+    candidate.area.gps_latitude_end = partition.gps_latitude_end_;
+    candidate.area.gps_longitude_end = partition.gps_longitude_end_;
+    candidates.push_back(candidate);
+  }
+
+  intervals_.clear();
+  for (auto &entry : by_start) {
+    std::vector<Candidate> &candidates = entry.second;
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate &lhs, const Candidate &rhs) {
+                return lhs.priority < rhs.priority;
+              });
+
+    Interval interval;
+    interval.ts_start = entry.first;
+    for (const auto &candidate : candidates) {
+      interval.areas.push_back(candidate.area);
+    }
+    BuildGrid(&interval);
+    intervals_.push_back(std::move(interval));
+  }
+
+  return StatusCode::OK;
+}
+
+int Router::Interval::LatitudeCell(float gps_latitude) const {
+  const int cell =
+      static_cast<int>((gps_latitude - gps_latitude_min) / cell_latitude);
+  return std::clamp(cell, 0, cells_per_axis - 1);
+}
+
+int Router::Interval::LongitudeCell(float gps_longitude) const {
+  const int cell =
+      static_cast<int>((gps_longitude - gps_longitude_min) / cell_longitude);
+  return std::clamp(cell, 0, cells_per_axis - 1);
+}
+
+void Router::BuildGrid(Interval *interval) {
+  if (interval->areas.empty()) {
+    return;
+  }
+
+  interval->gps_latitude_min = interval->areas[0].gps_latitude_begin;
+  interval->gps_longitude_min = interval->areas[0].gps_longitude_begin;
+  interval->gps_latitude_max = interval->areas[0].gps_latitude_end;
+  interval->gps_longitude_max = interval->areas[0].gps_longitude_end;
+  for (const auto &area : interval->areas) {
+    interval->gps_latitude_min =
+        std::min(interval->gps_latitude_min, area.gps_latitude_begin);
+    interval->gps_longitude_min =
+        std::min(interval->gps_longitude_min, area.gps_longitude_begin);
+    interval->gps_latitude_max =
+        std::max(interval->gps_latitude_max, area.gps_latitude_end);
+    interval->gps_longitude_max =
+        std::max(interval->gps_longitude_max, area.gps_longitude_end);
+  }
+
+  // About a few areas per cell if they are evenly spread.
+  const int cells =
+      2 * static_cast<int>(std::ceil(std::sqrt(interval->areas.size())));
+  interval->cells_per_axis = std::clamp(cells, 1, kMaxCellsPerAxis);
+  interval->cell_latitude =
+      (interval->gps_latitude_max - interval->gps_latitude_min) /
+      interval->cells_per_axis;
+  interval->cell_longitude =
+      (interval->gps_longitude_max - interval->gps_longitude_min) /
+      interval->cells_per_axis;
+
+  // Cells are computed the same way for area bounds and for points, a
+  // point within an area is always in one of the cells of the area.
+  const int cell_count = interval->cells_per_axis * interval->cells_per_axis;
+  std::vector<std::vector<int>> cells_areas(cell_count);
+  for (size_t i = 0; i < interval->areas.size(); ++i) {
+    const Area &area = interval->areas[i];
+    const int lat_begin = interval->LatitudeCell(area.gps_latitude_begin);
+    const int lat_end = interval->LatitudeCell(area.gps_latitude_end);
+    const int long_begin = interval->LongitudeCell(area.gps_longitude_begin);
+    const int long_end = interval->LongitudeCell(area.gps_longitude_end);
+
+    for (int lat = lat_begin; lat <= lat_end; ++lat) {
+      for (int lng = long_begin; lng <= long_end; ++lng) {
+        cells_areas[lat * interval->cells_per_axis + lng].push_back(i);
+      }
+    }
+  }
+
+  interval->cell_offsets.reserve(cell_count + 1);
+  interval->cell_offsets.push_back(0);
+  for (const auto &areas : cells_areas) {
+    interval->cell_areas.insert(interval->cell_areas.end(), areas.begin(),
+                                areas.end());
+    interval->cell_offsets.push_back(interval->cell_areas.size());
+  }
+}
+
+int Router::Route(float gps_latitude, float gps_longitude, int64_t ts) const {
+  if (ts < 0) {
+    return kDefaultShard;
+  }
+
+  auto it = std::upper_bound(intervals_.begin(), intervals_.end(),
+                             static_cast<uint64_t>(ts),
+                             [](uint64_t ts, const Interval &interval) {
+                               return ts < interval.ts_start;
+                             });
+  if (it == intervals_.begin()) {
+    return kDefaultShard;
+  }
+  const Interval &interval = *(it - 1);
+
+  if (interval.areas.empty() ||
+      !IsWithinArea(gps_latitude, gps_longitude, interval.gps_latitude_min,
+                    interval.gps_longitude_min, interval.gps_latitude_max,
+                    interval.gps_longitude_max)) {
+    return kDefaultShard;
+  }
+
+  const int cell =
+      interval.LatitudeCell(gps_latitude) * interval.cells_per_axis +
+      interval.LongitudeCell(gps_longitude);
+  for (int i = interval.cell_offsets[cell];
+       i < interval.cell_offsets[cell + 1]; ++i) {
+    const Area &area = interval.areas[interval.cell_areas[i]];
+    if (IsWithinArea(gps_latitude, gps_longitude, area.gps_latitude_begin,
+                     area.gps_longitude_begin, area.gps_latitude_end,
+                     area.gps_longitude_end)) {
+      return area.shard;
+    }
+  }
+
+  return kDefaultShard;
+}
+
+} // namespace bt
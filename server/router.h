@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common/status.h"
+#include "server/mixer_config.h"
+
+namespace bt {
+
+// Maps a point to the shard handling it, built once from the
+// partitions of the mixer config.
+//
+// Partitions are grouped by time interval (all partitions of an `at`
+// entry in the config), each interval has a 2D grid over the bounding
+// box of its area partitions; cells of the grid list the partitions
+// overlapping them. Routing a point is a binary search on time, a
+// grid lookup and a check of the few partitions of the cell.
+//
+// Points not in any area partition go to the default shard. When
+// partitions overlap, the first shard in config order wins, then the
+// first partition of that shard.
+//
+// This class is immutable after Init, it can be used from multiple
+// threads.
+class Router {
+public:
+  // Maximum number of grid cells per axis.
+  static constexpr int kMaxCellsPerAxis = 256;
+
+  // Returned when the point goes to the default shard.
+  static constexpr int kDefaultShard = -1;
+
+  Status Init(const std::vector<ShardConfig> &shards,
+              const std::vector<PartitionConfig> &partitions);
+
+  // Returns the index in the shard configs of the shard handling the
+  // point, or kDefaultShard.
+  int Route(float gps_latitude, float gps_longitude, int64_t ts) const;
+
+private:
+  struct Area {
+    int shard = kDefaultShard;
+    float gps_latitude_begin = 0.0;
+    float gps_longitude_begin = 0.0;
+    float gps_latitude_end = 0.0;
+    float gps_longitude_end = 0.0;
+  };
+
+  // Area partitions active during a time interval.
+  struct Interval {
+    uint64_t ts_start = 0;
+
+    // Areas sorted by priority.
+    std::vector<Area> areas;
+
+    // Grid over the bounding box of areas.
+    float gps_latitude_min = 0.0;
+    float gps_longitude_min = 0.0;
+    float gps_latitude_max = 0.0;
+    float gps_longitude_max = 0.0;
+    float cell_latitude = 0.0;
+    float cell_longitude = 0.0;
+    int cells_per_axis = 0;
+
+    // Areas of cell i are cell_areas[cell_offsets[i]] to
+    // cell_areas[cell_offsets[i + 1]], sorted by priority.
+    std::vector<int> cell_offsets;
+    std::vector<int> cell_areas;
+
+    int LatitudeCell(float gps_latitude) const;
+    int LongitudeCell(float gps_longitude) const;
+  };
+
+  static void BuildGrid(Interval *interval);
+
+  // Sorted by start time.
+  std::vector<Interval> intervals_;
+};
+
+} // namespace bt
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "server/router.h"
+
+namespace bt {
+namespace {
+
+class RouterTest : public testing::Test {
+public:
+  void SetUp() {
+    for (int i = 0; i < 4; ++i) {
+      ShardConfig shard;
+      shard.name_ = "shard-" + std::to_string(i);
+      shard.workers_.push_back("fake-worker");
+      shards_.push_back(shard);
+    }
+  }
+
+  PartitionConfig DefaultPartition(uint64_t ts_start) {
+    PartitionConfig partition;
+
+    partition.shard_ = "shard-0";
+    partition.area_ = kDefaultArea;
+    partition.ts_start_ = ts_start;
+
+    return partition;
+  }
+
+  PartitionConfig AreaPartition(int shard, uint64_t ts_start, float lat_begin,
+                                float long_begin, float lat_end,
+                                float long_end) {
+    PartitionConfig partition;
+
+    partition.shard_ = "shard-" + std::to_string(shard);
+    partition.area_ = "fr";
+    partition.ts_start_ = ts_start;
+    partition.gps_latitude_begin_ = lat_begin;
+    partition.gps_longitude_begin_ = long_begin;
+    partition.gps_latitude_end_ = lat_end;
+    partition.gps_longitude_end_ = long_end;
+
+    return partition;
+  }
+
+  std::vector<ShardConfig> shards_;
+};
+
+TEST_F(RouterTest, DefaultOnly) {
+  Router router;
+  EXPECT_EQ(router.Init(shards_, {DefaultPartition(0)}), StatusCode::OK);
+
+  EXPECT_EQ(router.Route(45.0, 2.0, 1582410316), Router::kDefaultShard);
+  EXPECT_EQ(router.Route(-10.0, -10.0, 0), Router::kDefaultShard);
+}
+
+TEST_F(RouterTest, AreaPartition) {
+  Router router;
+  EXPECT_EQ(router.Init(shards_, {DefaultPartition(0),
+                                  AreaPartition(1, 0, 44.0, -5.0, 47.5, 7.5)}),
+            StatusCode::OK);
+
+  EXPECT_EQ(router.Route(45.0, 2.0, 1582410316), 1);
+  EXPECT_EQ(router.Route(44.0, -5.0, 1582410316), 1);
+
+  // End bounds are excluded.
+  EXPECT_EQ(router.Route(47.5, 2.0, 1582410316), Router::kDefaultShard);
+  EXPECT_EQ(router.Route(45.0, 7.5, 1582410316), Router::kDefaultShard);
+  EXPECT_EQ(router.Route(53.0, 2.0, 1582410316), Router::kDefaultShard);
+}
+
+TEST_F(RouterTest, TimeIntervals) {
+  Router router;
+  EXPECT_EQ(router.Init(shards_, {DefaultPartition(100),
+                                  AreaPartition(1, 100, 44.0, -5.0, 47.5, 7.5),
+                                  DefaultPartition(200),
+                                  AreaPartition(2, 300, 44.0, -5.0, 47.5, 7.5),
+                                  DefaultPartition(300)}),
+            StatusCode::OK);
+
+  EXPECT_EQ(router.Route(45.0, 2.0, 50), Router::kDefaultShard);
+  EXPECT_EQ(router.Route(45.0, 2.0, 100), 1);
+  EXPECT_EQ(router.Route(45.0, 2.0, 199), 1);
+  EXPECT_EQ(router.Route(45.0, 2.0, 200), Router::kDefaultShard);
+  EXPECT_EQ(router.Route(45.0, 2.0, 300), 2);
+  EXPECT_EQ(router.Route(45.0, 2.0, 1582410316), 2);
+}
+
+TEST_F(RouterTest, OverlappingPartitions) {
+  Router router;
+  EXPECT_EQ(router.Init(shards_, {DefaultPartition(0),
+                                  AreaPartition(3, 0, 40.0, 0.0, 50.0, 10.0),
+                                  AreaPartition(2, 0, 44.0, 4.0, 46.0, 6.0)}),
+            StatusCode::OK);
+
+  // The first shard in config order wins.
+  EXPECT_EQ(router.Route(45.0, 5.0, 0), 2);
+  EXPECT_EQ(router.Route(41.0, 1.0, 0), 3);
+}
+
+TEST_F(RouterTest, EmptyAreaIgnored) {
+  Router router;
+  EXPECT_EQ(router.Init(shards_, {DefaultPartition(0),
+                                  AreaPartition(1, 0, 47.5, 7.5, 44.0, -5.0)}),
+            StatusCode::OK);
+
+  EXPECT_EQ(router.Route(45.0, 2.0, 0), Router::kDefaultShard);
+}
+
+TEST_F(RouterTest, UnknownShard) {
+  Router router;
+  EXPECT_EQ(router.Init(shards_, {AreaPartition(42, 0, 44.0, -5.0, 47.5, 7.5)}),
+            StatusCode::INVALID_CONFIG);
+}
+
+// Tests that routing matches a scan of all partitions, in config order.
+TEST_F(RouterTest, MatchesLinearScan) {
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> lat(40.0, 50.0);
+  std::uniform_real_distribution<float> lng(-5.0, 10.0);
+  std::uniform_real_distribution<float> size(0.01, 2.0);
+  std::uniform_int_distribution<int> shard(1, shards_.size() - 1);
+
+  std::vector<PartitionConfig> partitions = {DefaultPartition(0)};
+  for (int i = 0; i < 1000; ++i) {
+    const float lat_begin = lat(gen);
+    const float long_begin = lng(gen);
+    partitions.push_back(AreaPartition(shard(gen), i < 500 ? 0 : 1000,
+                                       lat_begin, long_begin,
+                                       lat_begin + size(gen),
+                                       long_begin + size(gen)));
+  }
+  partitions.push_back(DefaultPartition(1000));
+
+  Router router;
+  EXPECT_EQ(router.Init(shards_, partitions), StatusCode::OK);
+
+  for (int i = 0; i < 10000; ++i) {
+    const float point_lat = lat(gen);
+    const float point_long = lng(gen);
+    const int64_t ts = i % 2 ? 500 : 1500;
+
+    int expected = Router::kDefaultShard;
+    for (size_t s = 1; s < shards_.size() && expected < 0; ++s) {
+      for (const auto &p : partitions) {
+        const uint64_t ts_end = p.ts_start_ == 0 ? 1000 : 0;
+        if (p.area_ != kDefaultArea && p.shard_ == shards_[s].name_ &&
+            point_lat >= p.gps_latitude_begin_ &&
+            point_lat < p.gps_latitude_end_ &&
+            point_long >= p.gps_longitude_begin_ &&
+            point_long < p.gps_longitude_end_ &&
+            static_cast<uint64_t>(ts) >= p.ts_start_ &&
+            (ts_end == 0 || static_cast<uint64_t>(ts) < ts_end)) {
+          expected = s;
+          break;
+        }
+      }
+    }
+
+    EXPECT_EQ(router.Route(point_lat, point_long, ts), expected);
+  }
+}
+
+} // namespace
+} // namespace bt
@@ -1,68 +1,132 @@
+#include <algorithm>
 #include <glog/logging.h>
 #include <math.h>
 #include <rocksdb/db.h>
+#include <map>
 #include <memory>
 #include <utility>
 #include <vector>
 
+#include "server/correlator.h"
+#include "server/keys.h"
 #include "server/nearby_folk.h"
+#include "server/proto.h"
 #include "server/seeker.h"
 #include "server/zones.h"
 
 namespace bt {
 
-Status Seeker::Init(Db* db) {
+namespace {
+
+// Key at the beginning of the timeline zone of a reverse key.
+proto::DbKey ZoneKeyFromReverseKey(const proto::DbReverseKey& reverse_key) {
+  proto::DbKey key;
+  key.set_timestamp(reverse_key.timestamp_zone() * kTimePrecision);
+  key.set_user_id(reverse_key.user_id());
+  key.set_gps_longitude_zone(reverse_key.gps_longitude_zone());
+  key.set_gps_latitude_zone(reverse_key.gps_latitude_zone());
+  return key;
+}
+
+// Positions the iterator on the first entry of the zone of the
+// timeline key, start_key_raw is set to a key of the zone.
+void SeekBlock(rocksdb::Iterator* timeline_it, const proto::DbKey& timeline_key,
+               std::string* start_key_raw) {
+  // Start at the beginning of the zone, the user id is part of the key
+  // so we start from the smallest one.
+  proto::DbKey start_key = timeline_key;
+  start_key.set_timestamp(TsToZone(start_key.timestamp()) * kTimePrecision);
+  start_key.set_user_id(0);
+
+  EncodeTimelineKey(start_key, start_key_raw);
+  timeline_it->Seek(
+      rocksdb::Slice(start_key_raw->data(), start_key_raw->size()));
+}
+
+}  // anonymous namespace
+
+Status Seeker::Init(Db* db, const WorkerConfig& config) {
+  if (!(config.seeker_threads_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "seeker.threads should be > 0");
+  }
+  if (!(config.seeker_stream_chunk_size_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "seeker.stream_chunk_size should be > 0");
+  }
+  stream_chunk_size_ = config.seeker_stream_chunk_size_;
+  RETURN_IF_ERROR(pool_.Init("seeker", config.seeker_threads_));
+
+  SetMessageAllocatorFor_InternalGetUserTimeline(&timeline_allocator_);
+  SetMessageAllocatorFor_InternalBuildBlockForUser(&block_allocator_);
+  SetMessageAllocatorFor_InternalCorrelateUser(&correlate_allocator_);
+
   db_ = db;
   return StatusCode::OK;
 }
 
+grpc::ServerUnaryReactor* Seeker::InternalGetUserTimeline(
+    grpc::CallbackServerContext* context,
+    const proto::GetUserTimeline_Request* request,
+    proto::GetUserTimeline_Response* response) {
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  pool_.Run([this, reactor, request, response]() {
+    reactor->Finish(GetUserTimeline(request, response));
+  });
+  return reactor;
+}
+
+grpc::ServerUnaryReactor* Seeker::InternalBuildBlockForUser(
+    grpc::CallbackServerContext* context,
+    const proto::BuildBlockForUser_Request* request,
+    proto::BuildBlockForUser_Response* response) {
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  pool_.Run([this, reactor, request, response]() {
+    reactor->Finish(BuildBlockForUser(request, response));
+  });
+  return reactor;
+}
+
+grpc::ServerUnaryReactor* Seeker::InternalCorrelateUser(
+    grpc::CallbackServerContext* context,
+    const proto::CorrelateUser_Request* request,
+    proto::CorrelateUser_Response* response) {
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  pool_.Run([this, reactor, request, response]() {
+    reactor->Finish(CorrelateUser(request, response));
+  });
+  return reactor;
+}
+
 Status Seeker::BuildTimelineKeysForUser(uint64_t user_id,
                                         std::list<proto::DbKey>* keys) {
   // Build an iterator to start looking up in the reverse table, goal
   // here is to get all zones where the user was, so as to build the
   // corresponding keys.
-  proto::DbReverseKey reverse_key_it;
-  reverse_key_it.set_user_id(user_id);
-  reverse_key_it.set_timestamp_zone(0);
-  reverse_key_it.set_gps_longitude_zone(0.0);
-  reverse_key_it.set_gps_latitude_zone(0.0);
-
-  std::string reverse_raw_key_it;
-  if (!reverse_key_it.SerializeToString(&reverse_raw_key_it)) {
-    RETURN_ERROR(
-        INTERNAL_ERROR,
-        "can't serialize internal db reverse key, user_id=" << user_id);
-  }
+  std::string reverse_prefix;
+  EncodeReversePrefix(user_id, &reverse_prefix);
 
   // Build the list of timeline keys to iterate over from the reverse
-  // column.
-  std::unique_ptr<rocksdb::Iterator> reverse_it(
-      db_->Rocks()->NewIterator(rocksdb::ReadOptions(), db_->ReverseHandle()));
-  reverse_it->Seek(
-      rocksdb::Slice(reverse_raw_key_it.data(), reverse_raw_key_it.size()));
-  while (reverse_it->Valid()) {
-    const rocksdb::Slice reverse_key_raw = reverse_it->key();
-    proto::DbReverseKey reverse_key;
-    if (!reverse_key.ParseFromArray(reverse_key_raw.data(),
-                                    reverse_key_raw.size())) {
-      RETURN_ERROR(
-          INTERNAL_ERROR,
-          "can't unserialize internal db reverse key, user_id=" << user_id);
-    }
-    // If we have a different user ID, we are done scanning keys for
-    // this user.
-    if (reverse_key.user_id() != user_id) {
-      break;
-    }
+  // column of each partition, all keys of a user share the same
+  // prefix: the iterator stops after the last one, and partitions
+  // where the user never was are skipped with bloom filters.
+  for (const Partition& partition : db_->Partitions()) {
+    std::unique_ptr<rocksdb::Iterator> reverse_it(db_->Rocks()->NewIterator(
+        PrefixReadOptions(), partition.reverse.get()));
+    reverse_it->Seek(
+        rocksdb::Slice(reverse_prefix.data(), reverse_prefix.size()));
+    while (reverse_it->Valid()) {
+      const rocksdb::Slice reverse_key_raw = reverse_it->key();
+
+      proto::DbReverseKey reverse_key;
+      if (!DecodeReverseKey(reverse_key_raw, &reverse_key)) {
+        RETURN_ERROR(INTERNAL_ERROR,
+                     "can't decode internal db reverse key, user_id="
+                         << user_id);
+      }
 
-    proto::DbKey key;
-    key.set_timestamp(reverse_key.timestamp_zone() * kTimePrecision);
-    key.set_user_id(user_id);
-    key.set_gps_longitude_zone(reverse_key.gps_longitude_zone());
-    key.set_gps_latitude_zone(reverse_key.gps_latitude_zone());
-    keys->push_back(key);
+      keys->push_back(ZoneKeyFromReverseKey(reverse_key));
 
-    reverse_it->Next();
+      reverse_it->Next();
+    }
   }
 
   return StatusCode::OK;
@@ -70,59 +134,67 @@ Status Seeker::BuildTimelineKeysForUser(uint64_t user_id,
 
 Status Seeker::BuildTimelineForUser(const std::list<proto::DbKey>& keys,
                                     proto::GetUserTimeline_Response* timeline) {
-  std::unique_ptr<rocksdb::Iterator> timeline_it(
-      db_->Rocks()->NewIterator(rocksdb::ReadOptions(), db_->TimelineHandle()));
+  PartitionIterators partitions(db_);
 
   for (const auto& key_it : keys) {
-    std::string key_raw_it;
-    if (!key_it.SerializeToString(&key_raw_it)) {
-      RETURN_ERROR(INTERNAL_ERROR, "can't serialize internal db timeline key");
+    // The partition may have been dropped since keys were built.
+    rocksdb::Iterator* timeline_it =
+        partitions.Timeline(TsToZone(key_it.timestamp()));
+    if (timeline_it == nullptr) {
+      continue;
     }
+    RETURN_IF_ERROR(
+        ReadTimelineZone(timeline_it, key_it, timeline->mutable_point()));
+  }
 
-    const uint64_t timestamp_end = key_it.timestamp() + kTimePrecision - 1;
-    timeline_it->Seek(rocksdb::Slice(key_raw_it.data(), key_raw_it.size()));
-    while (timeline_it->Valid()) {
-      const rocksdb::Slice key_raw = timeline_it->key();
-      proto::DbKey key;
-      if (!key.ParseFromArray(key_raw.data(), key_raw.size())) {
-        RETURN_ERROR(INTERNAL_ERROR,
-                     "can't unserialize internal db timeline key, user_id="
-                         << key.user_id());
-      }
+  return StatusCode::OK;
+}
 
-      const bool end_of_zone =
-          (key.timestamp() > timestamp_end) ||
-          (key.gps_longitude_zone() != key_it.gps_longitude_zone()) ||
-          (key.gps_latitude_zone() != key_it.gps_latitude_zone()) ||
-          (key.user_id() != key_it.user_id());
-      if (end_of_zone) {
-        break;
-      }
+Status Seeker::ReadTimelineZone(
+    rocksdb::Iterator* timeline_it, const proto::DbKey& zone_key,
+    google::protobuf::RepeatedPtrField<proto::UserTimelinePoint>* points) {
+  std::string zone_key_raw;
+  EncodeTimelineKey(zone_key, &zone_key_raw);
+  const rocksdb::Slice zone = TimelineKeyZone(zone_key_raw);
 
-      const rocksdb::Slice value_raw = timeline_it->value();
-      proto::DbValue value;
-      if (!value.ParseFromArray(value_raw.data(), value_raw.size())) {
-        RETURN_ERROR(INTERNAL_ERROR,
-                     "can't unserialize internal db timeline value, user_id="
-                         << key.user_id());
-      }
+  timeline_it->Seek(rocksdb::Slice(zone_key_raw.data(), zone_key_raw.size()));
+  proto::DbKey key;
+  proto::DbValue value;
+  while (timeline_it->Valid()) {
+    const rocksdb::Slice key_raw = timeline_it->key();
+    if (!DecodeTimelineKey(key_raw, &key)) {
+      RETURN_ERROR(INTERNAL_ERROR,
+                   "can't decode internal db timeline key, user_id="
+                       << zone_key.user_id());
+    }
 
-      proto::UserTimelinePoint* point = timeline->add_point();
-      point->set_timestamp(key.timestamp());
-      point->set_duration(value.duration());
-      point->set_gps_latitude(value.gps_latitude());
-      point->set_gps_longitude(value.gps_longitude());
-      point->set_gps_altitude(value.gps_altitude());
+    const bool end_of_zone = (TimelineKeyZone(key_raw) != zone) ||
+                             (key.user_id() != zone_key.user_id());
+    if (end_of_zone) {
+      break;
+    }
 
-      timeline_it->Next();
+    const rocksdb::Slice value_raw = timeline_it->value();
+    if (!value.ParseFromArray(value_raw.data(), value_raw.size())) {
+      RETURN_ERROR(INTERNAL_ERROR,
+                   "can't unserialize internal db timeline value, user_id="
+                       << key.user_id());
     }
+
+    proto::UserTimelinePoint* point = points->Add();
+    point->set_timestamp(key.timestamp());
+    point->set_duration(value.duration());
+    point->set_gps_latitude(value.gps_latitude());
+    point->set_gps_longitude(value.gps_longitude());
+    point->set_gps_altitude(value.gps_altitude());
+
+    timeline_it->Next();
   }
 
   return StatusCode::OK;
 }
 
-grpc::Status Seeker::InternalGetUserTimeline(
-    grpc::ServerContext* context,
+grpc::Status Seeker::GetUserTimeline(
     const proto::GetUserTimeline_Request* request,
     proto::GetUserTimeline_Response* response) {
   std::list<proto::DbKey> keys;
@@ -146,6 +218,14 @@ grpc::Status Seeker::InternalGetUserTimeline(
                         "can't build timeline values");
   }
 
+  // Points are ordered per zone, mixers merge timelines of workers
+  // and expect them to be fully sorted.
+  CompareTimelinePoints cmp;
+  auto* points = response->mutable_point();
+  if (!std::is_sorted(points->begin(), points->end(), cmp)) {
+    std::sort(points->begin(), points->end(), cmp);
+  }
+
   LOG_EVERY_N(INFO, 1000) << "retrieved timeline values, user_id="
                           << request->user_id() << ", timeline_values_count="
                           << response->point_size();
@@ -153,48 +233,181 @@ grpc::Status Seeker::InternalGetUserTimeline(
   return grpc::Status::OK;
 }
 
-grpc::Status Seeker::InternalBuildBlockForUser(
-    grpc::ServerContext* context,
-    const proto::BuildBlockForUser_Request* request,
-    proto::BuildBlockForUser_Response* response) {
-  proto::DbKey start_key = request->timeline_key();
-  start_key.set_user_id(0);
+class Seeker::TimelineWriter
+    : public grpc::ServerWriteReactor<proto::GetUserTimeline_Response> {
+public:
+  TimelineWriter(Seeker* seeker, const proto::GetUserTimeline_Request* request)
+      : seeker_(seeker), request_(request), partitions_(seeker->db_) {
+    EncodeReversePrefix(request_->user_id(), &reverse_prefix_);
+    seeker_->pool_.Run([this]() { WriteNext(); });
+  }
 
-  const uint64_t timestamp_end = start_key.timestamp() + kTimePrecision - 1;
+  void OnWriteDone(bool ok) override {
+    if (!ok) {
+      Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                          "unable to write timeline to stream"));
+      return;
+    }
+    seeker_->pool_.Run([this]() { WriteNext(); });
+  }
 
-  std::string start_key_raw;
-  if (!start_key.SerializeToString(&start_key_raw)) {
-    LOG_EVERY_N(WARNING, 10000) << "can't serialize internal db timeline key";
-    return grpc::Status(grpc::StatusCode::INTERNAL,
-                        "can't serialize internal db timeline key");
+  void OnDone() override {
+    LOG_EVERY_N(INFO, 1000) << "streamed timeline values, user_id="
+                            << request_->user_id()
+                            << ", timeline_values_count=" << written_;
+    delete this;
+  }
+
+private:
+  // Fills a chunk with points of the next time zones and writes it,
+  // finishes the call once all zones are read.
+  void WriteNext() {
+    response_.Clear();
+    while (response_.point_size() < seeker_->stream_chunk_size_) {
+      if (next_ == points_.size()) {
+        points_.Clear();
+        next_ = 0;
+
+        bool done = false;
+        Status status = ReadTimeZone(&done);
+        if (status != StatusCode::OK) {
+          LOG(WARNING) << "can't stream timeline for user, user_id="
+                       << request_->user_id() << ", status=" << status;
+          Finish(grpc::Status(grpc::StatusCode::INTERNAL,
+                              "can't build timeline values"));
+          return;
+        }
+        if (done) {
+          break;
+        }
+        continue;
+      }
+      response_.add_point()->Swap(points_.Mutable(next_++));
+    }
+
+    if (response_.point_size() > 0) {
+      written_ += response_.point_size();
+      StartWrite(&response_);
+      return;
+    }
+
+    Finish(grpc::Status::OK);
   }
 
-  std::unique_ptr<rocksdb::Iterator> timeline_it(
-      db_->Rocks()->NewIterator(rocksdb::ReadOptions(), db_->TimelineHandle()));
-  timeline_it->Seek(rocksdb::Slice(start_key_raw.data(), start_key_raw.size()));
+  // Reads all points of the user in the next time zone, sorted (points
+  // of the zone are ordered per GPS zone in the database); sets done
+  // if there are no more zones.
+  Status ReadTimeZone(bool* done) {
+    int64_t timestamp_zone = 0;
+    bool has_zone = false;
+
+    while (true) {
+      if (reverse_it_ == nullptr || !reverse_it_->Valid() ||
+          !reverse_it_->key().starts_with(reverse_prefix_)) {
+        // Time zones don't span partitions, the next one starts with
+        // the next zone.
+        if (has_zone || !NextPartition()) {
+          break;
+        }
+        continue;
+      }
+
+      const rocksdb::Slice reverse_key_raw = reverse_it_->key();
+
+      proto::DbReverseKey reverse_key;
+      if (!DecodeReverseKey(reverse_key_raw, &reverse_key)) {
+        RETURN_ERROR(INTERNAL_ERROR,
+                     "can't decode internal db reverse key, user_id="
+                         << request_->user_id());
+      }
+      if (has_zone && reverse_key.timestamp_zone() != timestamp_zone) {
+        break;
+      }
+      timestamp_zone = reverse_key.timestamp_zone();
+      has_zone = true;
+
+      const proto::DbKey zone_key = ZoneKeyFromReverseKey(reverse_key);
+      rocksdb::Iterator* timeline_it =
+          partitions_.Timeline(TsToZone(zone_key.timestamp()));
+      if (timeline_it != nullptr) {
+        RETURN_IF_ERROR(
+            seeker_->ReadTimelineZone(timeline_it, zone_key, &points_));
+      }
+      reverse_it_->Next();
+    }
+
+    *done = !has_zone;
+    std::sort(points_.begin(), points_.end(), CompareTimelinePoints());
+    return StatusCode::OK;
+  }
 
+  // Moves the reverse iterator to the keys of the user in the next
+  // partition, returns false if there are no more partitions.
+  bool NextPartition() {
+    if (next_partition_ == partitions_.Partitions().size()) {
+      return false;
+    }
+    reverse_it_ = partitions_.NewReverse(next_partition_++);
+    reverse_it_->Seek(
+        rocksdb::Slice(reverse_prefix_.data(), reverse_prefix_.size()));
+    return true;
+  }
+
+  Seeker* seeker_;
+  const proto::GetUserTimeline_Request* request_;
+  std::string reverse_prefix_;
+  PartitionIterators partitions_;
+  size_t next_partition_ = 0;
+  std::unique_ptr<rocksdb::Iterator> reverse_it_;
+
+  // Points of the current time zone, and next one to write.
+  google::protobuf::RepeatedPtrField<proto::UserTimelinePoint> points_;
+  int next_ = 0;
+
+  int64_t written_ = 0;
+  proto::GetUserTimeline_Response response_;
+};
+
+grpc::ServerWriteReactor<proto::GetUserTimeline_Response>*
+Seeker::InternalStreamUserTimeline(
+    grpc::CallbackServerContext* context,
+    const proto::GetUserTimeline_Request* request) {
+  return new TimelineWriter(this, request);
+}
+
+grpc::Status Seeker::ReadBlock(
+    rocksdb::Iterator* timeline_it, const proto::DbKey& timeline_key,
+    uint64_t user_id,
+    google::protobuf::RepeatedPtrField<proto::BlockEntry>* user_entries,
+    google::protobuf::RepeatedPtrField<proto::BlockEntry>* folk_entries) {
+  std::string start_key_raw;
+  SeekBlock(timeline_it, timeline_key, &start_key_raw);
+  const rocksdb::Slice zone = TimelineKeyZone(start_key_raw);
+
+  // Keys only have scalar fields, the key is reused across entries and
+  // values are parsed in place, on the arena of the response if it has
+  // one.
+  proto::DbKey key;
   while (timeline_it->Valid()) {
     const rocksdb::Slice key_raw = timeline_it->key();
-    proto::DbKey key;
-    if (!key.ParseFromArray(key_raw.data(), key_raw.size())) {
-      LOG_EVERY_N(WARNING, 10000)
-          << "can't unserialize internal db timeline key, user_id="
-          << key.user_id();
-      return grpc::Status(grpc::StatusCode::INTERNAL,
-                          "can't unserialize internal db timeline key");
+    if (TimelineKeyZone(key_raw) != zone) {
+      break;
     }
 
-    const bool end_of_zone =
-        (key.timestamp() > timestamp_end) ||
-        (key.gps_longitude_zone() != start_key.gps_longitude_zone()) ||
-        (key.gps_latitude_zone() != start_key.gps_latitude_zone());
-    if (end_of_zone) {
-      break;
+    if (!DecodeTimelineKey(key_raw, &key)) {
+      LOG_EVERY_N(WARNING, 10000) << "can't decode internal db timeline key";
+      return grpc::Status(grpc::StatusCode::INTERNAL,
+                          "can't decode internal db timeline key");
     }
 
+    proto::BlockEntry* entry = key.user_id() == user_id
+                                   ? user_entries->Add()
+                                   : folk_entries->Add();
+    *(entry->mutable_key()) = key;
+
     const rocksdb::Slice value_raw = timeline_it->value();
-    proto::DbValue value;
-    if (!value.ParseFromArray(value_raw.data(), value_raw.size())) {
+    if (!entry->mutable_value()->ParseFromArray(value_raw.data(),
+                                                value_raw.size())) {
       LOG_EVERY_N(WARNING, 10000)
           << "can't unserialize internal db timeline value, user_id="
           << key.user_id();
@@ -202,18 +415,52 @@ grpc::Status Seeker::InternalBuildBlockForUser(
                           "can't unserialize internal db timeline value");
     }
 
-    if (key.user_id() == request->user_id()) {
-      proto::BlockEntry* entry = response->add_user_entries();
-      *(entry->mutable_key()) = key;
-      *(entry->mutable_value()) = value;
-    } else {
-      proto::BlockEntry* entry = response->add_folk_entries();
-      *(entry->mutable_key()) = key;
-      *(entry->mutable_value()) = value;
+    timeline_it->Next();
+  }
+
+  return grpc::Status::OK;
+}
+
+void Seeker::ReadRawBlock(rocksdb::Iterator* timeline_it,
+                          const proto::DbKey& timeline_key,
+                          std::string* raw_entries) {
+  std::string start_key_raw;
+  SeekBlock(timeline_it, timeline_key, &start_key_raw);
+  const rocksdb::Slice zone = TimelineKeyZone(start_key_raw);
+
+  while (timeline_it->Valid()) {
+    const rocksdb::Slice key_raw = timeline_it->key();
+    if (TimelineKeyZone(key_raw) != zone) {
+      break;
     }
 
+    AppendRawEntry(key_raw, timeline_it->value(), raw_entries);
     timeline_it->Next();
   }
+}
+
+grpc::Status Seeker::BuildBlockForUser(
+    const proto::BuildBlockForUser_Request* request,
+    proto::BuildBlockForUser_Response* response) {
+  PartitionIterators partitions(db_);
+  rocksdb::Iterator* timeline_it =
+      partitions.Timeline(TsToZone(request->timeline_key().timestamp()));
+  if (timeline_it == nullptr) {
+    return grpc::Status::OK;
+  }
+
+  if (request->raw()) {
+    ReadRawBlock(timeline_it, request->timeline_key(),
+                 response->mutable_raw_entries());
+    return grpc::Status::OK;
+  }
+
+  grpc::Status status = ReadBlock(
+      timeline_it, request->timeline_key(), request->user_id(),
+      response->mutable_user_entries(), response->mutable_folk_entries());
+  if (!status.ok()) {
+    return status;
+  }
 
   LOG_EVERY_N(INFO, 10000) << "built logical block with user_entries="
                            << response->user_entries_size() << ", folk_entries="
@@ -222,4 +469,164 @@ grpc::Status Seeker::InternalBuildBlockForUser(
   return grpc::Status::OK;
 }
 
+// Streams blocks of a BuildBlocksForUser request, one block is read
+// at a time on the seeker pool and written once the previous write is
+// done, so that a large request doesn't hold all its blocks in memory
+// nor a thread while the client reads.
+class Seeker::BlockWriter
+    : public grpc::ServerWriteReactor<proto::BuildBlocksForUser_Response> {
+public:
+  BlockWriter(Seeker* seeker, const proto::BuildBlocksForUser_Request* request)
+      : seeker_(seeker), request_(request), partitions_(seeker->db_) {
+    seeker_->pool_.Run([this]() { WriteNext(); });
+  }
+
+  void OnWriteDone(bool ok) override {
+    if (!ok) {
+      Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE,
+                          "unable to write block to stream"));
+      return;
+    }
+    seeker_->pool_.Run([this]() { WriteNext(); });
+  }
+
+  void OnDone() override {
+    LOG_EVERY_N(INFO, 10000) << "built logical blocks, blocks=" << next_
+                             << ", user_id=" << request_->user_id();
+    delete this;
+  }
+
+private:
+  // Reads blocks until one has entries and writes it, finishes the
+  // call once all blocks are read.
+  void WriteNext() {
+    while (next_ < request_->timeline_keys_size()) {
+      const proto::DbKey& key = request_->timeline_keys(next_++);
+
+      rocksdb::Iterator* timeline_it =
+          partitions_.Timeline(TsToZone(key.timestamp()));
+      if (timeline_it == nullptr) {
+        continue;
+      }
+
+      response_.Clear();
+      if (request_->raw()) {
+        seeker_->ReadRawBlock(timeline_it, key,
+                              response_.mutable_raw_entries());
+      } else {
+        grpc::Status status = seeker_->ReadBlock(
+            timeline_it, key, request_->user_id(),
+            response_.mutable_user_entries(),
+            response_.mutable_folk_entries());
+        if (!status.ok()) {
+          Finish(status);
+          return;
+        }
+      }
+
+      if (response_.user_entries_size() || response_.folk_entries_size() ||
+          !response_.raw_entries().empty()) {
+        *response_.mutable_timeline_key() = key;
+        StartWrite(&response_);
+        return;
+      }
+    }
+
+    Finish(grpc::Status::OK);
+  }
+
+  Seeker* seeker_;
+  const proto::BuildBlocksForUser_Request* request_;
+  PartitionIterators partitions_;
+  int next_ = 0;
+  proto::BuildBlocksForUser_Response response_;
+};
+
+grpc::ServerWriteReactor<proto::BuildBlocksForUser_Response>*
+Seeker::InternalBuildBlocksForUser(
+    grpc::CallbackServerContext* context,
+    const proto::BuildBlocksForUser_Request* request) {
+  return new BlockWriter(this, request);
+}
+
+grpc::Status Seeker::CorrelateUser(const proto::CorrelateUser_Request* request,
+                                   proto::CorrelateUser_Response* response) {
+  CorrelatorConfig config;
+  config.nearby_time_sec_ = request->nearby_seconds();
+  config.nearby_gps_distance_ = request->nearby_gps_distance();
+
+  // Points of the user as they are stored in the database, only the
+  // timestamp and the value are used to correlate.
+  std::vector<std::pair<proto::DbKey, proto::DbValue>> user_entries(
+      request->point_size());
+  for (int i = 0; i < request->point_size(); ++i) {
+    const proto::UserTimelinePoint& point = request->point(i);
+    user_entries[i].first.set_timestamp(point.timestamp());
+    user_entries[i].first.set_user_id(request->user_id());
+    user_entries[i].second.set_duration(point.duration());
+    user_entries[i].second.set_gps_latitude(point.gps_latitude());
+    user_entries[i].second.set_gps_longitude(point.gps_longitude());
+    user_entries[i].second.set_gps_altitude(point.gps_altitude());
+  }
+
+  PartitionIterators partitions(db_);
+
+  std::map<uint64_t, int64_t> scores;
+  google::protobuf::RepeatedPtrField<proto::BlockEntry> own_entries;
+  google::protobuf::RepeatedPtrField<proto::BlockEntry> folk_entries;
+  std::vector<size_t> nearby_folks;
+
+  for (const auto& block : request->block()) {
+    rocksdb::Iterator* timeline_it =
+        partitions.Timeline(TsToZone(block.timeline_key().timestamp()));
+    if (timeline_it == nullptr) {
+      continue;
+    }
+
+    own_entries.Clear();
+    folk_entries.Clear();
+    grpc::Status status =
+        ReadBlock(timeline_it, block.timeline_key(), request->user_id(),
+                  &own_entries, &folk_entries);
+    if (!status.ok()) {
+      return status;
+    }
+
+    std::vector<CorrelationEntry> folks;
+    folks.reserve(folk_entries.size());
+    for (const auto& folk_entry : folk_entries) {
+      folks.push_back({&folk_entry.key(), &folk_entry.value()});
+    }
+    const Correlator correlator(config, std::move(folks),
+                                block.user_point_size());
+
+    for (const auto& user_point : block.user_point()) {
+      if (user_point.index() >= user_entries.size()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                            "user point index out of range");
+      }
+      const auto& user_entry = user_entries[user_point.index()];
+
+      nearby_folks.clear();
+      correlator.NearbyFolks(user_entry.first, user_entry.second,
+                             &nearby_folks);
+      for (size_t folk : nearby_folks) {
+        scores[folk_entries.Get(folk).key().user_id()] += user_point.weight();
+      }
+    }
+  }
+
+  for (const auto& score : scores) {
+    proto::NearbyUserFolk* folk = response->add_folk();
+    folk->set_user_id(score.first);
+    folk->set_score(score.second);
+  }
+
+  LOG_EVERY_N(INFO, 10000) << "correlated user, user_id=" << request->user_id()
+                           << ", blocks=" << request->block_size()
+                           << ", folks=" << response->folk_size();
+
+  return grpc::Status::OK;
+}
+
 }  // namespace bt
@@ -2,33 +2,88 @@
 #include <list>
 
 #include "common/status.h"
+#include "common/thread_pool.h"
 #include "proto/backtrace.grpc.pb.h"
+#include "server/arena_allocator.h"
 #include "server/db.h"
+#include "server/worker_config.h"
 
 namespace bt {
 
 class Db;
 
-// Service to seek points from the database.
-class Seeker : public proto::Seeker::Service {
+// Service to seek points from the database, requests are handled by
+// the seeker thread pool (see threading notes in worker.h).
+class Seeker : public proto::Seeker::CallbackService {
 public:
-  Status Init(Db *db);
+  Status Init(Db *db, const WorkerConfig &config);
 
-  grpc::Status
-  InternalGetUserTimeline(grpc::ServerContext *context,
+  grpc::ServerUnaryReactor *
+  InternalGetUserTimeline(grpc::CallbackServerContext *context,
                           const proto::GetUserTimeline_Request *request,
                           proto::GetUserTimeline_Response *response) override;
 
-  grpc::Status InternalBuildBlockForUser(
-      grpc::ServerContext *context,
+  // Same as above, points are streamed in chunks while they are read
+  // one time zone at a time.
+  grpc::ServerWriteReactor<proto::GetUserTimeline_Response> *
+  InternalStreamUserTimeline(
+      grpc::CallbackServerContext *context,
+      const proto::GetUserTimeline_Request *request) override;
+
+  grpc::ServerUnaryReactor *InternalBuildBlockForUser(
+      grpc::CallbackServerContext *context,
       const proto::BuildBlockForUser_Request *request,
       proto::BuildBlockForUser_Response *response) override;
 
+  // Same as above for a list of blocks, the response is streamed with
+  // one message per block which has entries.
+  grpc::ServerWriteReactor<proto::BuildBlocksForUser_Response> *
+  InternalBuildBlocksForUser(
+      grpc::CallbackServerContext *context,
+      const proto::BuildBlocksForUser_Request *request) override;
+
+  // Scores folks around a user in blocks of this worker.
+  grpc::ServerUnaryReactor *
+  InternalCorrelateUser(grpc::CallbackServerContext *context,
+                        const proto::CorrelateUser_Request *request,
+                        proto::CorrelateUser_Response *response) override;
+
 private:
+  class BlockWriter;
+  class TimelineWriter;
+
+  grpc::Status GetUserTimeline(const proto::GetUserTimeline_Request *request,
+                               proto::GetUserTimeline_Response *response);
+  grpc::Status
+  BuildBlockForUser(const proto::BuildBlockForUser_Request *request,
+                    proto::BuildBlockForUser_Response *response);
+
+  grpc::Status CorrelateUser(const proto::CorrelateUser_Request *request,
+                             proto::CorrelateUser_Response *response);
+
+  // Appends entries of the block at the given key, split between the
+  // user and other folks.
+  grpc::Status ReadBlock(
+      rocksdb::Iterator *timeline_it, const proto::DbKey &timeline_key,
+      uint64_t user_id,
+      google::protobuf::RepeatedPtrField<proto::BlockEntry> *user_entries,
+      google::protobuf::RepeatedPtrField<proto::BlockEntry> *folk_entries);
+
+  // Appends entries of the block at the given key as they are stored
+  // in the database, without decoding them (see AppendRawEntry).
+  void ReadRawBlock(rocksdb::Iterator *timeline_it,
+                    const proto::DbKey &timeline_key,
+                    std::string *raw_entries);
+
   Status BuildTimelineKeysForUser(uint64_t user_id,
                                   std::list<proto::DbKey> *keys);
   Status BuildTimelineForUser(const std::list<proto::DbKey> &keys,
                               proto::GetUserTimeline_Response *timeline);
+
+  // Appends points of the user of the key in its timeline zone.
+  Status ReadTimelineZone(
+      rocksdb::Iterator *timeline_it, const proto::DbKey &zone_key,
+      google::protobuf::RepeatedPtrField<proto::UserTimelinePoint> *points);
   Status BuildKeysToSearchAroundPoint(uint64_t user_id,
                                       const proto::UserTimelinePoint &point,
                                       std::list<proto::DbKey> *keys);
@@ -39,6 +94,21 @@ private:
       std::vector<std::pair<proto::DbKey, proto::DbValue>> *folk_entries);
 
   Db *db_ = nullptr;
+  int stream_chunk_size_ = kDefaultSeekerStreamChunkSize;
+
+  // Points and entries of unary requests are allocated on an arena.
+  ArenaAllocator<proto::GetUserTimeline_Request,
+                 proto::GetUserTimeline_Response>
+      timeline_allocator_;
+  ArenaAllocator<proto::BuildBlockForUser_Request,
+                 proto::BuildBlockForUser_Response>
+      block_allocator_;
+  ArenaAllocator<proto::CorrelateUser_Request, proto::CorrelateUser_Response>
+      correlate_allocator_;
+
+  // Last so that pending requests are done before other members are
+  // destroyed.
+  ThreadPool pool_;
 };
 
 } // namespace bt
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <glog/logging.h>
 #include <grpc++/grpc++.h>
 #include <sstream>
+#include <utility>
 
 #include "common/signal.h"
 #include "server/mixer.h"
@@ -11,6 +13,20 @@ namespace bt {
 
 ShardHandler::ShardHandler(const ShardConfig &config) : config_(config) {}
 
+ShardHandler::~ShardHandler() {
+  if (!flush_thread_.joinable()) {
+    return;
+  }
+
+  // Pending locations are flushed before the thread exits.
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    do_exit_ = true;
+  }
+  flush_wakeup_.notify_one();
+  flush_thread_.join();
+}
+
 Status ShardHandler::Init(const MixerConfig &config,
                           const std::vector<PartitionConfig> &partitions) {
   for (const auto &partition : partitions) {
@@ -27,6 +43,9 @@ Status ShardHandler::Init(const MixerConfig &config,
                  "default shard must have exactly one partition");
   }
 
+  worker_timeout_ = config.WorkerTimeout();
+  compress_batches_ = config.CompressBatches();
+
   grpc::ChannelArguments args;
 
   // This is set in unit test to speed up failing to connect to a
@@ -47,6 +66,15 @@ Status ShardHandler::Init(const MixerConfig &config,
   LOG(INFO) << "initialized shard handler for " << config_.name_ << " with "
             << config_.workers_.size() << " workers";
 
+  flusher_ = config.ConfigForFlusher();
+  if (flusher_.enabled_) {
+    pending_ = std::make_shared<PendingBatch>();
+    flush_thread_ = std::thread([this]() { FlushLoop(); });
+    LOG(INFO) << "started background flusher for " << config_.name_
+              << " with max_points=" << flusher_.max_points_
+              << ", max_delay_ms=" << flusher_.max_delay_ms_;
+  }
+
   if (is_default_) {
     LOG(INFO) << "this shard is the default shard (i.e: fallback)";
   } else {
@@ -68,6 +96,27 @@ grpc::Status ShardHandler::DeleteUser(const proto::DeleteUser_Request *request,
                                       proto::DeleteUser_Response *response) {
   grpc::Status status = grpc::Status::OK;
 
+  // With the background flusher, points of the user may be waiting to
+  // be sent; points queued in other mixers are sent within the flush
+  // delay, so a deletion may need to be retried after it.
+  if (flusher_.enabled_) {
+    std::lock_guard<std::mutex> lk(lock_);
+    auto *locations = locations_.mutable_locations();
+    locations->erase(
+        std::remove_if(locations->begin(), locations->end(),
+                       [request](const proto::Location &location) {
+                         return location.user_id() == request->user_id();
+                       }),
+        locations->end());
+    columns_.RemoveUser(request->user_id());
+
+    // Nothing left to send, requests waiting on the batch are done.
+    if (QueuedLocations() == 0) {
+      pending_->done.set_value(grpc::Status::OK);
+      pending_ = std::make_shared<PendingBatch>();
+    }
+  }
+
   for (auto &stub : pushers_) {
     grpc::ClientContext context;
     grpc::Status stub_status =
@@ -80,50 +129,83 @@ grpc::Status ShardHandler::DeleteUser(const proto::DeleteUser_Request *request,
   return status;
 }
 
-Status ShardHandler::InternalBuildBlockForUser(
-    const proto::DbKey &key, int64_t user_id,
-    std::set<proto::BlockEntry, CompareBlockEntry> *user_entries,
-    std::set<proto::BlockEntry, CompareBlockEntry> *folk_entries, bool *found) {
-  for (const auto &partition : partitions_) {
-    if (!IsWithinShard(partition, ZoneToGPSLocation(key.gps_latitude_zone()),
-                       ZoneToGPSLocation(key.gps_longitude_zone()),
-                       key.timestamp())) {
-      continue;
-    }
+ShardHandler::BlockStream::BlockStream(
+    proto::Seeker::Stub *stub, grpc::ClientContext *context,
+    const proto::BuildBlocksForUser_Request *request,
+    std::function<void(grpc::Status)> done)
+    : done_(std::move(done)) {
+  stub->async()->InternalBuildBlocksForUser(context, request, this);
+  StartRead(&block_);
+  StartCall();
+}
+
+void ShardHandler::BlockStream::OnReadDone(bool ok) {
+  if (!ok) {
+    return;
+  }
+  blocks.push_back(std::move(block_));
+  block_.Clear();
+  StartRead(&block_);
+}
 
-    *found = true;
+void ShardHandler::BlockStream::OnDone(const grpc::Status &status) {
+  // The stream may be destroyed as soon as the group is notified.
+  std::function<void(grpc::Status)> done = std::move(done_);
+  done(status);
+}
 
-    proto::BuildBlockForUser_Request request;
-    request.set_user_id(user_id);
-    *(request.mutable_timeline_key()) = key;
+std::unique_ptr<ShardHandler::BlockFetch>
+ShardHandler::StartBuildBlocksForUser(
+    int64_t user_id, std::vector<proto::DbKey> keys,
+    std::chrono::system_clock::time_point deadline) {
+  deadline =
+      std::min(deadline, std::chrono::system_clock::now() + worker_timeout_);
+
+  auto fetch = std::make_unique<BlockFetch>();
+  fetch->request.set_user_id(user_id);
+  fetch->request.set_raw(true);
+  for (auto &key : keys) {
+    *fetch->request.add_timeline_keys() = std::move(key);
+  }
 
-    bool ok = false;
+  for (auto &stub : seekers_) {
+    auto context = std::make_unique<grpc::ClientContext>();
+    context->set_deadline(deadline);
+    fetch->streams.push_back(std::make_unique<BlockStream>(
+        stub.get(), context.get(), &fetch->request, fetch->calls.Add()));
+    fetch->contexts.push_back(std::move(context));
+  }
 
-    for (auto &stub : seekers_) {
-      proto::BuildBlockForUser_Response response;
-      grpc::ClientContext context;
-      grpc::Status grpc_status =
-          stub->InternalBuildBlockForUser(&context, request, &response);
-      if (grpc_status.ok()) {
-        ok = true;
-      }
+  return fetch;
+}
 
-      for (const auto &block : response.user_entries()) {
-        user_entries->insert(block);
-      }
-      for (const auto &block : response.folk_entries()) {
-        folk_entries->insert(block);
-      }
-    }
+grpc::Status ShardHandler::FinishBuildBlocksForUser(
+    BlockFetch *fetch,
+    std::vector<proto::BuildBlocksForUser_Response> *blocks) {
+  fetch->calls.Wait();
 
-    if (!ok) {
-      RETURN_ERROR(INTERNAL_ERROR, "can't retrieve internal block from shard");
+  bool success = false;
+  grpc::Status retval = grpc::Status::OK;
+  const auto &statuses = fetch->calls.Statuses();
+  for (size_t i = 0; i < statuses.size(); ++i) {
+    if (statuses[i].ok()) {
+      success = true;
+      for (auto &block : fetch->streams[i]->blocks) {
+        blocks->push_back(std::move(block));
+      }
+    } else {
+      LOG_EVERY_N(WARNING, 10000)
+          << "can't retrieve blocks from shard " << config_.name_
+          << ", status=" << statuses[i].error_message();
+      retval = statuses[i];
     }
+  }
 
-    return StatusCode::OK;
+  if (success) {
+    return grpc::Status::OK;
   }
 
-  return StatusCode::OK;
+  return retval;
 }
 
 bool ShardHandler::IsWithinShard(const PartitionConfig &partition,
@@ -139,45 +221,181 @@ bool ShardHandler::IsWithinShard(const PartitionConfig &partition,
 }
 
 bool ShardHandler::QueueLocation(const proto::Location &location) {
+  return QueueLocation(location, nullptr);
+}
+
+bool ShardHandler::QueueLocation(const proto::Location &location,
+                                 std::shared_ptr<PendingBatch> *batch) {
   for (const auto &partition : partitions_) {
     if (!IsWithinShard(partition, location.gps_latitude(),
                        location.gps_longitude(), location.timestamp())) {
       continue;
     }
 
-    {
-      std::lock_guard<std::mutex> lk(lock_);
-      *locations_.add_locations() = location;
-    }
-
+    QueueRoutedLocations({&location}, batch);
     return true;
   }
 
   return false;
 }
 
-grpc::Status ShardHandler::FlushLocations() {
-  // Here we try to limit the amount of time we keep the lock at the
-  // cost of CPU, this is done by doing extra copies but doesn't block
-  // other threads queueing elements while waiting for the network or
-  // the worker to wait.
+void ShardHandler::QueueRoutedLocations(
+    const std::vector<const proto::Location *> &locations,
+    std::shared_ptr<PendingBatch> *batch) {
+  if (locations.empty()) {
+    return;
+  }
+
+  Queue(
+      [this, &locations]() {
+        for (const proto::Location *location : locations) {
+          *locations_.add_locations() = *location;
+        }
+      },
+      batch);
+}
+
+void ShardHandler::QueueRoutedBatch(const LocationColumns &columns,
+                                    const std::vector<size_t> &points,
+                                    std::shared_ptr<PendingBatch> *batch) {
+  if (points.empty()) {
+    return;
+  }
+
+  Queue(
+      [this, &columns, &points]() {
+        for (size_t i : points) {
+          columns_.Append(columns, i);
+        }
+      },
+      batch);
+}
+
+int ShardHandler::QueuedLocations() const {
+  return locations_.locations_size() + columns_.Size();
+}
+
+void ShardHandler::Queue(const std::function<void()> &add,
+                         std::shared_ptr<PendingBatch> *batch) {
+  bool wakeup = false;
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    if (QueuedLocations() == 0) {
+      first_queued_at_ = std::chrono::steady_clock::now();
+      wakeup = true;
+    }
+    add();
+
+    if (flusher_.enabled_) {
+      wakeup |= QueuedLocations() >= flusher_.max_points_;
+      if (batch != nullptr) {
+        *batch = pending_;
+      }
+    }
+  }
+
+  // The flusher config is fixed after Init, unlike pending_ which the
+  // flush thread replaces under the lock.
+  if (flusher_.enabled_ && wakeup) {
+    flush_wakeup_.notify_one();
+  }
+}
+
+void ShardHandler::FlushLoop() {
+  const auto max_delay = std::chrono::milliseconds(flusher_.max_delay_ms_);
+
+  std::unique_lock<std::mutex> lk(lock_);
+  while (true) {
+    if (QueuedLocations() == 0) {
+      if (do_exit_) {
+        break;
+      }
+      flush_wakeup_.wait(lk);
+      continue;
+    }
+
+    const auto flush_at = first_queued_at_ + max_delay;
+    if (!do_exit_ && QueuedLocations() < flusher_.max_points_ &&
+        std::chrono::steady_clock::now() < flush_at) {
+      flush_wakeup_.wait_until(lk, flush_at);
+      continue;
+    }
+
+    proto::PutLocation_Request locations;
+    locations.Swap(&locations_);
+    LocationColumns columns;
+    std::swap(columns, columns_);
+    std::shared_ptr<PendingBatch> batch = std::move(pending_);
+    pending_ = std::make_shared<PendingBatch>();
+
+    // Points keep being queued while this batch is sent, they are sent
+    // with the next one.
+    lk.unlock();
+    std::unique_ptr<Flush> flush =
+        SendLocations(&locations, columns,
+                      std::chrono::system_clock::now() + worker_timeout_);
+    batch->done.set_value(FinishFlush(flush.get()));
+    lk.lock();
+  }
+}
+
+std::unique_ptr<ShardHandler::Flush>
+ShardHandler::StartFlush(std::chrono::system_clock::time_point deadline) {
+  // Queued points are swapped out under the lock, so that other
+  // threads can keep queueing while we wait for the network or the
+  // worker, without copying every point.
   proto::PutLocation_Request locations;
+  LocationColumns columns;
   {
     std::lock_guard<std::mutex> lk(lock_);
-    if (locations_.locations_size() == 0) {
-      return grpc::Status::OK;
+    if (QueuedLocations() == 0) {
+      return nullptr;
     }
-    locations = locations_;
-    locations_.clear_locations();
+    locations.Swap(&locations_);
+    std::swap(columns, columns_);
   }
 
+  return SendLocations(
+      &locations, columns,
+      std::min(deadline, std::chrono::system_clock::now() + worker_timeout_));
+}
+
+std::unique_ptr<ShardHandler::Flush>
+ShardHandler::SendLocations(proto::PutLocation_Request *locations,
+                            const LocationColumns &columns,
+                            std::chrono::system_clock::time_point deadline) {
+  auto flush = std::make_unique<Flush>();
+  flush->locations.Swap(locations);
+  if (columns.Size() > 0) {
+    EncodeLocationBatch(columns, compress_batches_,
+                        flush->locations.mutable_batch());
+  }
+
+  // Responses are sized upfront, they must not move while calls are
+  // in flight.
+  flush->responses.resize(pushers_.size());
+  for (size_t i = 0; i < pushers_.size(); ++i) {
+    auto context = std::make_unique<grpc::ClientContext>();
+    context->set_deadline(deadline);
+    pushers_[i]->async()->InternalPutLocation(
+        context.get(), &flush->locations, &flush->responses[i],
+        flush->calls.Add());
+    flush->contexts.push_back(std::move(context));
+  }
+
+  return flush;
+}
+
+grpc::Status ShardHandler::FinishFlush(Flush *flush) {
+  if (flush == nullptr) {
+    return grpc::Status::OK;
+  }
+
+  flush->calls.Wait();
+
   bool sent = false;
   grpc::Status last_status = grpc::Status::OK;
-  for (auto &stub : pushers_) {
-    grpc::ClientContext context;
-    proto::PutLocation_Response response;
-    grpc::Status stub_status =
-        stub->InternalPutLocation(&context, locations, &response);
+  for (const auto &stub_status : flush->calls.Statuses()) {
     if (!stub_status.ok()) {
       LOG_EVERY_N(WARNING, 10000)
           << "can't send location point to shard " << config_.name_
@@ -200,37 +418,51 @@ grpc::Status ShardHandler::FlushLocations() {
   return grpc::Status::OK;
 }
 
-grpc::Status
-ShardHandler::GetUserTimeline(const proto::GetUserTimeline_Request *request,
-                              proto::GetUserTimeline_Response *response) {
-  grpc::Status retval = grpc::Status::OK;
-  std::set<proto::UserTimelinePoint, CompareTimelinePoints> timeline;
-  bool success = false;
+grpc::Status ShardHandler::FlushLocations() {
+  std::unique_ptr<Flush> flush =
+      StartFlush(std::chrono::system_clock::time_point::max());
+  return FinishFlush(flush.get());
+}
+
+std::unique_ptr<ShardHandler::TimelineFetch>
+ShardHandler::StartGetUserTimeline(
+    const proto::GetUserTimeline_Request *request,
+    std::chrono::system_clock::time_point deadline) {
+  deadline =
+      std::min(deadline, std::chrono::system_clock::now() + worker_timeout_);
 
   // Assume the two machines may have different data, for instance if
-  // one was down for too long, return a merged version of the
-  // timeline.
-  for (auto &stub : seekers_) {
-    grpc::ClientContext context;
-    proto::GetUserTimeline_Response response;
-    grpc::Status status =
-        stub->InternalGetUserTimeline(&context, *request, &response);
+  // one was down for too long, the caller merges their timelines.
+  auto fetch = std::make_unique<TimelineFetch>();
+  fetch->responses.resize(seekers_.size());
+  for (size_t i = 0; i < seekers_.size(); ++i) {
+    auto context = std::make_unique<grpc::ClientContext>();
+    context->set_deadline(deadline);
+    seekers_[i]->async()->InternalGetUserTimeline(
+        context.get(), request, &fetch->responses[i], fetch->calls.Add());
+    fetch->contexts.push_back(std::move(context));
+  }
 
-    for (const auto &point : response.point()) {
-      timeline.insert(point);
-    }
+  return fetch;
+}
+
+grpc::Status ShardHandler::FinishGetUserTimeline(
+    TimelineFetch *fetch,
+    std::vector<proto::GetUserTimeline_Response *> *timelines) {
+  fetch->calls.Wait();
 
-    if (status.ok()) {
+  bool success = false;
+  grpc::Status retval = grpc::Status::OK;
+  const auto &statuses = fetch->calls.Statuses();
+  for (size_t i = 0; i < statuses.size(); ++i) {
+    if (statuses[i].ok()) {
       success = true;
+      timelines->push_back(&fetch->responses[i]);
     } else {
-      retval = status;
+      retval = statuses[i];
     }
   }
 
-  for (const auto &p : timeline) {
-    *response->add_point() = p;
-  }
-
   if (success) {
     return grpc::Status::OK;
   }
@@ -238,4 +470,124 @@ ShardHandler::GetUserTimeline(const proto::GetUserTimeline_Request *request,
   return retval;
 }
 
+grpc::Status
+ShardHandler::GetUserTimeline(const proto::GetUserTimeline_Request *request,
+                              proto::GetUserTimeline_Response *response) {
+  std::unique_ptr<TimelineFetch> fetch = StartGetUserTimeline(
+      request, std::chrono::system_clock::time_point::max());
+
+  std::vector<proto::GetUserTimeline_Response *> timelines;
+  grpc::Status status = FinishGetUserTimeline(fetch.get(), &timelines);
+  MergeTimelines(timelines, response);
+
+  return status;
+}
+
+ShardHandler::TimelineStream::TimelineStream(
+    proto::Seeker::Stub *stub, const proto::GetUserTimeline_Request &request,
+    std::chrono::system_clock::time_point deadline) {
+  context_.set_deadline(deadline);
+  reader_ = stub->InternalStreamUserTimeline(&context_, request);
+}
+
+ShardHandler::TimelineStream::~TimelineStream() {
+  if (done_) {
+    return;
+  }
+
+  context_.TryCancel();
+  proto::GetUserTimeline_Response chunk;
+  while (reader_->Read(&chunk)) {
+  }
+  reader_->Finish();
+}
+
+bool ShardHandler::TimelineStream::Next(
+    proto::GetUserTimeline_Response *chunk) {
+  if (done_) {
+    return false;
+  }
+  if (reader_->Read(chunk)) {
+    return true;
+  }
+
+  done_ = true;
+  status_ = reader_->Finish();
+  return false;
+}
+
+std::vector<std::unique_ptr<ShardHandler::TimelineStream>>
+ShardHandler::StartStreamUserTimeline(
+    const proto::GetUserTimeline_Request &request,
+    std::chrono::system_clock::time_point deadline) {
+  deadline =
+      std::min(deadline, std::chrono::system_clock::now() + worker_timeout_);
+
+  std::vector<std::unique_ptr<TimelineStream>> streams;
+  for (auto &seeker : seekers_) {
+    streams.push_back(
+        std::make_unique<TimelineStream>(seeker.get(), request, deadline));
+  }
+
+  return streams;
+}
+
+std::unique_ptr<ShardHandler::Correlation>
+ShardHandler::StartCorrelateUser(
+    proto::CorrelateUser_Request request,
+    std::chrono::system_clock::time_point deadline) {
+  deadline =
+      std::min(deadline, std::chrono::system_clock::now() + worker_timeout_);
+
+  auto correlation = std::make_unique<Correlation>();
+  correlation->request = std::move(request);
+  correlation->responses.resize(seekers_.size());
+  for (size_t i = 0; i < seekers_.size(); ++i) {
+    auto context = std::make_unique<grpc::ClientContext>();
+    context->set_deadline(deadline);
+    seekers_[i]->async()->InternalCorrelateUser(
+        context.get(), &correlation->request, &correlation->responses[i],
+        correlation->calls.Add());
+    correlation->contexts.push_back(std::move(context));
+  }
+
+  return correlation;
+}
+
+grpc::Status
+ShardHandler::FinishCorrelateUser(Correlation *correlation,
+                                  std::map<uint64_t, int> *scores) {
+  correlation->calls.Wait();
+
+  bool success = false;
+  grpc::Status retval = grpc::Status::OK;
+  std::map<uint64_t, int> shard_scores;
+  const auto &statuses = correlation->calls.Statuses();
+  for (size_t i = 0; i < statuses.size(); ++i) {
+    if (!statuses[i].ok()) {
+      LOG_EVERY_N(WARNING, 10000)
+          << "can't correlate user in shard " << config_.name_
+          << ", status=" << statuses[i].error_message();
+      retval = statuses[i];
+      continue;
+    }
+
+    success = true;
+    for (const auto &folk : correlation->responses[i].folk()) {
+      int &score = shard_scores[folk.user_id()];
+      score = std::max(score, static_cast<int>(folk.score()));
+    }
+  }
+
+  if (!success) {
+    return retval;
+  }
+
+  for (const auto &score : shard_scores) {
+    (*scores)[score.first] += score.second;
+  }
+
+  return grpc::Status::OK;
+}
+
 } // namespace bt
@@ -1,47 +1,216 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <grpc++/grpc++.h>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
 
 #include "proto/backtrace.grpc.pb.h"
+#include "server/call_group.h"
+#include "server/location_batch.h"
 #include "server/mixer_config.h"
 #include "server/proto.h"
 
 namespace bt {
 
 // Streams requests to all machines of a specific shard.
+//
+// If the flusher is enabled in the config, queued locations are sent
+// by a background thread, coalescing points of concurrent requests in
+// larger batches; a batch is sent once it is large enough or once its
+// oldest point waited long enough.
 class ShardHandler {
 public:
   explicit ShardHandler(const ShardConfig &config);
+  ~ShardHandler();
 
   Status Init(const MixerConfig &config,
               const std::vector<PartitionConfig> &partitions);
   const std::string &Name() const;
   bool IsDefaultShard() const;
 
+  // Batch of locations sent by the background flusher, all requests
+  // which queued points in it wait on the result.
+  struct PendingBatch {
+    PendingBatch() : result(done.get_future().share()) {}
+
+    std::promise<grpc::Status> done;
+    std::shared_future<grpc::Status> result;
+  };
+
   // Returns true if the location is accepted by this shard; the
   // actual sending of the point is done when calling Flush.
   bool QueueLocation(const proto::Location &location);
 
-  // Sends location points to the actual worker and clears the queue,
-  // actual sending of the point is done here when calling Flush. We
-  // don't do it in a dedicated background thread to simplify the
-  // implementation ( doing so would require to properly handle delete
-  // user in pending locations, in all other mixers).
+  // Same as above, with the background flusher enabled, batch is set
+  // to the batch the location will be sent with.
+  bool QueueLocation(const proto::Location &location,
+                     std::shared_ptr<PendingBatch> *batch);
+
+  // Queues locations already routed to this shard (see router.h),
+  // without checking partitions.
+  void
+  QueueRoutedLocations(const std::vector<const proto::Location *> &locations,
+                       std::shared_ptr<PendingBatch> *batch);
+
+  // Same as above for points of a columnar batch, only the points at
+  // the given indexes are queued.
+  void QueueRoutedBatch(const LocationColumns &columns,
+                        const std::vector<size_t> &points,
+                        std::shared_ptr<PendingBatch> *batch);
+
+  // In-flight sending of queued locations to the workers of a shard.
+  struct Flush {
+    proto::PutLocation_Request locations;
+    std::vector<std::unique_ptr<grpc::ClientContext>> contexts;
+    std::vector<proto::PutLocation_Response> responses;
+    CallGroup calls;
+  };
+
+  // Sends location points to all workers of the shard concurrently and
+  // clears the queue, without waiting for workers to answer; returns
+  // nullptr if there is nothing to send. Calls fail if they are not
+  // done by the deadline, or by the worker timeout if it is sooner.
+  std::unique_ptr<Flush>
+  StartFlush(std::chrono::system_clock::time_point deadline);
+
+  // Waits for workers to answer, succeeds if at least one of them
+  // wrote the locations.
+  grpc::Status FinishFlush(Flush *flush);
+
+  // Same as above, in a single call.
   grpc::Status FlushLocations();
 
-  Status InternalBuildBlockForUser(
-      const proto::DbKey &key, int64_t user_id,
-      std::set<proto::BlockEntry, CompareBlockEntry> *user_entries,
-      std::set<proto::BlockEntry, CompareBlockEntry> *folk_entries,
-      bool *found);
+  // Streams blocks of a BuildBlocksForUser call from a single worker.
+  class BlockStream
+      : public grpc::ClientReadReactor<proto::BuildBlocksForUser_Response> {
+  public:
+    BlockStream(proto::Seeker::Stub *stub, grpc::ClientContext *context,
+                const proto::BuildBlocksForUser_Request *request,
+                std::function<void(grpc::Status)> done);
+
+    void OnReadDone(bool ok) override;
+    void OnDone(const grpc::Status &status) override;
+
+    std::vector<proto::BuildBlocksForUser_Response> blocks;
+
+  private:
+    proto::BuildBlocksForUser_Response block_;
+    std::function<void(grpc::Status)> done_;
+  };
+
+  // In-flight retrieval of blocks from the workers of a shard.
+  struct BlockFetch {
+    proto::BuildBlocksForUser_Request request;
+    std::vector<std::unique_ptr<grpc::ClientContext>> contexts;
+    std::vector<std::unique_ptr<BlockStream>> streams;
+    CallGroup calls;
+  };
+
+  // Asks all workers of the shard concurrently for the entries of
+  // blocks around a user, in a single call per worker, without waiting
+  // for them to answer. Keys identify blocks (the user id and the
+  // offset in the time zone are ignored), they must be sorted in
+  // timeline key order and without duplicates. Calls fail if they are
+  // not done by the deadline, or by the worker timeout if it is sooner.
+  std::unique_ptr<BlockFetch>
+  StartBuildBlocksForUser(int64_t user_id, std::vector<proto::DbKey> keys,
+                          std::chrono::system_clock::time_point deadline);
+
+  // Waits for workers to answer, succeeds if at least one of them
+  // did; blocks of workers which answered are moved to blocks, the
+  // same block may be returned by several workers.
+  grpc::Status FinishBuildBlocksForUser(
+      BlockFetch *fetch,
+      std::vector<proto::BuildBlocksForUser_Response> *blocks);
+
+  // In-flight retrieval of a user timeline from the workers of a shard.
+  struct TimelineFetch {
+    std::vector<std::unique_ptr<grpc::ClientContext>> contexts;
+    std::vector<proto::GetUserTimeline_Response> responses;
+    CallGroup calls;
+  };
+
+  // Asks all workers of the shard concurrently for the timeline of a
+  // user, without waiting for them to answer; the request must outlive
+  // the fetch. Calls fail if they are not done by the deadline, or by
+  // the worker timeout if it is sooner.
+  std::unique_ptr<TimelineFetch>
+  StartGetUserTimeline(const proto::GetUserTimeline_Request *request,
+                       std::chrono::system_clock::time_point deadline);
 
+  // Waits for workers to answer, succeeds if at least one of them
+  // did; timelines of workers which answered are appended to
+  // timelines, each sorted by CompareTimelinePoints (see
+  // MergeTimelines in proto.h).
+  grpc::Status FinishGetUserTimeline(
+      TimelineFetch *fetch,
+      std::vector<proto::GetUserTimeline_Response *> *timelines);
+
+  // Same as above, in a single call with the merged timeline.
   grpc::Status GetUserTimeline(const proto::GetUserTimeline_Request *request,
                                proto::GetUserTimeline_Response *response);
 
+  // Streams the timeline of a user from a single worker, chunks are
+  // only read when the caller asks for them.
+  class TimelineStream : public TimelineSource {
+  public:
+    TimelineStream(proto::Seeker::Stub *stub,
+                   const proto::GetUserTimeline_Request &request,
+                   std::chrono::system_clock::time_point deadline);
+
+    // Cancels the call if it isn't done.
+    ~TimelineStream() override;
+
+    bool Next(proto::GetUserTimeline_Response *chunk) override;
+
+    // Status of the call, only valid once Next returned false.
+    const grpc::Status &CallStatus() const { return status_; }
+
+  private:
+    grpc::ClientContext context_;
+    std::unique_ptr<grpc::ClientReader<proto::GetUserTimeline_Response>>
+        reader_;
+    bool done_ = false;
+    grpc::Status status_;
+  };
+
+  // Starts streaming the timeline of a user from all workers of the
+  // shard concurrently. Calls fail if they are not done by the
+  // deadline, or by the worker timeout if it is sooner.
+  std::vector<std::unique_ptr<TimelineStream>>
+  StartStreamUserTimeline(const proto::GetUserTimeline_Request &request,
+                          std::chrono::system_clock::time_point deadline);
+
+  // In-flight scoring of folks around a user on the workers of a shard.
+  struct Correlation {
+    proto::CorrelateUser_Request request;
+    std::vector<std::unique_ptr<grpc::ClientContext>> contexts;
+    std::vector<proto::CorrelateUser_Response> responses;
+    CallGroup calls;
+  };
+
+  // Asks all workers of the shard concurrently to score folks in the
+  // blocks of the request, without waiting for them to answer. Calls
+  // fail if they are not done by the deadline, or by the worker
+  // timeout if it is sooner.
+  std::unique_ptr<Correlation>
+  StartCorrelateUser(proto::CorrelateUser_Request request,
+                     std::chrono::system_clock::time_point deadline);
+
+  // Waits for workers to answer, succeeds if at least one of them did;
+  // scores of the shard are added to scores. Workers of a shard hold
+  // the same points, so the highest score of a folk among them is
+  // used instead of their sum.
+  grpc::Status FinishCorrelateUser(Correlation *correlation,
+                                   std::map<uint64_t, int> *scores);
+
   grpc::Status DeleteUser(const proto::DeleteUser_Request *request,
                           proto::DeleteUser_Response *response);
 
@@ -49,10 +218,38 @@ public:
                      float gps_long, int64_t ts) const;
 
 private:
+  // Queues points added by add, lock_ is held while it is called.
+  void Queue(const std::function<void()> &add,
+             std::shared_ptr<PendingBatch> *batch);
+
+  // Number of queued points, lock_ must be held.
+  int QueuedLocations() const;
+
+  // Points of columns are sent in a columnar batch along locations.
+  std::unique_ptr<Flush>
+  SendLocations(proto::PutLocation_Request *locations,
+                const LocationColumns &columns,
+                std::chrono::system_clock::time_point deadline);
+
+  // Background flusher.
+  void FlushLoop();
+
   std::mutex lock_;
   ShardConfig config_;
   bool is_default_ = false;
+  std::chrono::milliseconds worker_timeout_;
   proto::PutLocation_Request locations_;
+  LocationColumns columns_;
+  bool compress_batches_ = false;
+
+  // Background flusher state, only used if it is enabled.
+  FlusherConfig flusher_;
+  std::shared_ptr<PendingBatch> pending_;
+  std::chrono::steady_clock::time_point first_queued_at_;
+  std::condition_variable flush_wakeup_;
+  bool do_exit_ = false;
+  std::thread flush_thread_;
+
   std::vector<PartitionConfig> partitions_;
   std::vector<std::unique_ptr<proto::Pusher::Stub>> pushers_;
   std::vector<std::unique_ptr<proto::Seeker::Stub>> seekers_;
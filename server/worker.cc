@@ -26,12 +26,16 @@ Status Worker::Init(const WorkerConfig& config) {
   RETURN_IF_ERROR(db_->Init(config));
   LOG(INFO) << "initialized db";
 
+  writer_ = std::make_unique<Writer>();
+  RETURN_IF_ERROR(writer_->Init(db_.get(), config));
+  LOG(INFO) << "initialized writer";
+
   pusher_ = std::make_unique<Pusher>();
-  RETURN_IF_ERROR(pusher_->Init(db_.get()));
+  RETURN_IF_ERROR(pusher_->Init(db_.get(), writer_.get(), config));
   LOG(INFO) << "initialized pusher";
 
   seeker_ = std::make_unique<Seeker>();
-  RETURN_IF_ERROR(seeker_->Init(db_.get()));
+  RETURN_IF_ERROR(seeker_->Init(db_.get(), config));
   LOG(INFO) << "initialized seeker";
 
   gc_ = std::make_unique<Gc>();
@@ -57,6 +61,7 @@ Status Worker::Run() {
 
   grpc_->Shutdown();
   gc_->Shutdown();
+  writer_->Shutdown();
 
   grpc_thread.join();
   gc_thread.join();
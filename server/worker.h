@@ -10,6 +10,7 @@
 #include "server/gc.h"
 #include "server/pusher.h"
 #include "server/seeker.h"
+#include "server/writer.h"
 
 namespace bt {
 
@@ -26,13 +27,21 @@ class WorkerConfig;
 //   backtracer does coalescing of points, it will increase CPU load
 //   which could be better used for rocksdb).
 //
-// - We probably will be stuck on I/Os in the end, which means having
-//   multiple threads accepting points won't yield better results.
+// - We probably will be stuck on I/Os in the end, so the work done
+//   outside of rocksdb (decoding requests, encoding keys and values)
+//   should not be done by the thread writing to the database.
 //
-// So having one thread accepting writes with one large completion
-// queue seems to be a good approach (clients will queue large
-// requests there and the single writer thread will push them in
-// order).
+// So gRPC threads decode and encode points in parallel, then hand
+// ready-to-write records to a lock-free queue; a single writer thread
+// pops them and group-commits everything pending in one write (see
+// writer.h). The queue is bounded, when the writer can't keep up,
+// gRPC threads block which pushes back on clients.
+//
+// - Pusher and Seeker are async (callback) services: gRPC only
+//   dispatches requests, which are handled by two separate thread
+//   pools, one for writes and one for reads (pusher.threads and
+//   seeker.threads), so a heavy correlation query can't stall
+//   ingestion on the same worker.
 //
 // - Garbage collection is running in a background thread, that wakes
 //   up every now and then to delete expired points.
@@ -51,9 +60,11 @@ public:
   Pusher *GetPusher() { return pusher_.get(); }
   Gc *GetGc() { return gc_.get(); }
   Db *GetDb() { return db_.get(); }
+  Writer *GetWriter() { return writer_.get(); }
 
 private:
   std::unique_ptr<Db> db_;
+  std::unique_ptr<Writer> writer_;
   std::unique_ptr<Pusher> pusher_;
   std::unique_ptr<Seeker> seeker_;
   std::unique_ptr<Gc> gc_;
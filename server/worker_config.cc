@@ -13,6 +13,8 @@ Status WorkerConfig::MakeWorkerConfig(const Config& config,
 
   // Database settings.
   worker_config->db_path_ = config.Get<std::string>("db.path", kDefaultDbPath);
+  worker_config->db_partition_days_ =
+      config.Get<int>("db.partition_days", kDefaultDbPartitionDays);
 
   // Network settings.
   worker_config->network_host_ =
@@ -25,6 +27,33 @@ Status WorkerConfig::MakeWorkerConfig(const Config& config,
       "gc.retention_period_days", kDefaultGcRetentionPeriodInDays);
   worker_config->gc_delay_between_rounds_sec_ = config.Get<int>(
       "gc.delay_between_rounds_sec", kDefaultGcDelayBetweenRoundsInSeconds);
+  worker_config->gc_compaction_filter_ =
+      config.Get<bool>("gc.compaction_filter", kDefaultGcCompactionFilter);
+  worker_config->gc_range_deletes_ =
+      config.Get<bool>("gc.range_deletes", kDefaultGcRangeDeletes);
+  worker_config->gc_periodic_compaction_sec_ =
+      config.Get<int>("gc.periodic_compaction_sec",
+                      worker_config->gc_delay_between_rounds_sec_);
+
+  // Pusher settings.
+  worker_config->pusher_max_batch_size_ =
+      config.Get<int>("pusher.max_batch_size", kDefaultPusherMaxBatchSize);
+  worker_config->pusher_reverse_cache_size_ = config.Get<int>(
+      "pusher.reverse_cache_size", kDefaultPusherReverseCacheSize);
+  worker_config->pusher_threads_ =
+      config.Get<int>("pusher.threads", kDefaultPusherThreads);
+
+  // Seeker settings.
+  worker_config->seeker_threads_ =
+      config.Get<int>("seeker.threads", kDefaultSeekerThreads);
+  worker_config->seeker_stream_chunk_size_ = config.Get<int>(
+      "seeker.stream_chunk_size", kDefaultSeekerStreamChunkSize);
+
+  // Writer settings.
+  worker_config->writer_max_queue_depth_ =
+      config.Get<int>("writer.max_queue_depth", kDefaultWriterMaxQueueDepth);
+  worker_config->writer_max_group_size_ =
+      config.Get<int>("writer.max_group_size", kDefaultWriterMaxGroupSize);
 
   return StatusCode::OK;
 }
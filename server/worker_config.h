@@ -11,10 +11,22 @@ constexpr auto kWorkerConfigType = "worker";
 
 // Default config values.
 constexpr auto kDefaultDbPath = "";
+constexpr auto kDefaultDbPartitionDays = 0;
 constexpr auto kDefaultGcRetentionPeriodInDays = 14;
 constexpr auto kDefaultGcDelayBetweenRoundsInSeconds = 3600;
+constexpr auto kDefaultGcCompactionFilter = false;
+constexpr auto kDefaultGcRangeDeletes = true;
+constexpr auto kDefaultGcPeriodicCompactionInSeconds =
+    kDefaultGcDelayBetweenRoundsInSeconds;
 constexpr auto kDefaultNetworkInterface = "0.0.0.0";
 constexpr auto kDefaultNetworkListenPort = 7000;
+constexpr auto kDefaultPusherMaxBatchSize = 10000;
+constexpr auto kDefaultPusherReverseCacheSize = 1000000;
+constexpr auto kDefaultPusherThreads = 4;
+constexpr auto kDefaultSeekerThreads = 8;
+constexpr auto kDefaultSeekerStreamChunkSize = 1000;
+constexpr auto kDefaultWriterMaxQueueDepth = 1024;
+constexpr auto kDefaultWriterMaxGroupSize = 64;
 
 // Config for workers. This could have been made nicer by having the
 // module specific logic be handled by the corresponding modules (i.e:
@@ -32,6 +44,12 @@ public:
   // exit.
   std::string db_path_ = kDefaultDbPath;
 
+  // Number of days of points per partition of the database, each
+  // partition has its own columns so that the GC drops them instead
+  // of deleting points one by one; 0 disables partitioning. This
+  // can't be changed once the database is created.
+  int db_partition_days_ = kDefaultDbPartitionDays;
+
   // IPv4 address to listen on.
   std::string network_host_ = kDefaultNetworkInterface;
 
@@ -47,6 +65,48 @@ public:
 
   // Delay in seconds between two GC pass.
   int gc_delay_between_rounds_sec_ = kDefaultGcDelayBetweenRoundsInSeconds;
+
+  // Whether expired points are dropped by compactions instead of
+  // being scanned and deleted by the GC.
+  bool gc_compaction_filter_ = kDefaultGcCompactionFilter;
+
+  // Whether the GC deletes expired points with range deletes instead
+  // of one delete per point.
+  bool gc_range_deletes_ = kDefaultGcRangeDeletes;
+
+  // Maximum age in seconds of database files before they are
+  // compacted again, so that expired points of files nobody writes to
+  // are dropped; only used with the compaction filter. Defaults to the
+  // delay between GC passes, which bounds how long expired points stay
+  // readable without the filter.
+  int gc_periodic_compaction_sec_ = kDefaultGcPeriodicCompactionInSeconds;
+
+  // Maximum number of points written to the database in a single
+  // batch, larger requests are split in multiple batches.
+  int pusher_max_batch_size_ = kDefaultPusherMaxBatchSize;
+
+  // Maximum number of users in the cache of recently written reverse
+  // keys, 0 disables the cache.
+  int pusher_reverse_cache_size_ = kDefaultPusherReverseCacheSize;
+
+  // Number of threads handling pusher requests (decoding and encoding
+  // points, deletions).
+  int pusher_threads_ = kDefaultPusherThreads;
+
+  // Number of threads handling seeker requests, they are separate from
+  // pusher threads so that heavy reads don't stall ingestion.
+  int seeker_threads_ = kDefaultSeekerThreads;
+
+  // Maximum number of points per message of streamed timelines.
+  int seeker_stream_chunk_size_ = kDefaultSeekerStreamChunkSize;
+
+  // Maximum number of write requests queued for the writer thread,
+  // producers block when the queue is full.
+  int writer_max_queue_depth_ = kDefaultWriterMaxQueueDepth;
+
+  // Maximum number of queued requests the writer thread commits to
+  // the database in a single write.
+  int writer_max_group_size_ = kDefaultWriterMaxGroupSize;
 };
 
 } // namespace bt
@@ -0,0 +1,230 @@
+#include <chrono>
+#include <glog/logging.h>
+#include <rocksdb/write_batch.h>
+
+#include "server/writer.h"
+
+using namespace std::chrono_literals;
+
+namespace bt {
+
+namespace {
+
+// Upper bound on the time a waiting thread sleeps, wake-ups are
+// notified but this avoids relying on them only.
+constexpr auto kMaxIdleWait = 100ms;
+
+} // anonymous namespace
+
+Writer::~Writer() { Shutdown(); }
+
+Status Writer::Init(Db *db, const WorkerConfig &config) {
+  max_queue_depth_ = config.writer_max_queue_depth_;
+  if (!(max_queue_depth_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "writer.max_queue_depth should be > 0");
+  }
+
+  max_group_size_ = config.writer_max_group_size_;
+  if (!(max_group_size_ > 0)) {
+    RETURN_ERROR(INVALID_CONFIG, "writer.max_group_size should be > 0");
+  }
+
+  db_ = db;
+  thread_ = std::thread([this]() { Loop(); });
+
+  return StatusCode::OK;
+}
+
+Status Writer::Shutdown() {
+  if (!thread_.joinable()) {
+    return StatusCode::OK;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(writer_lock_);
+    do_exit_ = true;
+  }
+  writer_wakeup_.notify_one();
+  thread_.join();
+
+  // Producers blocked on a full queue.
+  {
+    std::lock_guard<std::mutex> lock(slot_lock_);
+  }
+  slot_available_.notify_all();
+
+  return StatusCode::OK;
+}
+
+uint64_t Writer::AverageCommitLatencyUs() const {
+  const uint64_t commits = commits_;
+  return commits ? total_commit_latency_us_ / commits : 0;
+}
+
+bool Writer::WaitForSlot() {
+  int64_t depth = depth_;
+  while (!do_exit_) {
+    if (depth < max_queue_depth_) {
+      if (depth_.compare_exchange_weak(depth, depth + 1)) {
+        return true;
+      }
+      continue;
+    }
+
+    ++back_pressure_waits_;
+    {
+      std::unique_lock<std::mutex> lock(slot_lock_);
+      ++slot_waiters_;
+      slot_available_.wait_for(lock, kMaxIdleWait, [this]() {
+        return depth_ < max_queue_depth_ || do_exit_;
+      });
+      --slot_waiters_;
+    }
+    depth = depth_;
+  }
+
+  return false;
+}
+
+std::future<Status> Writer::Submit(std::vector<WriteRecord> records) {
+  Request *request = new Request();
+  request->records = std::move(records);
+  std::future<Status> done = request->done.get_future();
+
+  if (!WaitForSlot()) {
+    request->done.set_value(
+        Status(INTERNAL_ERROR, "writer is shut down, records not written"));
+    delete request;
+    return done;
+  }
+
+  queue_.Push(request);
+
+  if (writer_sleeping_) {
+    std::lock_guard<std::mutex> lock(writer_lock_);
+    writer_wakeup_.notify_one();
+  }
+
+  return done;
+}
+
+Status Writer::Write(std::vector<WriteRecord> records) {
+  return Submit(std::move(records)).get();
+}
+
+Status Writer::WriteGroup(const std::vector<Request *> &group) {
+  rocksdb::WriteBatch batch;
+
+  for (const Request *request : group) {
+    for (const WriteRecord &record : request->records) {
+      rocksdb::Status status =
+          batch.Put(record.column, record.key, record.value);
+      if (!status.ok()) {
+        RETURN_ERROR(INTERNAL_ERROR,
+                     "failed to add record to batch, status="
+                         << status.ToString());
+      }
+    }
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  rocksdb::Status status = db_->Rocks()->Write(PointWriteOptions(), &batch);
+  const uint64_t latency_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+
+  ++commits_;
+  total_commit_latency_us_ += latency_us;
+  uint64_t max_latency_us = max_commit_latency_us_;
+  while (latency_us > max_latency_us &&
+         !max_commit_latency_us_.compare_exchange_weak(max_latency_us,
+                                                       latency_us)) {
+  }
+
+  if (!status.ok()) {
+    RETURN_ERROR(INTERNAL_ERROR, "failed to write group of requests, size="
+                                     << group.size()
+                                     << ", status=" << status.ToString());
+  }
+
+  committed_requests_ += group.size();
+  return StatusCode::OK;
+}
+
+void Writer::CommitGroup(const std::vector<Request *> &group) {
+  // Requests of a group are written together, they either all succeed
+  // or all fail.
+  Status status = WriteGroup(group);
+  if (status != StatusCode::OK) {
+    LOG_EVERY_N(WARNING, 1000) << "unable to commit, status=" << status;
+  }
+
+  for (Request *request : group) {
+    request->done.set_value(status);
+    delete request;
+  }
+
+  // Slots are only released once requests are written, so the queue
+  // bounds the number of points held in memory.
+  depth_ -= group.size();
+  if (slot_waiters_ > 0) {
+    {
+      std::lock_guard<std::mutex> lock(slot_lock_);
+    }
+    slot_available_.notify_all();
+  }
+
+  LOG_EVERY_N(INFO, 10000) << "writer commits=" << commits_
+                           << ", requests=" << committed_requests_
+                           << ", queue_depth=" << depth_
+                           << ", avg_commit_latency_us="
+                           << AverageCommitLatencyUs()
+                           << ", max_commit_latency_us="
+                           << max_commit_latency_us_
+                           << ", back_pressure_waits=" << back_pressure_waits_;
+}
+
+void Writer::Loop() {
+  LOG(INFO) << "starting writer thread";
+
+  std::vector<Request *> group;
+  group.reserve(max_group_size_);
+
+  while (true) {
+    while (static_cast<int>(group.size()) < max_group_size_) {
+      Request *request = queue_.Pop();
+      if (request == nullptr) {
+        break;
+      }
+      group.push_back(request);
+    }
+
+    if (!group.empty()) {
+      CommitGroup(group);
+      group.clear();
+      continue;
+    }
+
+    // Nothing left to write: pending requests are drained before
+    // exiting.
+    if (depth_ == 0) {
+      if (do_exit_) {
+        break;
+      }
+
+      std::unique_lock<std::mutex> lock(writer_lock_);
+      writer_sleeping_ = true;
+      writer_wakeup_.wait_for(lock, kMaxIdleWait,
+                              [this]() { return depth_ > 0 || do_exit_; });
+      writer_sleeping_ = false;
+    } else {
+      // A producer is in the middle of a push.
+      std::this_thread::yield();
+    }
+  }
+
+  LOG(INFO) << "stopping writer thread";
+}
+
+} // namespace bt
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <rocksdb/db.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/mpsc_queue.h"
+#include "common/status.h"
+#include "server/db.h"
+#include "server/worker_config.h"
+
+namespace bt {
+
+// A single key/value to write to a column of the database.
+struct WriteRecord {
+  rocksdb::ColumnFamilyHandle *column = nullptr;
+  std::string key;
+  std::string value;
+};
+
+// Single writer thread of the database, see threading notes in
+// worker.h.
+//
+// Producers (gRPC threads) encode their records and submit them to a
+// lock-free queue, the writer thread pops as many requests as there
+// are pending (up to a limit) and writes them in a single batch (one
+// WAL append and memtable insertion for the whole group). Records of
+// a request are always written atomically.
+//
+// The queue is bounded: when it is full, producers block until the
+// writer catches up, which slows down clients instead of buffering
+// an unbounded amount of points.
+//
+// The writer thread is started by Init and stopped by Shutdown (or
+// the destructor), producers must be stopped before Shutdown is
+// called. This class can be used from multiple threads.
+class Writer {
+public:
+  ~Writer();
+
+  Status Init(Db *db, const WorkerConfig &config);
+  Status Shutdown();
+
+  // Queues records to be written, blocks if the queue is full. The
+  // future is set once the records are written to the database.
+  std::future<Status> Submit(std::vector<WriteRecord> records);
+
+  // Same as above but waits for records to be written.
+  Status Write(std::vector<WriteRecord> records);
+
+  // Number of requests submitted but not yet written.
+  int64_t QueueDepth() const { return depth_; }
+
+  // Commit counters, latencies are in microseconds and measure the
+  // time spent writing a group to the database.
+  uint64_t Commits() const { return commits_; }
+  uint64_t CommittedRequests() const { return committed_requests_; }
+  uint64_t AverageCommitLatencyUs() const;
+  uint64_t MaxCommitLatencyUs() const { return max_commit_latency_us_; }
+
+  // Number of times a producer had to wait for the queue to drain.
+  uint64_t BackPressureWaits() const { return back_pressure_waits_; }
+
+private:
+  struct Request : public MpscQueue<Request>::Node {
+    std::vector<WriteRecord> records;
+    std::promise<Status> done;
+  };
+
+  // Reserves a slot in the queue, blocks while it is full. Returns
+  // false if the writer is shut down.
+  bool WaitForSlot();
+
+  void Loop();
+  Status WriteGroup(const std::vector<Request *> &group);
+  void CommitGroup(const std::vector<Request *> &group);
+
+  Db *db_ = nullptr;
+  int64_t max_queue_depth_ = kDefaultWriterMaxQueueDepth;
+  int max_group_size_ = kDefaultWriterMaxGroupSize;
+
+  MpscQueue<Request> queue_;
+  std::atomic<int64_t> depth_ = 0;
+
+  // Wakes up the writer thread when it is idle.
+  std::mutex writer_lock_;
+  std::condition_variable writer_wakeup_;
+  std::atomic<bool> writer_sleeping_ = false;
+
+  // Wakes up producers waiting for a slot in the queue.
+  std::mutex slot_lock_;
+  std::condition_variable slot_available_;
+  std::atomic<int> slot_waiters_ = 0;
+
+  std::atomic<bool> do_exit_ = false;
+  std::thread thread_;
+
+  std::atomic<uint64_t> commits_ = 0;
+  std::atomic<uint64_t> committed_requests_ = 0;
+  std::atomic<uint64_t> total_commit_latency_us_ = 0;
+  std::atomic<uint64_t> max_commit_latency_us_ = 0;
+  std::atomic<uint64_t> back_pressure_waits_ = 0;
+};
+
+} // namespace bt
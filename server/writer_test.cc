@@ -0,0 +1,157 @@
+#include <future>
+#include <gtest/gtest.h>
+#include <rocksdb/db.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/utils.h"
+#include "server/db.h"
+#include "server/worker_config.h"
+#include "server/writer.h"
+
+namespace bt {
+namespace {
+
+class WriterTest : public testing::Test {
+protected:
+  void SetUp() override { EXPECT_EQ(db_.Init(config_), StatusCode::OK); }
+
+  std::vector<WriteRecord> MakeRecords(const std::string &prefix, int count) {
+    std::vector<WriteRecord> records;
+    for (int i = 0; i < count; ++i) {
+      records.push_back(WriteRecord{db_.DefaultHandle(),
+                                    prefix + "-" + std::to_string(i),
+                                    std::to_string(i)});
+    }
+    return records;
+  }
+
+  bool HasKey(const std::string &key) {
+    std::string value;
+    return db_.Rocks()->Get(rocksdb::ReadOptions(), db_.DefaultHandle(), key,
+                             &value)
+        .ok();
+  }
+
+  WorkerConfig config_;
+  Db db_;
+};
+
+TEST_F(WriterTest, InvalidConfig) {
+  Writer writer;
+
+  config_.writer_max_queue_depth_ = 0;
+  EXPECT_EQ(writer.Init(&db_, config_), StatusCode::INVALID_CONFIG);
+
+  config_.writer_max_queue_depth_ = kDefaultWriterMaxQueueDepth;
+  config_.writer_max_group_size_ = 0;
+  EXPECT_EQ(writer.Init(&db_, config_), StatusCode::INVALID_CONFIG);
+}
+
+TEST_F(WriterTest, WriteOK) {
+  Writer writer;
+  EXPECT_EQ(writer.Init(&db_, config_), StatusCode::OK);
+
+  EXPECT_EQ(writer.Write(MakeRecords("a", 10)), StatusCode::OK);
+  EXPECT_TRUE(HasKey("a-0"));
+  EXPECT_TRUE(HasKey("a-9"));
+
+  EXPECT_EQ(writer.QueueDepth(), 0);
+  EXPECT_EQ(writer.CommittedRequests(), 1);
+  EXPECT_GE(writer.Commits(), 1);
+}
+
+// Tests that requests from concurrent producers are all written, with
+// a tiny queue so that producers have to wait for the writer.
+TEST_F(WriterTest, ConcurrentProducersOK) {
+  constexpr int kProducers = 4;
+  constexpr int kRequestsPerProducer = 100;
+
+  config_.writer_max_queue_depth_ = 2;
+  config_.writer_max_group_size_ = 8;
+
+  Writer writer;
+  EXPECT_EQ(writer.Init(&db_, config_), StatusCode::OK);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([this, &writer, p]() {
+      std::vector<std::future<Status>> pending;
+      for (int i = 0; i < kRequestsPerProducer; ++i) {
+        pending.push_back(writer.Submit(MakeRecords(
+            "p" + std::to_string(p) + "-r" + std::to_string(i), 3)));
+      }
+      for (auto &done : pending) {
+        EXPECT_EQ(done.get(), StatusCode::OK);
+      }
+    });
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+
+  for (int p = 0; p < kProducers; ++p) {
+    for (int i = 0; i < kRequestsPerProducer; ++i) {
+      EXPECT_TRUE(
+          HasKey("p" + std::to_string(p) + "-r" + std::to_string(i) + "-2"));
+    }
+  }
+
+  EXPECT_EQ(writer.QueueDepth(), 0);
+  EXPECT_EQ(writer.CommittedRequests(), kProducers * kRequestsPerProducer);
+  EXPECT_LE(writer.Commits(), writer.CommittedRequests());
+  EXPECT_GT(writer.BackPressureWaits(), 0);
+}
+
+TEST_F(WriterTest, SubmitAfterShutdown) {
+  Writer writer;
+  EXPECT_EQ(writer.Init(&db_, config_), StatusCode::OK);
+  EXPECT_EQ(writer.Shutdown(), StatusCode::OK);
+
+  EXPECT_EQ(writer.Write(MakeRecords("a", 1)), StatusCode::INTERNAL_ERROR);
+  EXPECT_FALSE(HasKey("a-0"));
+}
+
+// Tests that a partition dropped by the GC after points were batched
+// for it doesn't fail the points of other partitions in the group.
+TEST(WriterPartitionTest, WriteToDroppedPartitionOK) {
+  StatusOr<std::string> dir = utils::MakeTemporaryDirectory();
+  ASSERT_TRUE(dir.Ok());
+
+  WorkerConfig config;
+  config.db_path_ = dir.ValueOrDie() + "/db";
+  config.db_partition_days_ = 1;
+
+  {
+    Db db;
+    EXPECT_EQ(db.Init(config), StatusCode::OK);
+
+    Partition expired;
+    EXPECT_EQ(db.PartitionForZone(0, &expired), StatusCode::OK);
+    Partition current;
+    EXPECT_EQ(db.PartitionForZone(expired.end_zone, &current),
+              StatusCode::OK);
+
+    Writer writer;
+    EXPECT_EQ(writer.Init(&db, config), StatusCode::OK);
+
+    std::vector<WriteRecord> records;
+    records.push_back(WriteRecord{expired.timeline.get(), "expired", ""});
+    records.push_back(WriteRecord{current.timeline.get(), "current", ""});
+    EXPECT_EQ(db.DropPartition(expired), StatusCode::OK);
+
+    EXPECT_EQ(writer.Write(std::move(records)), StatusCode::OK);
+    std::string value;
+    EXPECT_TRUE(db.Rocks()
+                    ->Get(rocksdb::ReadOptions(), current.timeline.get(),
+                          "current", &value)
+                    .ok());
+    EXPECT_EQ(writer.Shutdown(), StatusCode::OK);
+  }
+
+  utils::DeleteDirectory(dir.ValueOrDie());
+}
+
+} // namespace
+} // namespace bt